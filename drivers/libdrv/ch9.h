@@ -69,6 +69,14 @@ constexpr bool usb_endpoint_dir_out(const USB_ENDPOINT_DESCRIPTOR &epd)
 	return USB_ENDPOINT_DIRECTION_OUT(epd.bEndpointAddress);
 }
 
+/*
+ * @return bits 10..0 of wMaxPacketSize, without additional transactions per microframe
+ */
+constexpr USHORT usb_endpoint_maxp(const USB_ENDPOINT_DESCRIPTOR &epd)
+{
+	return epd.wMaxPacketSize & 0x7FF;
+}
+
 /*
  * Default control pipe doesn't have descriptor, but zeroed descriptor 
  * has bEndpointAddress|bmAttributes that match expectations.
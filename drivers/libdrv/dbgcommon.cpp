@@ -250,6 +250,8 @@ const char *device_control_name(ULONG ioctl_code)
 	case vhci::ioctl::GET_IMPORTED_DEVICES: return "vhci_get_imported_devices";
 	case vhci::ioctl::GET_PERSISTENT: return "vhci_get_persistent";
 	case vhci::ioctl::SET_PERSISTENT: return "vhci_set_persistent";
+	case vhci::ioctl::GET_IMPORTED_DEVICES_SINCE: return "vhci_get_imported_devices_since";
+	case vhci::ioctl::GET_DEVICE_STATISTICS: return "vhci_get_device_statistics";
 
 	case IOCTL_USB_DIAG_IGNORE_HUBS_ON: return "USB_DIAG_IGNORE_HUBS_ON";
 	case IOCTL_USB_DIAG_IGNORE_HUBS_OFF: return "USB_DIAG_IGNORE_HUBS_OFF";
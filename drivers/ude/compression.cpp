@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "compression.h"
+#include "trace.h"
+#include "compression.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "persistent.h"
+#include "wsk_context.h"
+
+#include <usbip\consts.h>
+#include <usbip\proto_op.h>
+
+#include <libdrv\ch9.h>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr auto HASH_TABLE_BYTES = lz4::HASH_TABLE_SIZE*sizeof(lz4::hash_entry);
+
+/*
+ * The output that exceeds this size is useless because the policy will find the ratio poor,
+ * the compressor gives up earlier on incompressible data.
+ */
+constexpr auto max_compressed_size(_In_ ULONG length)
+{
+        return ULONG(ULONGLONG(length)*compression_policy::MAX_RATIO/compression_policy::RATIO_SCALE);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto elapsed_usec(_In_ LONGLONG start, _In_ LONGLONG frequency)
+{
+        auto ticks = KeQueryPerformanceCounter(nullptr).QuadPart - start;
+        return ULONGLONG(ticks)*1'000'000/frequency;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_compression_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.payload_compression = false;
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, payload_compression_value_name);
+
+        ULONG value = 0;
+
+        if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                return;
+        }
+
+        vhci.payload_compression = value;
+
+        if (vhci.payload_compression) {
+                Trace(TRACE_LEVEL_INFORMATION, "payload compression is enabled");
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT32 usbip::requested_extensions(_In_ const vhci_ctx &vhci)
+{
+        return vhci.payload_compression ? OP_EXT_COMPRESSION_LZ4 : 0;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_compression(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint)
+{
+        PAGED_CODE();
+
+        auto &endp = *get_endpoint_ctx(endpoint);
+        auto &epd = endp.descriptor;
+
+        if (!(dev.ext->extensions & OP_EXT_COMPRESSION_LZ4 &&
+              usb_endpoint_type(epd) == UsbdPipeTypeBulk && usb_endpoint_dir_out(epd))) {
+                return STATUS_SUCCESS;
+        }
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = endpoint;
+
+        WDFMEMORY mem{};
+        void *table{};
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, pooltag, HASH_TABLE_BYTES, &mem, &table)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (auto err = WdfSpinLockCreate(&attr, &endp.compression.lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        endp.compression.table = static_cast<lz4::hash_entry*>(table);
+
+        TraceDbg("dev %04x, endp %04x, bEndpointAddress %#x",
+                  ptr04x(get_handle(&dev)), ptr04x(endpoint), epd.bEndpointAddress);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::compress_transfer(_Inout_ wsk_context &ctx, _In_ UDECXUSBENDPOINT endpoint, _In_ const URB &urb)
+{
+        auto &c = get_endpoint_ctx(endpoint)->compression;
+        auto &cmd = ctx.hdr.u.cmd_submit;
+
+        if (!c.lock || urb.UrbHeader.Function != URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER) { // not chained MDL
+                return false;
+        }
+
+        auto len = ULONG(cmd.transfer_buffer_length);
+        {
+                wdf::Lock lck(c.lock);
+                if (!c.policy.next(len)) {
+                        ++c.skipped;
+                        return false;
+                }
+        }
+
+        UCHAR *TransferBuffer{};
+        ULONG TransferBufferLength{};
+
+        if (auto err = UdecxUrbRetrieveBuffer(ctx.request, &TransferBuffer, &TransferBufferLength)) {
+                Trace(TRACE_LEVEL_ERROR, "UdecxUrbRetrieveBuffer %!STATUS!", err);
+                return false;
+        } else if (TransferBufferLength < len) {
+                return false;
+        }
+
+        if (InterlockedExchange(&c.table_busy, true)) { // is used by a concurrent URB
+                wdf::Lock lck(c.lock);
+                ++c.skipped;
+                return false;
+        }
+
+        auto capacity = max_compressed_size(len); // compression_policy::MAX_LENGTH at most
+
+        unique_ptr buf(libdrv::uninitialized, NonPagedPoolNx, capacity);
+        if (!buf) {
+                InterlockedExchange(&c.table_busy, false);
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu bytes", capacity);
+                return false;
+        }
+
+        auto block = buf.get<UCHAR>();
+
+        LARGE_INTEGER frequency;
+        auto start = KeQueryPerformanceCounter(&frequency).QuadPart;
+
+        auto size = ULONG(lz4::compress(TransferBuffer, len, block, capacity, c.table));
+        auto usec = elapsed_usec(start, frequency.QuadPart);
+
+        InterlockedExchange(&c.table_busy, false);
+        {
+                wdf::Lock lck(c.lock);
+                c.policy.compressed(len, size, usec);
+
+                if (size) {
+                        c.original += len;
+                        c.compressed += size;
+                }
+        }
+
+        if (!size) {
+                return false;
+        }
+
+        NT_ASSERT(!ctx.mdl_buf);
+        ctx.mdl_buf = Mdl(block, size);
+
+        if (auto err = ctx.mdl_buf.prepare_nonpaged()) {
+                Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
+                ctx.mdl_buf.reset();
+                return false;
+        }
+
+        NT_ASSERT(!ctx.compressed);
+        ctx.compressed = buf.release();
+
+        cmd.start_frame = LONG(size);
+        get_request_ctx(ctx.request)->compressed = size;
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::compression_completed(_In_ WDFREQUEST request, _In_ const URB &urb)
+{
+        auto &req = *get_request_ctx(request);
+        auto &c = get_endpoint_ctx(req.endpoint)->compression;
+
+        if (!(c.lock && req.submitted)) {
+                return;
+        }
+
+        auto wire_bytes = req.compressed ? req.compressed : urb.UrbBulkOrInterruptTransfer.TransferBufferLength;
+        auto usec = ULONGLONG(KeQueryInterruptTime() - req.submitted)/10; // 100ns units
+
+        wdf::Lock lck(c.lock);
+        c.policy.completed(wire_bytes, usec);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::decompress_transfer(
+        _In_ WDFREQUEST request, _In_ const void *block, _In_ ULONG length, _In_ int actual_length)
+{
+        PAGED_CODE();
+
+        UCHAR *TransferBuffer{};
+        ULONG TransferBufferLength{};
+
+        if (auto err = UdecxUrbRetrieveBuffer(request, &TransferBuffer, &TransferBufferLength)) {
+                Trace(TRACE_LEVEL_ERROR, "UdecxUrbRetrieveBuffer %!STATUS!", err);
+                return err;
+        }
+
+        if (actual_length <= 0 || ULONG(actual_length) > TransferBufferLength) {
+                Trace(TRACE_LEVEL_ERROR, "TransferBufferLength(%lu), actual_length(%d)",
+                                          TransferBufferLength, actual_length);
+                return STATUS_INVALID_BUFFER_SIZE;
+        }
+
+        size_t size{};
+
+        if (!lz4::decompress(block, length, TransferBuffer, ULONG(actual_length), size) || size != ULONG(actual_length)) {
+                Trace(TRACE_LEVEL_ERROR, "Malformed LZ4 block of %lu bytes, decompressed %Iu, actual_length(%d)",
+                                          length, size, actual_length);
+                return STATUS_INVALID_PARAMETER;
+        }
+
+        UdecxUrbSetBytesCompleted(request, ULONG(size));
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::trace_compression_stats(_In_ UDECXUSBENDPOINT endpoint)
+{
+        auto &c = get_endpoint_ctx(endpoint)->compression;
+        if (!c.lock) {
+                return;
+        }
+
+        wdf::Lock lck(c.lock);
+        auto &p = c.policy;
+
+        Trace(TRACE_LEVEL_INFORMATION, "endp %04x, compressed %!UINT64! -> %!UINT64! bytes, skipped %!UINT64! URBs, "
+                "ratio %u/%u, compressor %!UINT64! KB/s, link %!UINT64! KB/s",
+                ptr04x(endpoint), c.original, c.compressed, c.skipped,
+                p.ratio, compression_policy::RATIO_SCALE, p.compress_rate, p.link_rate);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usbip\compression_policy.h>
+#include <usbip\lz4.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+struct endpoint_ctx;
+struct wsk_context;
+
+/*
+ * Opt-in LZ4 compression of bulk payloads, see vhci_ctx::payload_compression and OP_EXT_COMPRESSION_LZ4.
+ * Helps on slow links (VPN, Wi-Fi) with compressible data of scanners, storage, etc.
+ *
+ * It is requested in OP_REQ_IMPORT and is used only if the server has confirmed it in OP_REP_IMPORT.
+ * The client compresses bulk OUT, the server compresses bulk IN. Each PDU is compressed or not
+ * independently, see usbip_header_cmd_submit.start_frame.
+ *
+ * Bulk OUT endpoint has a policy that skips compression if the ratio is poor or the compressor
+ * is slower than the link. Segmented transfers are not compressed.
+ *
+ * The compressor can run at DISPATCH_LEVEL, compression_policy::MAX_LENGTH bounds its time.
+ * The hash table is allocated once per endpoint. If it is in use by a concurrent URB,
+ * the transfer is sent uncompressed.
+ *
+ * Protected by lock, except table.
+ */
+struct payload_compression
+{
+        WDFSPINLOCK lock; // WDF_NO_HANDLE if disabled for endpoint
+        compression_policy policy;
+
+        lz4::hash_entry *table; // lz4::HASH_TABLE_SIZE entries, child memory of endpoint
+        LONG table_busy; // Interlocked
+
+        // statistics
+        UINT64 original; // bytes of compressed transfers
+        UINT64 compressed;
+        UINT64 skipped; // transfers
+};
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_compression_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * @return OP_EXT_* flags to request in OP_REQ_IMPORT
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT32 requested_extensions(_In_ const vhci_ctx &vhci);
+
+/*
+ * Does nothing if compression was not negotiated or endpoint is not bulk OUT.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_compression(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint);
+
+/*
+ * Is called for bulk OUT URB after CMD_SUBMIT was initialized.
+ * On success, ctx.mdl_buf describes LZ4 block and start_frame of CMD_SUBMIT is its size.
+ * @return false if URB must be sent uncompressed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool compress_transfer(_Inout_ wsk_context &ctx, _In_ UDECXUSBENDPOINT endpoint, _In_ const URB &urb);
+
+/*
+ * Is called by complete() for URB that was completed successfully, feeds the policy with the rate of the link.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void compression_completed(_In_ WDFREQUEST request, _In_ const URB &urb);
+
+/*
+ * Decompress LZ4 block of RET_SUBMIT into the transfer buffer of bulk IN URB.
+ * @param block of received payload
+ * @param actual_length of RET_SUBMIT, the size of decompressed data
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS decompress_transfer(
+        _In_ WDFREQUEST request, _In_ const void *block, _In_ ULONG length, _In_ int actual_length);
+
+/*
+ * Is called when endpoint is destroyed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void trace_compression_stats(_In_ UDECXUSBENDPOINT endpoint);
+
+} // namespace usbip
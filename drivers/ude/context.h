@@ -9,6 +9,7 @@
 #include <libdrv\wdf_cpp.h>
 
 #include <usbip\proto.h>
+#include <usbip\consts.h>
 
 #include <wdfusb.h>
 #include <UdeCx.h>
@@ -16,6 +17,14 @@
 #include <initguid.h>
 #include <usbip\vhci.h>
 
+#include "frame_clock.h"
+#include "descriptor_cache.h"
+#include "local_requests.h"
+#include "flow_control.h"
+#include "segmented_transfer.h"
+#include "compression.h"
+#include "event_slots.h"
+
 /*
  * Macro WDF_TYPE_NAME_TO_TYPE_INFO (see WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE)
  * makes impossible to declare context type with the same name in different namespaces.
@@ -30,15 +39,20 @@ namespace usbip
 {
 
 enum { 
-        USB2_PORTS = 30,
+        USB2_PORTS = 30, // default, see vhci_ctx::usb2_ports
         USB3_PORTS = USB2_PORTS,
-        TOTAL_PORTS = USB2_PORTS + USB3_PORTS
+        TOTAL_PORTS = USB2_PORTS + USB3_PORTS,
 };
 
-constexpr auto is_valid_port(int port)
+/*
+ * Entry of lock-free port table.
+ */
+struct port_slot
 {
-        return port > 0 && port <= TOTAL_PORTS;
-}
+        UDECXUSBDEVICE device; // holds a reference
+        EX_RUNDOWN_REF readers; // vhci::get_device calls that are in progress, see vhci::reclaim_roothub_port
+        volatile LONG64 generation; // vhci_ctx::generation of the last claim or reclaim, zero if never
+};
 
 /*
  * Context space for WDFDEVICE, Virtual Host Controller Interface.
@@ -48,16 +62,39 @@ struct vhci_ctx
 {
         WDFQUEUE sequential_queue; // see also WdfDeviceGetDefaultQueue
 
-        UDECXUSBDEVICE devices[TOTAL_PORTS]; // do not access directly, functions must be used
-        WDFSPINLOCK devices_lock;
+        // do not access directly, functions must be used
+        int usb2_ports; // ports [1, usb2_ports]
+        int usb3_ports; // ports (usb2_ports, usb2_ports + usb3_ports]
+        port_slot *ports; // [usb2_ports + usb3_ports]
+        volatile LONG *claimed_ports; // @see port_bitmap
+        LONG64 generation; // is incremented when a port is claimed or reclaimed, protected by generation_lock
+        WDFSPINLOCK generation_lock; // also for port_slot::generation, see vhci::get_generation
+        UINT64 instance; // differs for each load of the driver, see ioctl::get_imported_devices_since
 
         LIST_ENTRY fileobjects; // @see fileobject_ctx::entry
         WDFQUEUE reads; // IRP_MJ_READ
         int events_subscribers; // SUM(fileobject_ctx::process_events)
         WDFWAITLOCK events_lock;
+        UINT64 events_seq; // the number of state changes, protected by events_lock
+        vhci::device_state event; // the change that is being posted to subscribers, protected by events_lock
 
         _KTHREAD *attach_thread;
         KEVENT attach_thread_stop;
+
+        ULONG jitter_depth; // initial depth of jitter buffer, zero if disabled
+        ULONG jitter_underrun_rate; // target, per mille
+
+        LIST_ENTRY stored_descriptors; // @see stored_descriptors::entry
+        ULONG stored_descriptors_cnt;
+        WDFWAITLOCK stored_descriptors_lock;
+
+        bool local_requests; // answer standard requests from tracked_state
+        UCHAR local_classes[(MAXUCHAR + 1)/CHAR_BIT]; // bitmap, index is bInterfaceClass
+
+        bool bulk_in_flow_control; // @see flow_control
+        ULONG bulk_out_segment_size; // zero if disabled, @see segmented_transfer
+        bool descriptor_prefetch; // @see prefetch_descriptors
+        bool payload_compression; // request OP_EXT_COMPRESSION_LZ4, @see payload_compression
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(vhci_ctx, get_vhci_ctx)
 
@@ -67,8 +104,20 @@ inline auto get_handle(_In_ vhci_ctx *ctx)
         return static_cast<WDFDEVICE>(WdfObjectContextGetObject(ctx));
 }
 
+inline auto total_ports(_In_ const vhci_ctx &ctx)
+{
+        return ctx.usb2_ports + ctx.usb3_ports;
+}
+
+inline auto is_valid_port(_In_ const vhci_ctx &ctx, _In_ int port)
+{
+        return port > 0 && port <= total_ports(ctx);
+}
+
 struct wsk_context;
 struct device_ctx;
+struct jitter_buffer;
+struct recv_buffer;
 
 /*
  * Context extention for device_ctx. 
@@ -80,7 +129,7 @@ struct device_ctx;
  * device_ctx_ext can't be embedded into device_ctx because SocketContext must be passed to WskSocket(). 
  * Pointer to instance of device_ctx_ext will be passed.
  * 
- * Alternative is to claim portnum in vhci_ctx.devices and pass it as SocketContext.
+ * Alternative is to claim portnum in vhci_ctx.ports and pass it as SocketContext.
  */
 struct device_ctx_ext
 {
@@ -95,6 +144,8 @@ struct device_ctx_ext
         //
         
         vhci::imported_device_properties dev; // for ioctl::get_imported_devices
+        UINT16 bcdDevice; // from OP_REP_IMPORT, identifies stored descriptors
+        UINT32 extensions; // OP_EXT_* confirmed by OP_REP_IMPORT
 };
 
 /*
@@ -115,7 +166,7 @@ struct device_ctx
 
         WDFSPINLOCK send_lock; // for WskSend on sock()
 
-        int port; // vhci_ctx.devices[port - 1]
+        int port; // vhci_ctx.ports[port - 1]
         seqnum_t seqnum; // @see next_seqnum
 
         volatile bool unplugged; // initiated detach that may still be ongoing
@@ -126,11 +177,35 @@ struct device_ctx
         LIST_ENTRY requests; // list head, requests that are waiting for USBIP_RET_SUBMIT from a server
         WDFSPINLOCK requests_lock;
 
+        frame_clock clock; // for isochronous transfers
+        WDFSPINLOCK frame_lock;
+
+        jitter_buffer *jitter[USB_ENDPOINT_ADDRESS_MASK + 1]; // isochronous IN endpoints, index is endpoint number
+
+        descriptor_cache descriptors;
+        WDFSPINLOCK descriptors_lock;
+        stored_descriptors *stored; // can be nullptr, owned by vhci_ctx
+
+        tracked_state tracked;
+        WDFSPINLOCK tracked_lock;
+
+        LIST_ENTRY segmented; // @see segmented_transfer::entry
+        WDFSPINLOCK segmented_lock;
+
         // statistics
         UINT64 sent_requests; // were sent successfully
         UINT64 cancelable_requests; // marked as
+        UINT64 descriptor_hits; // GET_DESCRIPTOR was completed from the cache
+        UINT64 descriptor_misses;
+
+        // transfer statistics, see vhci::ioctl::get_device_statistics
+        volatile LONG64 bytes_in;
+        volatile LONG64 bytes_out;
+        volatile LONG64 completed_urbs;
+        volatile LONG64 latency[vhci::LATENCY_BUCKETS];
 
         _KTHREAD *recv_thread;
+        recv_buffer *recv_buf; // is used by the receive thread only, can be nullptr
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(device_ctx, get_device_ctx)
 
@@ -157,6 +232,9 @@ struct endpoint_ctx
 
         USBD_PIPE_HANDLE PipeHandle;
         LIST_ENTRY entry; // list head if default control pipe, protected by device_ctx::endpoint_list_lock
+
+        flow_control flow; // bulk IN
+        payload_compression compression; // bulk OUT
 };        
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(endpoint_ctx, get_endpoint_ctx)
 
@@ -176,6 +254,14 @@ struct request_ctx
         UDECXUSBENDPOINT endpoint;
         seqnum_t seqnum;
         bool cancelable;
+
+        bool credits; // took credits of flow_control
+        ULONG credit_bytes;
+        LONG64 stamp; // interrupt time when URB was sent or started waiting for credits
+        LONG64 submitted; // interrupt time when CMD_SUBMIT was sent, zero if URB was not sent to a server
+        ULONG compressed; // size of LZ4 block that was sent instead of the transfer buffer, zero if none
+
+        segmented_transfer *segments; // is owned
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(request_ctx, get_request_ctx)
 
@@ -198,6 +284,15 @@ inline auto get_vhci(_In_ WDFREQUEST Request)
 }
 
 
+/*
+ * The latest state of a device that was not read yet.
+ */
+struct pending_event
+{
+        UINT64 seq; // vhci_ctx::events_seq of the change, reads return states in this order
+        vhci::device_state state;
+};
+
 /*
  * Context space for WDFFILEOBJECT.
  * @see WdfFileObjectGetDevice
@@ -206,13 +301,31 @@ struct fileobject_ctx
 {
         LIST_ENTRY entry; // head is vhci_ctx::fileobjects
 
-        WDFCOLLECTION events; // WDFMEMORY(device_state) that are waiting for IRP_MJ_READ
-        enum { MAX_EVENTS = 2*TOTAL_PORTS }; // arbitrary
+        /*
+         * State changes are compacted: a device has a single slot that holds its latest state,
+         * so a slow reader gets the current state of each device that has changed rather than every transition.
+         *
+         * The first half of the slots is indexed by the port, [port - 1], and is used by a device that owns the port.
+         * The second half is for devices without a port: the port is zero until the device is plugged, 
+         * it is reclaimed before unplugging and can be taken by another device before the final state
+         * of the previous one was read. These slots are looked up by the location.
+         *
+         * Protected by vhci_ctx::events_lock.
+         */
+        pending_event *events; // [max_events], allocated by the first IRP_MJ_READ
+        UINT64 *dirty; // bitmap, index in events[], slots that are waiting for IRP_MJ_READ; is allocated with events
+        int *order; // [max_events], dirty slots in the order of seq, see vhci::complete_read; is allocated with events
+        int max_events; // twice the number of ports, see alloc_events
 
         bool process_events; // if IRP_MJ_READ was issued, see vhci_ctx::events_subscribers
 };
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(fileobject_ctx, get_fileobject_ctx)
 
+inline auto has_events(_In_ const fileobject_ctx &fobj)
+{
+        return event_slots::any_dirty(fobj.dirty, fobj.max_events);
+}
+
 inline auto get_handle(_In_ fileobject_ctx *ctx)
 {
         NT_ASSERT(ctx);
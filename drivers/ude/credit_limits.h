@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Credit limits of bulk IN endpoint, see flow_control.
+ * Does not depend on Windows headers, see userspace/tests. It is not thread-safe.
+ *
+ * The limits are twice the bandwidth-delay product: delivery rate is measured over a window
+ * of a few RTT, RTT is the minimum over the last seconds. Times are in 100ns units of the interrupt time.
+ */
+
+namespace usbip
+{
+
+struct credit_limits
+{
+        enum : unsigned int {
+                MIN_URBS = 2,
+                MAX_URBS = 64,
+                INITIAL_URBS = 8,
+
+                MIN_BYTES = 64*1024,
+                MAX_BYTES = 8*1024*1024,
+                INITIAL_BYTES = 1024*1024,
+
+                RATE_WINDOW_RTTS = 4, // delivery rate is measured over this number of min_rtt
+                RATE_DECAY = 8, // max rate loses 1/RATE_DECAY every window
+        };
+
+        static constexpr long long MSEC = 10'000;
+        static constexpr long long SECOND = 1000*MSEC;
+
+        static constexpr auto MIN_RATE_WINDOW = 10*MSEC;
+        static constexpr auto MIN_RTT_WINDOW = 10*SECOND; // min_rtt expires after that
+
+        unsigned int max_urbs;
+        unsigned int max_bytes;
+
+        unsigned int avg_urb_size; // TransferBufferLength, smoothed
+
+        long long min_rtt;
+        long long min_rtt_stamp; // when it was measured
+
+        long long window_start;
+        unsigned long long window_bytes; // delivered in the current window
+        unsigned long long rate; // bytes per second, the max with a decay
+
+        void init(long long now)
+        {
+                max_urbs = INITIAL_URBS;
+                max_bytes = INITIAL_BYTES;
+                window_start = now;
+        }
+
+        /*
+         * Endpoint is never stalled by credits if nothing is outstanding, even if URB is larger than max_bytes.
+         * @param urbs outstanding
+         * @param bytes outstanding
+         */
+        bool allow(unsigned int urbs, unsigned int bytes) const
+        {
+                return !urbs || (urbs < max_urbs && bytes < max_bytes);
+        }
+
+        /*
+         * URB has taken credits.
+         */
+        void taken(unsigned int length)
+        {
+                avg_urb_size = avg_urb_size ? (7*avg_urb_size + length)/8 : length;
+        }
+
+        /*
+         * URB was completed by the server.
+         * @param rtt from submission to completion
+         * @return true if the limits were updated
+         */
+        bool delivered(long long rtt, unsigned int length, long long now)
+        {
+                if (!min_rtt || rtt < min_rtt || now - min_rtt_stamp > MIN_RTT_WINDOW) {
+                        min_rtt = rtt > 1 ? rtt : 1;
+                        min_rtt_stamp = now;
+                }
+
+                window_bytes += length;
+
+                auto elapsed = now - window_start;
+                if (elapsed < (RATE_WINDOW_RTTS*min_rtt > MIN_RATE_WINDOW ? RATE_WINDOW_RTTS*min_rtt : MIN_RATE_WINDOW)) {
+                        return false;
+                }
+
+                auto r = window_bytes*SECOND/elapsed;
+                rate = r > rate - rate/RATE_DECAY ? r : rate - rate/RATE_DECAY;
+
+                window_start = now;
+                window_bytes = 0;
+
+                update();
+                return true;
+        }
+
+        /*
+         * max_bytes is twice the bandwidth-delay product, it leaves room for the delivery rate to grow.
+         */
+        void update()
+        {
+                auto bdp = rate*min_rtt/SECOND;
+                auto bytes = clamp(2*bdp, MIN_BYTES, MAX_BYTES);
+
+                max_bytes = static_cast<unsigned int>(bytes);
+                max_urbs = static_cast<unsigned int>(clamp(max_bytes/(avg_urb_size ? avg_urb_size : 1) + 1,
+                                                           MIN_URBS, MAX_URBS));
+        }
+
+private:
+        static unsigned long long clamp(unsigned long long val, unsigned long long lo, unsigned long long hi)
+        {
+                return val < lo ? lo : val > hi ? hi : val;
+        }
+};
+
+} // namespace usbip
@@ -0,0 +1,537 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "descriptor_cache.h"
+#include "trace.h"
+#include "descriptor_cache.tmh"
+
+#include "context.h"
+#include "driver.h"
+
+#include <libdrv\ch9.h>
+#include <libdrv\strconv.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG {
+        MAX_CACHE_BYTES = 64*1024, // per device
+        MAX_STORED_DEVICES = 64,
+};
+
+constexpr auto operator ==(_In_ const descriptor_key &a, _In_ const descriptor_key &b)
+{
+        return a.wValue == b.wValue && a.wIndex == b.wIndex && a.wLength == b.wLength;
+}
+
+constexpr auto make_key(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        return descriptor_key{ .wValue = pkt.wValue.W, .wIndex = pkt.wIndex.W, .wLength = pkt.wLength };
+}
+
+/*
+ * Standard descriptors of the device that do not depend on its state.
+ * Class and vendor specific descriptors are not cached.
+ */
+constexpr auto is_cacheable(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        if (!(pkt.bmRequestType.B == (USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE) &&
+              pkt.bRequest == USB_REQUEST_GET_DESCRIPTOR && pkt.wLength)) {
+                return false;
+        }
+
+        switch (pkt.wValue.HiByte) {
+        case USB_DEVICE_DESCRIPTOR_TYPE:
+        case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+        case USB_STRING_DESCRIPTOR_TYPE:
+        case USB_BOS_DESCRIPTOR_TYPE:
+                return true;
+        }
+
+        return false;
+}
+
+/*
+ * @see stored_descriptors
+ */
+constexpr auto is_storable(_In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        return pkt.wValue.HiByte != USB_STRING_DESCRIPTOR_TYPE;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto find(_In_ const descriptor_cache &c, _In_ const descriptor_key &key)
+{
+        for (auto entry = c.entries.Flink; entry != &c.entries; entry = entry->Flink) {
+                auto d = CONTAINING_RECORD(entry, descriptor_entry, entry);
+                if (d->key == key) {
+                        return d;
+                }
+        }
+
+        return static_cast<descriptor_entry*>(nullptr);
+}
+
+/*
+ * The descriptor was received entirely, a response on any wLength is its prefix.
+ */
+constexpr auto is_complete(_In_ const descriptor_entry &d)
+{
+        if (d.length < d.key.wLength) { // short transfer
+                return true;
+        }
+
+        auto type = UCHAR(d.key.wValue >> 8);
+
+        switch (type) {
+        case USB_DEVICE_DESCRIPTOR_TYPE:
+        case USB_STRING_DESCRIPTOR_TYPE:
+                return d.data[0] == d.length; // bLength
+        case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+        case USB_BOS_DESCRIPTOR_TYPE:
+                return d.length >= 4 && (d.data[2] | d.data[3] << 8) == d.length; // wTotalLength
+        }
+
+        return false;
+}
+
+/*
+ * Exact match is preferred, otherwise an entry that contains the requested prefix.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto lookup(_In_ const descriptor_cache &c, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        auto key = make_key(pkt);
+
+        if (auto d = find(c, key)) {
+                return d;
+        }
+
+        for (auto entry = c.entries.Flink; entry != &c.entries; entry = entry->Flink) {
+                auto d = CONTAINING_RECORD(entry, descriptor_entry, entry);
+
+                if (d->key.wValue == key.wValue && d->key.wIndex == key.wIndex &&
+                    (d->key.wLength >= key.wLength || is_complete(*d))) {
+                        return d;
+                }
+        }
+
+        return static_cast<descriptor_entry*>(nullptr);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto alloc_entry(_In_ const descriptor_key &key, _In_ const void *data, _In_ USHORT length)
+{
+        unique_ptr ptr(libdrv::uninitialized, NonPagedPoolNx, offsetof(descriptor_entry, data) + length);
+
+        if (auto d = ptr.get<descriptor_entry>()) {
+                d->key = key;
+                d->length = length;
+                RtlCopyMemory(d->data, data, length);
+        } else {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate descriptor_entry, length %d", length);
+        }
+
+        return static_cast<descriptor_entry*>(ptr.release());
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_entries(_Inout_ LIST_ENTRY &head)
+{
+        while (!IsListEmpty(&head)) {
+                auto entry = RemoveHeadList(&head);
+                ExFreePoolWithTag(CONTAINING_RECORD(entry, descriptor_entry, entry), pooltag);
+        }
+}
+
+/*
+ * The replaced entry is moved to the list.
+ * @return false if the cache is full
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto insert(_Inout_ descriptor_cache &c, _In_ descriptor_entry *d, _Inout_ LIST_ENTRY &replaced)
+{
+        auto old = find(c, d->key);
+        auto bytes = c.bytes - (old ? old->length : 0) + d->length;
+
+        if (bytes > MAX_CACHE_BYTES) {
+                return false;
+        }
+
+        if (old) {
+                RemoveEntryList(&old->entry);
+                InsertTailList(&replaced, &old->entry);
+        }
+
+        InsertTailList(&c.entries, &d->entry);
+        c.bytes = bytes;
+
+        return true;
+}
+
+/*
+ * @return false if allocation failed
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto copy(_Inout_ descriptor_cache &dst, _In_ const descriptor_cache &src)
+{
+        for (auto entry = src.entries.Flink; entry != &src.entries; entry = entry->Flink) {
+                auto s = CONTAINING_RECORD(entry, descriptor_entry, entry);
+
+                auto d = alloc_entry(s->key, s->data, s->length);
+                if (!d) {
+                        return false;
+                }
+
+                InsertTailList(&dst.entries, &d->entry);
+                dst.bytes += d->length;
+        }
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto copy(_Out_ UNICODE_STRING &dst, _In_ const UNICODE_STRING &src)
+{
+        PAGED_CODE();
+        RtlInitEmptyUnicodeString(&dst, nullptr, 0);
+
+        if (!src.Length) {
+                return STATUS_SUCCESS;
+        }
+
+        auto buf = (WCHAR*)ExAllocatePoolUninitialized(PagedPool, src.Length, pooltag);
+        if (!buf) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlInitEmptyUnicodeString(&dst, buf, src.Length);
+        RtlCopyUnicodeString(&dst, &src);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void free(_In_ stored_descriptors *s)
+{
+        PAGED_CODE();
+
+        free_entries(s->cache.entries);
+
+        libdrv::FreeUnicodeString(s->node_name, pooltag);
+        libdrv::FreeUnicodeString(s->service_name, pooltag);
+        libdrv::FreeUnicodeString(s->busid, pooltag);
+
+        ExFreePoolWithTag(s, pooltag);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto is_same_device(_In_ const stored_descriptors &s, _In_ const device_ctx_ext &ext)
+{
+        PAGED_CODE();
+
+        return  s.vendor == ext.dev.vendor &&
+                s.product == ext.dev.product &&
+                s.bcdDevice == ext.bcdDevice &&
+                RtlEqualUnicodeString(&s.busid, &ext.busid, false) &&
+                RtlEqualUnicodeString(&s.service_name, &ext.service_name, true) &&
+                RtlEqualUnicodeString(&s.node_name, &ext.node_name, true);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_stored_descriptors(_In_ const device_ctx_ext &ext)
+{
+        PAGED_CODE();
+
+        auto s = (stored_descriptors*)ExAllocatePoolZero(NonPagedPoolNx, sizeof(stored_descriptors), pooltag);
+        if (!s) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate stored_descriptors");
+                return s;
+        }
+
+        InitializeListHead(&s->cache.entries);
+
+        s->vendor = ext.dev.vendor;
+        s->product = ext.dev.product;
+        s->bcdDevice = ext.bcdDevice;
+
+        struct {
+                UNICODE_STRING &dst;
+                const UNICODE_STRING &src;
+        } const v[] = {
+                { s->node_name, ext.node_name },
+                { s->service_name, ext.service_name },
+                { s->busid, ext.busid },
+        };
+
+        for (auto &[dst, src]: v) {
+                if (auto err = copy(dst, src)) {
+                        Trace(TRACE_LEVEL_ERROR, "copy('%!USTR!') %!STATUS!", &src, err);
+                        free(s);
+                        return static_cast<stored_descriptors*>(nullptr);
+                }
+        }
+
+        return s;
+}
+
+/*
+ * Releases the least recently used entry that is not used by any device.
+ * @return false if all entries are in use
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto evict_stored_descriptors(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+        auto head = &vhci.stored_descriptors;
+
+        for (auto entry = head->Flink; entry != head; entry = entry->Flink) {
+                auto s = CONTAINING_RECORD(entry, stored_descriptors, entry);
+                if (!s->users) {
+                        TraceDbg("busid '%!USTR!', %lu bytes", &s->busid, s->cache.bytes);
+                        RemoveEntryList(entry);
+                        --vhci.stored_descriptors_cnt;
+                        free(s);
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/*
+ * The entry is moved to the tail of the list, it becomes the most recently used.
+ * The caller must increment stored_descriptors::users.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto get_stored_descriptors(_Inout_ vhci_ctx &vhci, _In_ const device_ctx_ext &ext)
+{
+        PAGED_CODE();
+        auto head = &vhci.stored_descriptors;
+
+        for (auto entry = head->Flink; entry != head; entry = entry->Flink) {
+                auto s = CONTAINING_RECORD(entry, stored_descriptors, entry);
+                if (is_same_device(*s, ext)) {
+                        RemoveEntryList(entry);
+                        InsertTailList(head, entry);
+                        return s;
+                }
+        }
+
+        if (vhci.stored_descriptors_cnt == MAX_STORED_DEVICES && !evict_stored_descriptors(vhci)) {
+                TraceDbg("MAX_STORED_DEVICES are in use");
+                return static_cast<stored_descriptors*>(nullptr);
+        }
+
+        auto s = create_stored_descriptors(ext);
+        if (s) {
+                InsertTailList(head, &s->entry);
+                ++vhci.stored_descriptors_cnt;
+        }
+
+        return s;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::init_descriptor_cache(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        auto &c = dev.descriptors;
+        InitializeListHead(&c.entries);
+
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+        wdf::WaitLock lck(vhci.stored_descriptors_lock);
+
+        dev.stored = get_stored_descriptors(vhci, *dev.ext);
+        if (!dev.stored) {
+                return STATUS_SUCCESS;
+        }
+
+        ++dev.stored->users;
+
+        if (!copy(c, dev.stored->cache)) {
+                free_entries(c.entries);
+                c.bytes = 0;
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (c.bytes) {
+                TraceDbg("dev %04x, %lu bytes of stored descriptors", ptr04x(get_handle(&dev)), c.bytes);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::free_descriptor_cache(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x, descriptor cache hits(%!UINT64!) / misses(%!UINT64!)",
+                ptr04x(get_handle(&dev)), dev.descriptor_hits, dev.descriptor_misses);
+
+        if (auto &c = dev.descriptors; c.entries.Flink) { // can be not initialized
+                free_entries(c.entries);
+                c.bytes = 0;
+        }
+
+        if (auto &s = dev.stored) {
+                auto &vhci = *get_vhci_ctx(dev.vhci);
+                wdf::WaitLock lck(vhci.stored_descriptors_lock);
+
+                NT_ASSERT(s->users);
+                --s->users;
+                s = nullptr;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::free_stored_descriptors(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+        auto &head = vhci.stored_descriptors;
+
+        if (!head.Flink) { // init_context failed
+                return;
+        }
+
+        while (!IsListEmpty(&head)) {
+                auto entry = RemoveHeadList(&head);
+                free(CONTAINING_RECORD(entry, stored_descriptors, entry));
+        }
+
+        vhci.stored_descriptors_cnt = 0;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::get_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request,
+        _Inout_ _URB_CONTROL_TRANSFER_EX &r, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        if (!((r.TransferFlags & USBD_DEFAULT_PIPE_TRANSFER) && is_cacheable(pkt))) {
+                return false;
+        }
+
+        UCHAR *buf{};
+        ULONG len{};
+
+        if (auto err = UdecxUrbRetrieveBuffer(request, &buf, &len)) {
+                Trace(TRACE_LEVEL_ERROR, "UdecxUrbRetrieveBuffer %!STATUS!", err);
+                return false;
+        }
+
+        USHORT length = 0;
+        {
+                wdf::Lock lck(dev.descriptors_lock);
+
+                if (auto d = lookup(dev.descriptors, pkt)) {
+                        length = min(d->length, pkt.wLength);
+                        if (length <= len) {
+                                RtlCopyMemory(buf, d->data, length);
+                        } else {
+                                length = 0;
+                        }
+                }
+        }
+
+        if (!length) {
+                ++dev.descriptor_misses;
+                return false;
+        }
+
+        ++dev.descriptor_hits;
+
+        UdecxUrbSetBytesCompleted(request, length);
+        r.Hdr.Status = USBD_STATUS_SUCCESS;
+
+        TraceUrb("req %04x, %!usb_descriptor_type!, index %d, LangID %#x, wLength %d -> %d bytes from cache",
+                  ptr04x(request), pkt.wValue.HiByte, pkt.wValue.LowByte, pkt.wIndex.W, pkt.wLength, length);
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::cache_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_ const void *data, _In_ USHORT length)
+{
+        PAGED_CODE();
+
+        if (!(is_cacheable(pkt) && length && length <= pkt.wLength)) {
+                return;
+        }
+
+        auto key = make_key(pkt);
+
+        LIST_ENTRY replaced;
+        InitializeListHead(&replaced);
+
+        if (auto d = alloc_entry(key, data, length)) {
+                wdf::Lock lck(dev.descriptors_lock);
+                if (!insert(dev.descriptors, d, replaced)) {
+                        InsertTailList(&replaced, &d->entry);
+                }
+        }
+
+        if (auto s = dev.stored; s && is_storable(pkt)) {
+                if (auto d = alloc_entry(key, data, length)) {
+                        auto &vhci = *get_vhci_ctx(dev.vhci);
+                        wdf::WaitLock lck(vhci.stored_descriptors_lock);
+                        if (!insert(s->cache, d, replaced)) {
+                                InsertTailList(&replaced, &d->entry);
+                        }
+                }
+        }
+
+        free_entries(replaced);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::invalidate_descriptor_cache(_Inout_ device_ctx &dev)
+{
+        LIST_ENTRY head;
+        InitializeListHead(&head);
+        {
+                wdf::Lock lck(dev.descriptors_lock);
+                auto &c = dev.descriptors;
+
+                if (IsListEmpty(&c.entries)) {
+                        return;
+                }
+
+                while (!IsListEmpty(&c.entries)) {
+                        auto entry = RemoveHeadList(&c.entries);
+                        InsertTailList(&head, entry);
+                }
+
+                c.bytes = 0;
+        }
+
+        TraceDbg("dev %04x", ptr04x(get_handle(&dev)));
+        free_entries(head);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+
+/*
+ * Setup packet of GET_DESCRIPTOR.
+ * wValue is descriptor type and index, wIndex is language ID for string descriptors.
+ */
+struct descriptor_key
+{
+        USHORT wValue;
+        USHORT wIndex;
+        USHORT wLength;
+};
+
+struct descriptor_entry
+{
+        LIST_ENTRY entry; // head is descriptor_cache::entries
+        descriptor_key key;
+        USHORT length; // actual, <= key.wLength
+        UCHAR data[ANYSIZE_ARRAY];
+};
+
+struct descriptor_cache
+{
+        LIST_ENTRY entries; // descriptor_entry
+        ULONG bytes; // SUM(descriptor_entry::length)
+};
+
+/*
+ * Descriptors of the device that was attached earlier, they survive its detach.
+ * The device is identified by its location and idVendor/idProduct/bcdDevice from OP_REP_IMPORT.
+ * Another unit of the same model can be plugged into the same port, so string descriptors
+ * (iSerialNumber in particular) are not stored.
+ * Protected by vhci_ctx::stored_descriptors_lock.
+ */
+struct stored_descriptors
+{
+        LIST_ENTRY entry; // head is vhci_ctx::stored_descriptors, the least recently used first
+        ULONG users; // devices that use it, see device_ctx::stored; can't be evicted if non-zero
+
+        UNICODE_STRING node_name;
+        UNICODE_STRING service_name;
+        UNICODE_STRING busid;
+
+        UINT16 vendor;
+        UINT16 product;
+        UINT16 bcdDevice;
+
+        descriptor_cache cache;
+};
+
+
+/*
+ * Copies stored descriptors of the same device into its cache.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS init_descriptor_cache(_Inout_ device_ctx &dev);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void free_descriptor_cache(_Inout_ device_ctx &dev);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void free_stored_descriptors(_Inout_ vhci_ctx &vhci);
+
+/*
+ * @return true if URB was completed from the cache
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool get_cached_descriptor(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request,
+        _Inout_ _URB_CONTROL_TRANSFER_EX &r, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt);
+
+/*
+ * @param data response on GET_DESCRIPTOR from the server
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void cache_descriptor(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_ const void *data, _In_ USHORT length);
+
+/*
+ * SET_CONFIGURATION or port reset. Stored descriptors are not affected.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void invalidate_descriptor_cache(_Inout_ device_ctx &dev);
+
+} // namespace usbip
@@ -0,0 +1,373 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "descriptor_prefetch.h"
+#include "trace.h"
+#include "descriptor_prefetch.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "proto.h"
+#include "network.h"
+#include "device_ioctl.h"
+#include "descriptor_cache.h"
+#include "wsk_receive.h"
+#include "persistent.h"
+
+#include <usbip\consts.h>
+
+#include <libdrv\ch9.h>
+#include <libdrv\pdu.h>
+#include <libdrv\usbdsc.h>
+#include <libdrv\usb_util.h>
+#include <libdrv\dbgcommon.h>
+#include <libdrv\wait_timeout.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum {
+        MAX_REQUESTS = 16, // per round
+        MAX_CONFIGS = 8, // configuration descriptors to prefetch
+        LANGID_EN_US = 0x0409,
+};
+
+struct prefetch_ctx
+{
+        // current round
+        usbip_header hdr[MAX_REQUESTS]; // network byte order
+        USB_DEFAULT_PIPE_SETUP_PACKET pkt[MAX_REQUESTS];
+        seqnum_t seqnum[MAX_REQUESTS];
+        int cnt;
+
+        // from responses of previous rounds
+        USB_DEVICE_DESCRIPTOR dd; // zeroed if was not received
+        USHORT LanguageId;
+        USHORT wTotalLength[MAX_CONFIGS]; // of configuration descriptors
+        USHORT bos_wTotalLength;
+
+        UCHAR data[MAXUSHORT]; // of the current response
+};
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void add(
+        _Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev,
+        _In_ UCHAR type, _In_ UCHAR index, _In_ USHORT LanguageId, _In_ USHORT wLength)
+{
+        PAGED_CODE();
+
+        if (ctx.cnt == ARRAYSIZE(ctx.hdr)) {
+                return;
+        }
+
+        auto &hdr = ctx.hdr[ctx.cnt];
+        const ULONG TransferFlags = USBD_DEFAULT_PIPE_TRANSFER | USBD_SHORT_TRANSFER_OK | USBD_TRANSFER_DIRECTION_IN;
+
+        if (set_cmd_submit_usbip_header(hdr, dev, EP0, TransferFlags, wLength, setup_dir::in())) {
+                return;
+        }
+
+        auto &pkt = ctx.pkt[ctx.cnt] = device::make_get_descriptor(type, index, LanguageId, wLength);
+        get_submit_setup(hdr) = pkt;
+
+        ctx.seqnum[ctx.cnt++] = hdr.base.seqnum;
+
+        char buf[DBG_USBIP_HDR_BUFSZ];
+        TraceDbg("dev %04x -> %s", ptr04x(get_handle(&dev)), dbg_usbip_hdr(buf, sizeof(buf), &hdr, true));
+
+        byteswap_header(hdr, swap_dir::host2net);
+}
+
+/*
+ * Device, the first configuration header and string descriptor zero do not depend on anything.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void first_round(_Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        add(ctx, dev, USB_DEVICE_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_DEVICE_DESCRIPTOR));
+        add(ctx, dev, USB_CONFIGURATION_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_CONFIGURATION_DESCRIPTOR));
+        add(ctx, dev, USB_STRING_DESCRIPTOR_TYPE, 0, 0, MAXUCHAR);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void second_round(_Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+        auto &dd = ctx.dd;
+
+        if (!dd.bLength) {
+                return;
+        }
+
+        for (UCHAR i = 0; i < min(dd.bNumConfigurations, MAX_CONFIGS); ++i) {
+                if (i) {
+                        add(ctx, dev, USB_CONFIGURATION_DESCRIPTOR_TYPE, i, 0, sizeof(USB_CONFIGURATION_DESCRIPTOR));
+                } else if (auto len = ctx.wTotalLength[i]) {
+                        add(ctx, dev, USB_CONFIGURATION_DESCRIPTOR_TYPE, i, 0, len);
+                }
+        }
+
+        if (auto LanguageId = ctx.LanguageId) {
+                for (auto index: {dd.iManufacturer, dd.iProduct, dd.iSerialNumber}) {
+                        if (index) {
+                                add(ctx, dev, USB_STRING_DESCRIPTOR_TYPE, index, LanguageId, MAXUCHAR);
+                        }
+                }
+        }
+
+        if (dd.bcdUSB >= 0x0201) { // BOS is not requested from older devices, some of them misbehave
+                add(ctx, dev, USB_BOS_DESCRIPTOR_TYPE, 0, 0, sizeof(USB_BOS_DESCRIPTOR));
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void third_round(_Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        for (UCHAR i = 1; i < min(ctx.dd.bNumConfigurations, MAX_CONFIGS); ++i) {
+                if (auto len = ctx.wTotalLength[i]) {
+                        add(ctx, dev, USB_CONFIGURATION_DESCRIPTOR_TYPE, i, 0, len);
+                }
+        }
+
+        if (auto len = ctx.bos_wTotalLength; len > sizeof(USB_BOS_DESCRIPTOR)) {
+                add(ctx, dev, USB_BOS_DESCRIPTOR_TYPE, 0, 0, len);
+        }
+}
+
+/*
+ * Remember what is required for the next rounds.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void on_response(_Inout_ prefetch_ctx &ctx, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt, _In_ USHORT len)
+{
+        PAGED_CODE();
+        auto index = pkt.wValue.LowByte;
+
+        switch (pkt.wValue.HiByte) {
+        case USB_DEVICE_DESCRIPTOR_TYPE:
+                if (auto &d = reinterpret_cast<USB_DEVICE_DESCRIPTOR&>(*ctx.data);
+                    len == sizeof(d) && libdrv::is_valid(d)) {
+                        ctx.dd = d;
+                }
+                break;
+        case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+                if (auto &d = reinterpret_cast<USB_CONFIGURATION_DESCRIPTOR&>(*ctx.data);
+                    len == sizeof(d) && libdrv::is_valid(d) && index < ARRAYSIZE(ctx.wTotalLength)) {
+                        ctx.wTotalLength[index] = d.wTotalLength;
+                }
+                break;
+        case USB_STRING_DESCRIPTOR_TYPE:
+                if (auto &d = reinterpret_cast<USB_STRING_DESCRIPTOR&>(*ctx.data);
+                    !index && len >= sizeof(d) && libdrv::is_valid(d)) {
+                        ctx.LanguageId = d.bString[0];
+                        for (auto i = 0; i < (min(d.bLength, len) - 2)/2; ++i) {
+                                if (d.bString[i] == LANGID_EN_US) { // Windows prefers it
+                                        ctx.LanguageId = LANGID_EN_US;
+                                }
+                        }
+                }
+                break;
+        case USB_BOS_DESCRIPTOR_TYPE:
+                if (auto &d = reinterpret_cast<USB_BOS_DESCRIPTOR&>(*ctx.data);
+                    len == sizeof(d) && d.bDescriptorType == USB_BOS_DESCRIPTOR_TYPE) {
+                        ctx.bos_wTotalLength = d.wTotalLength;
+                }
+                break;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto find_request(_In_ const prefetch_ctx &ctx, _In_ seqnum_t seqnum)
+{
+        PAGED_CODE();
+
+        for (int i = 0; i < ctx.cnt; ++i) {
+                if (ctx.seqnum[i] == seqnum) {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+/*
+ * The server can complete the requests in any order.
+ *
+ * The payload of unexpected RET_SUBMIT is received if its length is sane, the stream stays in sync.
+ * Responses that are not received here are drained by the receive thread because their seqnums are unknown.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS recv_ret_submit(_Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        usbip_header hdr;
+        if (auto err = recv(dev.sock(), memory::stack, &hdr, sizeof(hdr))) {
+                Trace(TRACE_LEVEL_ERROR, "Receive usbip_header %!STATUS!", err);
+                return err;
+        }
+        byteswap_header(hdr, swap_dir::net2host);
+
+        if (hdr.base.command != USBIP_RET_SUBMIT) {
+                Trace(TRACE_LEVEL_ERROR, "USBIP_RET_SUBMIT expected, got %!usbip_request_type!", hdr.base.command);
+                return USBIP_ERROR_PROTOCOL;
+        }
+
+        auto &ret = hdr.u.ret_submit;
+
+        if (!(ret.number_of_packets == number_of_packets_non_isoch || !ret.number_of_packets) ||
+            ret.actual_length < 0 || ret.actual_length > sizeof(ctx.data)) {
+                char buf[DBG_USBIP_HDR_BUFSZ];
+                Trace(TRACE_LEVEL_ERROR, "Unexpected %s", dbg_usbip_hdr(buf, sizeof(buf), &hdr, false));
+                return USBIP_ERROR_PROTOCOL;
+        }
+
+        auto len = static_cast<USHORT>(ret.actual_length);
+
+        if (auto err = len ? recv(dev.sock(), memory::paged, ctx.data, len) : STATUS_SUCCESS) {
+                Trace(TRACE_LEVEL_ERROR, "Receive transfer buffer %!STATUS!", err);
+                return err;
+        }
+
+        auto i = find_request(ctx, hdr.base.seqnum);
+
+        if (i < 0 || len > ctx.pkt[i].wLength) {
+                char buf[DBG_USBIP_HDR_BUFSZ];
+                Trace(TRACE_LEVEL_ERROR, "Unexpected %s", dbg_usbip_hdr(buf, sizeof(buf), &hdr, false));
+                return STATUS_INVALID_DEVICE_REQUEST; // the stream is in sync
+        }
+
+        auto &pkt = ctx.pkt[i];
+        ctx.seqnum[i] = 0; // received
+
+        if (ret.status || !len) {
+                TraceDbg("%!usb_descriptor_type!, index %d, status %d",
+                          pkt.wValue.HiByte, pkt.wValue.LowByte, ret.status);
+        } else {
+                on_response(ctx, pkt, len);
+                fix_descriptor(dev, ctx.data, len); // as for URBs, see post_control_transfer
+                cache_descriptor(dev, pkt, ctx.data, len);
+        }
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS run_round(_Inout_ prefetch_ctx &ctx, _Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (auto err = send(dev.sock(), memory::paged, ctx.hdr, ctx.cnt*sizeof(*ctx.hdr))) {
+                Trace(TRACE_LEVEL_ERROR, "Send %d requests %!STATUS!", ctx.cnt, err);
+                return err;
+        }
+
+        for (int i = 0; i < ctx.cnt; ++i) {
+                if (auto err = recv_ret_submit(ctx, dev)) {
+                        return err;
+                }
+        }
+
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_prefetch_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.descriptor_prefetch = false;
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, descriptor_prefetch_value_name);
+
+        ULONG value = 0;
+
+        if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                return;
+        }
+
+        vhci.descriptor_prefetch = value;
+
+        if (vhci.descriptor_prefetch) {
+                Trace(TRACE_LEVEL_INFORMATION, "descriptor prefetch is enabled");
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::prefetch_descriptors(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        if (!get_vhci_ctx(dev.vhci)->descriptor_prefetch) {
+                return;
+        }
+
+        if (dev.descriptors.bytes) {
+                TraceDbg("dev %04x, stored descriptors are used", ptr04x(get_handle(&dev)));
+                return;
+        }
+
+        unique_ptr ptr(PagedPool, sizeof(prefetch_ctx));
+        auto ctx = ptr.get<prefetch_ctx>();
+        if (!ctx) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate prefetch_ctx");
+                return;
+        }
+
+        using round_t = void(prefetch_ctx&, device_ctx&);
+        round_t* const rounds[] { first_round, second_round, third_round };
+
+        auto start = KeQueryInterruptTime();
+        int cnt = 0;
+
+        for (auto fill: rounds) {
+                ctx->cnt = 0;
+                fill(*ctx, dev);
+
+                if (!ctx->cnt) {
+                        break;
+                }
+
+                if (auto err = run_round(*ctx, dev)) {
+                        Trace(TRACE_LEVEL_WARNING, "dev %04x, round %d %!STATUS!, fall back to enumeration by the OS",
+                                ptr04x(get_handle(&dev)), cnt + 1, err);
+
+                        invalidate_descriptor_cache(dev);
+                        return;
+                }
+
+                ++cnt;
+        }
+
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %lu bytes of descriptors in %d round(s), %I64u ms",
+                ptr04x(get_handle(&dev)), dev.descriptors.bytes, cnt, (KeQueryInterruptTime() - start)/wdm::msec);
+}
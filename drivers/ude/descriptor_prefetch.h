@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <wdm.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_prefetch_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * Opt-in, see vhci_ctx::descriptor_prefetch.
+ *
+ * Issue GET_DESCRIPTOR requests that the OS will send during enumeration, the responses populate the descriptor cache.
+ * Requests that do not depend on each other are sent back-to-back, thus it takes about 2 RTT
+ * instead of one RTT per request.
+ *
+ * Must be called after OP_REP_IMPORT and before UdecxUsbDevicePlugIn, the receive thread is not running yet.
+ * Does nothing if the cache already has stored descriptors of the device.
+ *
+ * Errors are not fatal for attach. The cache is emptied and the OS requests descriptors from the server as usual,
+ * responses that were not received yet are drained by the receive thread. If the connection is broken,
+ * the receive thread detects that after the device is plugged in.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void prefetch_descriptors(_Inout_ device_ctx &dev);
+
+} // namespace usbip
@@ -14,6 +14,10 @@
 #include "wsk_receive.h"
 #include "ioctl.h"
 #include "vhci.h"
+#include "jitter_buffer.h"
+#include "flow_control.h"
+#include "descriptor_cache.h"
+#include "local_requests.h"
 
 #include <libdrv/dbgcommon.h>
 #include <libdrv/wait_timeout.h>
@@ -76,6 +80,10 @@ PAGED void device_cleanup(_In_ WDFOBJECT Object)
         Trace(TRACE_LEVEL_INFORMATION, "dev %04x, cancelable(%!UINT64!) / sent(%!UINT64!) requests",
                 ptr04x(device), dev.cancelable_requests, dev.sent_requests);
 
+        free_jitter_buffers(dev);
+        free_descriptor_cache(dev);
+        log_local_requests(dev);
+
         // all resources must be freed except for device_ctx_ext*
         NT_ASSERT(IsListEmpty(&dev.requests));
         NT_ASSERT(dev.unplugged);
@@ -145,6 +153,9 @@ PAGED void NTAPI endpoint_cleanup(_In_ WDFOBJECT object)
                   ptr04x(endpoint), d.bEndpointAddress, usbd_pipe_type_str(usb_endpoint_type(d)),
                   usb_endpoint_dir_out(d) ? "Out" : "In", usb_endpoint_num(d), ptr04x(endp.PipeHandle));
 
+        jitter_buffer_stop(*get_device_ctx(endp.device), endpoint);
+        flow_control_stop(endpoint);
+        trace_compression_stats(endpoint);
         remove_endpoint_list(endp);
 }
 
@@ -174,6 +185,9 @@ void endpoint_purge(_In_ UDECXUSBENDPOINT endpoint)
 
         TraceDbg("dev %04x, endp %04x, queue %04x", ptr04x(endp.device), ptr04x(endpoint), ptr04x(endp.queue));
 
+        jitter_buffer_stop(dev, endpoint);
+        flow_control_stop(endpoint); // before cancelling of sent URBs, their completion sends waiting ones
+
         while (auto request = device::remove_request(dev, endpoint)) {
                 device::send_cmd_unlink_and_cancel(endp.device, request);
         }
@@ -370,6 +384,18 @@ PAGED NTSTATUS endpoint_add(_In_ UDECXUSBDEVICE device, _In_ UDECX_USB_ENDPOINT_
                 NT_ASSERT(sizeof(endp.descriptor) >= len);
                 RtlCopyMemory(&endp.descriptor, &epd, len);
                 insert_endpoint_list(endp);
+
+                if (auto err = create_jitter_buffer(dev, endp.descriptor)) {
+                        return err;
+                }
+
+                if (auto err = create_flow_control(dev, endpoint)) {
+                        return err;
+                }
+
+                if (auto err = create_compression(dev, endpoint)) {
+                        return err;
+                }
         } else {
                 NT_ASSERT(epd == EP0);
                 static_cast<USB_ENDPOINT_DESCRIPTOR&>(endp.descriptor) = epd;
@@ -561,6 +587,10 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
                 &dev.send_lock,
                 &dev.endpoint_list_lock,
                 &dev.requests_lock,
+                &dev.frame_lock,
+                &dev.descriptors_lock,
+                &dev.tracked_lock,
+                &dev.segmented_lock,
         };
 
         for (auto i: v) {
@@ -574,6 +604,7 @@ PAGED auto init_device(_In_ UDECXUSBDEVICE device, _Inout_ device_ctx &dev)
         }
 
         InitializeListHead(&dev.requests);
+        InitializeListHead(&dev.segmented);
         KeInitializeEvent(&dev.detach_completed, NotificationEvent, false);
 
         return STATUS_SUCCESS;
@@ -747,6 +778,10 @@ PAGED NTSTATUS usbip::device::create(_Out_ UDECXUSBDEVICE &device, _In_ WDFDEVIC
                 return err;
         }
 
+        if (auto err = init_descriptor_cache(ctx)) {
+                return err;
+        }
+
         Trace(TRACE_LEVEL_INFORMATION, "dev %04x", ptr04x(device));
         return STATUS_SUCCESS;
 }
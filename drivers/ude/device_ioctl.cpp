@@ -14,6 +14,13 @@
 #include "proto.h"
 #include "network.h"
 #include "ioctl.h"
+#include "frame_clock.h"
+#include "jitter_buffer.h"
+#include "flow_control.h"
+#include "segmented_transfer.h"
+#include "compression.h"
+#include "descriptor_cache.h"
+#include "local_requests.h"
 
 #include "filter_request.h"
 #include <ude_filter\request.h>
@@ -53,7 +60,11 @@ NTSTATUS send_complete(_In_ DEVICE_OBJECT*, _In_ IRP *wsk_irp, _In_reads_opt_(_I
         TraceWSK("req %04x -> wsk irp %04x, %!STATUS!, Information %Iu", 
                   ptr04x(request), ptr04x(wsk_irp), wsk.Status, wsk.Information);
 
-        if (!request) {
+        if (auto st = ctx->segment) {
+                NT_ASSERT(!request);
+                ctx->segment = nullptr;
+                segment_send_completed(*st); // can complete URB, the transfer buffer is not accessed anymore
+        } else if (!request) {
                 // nothing to do
         } else if (NT_SUCCESS(wsk.Status)) {
                 ++dev.sent_requests;
@@ -80,7 +91,7 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_ const URB *transfer_buffer)
 {
-        NT_ASSERT(!ctx.mdl_buf);
+        NT_ASSERT(!(transfer_buffer && ctx.mdl_buf)); // ctx.mdl_buf can be set by send_segment
 
         if (transfer_buffer && is_transfer_dir_out(ctx.hdr)) { // TransferFlags can have wrong direction
                 if (auto err = make_transfer_buffer_mdl(ctx.mdl_buf, URB_BUF_LEN, IoReadAccess, *transfer_buffer)) {
@@ -100,7 +111,7 @@ auto prepare_wsk_buf(_Inout_ WSK_BUF &buf, _Inout_ wsk_context &ctx, _Inout_opt_
 
         buf.Mdl = ctx.mdl_hdr.get();
         buf.Offset = 0;
-        buf.Length = get_total_size(ctx.hdr);
+        buf.Length = ctx.compressed ? sizeof(ctx.hdr) + ctx.mdl_buf.size() : get_total_size(ctx.hdr); // see compress_transfer
 
         NT_ASSERT(verify(buf, ctx.is_isoc));
         return STATUS_SUCCESS;
@@ -208,6 +219,15 @@ auto control_transfer(
                 return STATUS_INVALID_PARAMETER;
         }
 
+        if (get_cached_descriptor(dev, request, r, pkt) || answer_control_request(dev, request, r, pkt)) {
+                return STATUS_SUCCESS;
+        } else if (pkt.bmRequestType.B == (USB_DIR_OUT | USB_TYPE_STANDARD | USB_RECIP_DEVICE) &&
+                   pkt.bRequest == USB_REQUEST_SET_CONFIGURATION) {
+                invalidate_descriptor_cache(dev);
+        }
+
+        track_control_request(dev, pkt);
+
         wsk_context_ptr ctx(&dev, request);
         if (!ctx) {
                 return STATUS_INSUFFICIENT_RESOURCES;
@@ -225,6 +245,110 @@ auto control_transfer(
         return send(endpoint, ctx, dev, true, &urb);
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto send_bulk_or_interrupt_transfer(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ const endpoint_ctx &endp,
+        _In_ WDFREQUEST request, _In_ URB &urb)
+{
+        auto &r = urb.UrbBulkOrInterruptTransfer;
+
+        wsk_context_ptr ctx(&dev, request);
+        if (!ctx) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, r.TransferBufferLength)) {
+                return err;
+        }
+
+        auto compressed = compress_transfer(*ctx, endpoint, urb);
+        return send(endpoint, ctx, dev, false, compressed ? nullptr : &urb);
+}
+
+/*
+ * @param request WDF_NO_HANDLE for all segments except the last one
+ * @param st is not nullptr if request is WDF_NO_HANDLE
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto send_segment(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ const endpoint_ctx &endp,
+        _In_opt_ WDFREQUEST request, _In_ const URB &urb, _In_ ULONG offset, _In_ ULONG length,
+        _Inout_opt_ segmented_transfer *st)
+{
+        NT_ASSERT(!request == bool(st));
+        auto &r = urb.UrbBulkOrInterruptTransfer;
+
+        wsk_context_ptr ctx(&dev, request);
+        if (!ctx) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, length)) {
+                return err;
+        }
+
+        if (auto err = make_transfer_buffer_mdl(ctx->mdl_buf, offset, length, IoReadAccess, urb)) {
+                Trace(TRACE_LEVEL_ERROR, "make_transfer_buffer_mdl %!STATUS!", err);
+                return err;
+        }
+
+        if (st) {
+                segment_pending(dev, *st, ctx->hdr.base.seqnum);
+                ctx->segment = st;
+        }
+
+        auto ret = send(endpoint, ctx, dev, false);
+        if (ret != STATUS_PENDING && st) { // send_complete will not be called
+                ctx->segment = nullptr;
+                segment_send_completed(*st);
+        }
+
+        return ret;
+}
+
+/*
+ * @see segmented_transfer
+ *
+ * If a segment can't be sent, URB is completed by complete() that waits for the sends of previous segments.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto send_segmented_transfer(
+        _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ const endpoint_ctx &endp,
+        _In_ WDFREQUEST request, _In_ URB &urb, _In_ ULONG segment_size)
+{
+        auto length = urb.UrbBulkOrInterruptTransfer.TransferBufferLength;
+
+        auto st = alloc_segmented_transfer(dev, request);
+        if (!st) {
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        auto &req = *get_request_ctx(request);
+        req.endpoint = endpoint; // for complete()
+        req.segments = st; // before send, RET_SUBMIT can be received before it returns
+
+        ULONG offset = 0;
+        auto ret = STATUS_PENDING;
+
+        for ( ; ret == STATUS_PENDING && length - offset > segment_size; offset += segment_size) {
+                ret = send_segment(dev, endpoint, endp, WDF_NO_HANDLE, urb, offset, segment_size, st);
+        }
+
+        if (ret == STATUS_PENDING) {
+                TraceUrb("req %04x, %lu segments of %lu bytes", ptr04x(request), st->cnt + 1, segment_size);
+                ret = send_segment(dev, endpoint, endp, request, urb, offset, length - offset, nullptr);
+        }
+
+        if (ret != STATUS_PENDING) {
+                complete(request, ret);
+        }
+
+        return STATUS_PENDING;
+}
+
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
 auto bulk_or_interrupt_transfer(
@@ -249,16 +373,20 @@ auto bulk_or_interrupt_transfer(
                         r.TransferBufferLength, func);
         }
 
-        wsk_context_ptr ctx(&dev, request);
-        if (!ctx) {
-                return STATUS_INSUFFICIENT_RESOURCES;
+        if (NTSTATUS st; flow_control_hold(st, endpoint, request, r.TransferBufferLength)) {
+                return st;
         }
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, r.TransferBufferLength)) {
-                return err;
+        if (auto size = get_segment_size(dev, endp.descriptor, r.TransferBufferLength)) {
+                return send_segmented_transfer(dev, endpoint, endp, request, urb, size);
         }
 
-        return send(endpoint, ctx, dev, false, &urb);
+        auto st = send_bulk_or_interrupt_transfer(dev, endpoint, endp, request, urb);
+        if (st != STATUS_PENDING) {
+                flow_control_completed(request, nullptr); // URB will be completed by the caller
+        }
+
+        return st;
 }
 
 /*
@@ -292,7 +420,8 @@ auto repack(_In_ usbip_iso_packet_descriptor *d, _In_ const _URB_ISOCH_TRANSFER
 }
 
 /*
- * USBD_START_ISO_TRANSFER_ASAP is appended because URB_GET_CURRENT_FRAME_NUMBER is not implemented.
+ * Explicit StartFrame is translated to the server's frame space, see frame_clock.
+ * USBD_START_ISO_TRANSFER_ASAP is appended if the frame clock is not synchronized yet.
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 _Function_class_(urb_function_t)
@@ -326,13 +455,24 @@ auto isoch_transfer(
                 return STATUS_INVALID_PARAMETER;
         }
 
+        if (NTSTATUS st; jitter_buffer_submit(st, dev, endpoint, request, r)) {
+                return st;
+        }
+
         wsk_context_ptr ctx(&dev, request, r.NumberOfPackets);
         if (!ctx) {
                 return STATUS_INSUFFICIENT_RESOURCES;
         }
 
-        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, 
-                               r.TransferFlags | USBD_START_ISO_TRANSFER_ASAP, r.TransferBufferLength)) {
+        auto flags = r.TransferFlags;
+        auto start_frame = LONG(r.StartFrame);
+
+        if (!(flags & USBD_START_ISO_TRANSFER_ASAP) && !to_server_frame(start_frame, dev, r.StartFrame)) {
+                flags |= USBD_START_ISO_TRANSFER_ASAP;
+                start_frame = r.StartFrame;
+        }
+
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, flags, r.TransferBufferLength)) {
                 return err;
         }
 
@@ -341,13 +481,31 @@ auto isoch_transfer(
         }
 
         if (auto cmd = &ctx->hdr.u.cmd_submit) {
-                cmd->start_frame = r.StartFrame;
+                cmd->start_frame = start_frame;
                 cmd->number_of_packets = r.NumberOfPackets;
         }
 
         return send(endpoint, ctx, dev, false, &urb);
 }
 
+/*
+ * Is answered locally, the server is not involved.
+ * @see frame_clock
+ */
+_IRQL_requires_max_(DISPATCH_LEVEL)
+_Function_class_(urb_function_t)
+auto get_current_frame_number(
+        _In_ device_ctx&, _In_ UDECXUSBENDPOINT, _In_ endpoint_ctx&, _In_ WDFREQUEST request, _In_ URB &urb)
+{
+        auto &r = urb.UrbGetCurrentFrameNumber;
+
+        r.FrameNumber = get_current_frame();
+        r.Hdr.Status = USBD_STATUS_SUCCESS;
+
+        TraceUrb("req %04x -> FrameNumber %lu", ptr04x(request), r.FrameNumber);
+        return STATUS_SUCCESS;
+}
+
 /*
  * @see WdfRequestForwardToParentDeviceIoQueue
  */
@@ -378,6 +536,9 @@ auto usb_submit_urb(
                 return err;
         }
 
+        auto &req = *get_request_ctx(request);
+        req = {}; // a request can be reused for the next URB, the context keeps the values of the previous one
+
         auto &urb = get_urb(request);
         urb_function_t *handler{};
 
@@ -394,6 +555,9 @@ auto usb_submit_urb(
         case URB_FUNCTION_CONTROL_TRANSFER:
                 handler = control_transfer;
                 break;
+        case URB_FUNCTION_GET_CURRENT_FRAME_NUMBER:
+                handler = get_current_frame_number;
+                break;
         default:
                 Trace(TRACE_LEVEL_ERROR, "%s(%#04x), dev %04x, endp %04x", urb_function_str(func), func, 
                                           ptr04x(endp.device), ptr04x(endpoint));
@@ -464,16 +628,77 @@ void usbip::device::send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In
 
         TraceDbg("dev %04x, seqnum %u", ptr04x(device), req.seqnum);
 
+        send_cmd_unlink(dev, req.seqnum);
+        complete(request, status);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::device::send_cmd_unlink(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum)
+{
         if (dev.unplugged) {
                 TraceDbg("Unplugged, do not send unlink");
         } else if (auto ctx = wsk_context_ptr(&dev, WDFREQUEST(WDF_NO_HANDLE))) {
-                set_cmd_unlink_usbip_header(ctx->hdr, dev, req.seqnum);
+                set_cmd_unlink_usbip_header(ctx->hdr, dev, seqnum);
                 ::send(WDF_NO_HANDLE, ctx, dev, false); // ignore error
         } else {
-                Trace(TRACE_LEVEL_ERROR, "dev %04x, seqnum %u, wsk_context_ptr error", ptr04x(device), req.seqnum);
+                Trace(TRACE_LEVEL_ERROR, "dev %04x, seqnum %u, wsk_context_ptr error", ptr04x(get_handle(&dev)), seqnum);
         }
+}
 
-        complete(request, status);
+/*
+ * The slot is not associated with WDFREQUEST, RET_SUBMIT will be received into it.
+ * @see jitter_slot_take
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::device::send_isoch_prefetch(
+        _Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _Inout_ jitter_slot &slot)
+{
+        auto &endp = *get_endpoint_ctx(endpoint);
+        auto &r = *slot.urb;
+
+        wsk_context_ptr ctx(&dev, WDFREQUEST(WDF_NO_HANDLE), r.NumberOfPackets);
+        if (!ctx) {
+                jitter_slot_release(slot);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (auto err = set_cmd_submit_usbip_header(ctx->hdr, dev, endp.descriptor, r.TransferFlags, r.TransferBufferLength)) {
+                jitter_slot_release(slot);
+                return err;
+        }
+
+        if (auto err = repack(ctx->isoc, r)) {
+                jitter_slot_release(slot);
+                return err;
+        }
+
+        if (auto cmd = &ctx->hdr.u.cmd_submit) {
+                cmd->start_frame = 0;
+                cmd->number_of_packets = r.NumberOfPackets;
+        }
+
+        slot.seqnum = ctx->hdr.base.seqnum;
+
+        if (!jitter_slot_pending(slot)) { // RET_SUBMIT can be received before send() returns
+                return STATUS_SUCCESS;
+        }
+
+        auto st = ::send(endpoint, ctx, dev, false);
+        return st == STATUS_PENDING ? STATUS_SUCCESS : st;
+}
+
+/*
+ * URB was waiting for credits of flow_control.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS usbip::device::send_bulk_transfer(
+        _Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ WDFREQUEST request)
+{
+        auto &endp = *get_endpoint_ctx(endpoint);
+        return send_bulk_or_interrupt_transfer(dev, endpoint, endp, request, get_urb(request));
 }
 
 _IRQL_requires_same_
@@ -526,14 +751,31 @@ USB_DEFAULT_PIPE_SETUP_PACKET usbip::device::make_reset_port(_In_ USHORT port)
         };
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+USB_DEFAULT_PIPE_SETUP_PACKET usbip::device::make_get_descriptor(
+        _In_ UCHAR DescriptorType, _In_ UCHAR Index, _In_ USHORT LanguageId, _In_ USHORT wLength)
+{
+        return USB_DEFAULT_PIPE_SETUP_PACKET {
+                .bmRequestType{.B = USB_DIR_IN | USB_TYPE_STANDARD | USB_RECIP_DEVICE},
+                .bRequest = USB_REQUEST_GET_DESCRIPTOR,
+                .wValue{.W = USHORT(DescriptorType << 8 | Index)},
+                .wIndex{.W = LanguageId},
+                .wLength = wLength,
+        };
+}
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS usbip::device::set_configuration(
         _In_ UDECXUSBDEVICE device, _In_opt_ WDFREQUEST request, _In_ UCHAR ConfigurationValue)
 {
         TraceDbg("dev %04x, ConfigurationValue %d", ptr04x(device), ConfigurationValue);
+        auto &dev = *get_device_ctx(device);
+        invalidate_descriptor_cache(dev);
 
         auto r = make_set_configuration(ConfigurationValue);
+        track_control_request(dev, r);
         return send_ep0_out(device, request, r);
 }
 
@@ -546,6 +788,7 @@ NTSTATUS usbip::device::set_interface(
         TraceDbg("dev %04x, %d.%d", ptr04x(device), InterfaceNumber, AlternateSetting);
 
         auto r = make_set_interface(InterfaceNumber, AlternateSetting);
+        track_control_request(*get_device_ctx(device), r);
         return send_ep0_out(device, request, r);
 }
 
@@ -580,6 +823,8 @@ NTSTATUS usbip::device::reset_port(_In_ UDECXUSBDEVICE device, _In_opt_ WDFREQUE
         auto port = static_cast<USHORT>(dev.port); // meaningless for a server which ignores it
 
         TraceDbg("dev %04x, port %d", ptr04x(device), port);
+        invalidate_descriptor_cache(dev);
+        reset_tracked_state(dev);
 
         auto r = make_reset_port(port);
         return send_ep0_out(device, request, r);
@@ -10,9 +10,22 @@
 #include <wdfusb.h>
 #include <UdeCx.h>
 
+#include <usbip\proto.h>
+
+namespace usbip
+{
+        struct device_ctx;
+        struct jitter_slot;
+} // namespace usbip
+
+
 namespace usbip::device
 {
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send_cmd_unlink(_Inout_ device_ctx &dev, _In_ seqnum_t seqnum);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void send_cmd_unlink_and_complete(_In_ UDECXUSBDEVICE device, _In_ WDFREQUEST request, _In_ NTSTATUS status);
@@ -24,6 +37,20 @@ inline void send_cmd_unlink_and_cancel(_In_ UDECXUSBDEVICE device, _In_ WDFREQUE
         send_cmd_unlink_and_complete(device, request, STATUS_CANCELLED);
 }
 
+/*
+ * The slot is released if it can't be sent.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS send_isoch_prefetch(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _Inout_ jitter_slot &slot);
+
+/*
+ * Does not complete the request if an error is returned.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+NTSTATUS send_bulk_transfer(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _In_ WDFREQUEST request);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 USB_DEFAULT_PIPE_SETUP_PACKET make_set_configuration(_In_ UCHAR ConfigurationValue);
@@ -40,6 +67,11 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 USB_DEFAULT_PIPE_SETUP_PACKET make_reset_port(_In_ USHORT port);
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+USB_DEFAULT_PIPE_SETUP_PACKET make_get_descriptor(
+        _In_ UCHAR DescriptorType, _In_ UCHAR Index, _In_ USHORT LanguageId, _In_ USHORT wLength);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS set_configuration(
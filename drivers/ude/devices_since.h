@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Changes of imported devices since a generation, see ioctl::get_imported_devices_since.
+ * vhci_ctx::generation is incremented when a port is claimed or reclaimed,
+ * port_slot::generation is the value of the last change of the port.
+ *
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+
+namespace usbip::devices_since
+{
+
+/*
+ * Generations of another load of the driver are stale, zero requests the full list.
+ * @param instance of the driver
+ * @param req_instance, req_generation of the previous call
+ */
+constexpr long long since(unsigned long long instance, unsigned long long req_instance, long long req_generation)
+{
+        return req_instance == instance ? req_generation : 0;
+}
+
+/*
+ * The generation of the driver must be read before the scan, so a port that changes during the scan
+ * has a greater generation and will be returned again by the next call.
+ *
+ * @param since see since()
+ * @param port_generation(port) returns port_slot::generation
+ * @param get_device(port) returns the device of the port that converts to false if the port is free
+ * @param report(port, dev) puts the device or the removal of the port into the result, returns an error
+ * @return the first error of report
+ */
+template<typename PortGeneration, typename GetDevice, typename Report>
+auto scan(int ports, long long since, PortGeneration &&port_generation, GetDevice &&get_device, Report &&report)
+{
+        decltype(report(1, get_device(1))) err{};
+
+        for (int port = 1; port <= ports; ++port) {
+                if (port_generation(port) <= since) {
+                        continue;
+                }
+
+                auto dev = get_device(port);
+                if (!(dev || since)) {
+                        continue; // a free port, the full list is requested
+                }
+
+                if ((err = report(port, dev))) {
+                        break;
+                }
+        }
+
+        return err;
+}
+
+} // namespace usbip::devices_since
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+/*
+ * Slots of compacted device states of a subscriber, see fileobject_ctx::events.
+ * A slot is dirty if it holds a state that was not read yet. Slot type must have member seq,
+ * the number of the change that is used to return states in the order they happened.
+ *
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+
+namespace usbip::event_slots
+{
+
+using word_t = unsigned long long;
+
+constexpr auto bitmap_words(int cnt)
+{
+        return (cnt + 63)/64;
+}
+
+inline bool is_dirty(const word_t *dirty, int i)
+{
+        return dirty[i/64] & (1ULL << (i % 64));
+}
+
+inline void set_dirty(word_t *dirty, int i, bool value)
+{
+        auto &bits = dirty[i/64];
+        auto mask = 1ULL << (i % 64);
+
+        if (value) {
+                bits |= mask;
+        } else {
+                bits &= ~mask;
+        }
+}
+
+inline bool any_dirty(const word_t *dirty, int cnt)
+{
+        for (int i = 0; i < bitmap_words(cnt); ++i) {
+                if (dirty[i]) {
+                        return true;
+                }
+        }
+
+        return false;
+}
+
+/*
+ * @param bits must not be zero
+ */
+inline int lowest_bit(word_t bits)
+{
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i, bits);
+        return static_cast<int>(i);
+#else
+        return __builtin_ctzll(bits);
+#endif
+}
+
+/*
+ * Calls f(i) for each dirty slot, clean words are skipped.
+ */
+template<typename F>
+void for_each_dirty(const word_t *dirty, int cnt, F &&f)
+{
+        for (int w = 0; w < bitmap_words(cnt); ++w) {
+                for (auto bits = dirty[w]; bits; bits &= bits - 1) {
+                        f(w*64 + lowest_bit(bits));
+                }
+        }
+}
+
+/*
+ * Slots in [first, last) that are looked up by the device rather than indexed.
+ * @param same(slot) returns true if the slot holds a state of the same device
+ * @return the slot of the same device, a free slot or the oldest one if all are taken
+ */
+template<typename Slot, typename Same>
+int find(const Slot *slots, const word_t *dirty, int first, int last, Same &&same)
+{
+        int free_slot = -1;
+        int oldest = -1;
+
+        for (int i = first; i < last; ++i) {
+                auto &slot = slots[i];
+
+                if (!is_dirty(dirty, i)) {
+                        if (free_slot < 0) {
+                                free_slot = i;
+                        }
+                } else if (same(slot)) {
+                        return i;
+                } else if (oldest < 0 || slot.seq < slots[oldest].seq) {
+                        oldest = i;
+                }
+        }
+
+        return free_slot >= 0 ? free_slot : oldest;
+}
+
+/*
+ * Heapsort of slot indices by seq, no allocations.
+ */
+template<typename Slot>
+void sort_by_seq(const Slot *slots, int *idx, int cnt)
+{
+        auto less = [slots] (int a, int b) { return slots[a].seq < slots[b].seq; };
+
+        auto sift_down = [idx, &less] (int i, int n)
+        {
+                for (int child; (child = 2*i + 1) < n; i = child) {
+                        if (child + 1 < n && less(idx[child], idx[child + 1])) {
+                                ++child;
+                        }
+                        if (!less(idx[i], idx[child])) {
+                                break;
+                        }
+                        auto tmp = idx[i];
+                        idx[i] = idx[child];
+                        idx[child] = tmp;
+                }
+        };
+
+        for (int i = cnt/2 - 1; i >= 0; --i) {
+                sift_down(i, cnt);
+        }
+
+        for (int n = cnt - 1; n > 0; --n) {
+                auto tmp = idx[0];
+                idx[0] = idx[n];
+                idx[n] = tmp;
+                sift_down(0, n);
+        }
+}
+
+/*
+ * Walks the bitmap, so the cost depends on the number of changed slots rather than on all of them.
+ * @param idx [cnt], receives the indices of dirty slots in the order of seq
+ * @return the number of dirty slots
+ */
+template<typename Slot>
+int dirty_by_seq(const Slot *slots, const word_t *dirty, int cnt, int *idx)
+{
+        int n = 0;
+        for_each_dirty(dirty, cnt, [idx, &n] (int i) { idx[n++] = i; });
+
+        sort_by_seq(slots, idx, n);
+        return n;
+}
+
+} // namespace usbip::event_slots
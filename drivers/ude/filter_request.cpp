@@ -8,6 +8,7 @@
 
 #include "endpoint_list.h"
 #include "device_ioctl.h"
+#include "local_requests.h"
 
 #include <ude_filter/request.h>
 
@@ -142,6 +143,8 @@ auto select_configuration(
                 }
         }
 
+        local_requests_select_configuration(dev, r);
+
         pkt = device::make_set_configuration(cfg);
         return STATUS_SUCCESS;
 }
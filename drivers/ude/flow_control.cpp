@@ -0,0 +1,351 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "flow_control.h"
+#include "trace.h"
+#include "flow_control.tmh"
+
+#include "context.h"
+#include "persistent.h"
+#include "device_ioctl.h"
+#include "wsk_receive.h"
+#include "ioctl.h"
+
+#include <usbip\consts.h>
+
+#include <libdrv\ch9.h>
+#include <libdrv\wait_timeout.h>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr auto to_usec(_In_ LONG64 interrupt_time)
+{
+        return ULONG(interrupt_time/wdm::usec);
+}
+
+inline auto& get_flow_control(_In_ UDECXUSBENDPOINT endpoint)
+{
+        return get_endpoint_ctx(endpoint)->flow;
+}
+
+inline auto has_credits(_In_ const flow_control &fc)
+{
+        return fc.limits.allow(fc.urbs, fc.bytes);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto waiting_cnt(_In_ const flow_control &fc)
+{
+        ULONG cnt = 0;
+        WdfIoQueueGetState(fc.held, &cnt, nullptr);
+        return cnt;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void trace_stats(_In_ UDECXUSBENDPOINT endpoint, _In_ const flow_control &fc)
+{
+        auto busy = fc.busy;
+        if (fc.urbs) {
+                busy += KeQueryInterruptTime() - fc.busy_since;
+        }
+
+        auto avg_delay = fc.delayed ? fc.delay/fc.delayed : 0;
+        auto throughput = busy ? fc.delivered*wdm::second/busy : 0; // bytes per second
+
+        Trace(TRACE_LEVEL_INFORMATION, "endp %04x, sent %!UINT64!, delayed %!UINT64!, "
+                "queueing delay %lu us(max %lu us), throughput %!UINT64! KiB/s, min rtt %lu us, "
+                "limits %lu urbs, %lu bytes",
+                ptr04x(endpoint), fc.sent, fc.delayed, to_usec(avg_delay), to_usec(fc.max_delay),
+                throughput/1024, to_usec(fc.limits.min_rtt), fc.limits.max_urbs, fc.limits.max_bytes);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void take(_Inout_ flow_control &fc, _Inout_ request_ctx &req, _In_ ULONG length, _In_ LONG64 now)
+{
+        req.credits = true;
+        req.credit_bytes = length;
+        req.stamp = now;
+
+        if (!fc.urbs++) {
+                fc.busy_since = now;
+        }
+        fc.bytes += length;
+        ++fc.sent;
+
+        fc.limits.taken(length);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void give(_Inout_ flow_control &fc, _Inout_ request_ctx &req, _In_ LONG64 now)
+{
+        NT_ASSERT(req.credits);
+        req.credits = false;
+
+        NT_ASSERT(fc.urbs);
+        NT_ASSERT(fc.bytes >= req.credit_bytes);
+
+        fc.bytes -= req.credit_bytes;
+
+        if (!--fc.urbs) {
+                fc.busy += now - fc.busy_since;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void sample(_Inout_ flow_control &fc, _In_ LONG64 rtt, _In_ ULONG length, _In_ LONG64 now)
+{
+        fc.delivered += length;
+        fc.limits.delivered(rtt, length, now);
+}
+
+/*
+ * Only one thread sends waiting URBs at a time, otherwise their order can be changed.
+ * It also prevents recursion if send fails and URB is completed in the same call stack.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send_waiting(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _Inout_ flow_control &fc)
+{
+        {
+                wdf::Lock lck(fc.lock);
+                if (fc.dispatching) {
+                        return;
+                }
+                fc.dispatching = true;
+        }
+
+        while (true) {
+                WDFREQUEST request{};
+                LONG64 delay{};
+                {
+                        wdf::Lock lck(fc.lock);
+
+                        if (!(has_credits(fc) && NT_SUCCESS(WdfIoQueueRetrieveNextRequest(fc.held, &request)))) {
+                                fc.dispatching = false;
+                                break;
+                        }
+
+                        auto now = KeQueryInterruptTime();
+                        auto &req = *get_request_ctx(request);
+
+                        delay = now - req.stamp;
+                        fc.delay += delay;
+                        fc.max_delay = max(fc.max_delay, delay);
+
+                        take(fc, req, get_urb(request).UrbBulkOrInterruptTransfer.TransferBufferLength, now);
+                }
+
+                TraceUrb("req %04x, waited for credits %lu us", ptr04x(request), to_usec(delay));
+
+                auto st = dev.unplugged ? STATUS_DEVICE_NOT_CONNECTED : device::send_bulk_transfer(dev, endpoint, request);
+                if (st == STATUS_PENDING) {
+                        continue;
+                }
+
+                {
+                        wdf::Lock lck(fc.lock);
+                        give(fc, *get_request_ctx(request), KeQueryInterruptTime());
+                }
+
+                if (dev.unplugged) {
+                        UdecxUrbComplete(request, USBD_STATUS_DEVICE_GONE);
+                } else {
+                        UdecxUrbCompleteWithNtStatus(request, st);
+                }
+        }
+}
+
+_Function_class_(EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI held_canceled(_In_ WDFQUEUE queue, _In_ WDFREQUEST request)
+{
+        TraceUrb("queue %04x, req %04x", ptr04x(queue), ptr04x(request));
+        complete(request, STATUS_CANCELLED);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_held_queue(_Out_ WDFQUEUE &queue, _In_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint)
+{
+        PAGED_CODE();
+
+        WDF_IO_QUEUE_CONFIG cfg;
+        WDF_IO_QUEUE_CONFIG_INIT(&cfg, WdfIoQueueDispatchManual);
+        cfg.PowerManaged = WdfFalse;
+        cfg.EvtIoCanceledOnQueue = held_canceled;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = endpoint;
+
+        if (auto err = WdfIoQueueCreate(dev.vhci, &cfg, &attr, &queue)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoQueueCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_flow_control_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.bulk_in_flow_control = false;
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, bulk_in_flow_control_value_name);
+
+        ULONG value = 0;
+
+        if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                return;
+        }
+
+        vhci.bulk_in_flow_control = value;
+
+        if (vhci.bulk_in_flow_control) {
+                Trace(TRACE_LEVEL_INFORMATION, "bulk IN flow control is enabled");
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_flow_control(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint)
+{
+        PAGED_CODE();
+
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+        auto &endp = *get_endpoint_ctx(endpoint);
+        auto &epd = endp.descriptor;
+
+        if (!(vhci.bulk_in_flow_control && usb_endpoint_type(epd) == UsbdPipeTypeBulk && usb_endpoint_dir_in(epd))) {
+                return STATUS_SUCCESS;
+        }
+
+        auto &fc = endp.flow;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = endpoint;
+
+        if (auto err = WdfSpinLockCreate(&attr, &fc.lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (auto err = create_held_queue(fc.held, dev, endpoint)) {
+                return err;
+        }
+
+        fc.limits.init(KeQueryInterruptTime());
+
+        TraceDbg("dev %04x, endp %04x, bEndpointAddress %#x",
+                  ptr04x(get_handle(&dev)), ptr04x(endpoint), epd.bEndpointAddress);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::flow_control_hold(
+        _Out_ NTSTATUS &status, _In_ UDECXUSBENDPOINT endpoint, _In_ WDFREQUEST request, _In_ ULONG length)
+{
+        status = STATUS_SUCCESS;
+
+        auto &fc = get_flow_control(endpoint);
+        if (!fc.held) {
+                return false;
+        }
+
+        auto &req = *get_request_ctx(request);
+        req.endpoint = endpoint; // for complete() if URB will wait in the queue
+
+        wdf::Lock lck(fc.lock);
+        auto now = KeQueryInterruptTime();
+
+        if (!fc.dispatching && !waiting_cnt(fc) && has_credits(fc)) {
+                take(fc, req, length, now);
+                return false;
+        }
+
+        if (auto err = WdfRequestForwardToIoQueue(request, fc.held)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRequestForwardToIoQueue %!STATUS!", err);
+                status = err;
+        } else {
+                req.stamp = now;
+                ++fc.delayed;
+                status = STATUS_PENDING;
+        }
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::flow_control_completed(_In_ WDFREQUEST request, _In_opt_ const URB *urb)
+{
+        auto &req = *get_request_ctx(request);
+        if (!req.credits) {
+                return;
+        }
+
+        auto endpoint = req.endpoint;
+        auto &endp = *get_endpoint_ctx(endpoint);
+        auto &fc = endp.flow;
+        {
+                wdf::Lock lck(fc.lock);
+                auto now = KeQueryInterruptTime();
+
+                give(fc, req, now);
+
+                if (urb) {
+                        sample(fc, now - req.stamp, urb->UrbBulkOrInterruptTransfer.TransferBufferLength, now);
+                }
+        }
+
+        send_waiting(*get_device_ctx(endp.device), endpoint, fc);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::flow_control_stop(_In_ UDECXUSBENDPOINT endpoint)
+{
+        auto &fc = get_flow_control(endpoint);
+        if (!fc.held) {
+                return;
+        }
+
+        {
+                wdf::Lock lck(fc.lock);
+                if (fc.sent) {
+                        trace_stats(endpoint, fc);
+                }
+        }
+
+        for (WDFREQUEST request; NT_SUCCESS(WdfIoQueueRetrieveNextRequest(fc.held, &request)); ) {
+                complete(request, STATUS_CANCELLED);
+        }
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "credit_limits.h"
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+
+/*
+ * Opt-in credits for bulk IN endpoint, see vhci_ctx::bulk_in_flow_control.
+ *
+ * Class drivers like USB mass storage and RNDIS queue dozens of large bulk IN URBs.
+ * If each of them becomes CMD_SUBMIT immediately, the queue of the server and socket buffers fill up
+ * and responses for other endpoints of the same connection wait behind megabytes of data.
+ *
+ * An URB is sent to the server if there are outstanding-URB and outstanding-byte credits,
+ * otherwise it waits in the queue and is sent after completion of a previous one.
+ * The limits are set by credit_limits.
+ *
+ * Protected by lock.
+ */
+struct flow_control
+{
+        WDFSPINLOCK lock;
+        WDFQUEUE held; // manual, URBs that are waiting for credits; WDF_NO_HANDLE if disabled for endpoint
+
+        ULONG urbs; // outstanding
+        ULONG bytes;
+        bool dispatching; // waiting URBs are being sent, preserves their order
+
+        credit_limits limits;
+
+        // statistics
+        UINT64 sent; // URBs
+        UINT64 delayed; // URBs that were waiting for credits
+        UINT64 delay; // SUM(time in the queue), 100ns units
+        LONG64 max_delay;
+        UINT64 delivered; // bytes
+        LONG64 busy; // time when there were outstanding URBs, 100ns units
+        LONG64 busy_since;
+};
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_flow_control_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * Does nothing if flow control is disabled or endpoint is not bulk IN.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_flow_control(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint);
+
+/*
+ * Is called for URB before it will be sent to the server.
+ * @return true if URB is waiting for credits or can't be queued (see status)
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool flow_control_hold(
+        _Out_ NTSTATUS &status, _In_ UDECXUSBENDPOINT endpoint, _In_ WDFREQUEST request, _In_ ULONG length);
+
+/*
+ * Return credits of URB that is about to be completed, send waiting URBs.
+ * Does nothing if URB did not take credits.
+ * @param urb is nullptr if it was not completed by the server, RTT and delivery rate are not updated
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void flow_control_completed(_In_ WDFREQUEST request, _In_opt_ const URB *urb);
+
+/*
+ * Cancel URBs that are waiting for credits.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void flow_control_stop(_In_ UDECXUSBENDPOINT endpoint);
+
+} // namespace usbip
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "frame_clock.h"
+#include "trace.h"
+#include "frame_clock.tmh"
+
+#include "context.h"
+
+#include <libdrv\wait_timeout.h>
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::get_current_frame()
+{
+        return static_cast<ULONG>(KeQueryInterruptTime()/wdm::msec);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::update_frame_clock(_Inout_ device_ctx &dev, _In_ LONG start_frame)
+{
+        auto now = get_current_frame();
+        auto &c = dev.clock;
+
+        wdf::Lock lck(dev.frame_lock);
+
+        if (frame_sync::calibrate(c, start_frame, now)) {
+                TraceDbg("shift %d", c.shift);
+        }
+
+        if (c.calibrated && frame_sync::synchronize(c, start_frame, now)) {
+                TraceDbg("offset %d", c.offset);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::to_server_frame(_Out_ LONG &server_frame, _In_ device_ctx &dev, _In_ ULONG StartFrame)
+{
+        auto &c = dev.clock;
+        wdf::Lock lck(dev.frame_lock);
+
+        if (!c.synchronized) {
+                server_frame = 0;
+                return false;
+        }
+
+        server_frame = frame_sync::to_server(c, StartFrame);
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::to_local_frame(_In_ device_ctx &dev, _In_ LONG server_frame)
+{
+        auto &c = dev.clock;
+        wdf::Lock lck(dev.frame_lock);
+
+        return c.synchronized ? frame_sync::to_local(c, server_frame) : server_frame;
+}
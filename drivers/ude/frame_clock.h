@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "frame_sync.h"
+#include <wdm.h>
+
+namespace usbip
+{
+
+struct device_ctx;
+
+/*
+ * @return local monotonic frame number, URB_FUNCTION_GET_CURRENT_FRAME_NUMBER
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG get_current_frame();
+
+/*
+ * @param start_frame from RET_SUBMIT of isochronous transfer
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void update_frame_clock(_Inout_ device_ctx &dev, _In_ LONG start_frame);
+
+/*
+ * @return false if the clock is not synchronized yet, USBD_START_ISO_TRANSFER_ASAP must be used
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool to_server_frame(_Out_ LONG &server_frame, _In_ device_ctx &dev, _In_ ULONG StartFrame);
+
+/*
+ * @return server_frame as is if the clock is not synchronized yet
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG to_local_frame(_In_ device_ctx &dev, _In_ LONG server_frame);
+
+} // namespace usbip
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Translation between local and server's frame numbers, see frame_clock.h.
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+
+namespace usbip
+{
+
+/*
+ * Virtual USB frame clock of the server's host controller.
+ *
+ * Frame numbers that are reported to Windows are local, one per millisecond of the interrupt time.
+ * Server's frame numbers are learned from RET_SUBMIT.start_frame of isochronous transfers.
+ * Linux HCDs count frames (xHCI, full-speed EHCI) or microframes (high-speed EHCI),
+ * the unit is detected by the rate of change of start_frame.
+ *
+ * RET_SUBMIT arrives later than the transfer was started, the smallest observed delay
+ * is the best estimation of the clocks offset.
+ *
+ * Protected by device_ctx::frame_lock.
+ */
+struct frame_clock
+{
+        int offset; // server_frame - (local_frame << shift)
+        unsigned int offset_time; // local frame when offset was adjusted last time
+
+        int rate_frame; // server's frame at the beginning of the rate measurement
+        unsigned int rate_time; // local frame at the beginning of the rate measurement
+
+        unsigned char shift; // log2(server's frames per millisecond), 0 or 3
+        bool calibrated; // shift is known
+        bool synchronized; // offset is known
+};
+
+namespace frame_sync
+{
+
+enum : unsigned int {
+        RATE_PERIOD = 100, // milliseconds, to measure server's frames per millisecond
+        DRIFT_PERIOD = 1000, // milliseconds, offset can be decreased by one server's frame per period
+};
+
+enum : int { RESYNC_FRAMES = 64 }; // server's counter was wrapped around or unit was changed
+
+constexpr unsigned char MICROFRAMES_SHIFT = 3; // 8 microframes per millisecond
+
+/*
+ * Server's frame counter increments 1 (frames) or 8 (microframes) times per millisecond.
+ * The threshold is in the middle, the measurement is rough due to network jitter.
+ *
+ * @param now local frame
+ * @return true if the unit was detected or has changed
+ */
+inline bool calibrate(frame_clock &c, int start_frame, unsigned int now)
+{
+        if (!c.rate_time) {
+                c.rate_frame = start_frame;
+                c.rate_time = now;
+                return false;
+        }
+
+        auto elapsed = int(now - c.rate_time);
+        if (elapsed < int(RATE_PERIOD)) {
+                return false;
+        }
+
+        auto frames = int(unsigned(start_frame) - unsigned(c.rate_frame));
+
+        c.rate_frame = start_frame;
+        c.rate_time = now;
+
+        if (frames <= 0 || frames > (elapsed << MICROFRAMES_SHIFT)*2) { // wrapped around
+                return false;
+        }
+
+        unsigned char shift = frames/elapsed >= 4 ? MICROFRAMES_SHIFT : 0;
+
+        if (c.calibrated && c.shift == shift) {
+                return false;
+        }
+
+        c.shift = shift;
+        c.calibrated = true;
+        c.synchronized = false;
+
+        return true;
+}
+
+/*
+ * @param now local frame
+ * @return true if the offset was reset
+ */
+inline bool synchronize(frame_clock &c, int start_frame, unsigned int now)
+{
+        auto offset = int(unsigned(start_frame) - (now << c.shift));
+        auto diff = offset - c.offset;
+
+        if (!c.synchronized || diff > (RESYNC_FRAMES << c.shift) || -diff > (RESYNC_FRAMES << c.shift)) {
+                c.offset = offset;
+                c.offset_time = now;
+                c.synchronized = true;
+                return true;
+        }
+
+        if (offset > c.offset) { // smaller network delay
+                c.offset = offset;
+                c.offset_time = now;
+        } else if (offset < c.offset && now - c.offset_time >= DRIFT_PERIOD) { // server's clock is slower
+                --c.offset;
+                c.offset_time = now;
+        }
+
+        return false;
+}
+
+/*
+ * The clock must be synchronized. HCD uses the result modulo its schedule size.
+ */
+inline auto to_server(const frame_clock &c, unsigned int local_frame)
+{
+        return int(unsigned(c.offset) + (local_frame << c.shift));
+}
+
+/*
+ * The clock must be synchronized.
+ * Signed delta relative to the recent local frame is used because (server_frame - offset) >> shift
+ * loses the high bits if the counter wraps around.
+ */
+inline auto to_local(const frame_clock &c, int server_frame)
+{
+        auto base = c.offset_time;
+        auto delta = int(unsigned(server_frame) - (unsigned(c.offset) + (base << c.shift)));
+
+        return base + (delta >> c.shift);
+}
+
+} // namespace frame_sync
+
+} // namespace usbip
@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "jitter_buffer.h"
+#include "trace.h"
+#include "jitter_buffer.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "persistent.h"
+#include "device_ioctl.h"
+#include "wsk_receive.h"
+#include "ioctl.h"
+
+#include <usbip\consts.h>
+
+#include <libdrv\ch9.h>
+#include <libdrv\wait_timeout.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG {
+        MAX_DEPTH = jitter_control::MAX_DEPTH,
+        DEFAULT_UNDERRUN_RATE = 10, // per mille
+};
+
+constexpr auto get_urb_size(_In_ ULONG NumberOfPackets)
+{
+        return ULONG(offsetof(_URB_ISOCH_TRANSFER, IsoPacket) + NumberOfPackets*sizeof(USBD_ISO_PACKET_DESCRIPTOR));
+}
+
+constexpr auto to_usec(_In_ LONG64 interrupt_time)
+{
+        return ULONG(interrupt_time/wdm::usec);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void trace_stats(_In_ const jitter_buffer &jb)
+{
+        auto latency = jb.delivered ? jb.latency/jb.delivered : 0;
+
+        Trace(TRACE_LEVEL_INFORMATION, "jb %04x, depth %lu(min %lu), delivered %!UINT64!, underruns %!UINT64!, "
+                "added latency %lu us, interval %lu us, jitter %lu us",
+                ptr04x(&jb), jb.ctl.depth, jb.ctl.min_depth, jb.delivered, jb.ctl.underruns,
+                to_usec(latency), to_usec(jb.ctl.interval), to_usec(jb.ctl.deviation));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_slot(_Inout_ jitter_buffer &jb, _In_ jitter_slot *slot)
+{
+        NT_ASSERT(jb.slots);
+        --jb.slots;
+        ExFreePoolWithTag(slot, pooltag);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void free_slots(_Inout_ jitter_buffer &jb, _Inout_ LIST_ENTRY &head)
+{
+        while (!IsListEmpty(&head)) {
+                auto entry = RemoveHeadList(&head);
+                free_slot(jb, CONTAINING_RECORD(entry, jitter_slot, entry));
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto alloc_slot(_Inout_ jitter_buffer &jb)
+{
+        auto &shape = *jb.shape;
+        auto urb_size = get_urb_size(shape.NumberOfPackets);
+
+        unique_ptr ptr(NonPagedPoolNx, sizeof(jitter_slot) + urb_size + shape.TransferBufferLength);
+        auto slot = ptr.get<jitter_slot>();
+
+        if (!slot) {
+                Trace(TRACE_LEVEL_ERROR, "jb %04x, can't allocate slot", ptr04x(&jb));
+                return slot;
+        }
+
+        slot->owner = &jb;
+        slot->urb = reinterpret_cast<_URB_ISOCH_TRANSFER*>(slot + 1);
+        slot->buffer = reinterpret_cast<UCHAR*>(slot->urb) + urb_size;
+
+        RtlCopyMemory(slot->urb, &shape, urb_size);
+        slot->urb->TransferBuffer = slot->buffer;
+
+        ++jb.slots;
+        ptr.release();
+        return slot;
+}
+
+/*
+ * Slot is returned to the free list.
+ * It is released if the depth was decreased or the stream was stopped, the shape of the next stream can differ.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void release_slot(_Inout_ jitter_buffer &jb, _In_ jitter_slot *slot)
+{
+        if (jb.slots > jb.ctl.depth || slot->generation != jb.generation) {
+                free_slot(jb, slot);
+        } else {
+                InsertTailList(&jb.free, &slot->entry);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto count(_In_ const LIST_ENTRY &head)
+{
+        ULONG cnt = 0;
+        for (auto entry = head.Flink; entry != &head; entry = entry->Flink, ++cnt);
+        return cnt;
+}
+
+/*
+ * Moves slots that must be sent to the server to the list.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void refill(_Inout_ jitter_buffer &jb, _Inout_ LIST_ENTRY &to_send)
+{
+        if (!jb.shape) {
+                return;
+        }
+
+        for (auto cnt = count(jb.pending) + count(jb.ready) + count(to_send); cnt < jb.ctl.depth; ++cnt) {
+
+                jitter_slot *slot{};
+
+                if (!IsListEmpty(&jb.free)) {
+                        auto entry = RemoveHeadList(&jb.free);
+                        slot = CONTAINING_RECORD(entry, jitter_slot, entry);
+                } else if (!(slot = alloc_slot(jb))) {
+                        break;
+                }
+
+                slot->generation = jb.generation;
+                InsertTailList(&to_send, &slot->entry);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void send(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint, _Inout_ LIST_ENTRY &to_send)
+{
+        while (!IsListEmpty(&to_send)) {
+                auto entry = RemoveHeadList(&to_send);
+                auto &slot = *CONTAINING_RECORD(entry, jitter_slot, entry);
+
+                if (auto err = device::send_isoch_prefetch(dev, endpoint, slot)) {
+                        Trace(TRACE_LEVEL_ERROR, "jb %04x, send_isoch_prefetch %!STATUS!", ptr04x(slot.owner), err);
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto has_same_shape(_In_ const _URB_ISOCH_TRANSFER &shape, _In_ const _URB_ISOCH_TRANSFER &r)
+{
+        if (!(r.TransferBufferLength == shape.TransferBufferLength && r.NumberOfPackets == shape.NumberOfPackets)) {
+                return false;
+        }
+
+        for (ULONG i = 0; i < r.NumberOfPackets; ++i) {
+                if (r.IsoPacket[i].Offset != shape.IsoPacket[i].Offset) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto start(_Inout_ jitter_buffer &jb, _In_ UDECXUSBENDPOINT endpoint, _In_ const _URB_ISOCH_TRANSFER &r)
+{
+        NT_ASSERT(!jb.shape);
+        auto urb_size = get_urb_size(r.NumberOfPackets);
+
+        unique_ptr ptr(NonPagedPoolNx, urb_size);
+        auto shape = ptr.get<_URB_ISOCH_TRANSFER>();
+
+        if (!shape) {
+                Trace(TRACE_LEVEL_ERROR, "jb %04x, can't allocate %lu bytes", ptr04x(&jb), urb_size);
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        shape->Hdr.Length = USHORT(urb_size);
+        shape->Hdr.Function = URB_FUNCTION_ISOCH_TRANSFER;
+        shape->PipeHandle = r.PipeHandle;
+        shape->TransferFlags = USBD_TRANSFER_DIRECTION_IN | USBD_START_ISO_TRANSFER_ASAP;
+        shape->TransferBufferLength = r.TransferBufferLength;
+        shape->NumberOfPackets = r.NumberOfPackets;
+
+        for (ULONG i = 0; i < r.NumberOfPackets; ++i) {
+                shape->IsoPacket[i].Offset = r.IsoPacket[i].Offset;
+        }
+
+        jb.shape = static_cast<_URB_ISOCH_TRANSFER*>(ptr.release());
+        jb.endpoint = endpoint;
+        jb.ctl.last_arrival = 0;
+
+        TraceDbg("jb %04x, endp %04x, TransferBufferLength %lu, NumberOfPackets %lu, depth %lu",
+                  ptr04x(&jb), ptr04x(endpoint), r.TransferBufferLength, r.NumberOfPackets, jb.ctl.depth);
+
+        return STATUS_SUCCESS;
+}
+
+/*
+ * The buffer has the same offsets, but Length of each packet can differ.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto deliver(_In_ const jitter_slot &slot, _In_ WDFREQUEST request)
+{
+        auto &src = *slot.urb;
+        auto &dst = get_urb(request).UrbIsochronousTransfer;
+
+        UCHAR *buffer{};
+        ULONG length{};
+
+        if (auto err = UdecxUrbRetrieveBuffer(request, &buffer, &length)) {
+                Trace(TRACE_LEVEL_ERROR, "UdecxUrbRetrieveBuffer %!STATUS!", err);
+                return err;
+        }
+
+        NT_ASSERT(length >= src.TransferBufferLength);
+        NT_ASSERT(dst.NumberOfPackets == src.NumberOfPackets);
+
+        for (ULONG i = 0; i < src.NumberOfPackets; ++i) {
+                auto &s = src.IsoPacket[i];
+                auto &d = dst.IsoPacket[i];
+
+                RtlCopyMemory(buffer + s.Offset, slot.buffer + s.Offset, s.Length);
+                d.Length = s.Length;
+                d.Status = s.Status;
+        }
+
+        dst.Hdr.Status = src.Hdr.Status;
+        dst.ErrorCount = src.ErrorCount;
+
+        if (dst.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
+                dst.StartFrame = src.StartFrame;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+/*
+ * @return slot that was delivered or nullptr
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto pop_ready(_Inout_ jitter_buffer &jb)
+{
+        jitter_slot *slot{};
+
+        if (!IsListEmpty(&jb.ready)) {
+                auto entry = RemoveHeadList(&jb.ready);
+                slot = CONTAINING_RECORD(entry, jitter_slot, entry);
+                jb.latency += KeQueryInterruptTime() - slot->received;
+                ++jb.delivered;
+        }
+
+        return slot;
+}
+
+/*
+ * Slot was delivered, it will be sent again unless the stream was stopped.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void delivered(_Inout_ device_ctx &dev, _Inout_ jitter_slot &slot)
+{
+        auto &jb = *slot.owner;
+
+        LIST_ENTRY to_send;
+        InitializeListHead(&to_send);
+
+        UDECXUSBENDPOINT endpoint{};
+        {
+                wdf::Lock lck(jb.lock);
+                release_slot(jb, &slot);
+                refill(jb, to_send);
+                endpoint = jb.endpoint;
+        }
+
+        send(dev, endpoint, to_send);
+}
+
+_Function_class_(EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE)
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void NTAPI waiting_canceled(_In_ WDFQUEUE queue, _In_ WDFREQUEST request)
+{
+        TraceUrb("queue %04x, req %04x", ptr04x(queue), ptr04x(request));
+        complete(request, STATUS_CANCELLED);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_waiting_queue(_Out_ WDFQUEUE &queue, _In_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        WDF_IO_QUEUE_CONFIG cfg;
+        WDF_IO_QUEUE_CONFIG_INIT(&cfg, WdfIoQueueDispatchManual);
+        cfg.PowerManaged = WdfFalse;
+        cfg.EvtIoCanceledOnQueue = waiting_canceled;
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = get_handle(&dev);
+
+        if (auto err = WdfIoQueueCreate(dev.vhci, &cfg, &attr, &queue)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfIoQueueCreate %!STATUS!", err);
+                return err;
+        }
+
+        return STATUS_SUCCESS;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_jitter_buffer_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.jitter_depth = 0; // disabled
+        vhci.jitter_underrun_rate = DEFAULT_UNDERRUN_RATE;
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        const struct {
+                const wchar_t *name;
+                ULONG &value;
+        } params[] {
+                { jitter_buffer_depth_value_name, vhci.jitter_depth },
+                { jitter_buffer_underrun_rate_value_name, vhci.jitter_underrun_rate },
+        };
+
+        for (auto &[name, value]: params) {
+                UNICODE_STRING value_name;
+                RtlUnicodeStringInit(&value_name, name);
+
+                if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value);
+                    err && err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+        }
+
+        vhci.jitter_depth = min(vhci.jitter_depth, MAX_DEPTH);
+        vhci.jitter_underrun_rate = max(min(vhci.jitter_underrun_rate, 1000UL), 1UL);
+
+        if (vhci.jitter_depth) {
+                Trace(TRACE_LEVEL_INFORMATION, "depth %lu, target underrun rate %lu per mille",
+                                                vhci.jitter_depth, vhci.jitter_underrun_rate);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS usbip::create_jitter_buffer(_Inout_ device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd)
+{
+        PAGED_CODE();
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+
+        if (!(vhci.jitter_depth && usb_endpoint_type(epd) == UsbdPipeTypeIsochronous && usb_endpoint_dir_in(epd))) {
+                return STATUS_SUCCESS;
+        }
+
+        auto &ptr = dev.jitter[usb_endpoint_num(epd)];
+        if (ptr) {
+                return STATUS_SUCCESS;
+        }
+
+        unique_ptr buf(NonPagedPoolNx, sizeof(*ptr));
+        auto jb = buf.get<jitter_buffer>();
+
+        if (!jb) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate jitter_buffer");
+                return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = get_handle(&dev);
+
+        if (auto err = WdfSpinLockCreate(&attr, &jb->lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (auto err = create_waiting_queue(jb->waiting, dev)) {
+                return err;
+        }
+
+        InitializeListHead(&jb->free);
+        InitializeListHead(&jb->pending);
+        InitializeListHead(&jb->ready);
+
+        jb->ctl.depth = vhci.jitter_depth;
+        jb->ctl.min_depth = 1;
+        jb->ctl.underrun_rate = vhci.jitter_underrun_rate;
+
+        TraceDbg("dev %04x, bEndpointAddress %#x, jb %04x", ptr04x(get_handle(&dev)), epd.bEndpointAddress, ptr04x(jb));
+
+        ptr = static_cast<jitter_buffer*>(buf.release());
+        return STATUS_SUCCESS;
+}
+
+/*
+ * Receive thread was joined, all slots are in the lists.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::free_jitter_buffers(_Inout_ device_ctx &dev)
+{
+        PAGED_CODE();
+
+        for (auto &jb: dev.jitter) {
+                if (!jb) {
+                        continue;
+                }
+
+                trace_stats(*jb);
+
+                for (auto head: {&jb->free, &jb->pending, &jb->ready}) {
+                        free_slots(*jb, *head);
+                }
+                NT_ASSERT(!jb->slots);
+
+                if (auto shape = jb->shape) {
+                        ExFreePoolWithTag(shape, pooltag);
+                }
+
+                ExFreePoolWithTag(jb, pooltag);
+                jb = nullptr;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::jitter_buffer_submit(
+        _Out_ NTSTATUS &status, _Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint,
+        _In_ WDFREQUEST request, _In_ const _URB_ISOCH_TRANSFER &r)
+{
+        status = STATUS_SUCCESS;
+
+        auto &d = get_endpoint_ctx(endpoint)->descriptor;
+        if (!usb_endpoint_dir_in(d)) {
+                return false;
+        }
+
+        auto jb = dev.jitter[usb_endpoint_num(d)];
+        if (!jb) {
+                return false;
+        }
+
+        get_request_ctx(request)->endpoint = endpoint; // for complete() if URB will wait in the queue
+
+        LIST_ENTRY to_send;
+        InitializeListHead(&to_send);
+
+        jitter_slot *slot{};
+        bool handled = true;
+        {
+                wdf::Lock lck(jb->lock);
+
+                if (!jb->shape) {
+                        handled = false; // the first URB of the stream is sent as usual
+                        if (NT_SUCCESS(start(*jb, endpoint, r))) {
+                                refill(*jb, to_send);
+                        }
+                } else if (!(jb->endpoint == endpoint && has_same_shape(*jb->shape, r))) {
+                        handled = false;
+                } else if ((slot = pop_ready(*jb))) {
+                        if (jb->ctl.adapt(false)) {
+                                trace_stats(*jb);
+                        }
+                } else if (auto err = WdfRequestForwardToIoQueue(request, jb->waiting)) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRequestForwardToIoQueue %!STATUS!", err);
+                        status = err;
+                } else {
+                        status = STATUS_PENDING; // underrun, wait for the next slot
+                        if (jb->ctl.adapt(jb->delivered != 0)) { // do not count URBs that were waiting for the first data
+                                trace_stats(*jb);
+                        }
+                        refill(*jb, to_send);
+                }
+        }
+
+        if (slot) {
+                status = deliver(*slot, request);
+                delivered(dev, *slot);
+        } else {
+                send(dev, endpoint, to_send);
+        }
+
+        return handled;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::jitter_buffer_stop(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint)
+{
+        auto &d = get_endpoint_ctx(endpoint)->descriptor;
+        auto jb = dev.jitter[usb_endpoint_num(d)];
+
+        if (!(jb && usb_endpoint_dir_in(d))) {
+                return;
+        }
+
+        seqnum_t unlink[MAX_DEPTH];
+        ULONG unlink_cnt = 0;
+        {
+                wdf::Lock lck(jb->lock);
+
+                if (jb->endpoint != endpoint) {
+                        return;
+                }
+
+                trace_stats(*jb);
+
+                jb->endpoint = WDF_NO_HANDLE;
+                ++jb->generation;
+
+                if (auto &shape = jb->shape) {
+                        ExFreePoolWithTag(shape, pooltag);
+                        shape = nullptr;
+                }
+
+                while (!IsListEmpty(&jb->pending)) {
+                        auto entry = RemoveHeadList(&jb->pending);
+                        auto slot = CONTAINING_RECORD(entry, jitter_slot, entry);
+
+                        if (unlink_cnt < ARRAYSIZE(unlink)) {
+                                unlink[unlink_cnt++] = slot->seqnum;
+                        }
+                        release_slot(*jb, slot);
+                }
+
+                while (!IsListEmpty(&jb->ready)) {
+                        auto entry = RemoveHeadList(&jb->ready);
+                        release_slot(*jb, CONTAINING_RECORD(entry, jitter_slot, entry));
+                }
+
+                free_slots(*jb, jb->free);
+        }
+
+        for (ULONG i = 0; i < unlink_cnt; ++i) {
+                device::send_cmd_unlink(dev, unlink[i]);
+        }
+
+        for (WDFREQUEST request; NT_SUCCESS(WdfIoQueueRetrieveNextRequest(jb->waiting, &request)); ) {
+                complete(request, STATUS_CANCELLED);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::jitter_slot_pending(_Inout_ jitter_slot &slot)
+{
+        auto &jb = *slot.owner;
+        wdf::Lock lck(jb.lock);
+
+        if (slot.generation == jb.generation) {
+                InsertTailList(&jb.pending, &slot.entry);
+                return true;
+        }
+
+        free_slot(jb, &slot);
+        return false;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::jitter_slot_release(_Inout_ jitter_slot &slot)
+{
+        auto &jb = *slot.owner;
+        wdf::Lock lck(jb.lock);
+        free_slot(jb, &slot);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+jitter_slot *usbip::jitter_slot_take(_In_ device_ctx &dev, _In_ const usbip_header &hdr)
+{
+        if (!(hdr.base.command == USBIP_RET_SUBMIT && hdr.base.direction == USBIP_DIR_IN)) {
+                return nullptr;
+        }
+
+        for (auto jb: dev.jitter) { // RET_SUBMIT has zero ep
+                if (!jb) {
+                        continue;
+                }
+
+                wdf::Lock lck(jb->lock);
+
+                for (auto entry = jb->pending.Flink; entry != &jb->pending; entry = entry->Flink) {
+                        auto slot = CONTAINING_RECORD(entry, jitter_slot, entry);
+                        if (slot->seqnum == hdr.base.seqnum) {
+                                RemoveEntryList(entry);
+                                return slot;
+                        }
+                }
+        }
+
+        return nullptr;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::jitter_slot_received(_Inout_ device_ctx &dev, _Inout_ jitter_slot &slot, _In_ NTSTATUS status)
+{
+        auto &jb = *slot.owner;
+        jitter_slot *deliver_slot{};
+        WDFREQUEST request{};
+
+        LIST_ENTRY to_send;
+        InitializeListHead(&to_send);
+
+        UDECXUSBENDPOINT endpoint{};
+        {
+                wdf::Lock lck(jb.lock);
+
+                if (status || slot.generation != jb.generation) {
+                        release_slot(jb, &slot);
+                        refill(jb, to_send);
+                } else {
+                        slot.received = KeQueryInterruptTime();
+                        if (jb.ctl.arrived(slot.received)) {
+                                trace_stats(jb);
+                        }
+                        InsertTailList(&jb.ready, &slot.entry);
+
+                        if (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(jb.waiting, &request))) {
+                                deliver_slot = pop_ready(jb);
+                                NT_ASSERT(deliver_slot);
+                        }
+                }
+
+                endpoint = jb.endpoint;
+        }
+
+        if (deliver_slot) {
+                auto st = deliver(*deliver_slot, request);
+                complete(request, st);
+                delivered(dev, *deliver_slot);
+        } else {
+                send(dev, endpoint, to_send);
+        }
+}
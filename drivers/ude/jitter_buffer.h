@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "jitter_control.h"
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usbip\proto.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+struct jitter_buffer;
+
+/*
+ * Isochronous IN transfer that was sent to the server by the driver itself.
+ * Its shape (TransferBufferLength, NumberOfPackets, IsoPacket[].Offset) is copied from the first URB of the stream.
+ * Received data are stored in the same way as in URB's transfer buffer (not compacted).
+ */
+struct jitter_slot
+{
+        LIST_ENTRY entry; // jitter_buffer::free, pending or ready
+        jitter_buffer *owner;
+        ULONG generation; // jitter_buffer::generation when it was sent
+
+        seqnum_t seqnum;
+        LONG64 received; // interrupt time
+
+        _URB_ISOCH_TRANSFER *urb; // placed after this struct
+        UCHAR *buffer; // [urb->TransferBufferLength], placed after urb
+};
+
+/*
+ * Opt-in jitter buffer for isochronous IN endpoint, see vhci_ctx::jitter_depth.
+ *
+ * Audio class drivers keep a few URBs in flight only, they complete at the network's jitter.
+ * The driver keeps "depth" own transfers submitted to the server and completes URBs
+ * with data that have already arrived. If there is no data yet (underrun), URB waits for the next slot.
+ * The depth is adapted by jitter_control.
+ *
+ * Protected by lock.
+ */
+struct jitter_buffer
+{
+        WDFSPINLOCK lock;
+        WDFQUEUE waiting; // manual, URBs that are waiting for the data
+
+        UDECXUSBENDPOINT endpoint; // WDF_NO_HANDLE if the stream is not started
+        ULONG generation; // is incremented every time the stream stops
+        _URB_ISOCH_TRANSFER *shape; // of the first URB, nullptr if the stream is not started
+
+        LIST_ENTRY free; // jitter_slot
+        LIST_ENTRY pending; // were sent to the server
+        LIST_ENTRY ready; // were received, waiting for URB
+
+        ULONG slots; // total number of allocated slots
+        jitter_control ctl; // depth
+
+        // statistics
+        UINT64 delivered; // URBs were completed with prefetched data
+        UINT64 latency; // SUM(time slot was waiting for URB), 100ns units
+};
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_jitter_buffer_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * Does nothing if jitter buffer is disabled or endpoint is not isochronous IN.
+ * Jitter buffer can be already created for the same endpoint number if alternate setting was changed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS create_jitter_buffer(_Inout_ device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd);
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void free_jitter_buffers(_Inout_ device_ctx &dev);
+
+/*
+ * @return false if URB must be sent to the server as usual
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool jitter_buffer_submit(
+        _Out_ NTSTATUS &status, _Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint,
+        _In_ WDFREQUEST request, _In_ const _URB_ISOCH_TRANSFER &r);
+
+/*
+ * Discard prefetched data, cancel waiting URBs, unlink pending slots.
+ * The stream will be started again by the next URB.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void jitter_buffer_stop(_Inout_ device_ctx &dev, _In_ UDECXUSBENDPOINT endpoint);
+
+/*
+ * Is called by device::send_isoch_prefetch before a slot will be sent.
+ * @return false if the stream was stopped, the slot is released
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool jitter_slot_pending(_Inout_ jitter_slot &slot);
+
+/*
+ * Is called by device::send_isoch_prefetch if the slot can't be sent.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void jitter_slot_release(_Inout_ jitter_slot &slot);
+
+/*
+ * @return slot which is waiting for this RET_SUBMIT or nullptr
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+jitter_slot *jitter_slot_take(_In_ device_ctx &dev, _In_ const usbip_header &hdr);
+
+/*
+ * @param status of RET_SUBMIT receiving
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void jitter_slot_received(_Inout_ device_ctx &dev, _Inout_ jitter_slot &slot, _In_ NTSTATUS status);
+
+} // namespace usbip
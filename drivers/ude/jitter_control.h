@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Adapts the depth of a jitter buffer, see jitter_buffer.
+ * Does not depend on Windows headers, see userspace/tests. It is not thread-safe.
+ *
+ * The depth is adapted to hold the target underrun rate. It can't be less than the value
+ * that is estimated from interarrival time variance of RET_SUBMIT.
+ */
+
+namespace usbip
+{
+
+struct jitter_control
+{
+        enum : unsigned int {
+                MAX_DEPTH = 32, // slots
+                WINDOW = 1024, // URBs, underrun rate is measured over it
+        };
+
+        unsigned int depth; // target number of slots
+        unsigned int min_depth; // is derived from interarrival variance
+        unsigned int underrun_rate; // target, per mille
+
+        // interarrival time of RET_SUBMIT, smoothed as TCP RTT, 100ns units
+        long long last_arrival;
+        long long interval;
+        long long deviation;
+
+        unsigned long long underruns; // URBs had to wait for the data
+
+        unsigned int window; // URBs in the current window
+        unsigned int window_underruns;
+
+        /*
+         * Interarrival time is smoothed in the same way as RTT in TCP, see RFC 6298.
+         * The depth must cover the interval plus four mean deviations.
+         *
+         * @param now time of arrival, 100ns units
+         * @return true if the depth was increased
+         */
+        bool arrived(long long now)
+        {
+                auto prev = last_arrival;
+                last_arrival = now;
+
+                if (!prev) {
+                        return false;
+                }
+
+                if (auto sample = now - prev; !interval) {
+                        interval = sample;
+                        deviation = sample/2;
+                } else {
+                        auto delta = sample - interval;
+                        interval += delta/8;
+                        deviation += ((delta < 0 ? -delta : delta) - deviation)/4;
+                }
+
+                if (interval <= 0) {
+                        return false;
+                }
+
+                auto d = 1 + (4*deviation + interval - 1)/interval;
+                min_depth = d < MAX_DEPTH ? static_cast<unsigned int>(d) : MAX_DEPTH;
+
+                if (depth >= min_depth) {
+                        return false;
+                }
+
+                depth = min_depth;
+                return true;
+        }
+
+        /*
+         * Depth is increased as soon as the target underrun rate is exceeded for the whole window.
+         * Depth is decreased if there were no underruns during the window.
+         *
+         * @param underrun URB had to wait for the data
+         * @return true if the depth was changed
+         */
+        bool adapt(bool underrun)
+        {
+                ++window;
+
+                if (underrun) {
+                        ++underruns;
+                        ++window_underruns;
+                }
+
+                auto old_depth = depth;
+
+                if (window_underruns*1000 > underrun_rate*WINDOW) {
+                        if (depth < MAX_DEPTH) {
+                                ++depth;
+                        }
+                } else if (window < WINDOW) {
+                        return false;
+                } else if (!window_underruns && depth > (min_depth > 1 ? min_depth : 1)) {
+                        --depth;
+                }
+
+                window = 0;
+                window_underruns = 0;
+
+                return depth != old_depth;
+        }
+};
+
+} // namespace usbip
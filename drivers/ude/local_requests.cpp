@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "local_requests.h"
+#include "trace.h"
+#include "local_requests.tmh"
+
+#include "context.h"
+#include "persistent.h"
+
+#include <usbip\consts.h>
+
+#include <libdrv\ch9.h>
+#include <libdrv\usbdsc.h>
+#include <libdrv\wait_timeout.h>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Class drivers which do not rely on side effects of these requests.
+ */
+constexpr UCHAR default_classes[] {
+        USB_DEVICE_CLASS_HUMAN_INTERFACE,
+        USB_DEVICE_CLASS_PRINTER,
+        USB_DEVICE_CLASS_STORAGE,
+        USB_DEVICE_CLASS_SMART_CARD,
+};
+
+constexpr UCHAR make_request_type(_In_ UCHAR recipient)
+{
+        return USB_DIR_IN | USB_TYPE_STANDARD | recipient;
+}
+
+inline auto is_allowed(_In_ const vhci_ctx &vhci, _In_ UCHAR cls)
+{
+        return vhci.local_classes[cls / CHAR_BIT] & (1 << (cls % CHAR_BIT));
+}
+
+inline void allow(_Inout_ vhci_ctx &vhci, _In_ UCHAR cls)
+{
+        vhci.local_classes[cls / CHAR_BIT] |= 1 << (cls % CHAR_BIT);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_classes(_Inout_ vhci_ctx &vhci, _In_ WDFKEY key)
+{
+        PAGED_CODE();
+
+        UCHAR classes[MAXUCHAR + 1];
+        ULONG len = 0;
+        ULONG type = REG_NONE;
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, local_requests_classes_value_name);
+
+        if (auto err = WdfRegistryQueryValue(key, &value_name, sizeof(classes), classes, &len, &type)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryValue('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                len = 0;
+        } else if (type != REG_BINARY) {
+                Trace(TRACE_LEVEL_ERROR, "'%!USTR!' type %lu != REG_BINARY", &value_name, type);
+                len = 0;
+        }
+
+        if (len) {
+                for (ULONG i = 0; i < len; ++i) {
+                        allow(vhci, classes[i]);
+                }
+        } else {
+                for (auto cls: default_classes) {
+                        allow(vhci, cls);
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void set_configuration(_Inout_ tracked_state &s, _In_ UCHAR value)
+{
+        s.configured = true;
+        s.configuration = value;
+        RtlZeroMemory(s.alt_setting, sizeof(s.alt_setting));
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void set_feature(_Inout_ tracked_state &s, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        enum { REMOTE_WAKEUP = 1 << 1 }; // GET_STATUS(device) bit
+
+        if (!(s.status_valid && pkt.wValue.W == USB_FEATURE_REMOTE_WAKEUP)) {
+                s.status_valid = false; // U1/U2 enable, test mode, etc.
+        } else if (pkt.bRequest == USB_REQUEST_SET_FEATURE) {
+                s.status |= REMOTE_WAKEUP;
+        } else {
+                s.status &= ~REMOTE_WAKEUP;
+        }
+}
+
+/*
+ * @return number of bytes of the response or zero
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+USHORT answer(
+        _Out_writes_bytes_(2) UCHAR *data, _In_ const tracked_state &s, _In_ const device_ctx &dev,
+        _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        auto type = pkt.bmRequestType.B;
+        auto intf = pkt.wIndex.W;
+
+        switch (pkt.bRequest) {
+        case USB_REQUEST_GET_CONFIGURATION:
+                if (type == make_request_type(USB_RECIP_DEVICE) && pkt.wLength == 1 && s.configured) {
+                        data[0] = s.configuration;
+                        return 1;
+                }
+                break;
+        case USB_REQUEST_GET_INTERFACE:
+                if (type == make_request_type(USB_RECIP_INTERFACE) && pkt.wLength == 1 &&
+                    s.configured && s.configuration && intf < ARRAYSIZE(s.alt_setting)) {
+                        data[0] = s.alt_setting[intf];
+                        return 1;
+                }
+                break;
+        case USB_REQUEST_GET_STATUS:
+                if (pkt.wLength != 2 || pkt.wValue.W) {
+                        //
+                } else if (type == make_request_type(USB_RECIP_DEVICE) && !intf && s.status_valid) {
+                        data[0] = UCHAR(s.status);
+                        data[1] = UCHAR(s.status >> 8);
+                        return 2;
+                } else if (type == make_request_type(USB_RECIP_INTERFACE) && dev.speed() < USB_SPEED_SUPER &&
+                           s.configured && s.configuration) {
+                        data[0] = data[1] = 0; // reserved, function remote wake is for SuperSpeed only
+                        return 2;
+                }
+                break;
+        }
+
+        return 0;
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_local_requests_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.local_requests = false;
+        RtlZeroMemory(vhci.local_classes, sizeof(vhci.local_classes));
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, local_requests_value_name);
+
+        ULONG value = 0;
+        if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value);
+            err && err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+        }
+
+        if (vhci.local_requests = value; vhci.local_requests) {
+                read_classes(vhci, key.get());
+                Trace(TRACE_LEVEL_INFORMATION, "enabled, classes %!BIN!",
+                        WppBinary(vhci.local_classes, sizeof(vhci.local_classes)));
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::local_requests_select_configuration(_Inout_ device_ctx &dev, _In_ const _URB_SELECT_CONFIGURATION &r)
+{
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+        bool enabled = vhci.local_requests;
+
+        if (auto cd = r.ConfigurationDescriptor; cd && enabled) {
+                auto intf = &r.Interface;
+                for (int i = 0; i < cd->bNumInterfaces && enabled; ++i, intf = libdrv::next(intf)) {
+                        enabled = intf->InterfaceNumber < MAX_TRACKED_INTERFACES && is_allowed(vhci, intf->Class);
+                }
+        } else {
+                enabled = false;
+        }
+
+        wdf::Lock lck(dev.tracked_lock);
+        auto &s = dev.tracked;
+
+        if (enabled && !s.enabled) {
+                s.since = KeQueryInterruptTime();
+        }
+
+        s.enabled = enabled;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::track_control_request(_Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        if (pkt.bmRequestType.s.Dir == BMREQUEST_DEVICE_TO_HOST || pkt.bmRequestType.s.Type != BMREQUEST_STANDARD) {
+                return;
+        }
+
+        auto recipient = pkt.bmRequestType.s.Recipient;
+        auto intf = pkt.wIndex.W;
+
+        wdf::Lock lck(dev.tracked_lock);
+        auto &s = dev.tracked;
+
+        switch (pkt.bRequest) {
+        case USB_REQUEST_SET_CONFIGURATION:
+                if (recipient == BMREQUEST_TO_DEVICE) {
+                        set_configuration(s, pkt.wValue.LowByte);
+                }
+                break;
+        case USB_REQUEST_SET_INTERFACE:
+                if (recipient == BMREQUEST_TO_INTERFACE && intf < ARRAYSIZE(s.alt_setting)) {
+                        s.alt_setting[intf] = pkt.wValue.LowByte;
+                }
+                break;
+        case USB_REQUEST_SET_FEATURE:
+        case USB_REQUEST_CLEAR_FEATURE:
+                if (recipient == BMREQUEST_TO_DEVICE) {
+                        set_feature(s, pkt);
+                }
+                break;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::track_control_response(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_ const void *data, _In_ ULONG length)
+{
+        auto bytes = static_cast<const UCHAR*>(data);
+
+        if (pkt.bmRequestType.B != make_request_type(USB_RECIP_DEVICE)) {
+                return;
+        }
+
+        wdf::Lock lck(dev.tracked_lock);
+        auto &s = dev.tracked;
+
+        switch (pkt.bRequest) {
+        case USB_REQUEST_GET_STATUS:
+                if (!pkt.wValue.W && !pkt.wIndex.W && length == 2) {
+                        s.status = USHORT(bytes[0] | bytes[1] << 8);
+                        s.status_valid = true;
+                }
+                break;
+        case USB_REQUEST_GET_CONFIGURATION:
+                /*
+                 * The device was configured by a request that was not tracked, its alternate settings
+                 * are unknown. Zero is the default after SET_CONFIGURATION, see 9.1.1.5 of USB 2.0 spec.
+                 */
+                if (length == 1 && !(s.configured && s.configuration == *bytes)) {
+                        set_configuration(s, *bytes);
+                }
+                break;
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::reset_tracked_state(_Inout_ device_ctx &dev)
+{
+        wdf::Lock lck(dev.tracked_lock);
+        auto &s = dev.tracked;
+
+        s.configured = false;
+        s.configuration = 0;
+        RtlZeroMemory(s.alt_setting, sizeof(s.alt_setting));
+
+        s.status_valid = false;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::answer_control_request(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request,
+        _Inout_ _URB_CONTROL_TRANSFER_EX &r, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt)
+{
+        if (!(dev.tracked.enabled && (r.TransferFlags & USBD_DEFAULT_PIPE_TRANSFER))) { // unlocked read is OK
+                return false;
+        }
+
+        switch (pkt.bRequest) {
+        case USB_REQUEST_GET_STATUS:
+        case USB_REQUEST_GET_CONFIGURATION:
+        case USB_REQUEST_GET_INTERFACE:
+                break;
+        default:
+                return false;
+        }
+
+        UCHAR *buf{};
+        ULONG len{};
+
+        if (auto err = UdecxUrbRetrieveBuffer(request, &buf, &len)) {
+                Trace(TRACE_LEVEL_ERROR, "UdecxUrbRetrieveBuffer %!STATUS!", err);
+                return false;
+        }
+
+        UCHAR data[2];
+        USHORT length{};
+        {
+                wdf::Lock lck(dev.tracked_lock);
+                auto &s = dev.tracked;
+
+                if (s.enabled && (length = answer(data, s, dev, pkt)) <= len) {
+                        s.answered += bool(length);
+                } else {
+                        length = 0;
+                }
+        }
+
+        if (!length) {
+                return false;
+        }
+
+        RtlCopyMemory(buf, data, length);
+
+        UdecxUrbSetBytesCompleted(request, length);
+        r.Hdr.Status = USBD_STATUS_SUCCESS;
+
+        TraceUrb("req %04x, bRequest %d, wIndex %d -> %!BIN!",
+                  ptr04x(request), pkt.bRequest, pkt.wIndex.W, WppBinary(data, length));
+
+        return true;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::log_local_requests(_In_ device_ctx &dev)
+{
+        auto &s = dev.tracked;
+        if (!s.since) {
+                return;
+        }
+
+        auto elapsed = KeQueryInterruptTime() - s.since;
+        auto per_minute = elapsed > 0 ? s.answered*wdm::minute/elapsed : 0;
+
+        Trace(TRACE_LEVEL_INFORMATION, "dev %04x, %!UINT64! round trips saved, %!UINT64! per minute",
+                ptr04x(get_handle(&dev)), s.answered, per_minute);
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+
+enum { MAX_TRACKED_INTERFACES = 32 };
+
+/*
+ * State of the device that is tracked by outgoing SET_CONFIGURATION, SET_INTERFACE, SET/CLEAR_FEATURE
+ * and by responses on GET_STATUS, GET_CONFIGURATION.
+ * Protected by device_ctx::tracked_lock.
+ */
+struct tracked_state
+{
+        bool enabled; // classes of all interfaces are allowed, see vhci_ctx::local_classes
+        bool configured; // configuration is known
+        UCHAR configuration; // bConfigurationValue, zero if not configured
+        UCHAR alt_setting[MAX_TRACKED_INTERFACES]; // index is bInterfaceNumber
+
+        bool status_valid;
+        USHORT status; // GET_STATUS(device)
+
+        // statistics
+        UINT64 answered; // requests that did not go to the server
+        LONG64 since; // interrupt time when it was enabled
+};
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_local_requests_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * Applies the class policy to the selected configuration.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void local_requests_select_configuration(_Inout_ device_ctx &dev, _In_ const _URB_SELECT_CONFIGURATION &r);
+
+/*
+ * Outgoing request.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void track_control_request(_Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt);
+
+/*
+ * Successful response of the server.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void track_control_response(
+        _Inout_ device_ctx &dev, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt,
+        _In_ const void *data, _In_ ULONG length);
+
+/*
+ * Port reset.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void reset_tracked_state(_Inout_ device_ctx &dev);
+
+/*
+ * GET_STATUS, GET_CONFIGURATION, GET_INTERFACE.
+ * @return true if URB was completed from the tracked state
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool answer_control_request(
+        _Inout_ device_ctx &dev, _In_ WDFREQUEST request,
+        _Inout_ _URB_CONTROL_TRANSFER_EX &r, _In_ const USB_DEFAULT_PIPE_SETUP_PACKET &pkt);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void log_local_requests(_In_ device_ctx &dev);
+
+} // namespace usbip
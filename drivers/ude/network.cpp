@@ -100,18 +100,22 @@ PAGED USBIP_STATUS usbip::recv_op_common(_Inout_ SOCKET *sock, _In_ UINT16 expec
  * If use MmBuildMdlForNonPagedPool for TransferBuffer, DRIVER_VERIFIER_DETECTED_VIOLATION (c4) will happen sooner or later,
  * Arg1: 0000000000000140, Non-locked MDL constructed from either pageable or tradable memory.
  * 
- * @param mdl_size pass URB_BUF_LEN to use TransferBufferLength, real value must not be greater than TransferBufferLength
+ * @param offset from the beginning of the transfer buffer, is not zero for segments of a transfer
+ * @param mdl_size pass URB_BUF_LEN to use the rest of TransferBufferLength, 
+ *        real value must not be greater than TransferBufferLength - offset
  */
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS usbip::make_transfer_buffer_mdl(
-        _Inout_ Mdl &mdl, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const URB &urb)
+        _Inout_ Mdl &mdl, _In_ ULONG offset, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const URB &urb)
 {
         NT_ASSERT(!mdl);
         auto &r = AsUrbTransfer(urb);
 
-        if (mdl_size == URB_BUF_LEN) {
-                mdl_size = r.TransferBufferLength;
-        } else if (mdl_size > r.TransferBufferLength) {
+        if (offset > r.TransferBufferLength) {
+                return STATUS_INVALID_PARAMETER;
+        } else if (mdl_size == URB_BUF_LEN) {
+                mdl_size = r.TransferBufferLength - offset;
+        } else if (mdl_size > r.TransferBufferLength - offset) {
                 return STATUS_INVALID_PARAMETER;
         }
 
@@ -127,7 +131,7 @@ NTSTATUS usbip::make_transfer_buffer_mdl(
                 if (auto len = size(head); len < r.TransferBufferLength) { // must describe full buffer
                         return STATUS_BUFFER_TOO_SMALL;
                 } else if (!head->Next) { // source MDL is not a chain
-                        mdl = Mdl(head, 0, mdl_size);
+                        mdl = Mdl(head, offset, mdl_size);
                         return mdl ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
                 } else if (buf = MmGetSystemAddressForMdlSafe(head, make_priority(operation)); !buf) {
                         return STATUS_INSUFFICIENT_RESOURCES;        
@@ -143,7 +147,7 @@ NTSTATUS usbip::make_transfer_buffer_mdl(
         }
 
         NT_ASSERT(buf);
-        mdl = Mdl(buf, mdl_size);
+        mdl = Mdl(static_cast<char*>(buf) + offset, mdl_size);
 
         auto st = probe_and_lock ? mdl.prepare_paged(operation) : mdl.prepare_nonpaged();
         if (st) {
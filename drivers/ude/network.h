@@ -38,7 +38,14 @@ enum : ULONG { URB_BUF_LEN = MAXULONG }; // set mdl_size to URB.TransferBufferLe
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 NTSTATUS make_transfer_buffer_mdl(
-	_Inout_ Mdl &mdl, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const _URB &urb);
+	_Inout_ Mdl &mdl, _In_ ULONG offset, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const _URB &urb);
+
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto make_transfer_buffer_mdl(
+	_Inout_ Mdl &mdl, _In_ ULONG mdl_size, _In_ LOCK_OPERATION operation, _In_ const _URB &urb)
+{
+	return make_transfer_buffer_mdl(mdl, 0, mdl_size, operation, urb);
+}
 
 _IRQL_requires_max_(DISPATCH_LEVEL)
 inline auto verify(_In_ const WSK_BUF &buf, _In_ bool exact)
@@ -244,7 +244,7 @@ PAGED void intersection(_In_ WDFCOLLECTION a, _In_ WDFCOLLECTION b)
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED ULONG get_count(_In_ WDFCOLLECTION col, _In_ WDFKEY key, _In_ bool refresh)
+PAGED ULONG get_count(_In_ WDFCOLLECTION col, _In_ WDFKEY key, _In_ bool refresh, _In_ ULONG max_cnt)
 {
         PAGED_CODE();
 
@@ -256,7 +256,7 @@ PAGED ULONG get_count(_In_ WDFCOLLECTION col, _In_ WDFKEY key, _In_ bool refresh
                 return 0;
         }
 
-        return min(WdfCollectionGetCount(col), ARRAYSIZE(vhci_ctx::devices));
+        return min(WdfCollectionGetCount(col), max_cnt);
 }
 
 _IRQL_requires_same_
@@ -294,7 +294,7 @@ PAGED void plugin_persistent_devices(_In_ vhci_ctx &ctx)
 
         for (ULONG attempt = 0; true; ++attempt) {
 
-                auto cnt = get_count(devices.get<WDFCOLLECTION>(), key.get(), attempt);
+                auto cnt = get_count(devices.get<WDFCOLLECTION>(), key.get(), attempt, total_ports(ctx));
                 if (!cnt) {
                         break;
                 }
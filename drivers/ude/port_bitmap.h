@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Lock-free bitmap of claimed root hub ports, see vhci_ctx::claimed_ports.
+ * Bit index is port - 1.
+ *
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+
+namespace usbip::port_bitmap
+{
+
+using word_t = long; // LONG
+
+enum { WORD_BITS = 32 }; // InterlockedBitTestAndSet uses 32-bit words
+
+constexpr auto words(int cnt)
+{
+        return (cnt + WORD_BITS - 1)/WORD_BITS;
+}
+
+/*
+ * @return previous value of the bit
+ */
+inline bool test_and_set(volatile word_t *bitmap, int i)
+{
+        auto word = bitmap + i/WORD_BITS;
+        auto bit = i % WORD_BITS;
+#ifdef _MSC_VER
+        return InterlockedBitTestAndSet(word, bit);
+#else
+        auto mask = word_t(1) << bit;
+        return __atomic_fetch_or(word, mask, __ATOMIC_SEQ_CST) & mask;
+#endif
+}
+
+/*
+ * @return previous value of the bit
+ */
+inline bool test_and_reset(volatile word_t *bitmap, int i)
+{
+        auto word = bitmap + i/WORD_BITS;
+        auto bit = i % WORD_BITS;
+#ifdef _MSC_VER
+        return InterlockedBitTestAndReset(word, bit);
+#else
+        auto mask = word_t(1) << bit;
+        return __atomic_fetch_and(word, ~mask, __ATOMIC_SEQ_CST) & mask;
+#endif
+}
+
+/*
+ * @return index of the first clear bit in [begin, end) that was set by this call, -1 if all are set
+ */
+inline int claim(volatile word_t *bitmap, int begin, int end)
+{
+        for (auto i = begin; i < end; ++i) {
+                if (!test_and_set(bitmap, i)) {
+                        return i;
+                }
+        }
+
+        return -1;
+}
+
+/*
+ * @return false if the bit was not set
+ */
+inline bool release(volatile word_t *bitmap, int i)
+{
+        return test_and_reset(bitmap, i);
+}
+
+} // namespace usbip::port_bitmap
@@ -62,6 +62,8 @@ void usbip::device::append_request(_Inout_ device_ctx &dev, _In_ const wsk_conte
         req.seqnum = wsk.hdr.base.seqnum;
         NT_ASSERT(is_valid_seqnum(req.seqnum));
 
+        req.submitted = KeQueryInterruptTime();
+
         wdf::Lock lck(dev.requests_lock);
         InsertTailList(&dev.requests, &req.entry);
 }
@@ -137,3 +139,17 @@ WDFREQUEST usbip::device::remove_request(
 
         return WDF_NO_HANDLE;
 }
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::device::count_requests(_In_ device_ctx &dev)
+{
+        ULONG cnt = 0;
+        wdf::Lock lck(dev.requests_lock);
+
+        for (auto head = &dev.requests, entry = head->Flink; entry != head; entry = entry->Flink) {
+                ++cnt;
+        }
+
+        return cnt;
+}
@@ -57,4 +57,11 @@ _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 WDFREQUEST remove_request(_In_ device_ctx &dev, _In_ const request_search &crit, _In_ bool unmark_cancelable = true);
 
+/*
+ * @return requests that are waiting for USBIP_RET_SUBMIT
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG count_requests(_In_ device_ctx &dev);
+
 } // namespace usbip::device
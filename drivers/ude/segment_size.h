@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Size of the segments of bulk OUT transfer, see segmented_transfer.
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+
+namespace usbip
+{
+
+enum { MAX_SEGMENTS = 64 };
+
+/*
+ * The segment size is rounded down to a multiple of wMaxPacketSize.
+ * It is increased if the transfer would be split into more than MAX_SEGMENTS.
+ *
+ * @param size configured segment size
+ * @param maxp wMaxPacketSize of the endpoint
+ * @param length of the transfer
+ * @return zero if the transfer must not be split
+ */
+constexpr unsigned int segment_size(unsigned int size, unsigned int maxp, unsigned int length)
+{
+        if (!(size && maxp && length > size)) {
+                return 0;
+        }
+
+        size -= size % maxp;
+        if (!size) {
+                size = maxp;
+        }
+
+        if (auto cnt = (length - 1)/size + 1; cnt > MAX_SEGMENTS) {
+                size = (length - 1)/MAX_SEGMENTS + 1;
+                size += maxp - 1; // round up
+                size -= size % maxp;
+        }
+
+        return size < length ? size : 0;
+}
+
+} // namespace usbip
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "segmented_transfer.h"
+#include "trace.h"
+#include "segmented_transfer.tmh"
+
+#include "context.h"
+#include "driver.h"
+#include "persistent.h"
+#include "device_ioctl.h"
+#include "wsk_receive.h"
+
+#include <usbip\consts.h>
+
+#include <libdrv\ch9.h>
+#include <libdrv\usbd_helper.h>
+#include <libdrv\dbgcommon.h>
+
+namespace
+{
+
+using namespace usbip;
+
+enum : ULONG { MIN_SEGMENT_SIZE = 64*1024 };
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto find(_In_ segmented_transfer &st, _In_ seqnum_t seqnum)
+{
+        for (ULONG i = 0; i < st.cnt; ++i) {
+                if (st.seqnum[i] == seqnum && (st.pending & (1ULL << i))) {
+                        return LONG(i);
+                }
+        }
+
+        return -1L;
+}
+
+/*
+ * @return bitmap of segments that are still pending
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto remove(_Inout_ device_ctx &dev, _Inout_ segmented_transfer &st)
+{
+        wdf::Lock lck(dev.segmented_lock);
+        RemoveEntryList(&st.entry);
+        return st.pending;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void unlink_pending(_Inout_ device_ctx &dev, _In_ const segmented_transfer &st, _In_ UINT64 pending)
+{
+        for (ULONG i = 0; i < st.cnt; ++i) {
+                if (pending & (1ULL << i)) {
+                        device::send_cmd_unlink(dev, st.seqnum[i]);
+                }
+        }
+}
+
+} // namespace
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::read_segmentation_config(_Inout_ vhci_ctx &vhci)
+{
+        PAGED_CODE();
+
+        vhci.bulk_out_segment_size = 0; // disabled
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return;
+        }
+
+        UNICODE_STRING value_name;
+        RtlUnicodeStringInit(&value_name, bulk_out_segment_size_value_name);
+
+        ULONG value = 0;
+
+        if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value)) {
+                if (err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+                return;
+        }
+
+        if (value) {
+                vhci.bulk_out_segment_size = max(value, ULONG(MIN_SEGMENT_SIZE));
+                Trace(TRACE_LEVEL_INFORMATION, "bulk OUT segment size %lu", vhci.bulk_out_segment_size);
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG usbip::get_segment_size(_In_ const device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd, _In_ ULONG length)
+{
+        auto &vhci = *get_vhci_ctx(dev.vhci);
+
+        if (!(usb_endpoint_type(epd) == UsbdPipeTypeBulk && usb_endpoint_dir_out(epd))) {
+                return 0;
+        }
+
+        return segment_size(vhci.bulk_out_segment_size, usb_endpoint_maxp(epd), length);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+segmented_transfer *usbip::alloc_segmented_transfer(_Inout_ device_ctx &dev, _In_ WDFREQUEST request)
+{
+        unique_ptr buf(NonPagedPoolNx, sizeof(segmented_transfer));
+
+        auto st = buf.get<segmented_transfer>();
+        if (!st) {
+                Trace(TRACE_LEVEL_ERROR, "Can't allocate segmented_transfer");
+                return nullptr;
+        }
+
+        st->request = request;
+        st->refcnt = 1;
+
+        {
+                wdf::Lock lck(dev.segmented_lock);
+                InsertTailList(&dev.segmented, &st->entry);
+        }
+
+        return static_cast<segmented_transfer*>(buf.release());
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::segment_pending(_Inout_ device_ctx &dev, _Inout_ segmented_transfer &st, _In_ seqnum_t seqnum)
+{
+        wdf::Lock lck(dev.segmented_lock);
+
+        NT_ASSERT(st.cnt < ARRAYSIZE(st.seqnum));
+        st.pending |= 1ULL << st.cnt;
+        st.seqnum[st.cnt++] = seqnum;
+
+        InterlockedIncrement(&st.refcnt);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::segment_send_completed(_Inout_ segmented_transfer &st)
+{
+        if (InterlockedDecrement(&st.refcnt)) {
+                return;
+        }
+
+        NT_ASSERT(st.completing);
+        TraceDbg("req %04x, deferred completion %!STATUS!", ptr04x(st.request), st.completion_status);
+
+        complete(st.request, st.completion_status);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool usbip::defer_segmented_completion(_In_ WDFREQUEST request, _In_ NTSTATUS status)
+{
+        auto st = get_request_ctx(request)->segments;
+        if (!st || st->completing) {
+                return false;
+        }
+
+        st->completing = true;
+        st->completion_status = status;
+
+        return InterlockedDecrement(&st->refcnt); // of WDFREQUEST
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::segment_received(_Inout_ device_ctx &dev, _In_ const usbip_header &hdr)
+{
+        if (hdr.base.command != USBIP_RET_SUBMIT) {
+                return;
+        }
+
+        auto &ret = hdr.u.ret_submit;
+        wdf::Lock lck(dev.segmented_lock);
+
+        for (auto entry = dev.segmented.Flink; entry != &dev.segmented; entry = entry->Flink) {
+
+                auto &st = *CONTAINING_RECORD(entry, segmented_transfer, entry);
+
+                if (auto i = find(st, hdr.base.seqnum); i >= 0) {
+                        st.pending &= ~(1ULL << i);
+                        st.actual_length += ret.actual_length;
+
+                        if (ret.status && USBD_SUCCESS(st.status)) {
+                                st.status = to_windows_status(ret.status);
+                        }
+
+                        TraceUrb("seqnum %u, segment %ld, actual_length %d, status %d",
+                                  hdr.base.seqnum, i, ret.actual_length, ret.status);
+                        return;
+                }
+        }
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void usbip::segmented_transfer_completed(_In_ WDFREQUEST request, _Inout_ URB &urb, _In_ NTSTATUS status)
+{
+        auto &req = *get_request_ctx(request);
+
+        auto st = req.segments;
+        if (!st) {
+                return;
+        }
+        req.segments = nullptr;
+
+        auto &dev = *get_device_ctx(get_endpoint_ctx(req.endpoint)->device);
+        auto pending = remove(dev, *st);
+
+        if (pending) { // URB was cancelled or the server does not preserve the order of completions
+                TraceDbg("req %04x, pending segments %#I64x", ptr04x(request), pending);
+                unlink_pending(dev, *st, pending);
+        }
+
+        auto &hdr = urb.UrbHeader;
+
+        if (NT_SUCCESS(status)) { // RET_SUBMIT of the last segment was received
+                auto &r = urb.UrbBulkOrInterruptTransfer;
+
+                if (USBD_SUCCESS(hdr.Status) && !USBD_SUCCESS(st->status)) {
+                        hdr.Status = st->status;
+                }
+
+                UdecxUrbSetBytesCompleted(request, st->actual_length + r.TransferBufferLength);
+
+                TraceUrb("req %04x, %lu segments, TransferBufferLength %lu, %s",
+                          ptr04x(request), st->cnt + 1, r.TransferBufferLength, get_usbd_status(hdr.Status));
+        }
+
+        ExFreePoolWithTag(st, pooltag);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "segment_size.h"
+
+#include <libdrv\codeseg.h>
+#include <libdrv\wdf_cpp.h>
+
+#include <usbip\proto.h>
+
+#include <usb.h>
+#include <UdeCx.h>
+
+namespace usbip
+{
+
+struct vhci_ctx;
+struct device_ctx;
+
+/*
+ * Opt-in segmentation of large bulk OUT transfers, see vhci_ctx::bulk_out_segment_size.
+ *
+ * A server can pass URB to the device only after the last byte of its payload was received,
+ * so network and USB time add up. If URB is split into a few CMD_SUBMIT, the device consumes a segment
+ * while the next one is on the way. Segments are multiples of wMaxPacketSize, thus no short packet
+ * appears in the middle of the transfer.
+ *
+ * The last segment is sent with WDFREQUEST as usual, the others are sent without it and are tracked here.
+ * A server completes URBs of an endpoint in submission order, thus RET_SUBMIT for the last segment
+ * is received after the others. Its actual_length and status are combined with them when URB is completed.
+ *
+ * Sends of the segments read the transfer buffer of URB. If URB is completed while some of them are
+ * in flight (error, cancellation), the completion is deferred until the last of them has finished.
+ *
+ * Bulk IN is not segmented, a short packet in the middle would end the transfer on the device side
+ * while the next segments would read data of the following transfer.
+ *
+ * Protected by device_ctx::segmented_lock.
+ */
+struct segmented_transfer
+{
+        LIST_ENTRY entry; // device_ctx::segmented
+
+        WDFREQUEST request;
+        volatile LONG refcnt; // sends of segments in flight plus one for completion of WDFREQUEST
+        bool completing; // complete() was called
+        NTSTATUS completion_status; // of deferred complete()
+
+        seqnum_t seqnum[MAX_SEGMENTS - 1]; // segments that are sent without WDFREQUEST
+        ULONG cnt; // in seqnum[]
+        UINT64 pending; // bitmap, index in seqnum[]
+
+        ULONG actual_length; // SUM of received segments
+        USBD_STATUS status; // the first error of received segments
+};
+
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void read_segmentation_config(_Inout_ vhci_ctx &vhci);
+
+/*
+ * @return zero if the transfer must not be split
+ * @see segment_size
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+ULONG get_segment_size(_In_ const device_ctx &dev, _In_ const USB_ENDPOINT_DESCRIPTOR &epd, _In_ ULONG length);
+
+/*
+ * @return is inserted into device_ctx::segmented
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+segmented_transfer *alloc_segmented_transfer(_Inout_ device_ctx &dev, _In_ WDFREQUEST request);
+
+/*
+ * Must be called before a segment will be sent, RET_SUBMIT can be received before send() returns.
+ * Adds a reference that is released by segment_send_completed.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void segment_pending(_Inout_ device_ctx &dev, _Inout_ segmented_transfer &st, _In_ seqnum_t seqnum);
+
+/*
+ * Send of a segment has finished or has failed to start.
+ * Completes WDFREQUEST if its completion was deferred and this was the last send in flight.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void segment_send_completed(_Inout_ segmented_transfer &st);
+
+/*
+ * Is called by complete() before anything else.
+ * @return true if sends of segments are in flight, complete() will be called again by the last of them
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+bool defer_segmented_completion(_In_ WDFREQUEST request, _In_ NTSTATUS status);
+
+/*
+ * RET_SUBMIT that does not have WDFREQUEST.
+ * Does nothing if it is not for a segment.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void segment_received(_Inout_ device_ctx &dev, _In_ const usbip_header &hdr);
+
+/*
+ * Is called by complete(), does nothing if URB was not segmented.
+ * @param status of WDFREQUEST completion
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void segmented_transfer_completed(_In_ WDFREQUEST request, _Inout_ URB &urb, _In_ NTSTATUS status);
+
+} // namespace usbip
@@ -9,6 +9,15 @@
 #include "device.h"
 #include "vhci_ioctl.h"
 #include "persistent.h"
+#include "jitter_buffer.h"
+#include "descriptor_cache.h"
+#include "local_requests.h"
+#include "flow_control.h"
+#include "segmented_transfer.h"
+#include "compression.h"
+#include "port_bitmap.h"
+
+#include <usbip\consts.h>
 
 #include <ntstrsafe.h>
 
@@ -59,6 +68,7 @@ PAGED void vhci_cleanup(_In_ WDFOBJECT object)
         TraceDbg("vhci %04x", ptr04x(vhci));
 
         attach_thread_join(vhci);
+        free_stored_descriptors(*get_vhci_ctx(vhci));
 }
 
 _Function_class_(EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE)
@@ -104,12 +114,22 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
         WDF_OBJECT_ATTRIBUTES_INIT(&attr);
         attr.ParentObject = vhci;
 
-        if (auto err = WdfSpinLockCreate(&attr, &ctx.devices_lock)) {
+        if (auto err = WdfWaitLockCreate(&attr, &ctx.events_lock)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfWaitLockCreate %!STATUS!", err);
+                return err;
+        }
+
+        if (auto err = WdfSpinLockCreate(&attr, &ctx.generation_lock)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfSpinLockCreate %!STATUS!", err);
                 return err;
         }
 
-        if (auto err = WdfWaitLockCreate(&attr, &ctx.events_lock)) {
+        LARGE_INTEGER now;
+        KeQuerySystemTimePrecise(&now);
+        ctx.instance = now.QuadPart;
+
+        InitializeListHead(&ctx.stored_descriptors);
+        if (auto err = WdfWaitLockCreate(&attr, &ctx.stored_descriptors_lock)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfWaitLockCreate %!STATUS!", err);
                 return err;
         }
@@ -121,6 +141,13 @@ PAGED auto init_context(_In_ WDFDEVICE vhci)
         KeInitializeEvent(&ctx.attach_thread_stop, NotificationEvent, false);
         InitializeListHead(&ctx.fileobjects);
 
+        read_jitter_buffer_config(ctx);
+        read_local_requests_config(ctx);
+        read_flow_control_config(ctx);
+        read_segmentation_config(ctx);
+        read_prefetch_config(ctx);
+        read_compression_config(ctx);
+
         return STATUS_SUCCESS;
 }
 
@@ -243,19 +270,6 @@ PAGED NTSTATUS vhci_query_remove(_In_ WDFDEVICE vhci)
         return STATUS_SUCCESS;
 }
 
-_IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto create_collection(_Out_ WDFCOLLECTION &result, _In_ WDFOBJECT parent)
-{
-        PAGED_CODE();
-
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.ParentObject = parent;
-
-        return WdfCollectionCreate(&attr, &result);
-}
-
 _Function_class_(EVT_WDF_DEVICE_FILE_CREATE)
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
@@ -267,16 +281,12 @@ PAGED void device_file_create(_In_ WDFDEVICE vhci, _In_ WDFREQUEST request, _In_
         auto &fobj = *get_fileobject_ctx(fileobj);
         InitializeListHead(&fobj.entry);
 
-        auto st = create_collection(fobj.events, fileobj);
-
-        if (NT_ERROR(st)) {
-                Trace(TRACE_LEVEL_ERROR, "WdfCollectionCreate %!STATUS!", st);
-        } else if (auto v = get_vhci_ctx(vhci)) {
+        if (auto v = get_vhci_ctx(vhci)) {
                 wdf::WaitLock lck(v->events_lock);
                 InsertTailList(&v->fileobjects, &fobj.entry);
         }
 
-        WdfRequestComplete(request, st);
+        WdfRequestComplete(request, STATUS_SUCCESS);
 }
 
 _Function_class_(EVT_WDF_FILE_CLEANUP)
@@ -359,6 +369,85 @@ PAGED auto initialize(_Inout_ WDFDEVICE_INIT *init)
         return STATUS_SUCCESS;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto read_ports_config()
+{
+        PAGED_CODE();
+        struct { ULONG usb2 = USB2_PORTS; ULONG usb3 = USB3_PORTS; } r;
+
+        Registry key;
+        if (auto err = open_parameters_key(key, KEY_QUERY_VALUE)) {
+                return r;
+        }
+
+        const struct {
+                const wchar_t *name;
+                ULONG &value;
+        } params[] {
+                { usb2_ports_value_name, r.usb2 },
+                { usb3_ports_value_name, r.usb3 },
+        };
+
+        for (auto &[name, value]: params) {
+                UNICODE_STRING value_name;
+                RtlUnicodeStringInit(&value_name, name);
+
+                if (auto err = WdfRegistryQueryULong(key.get(), &value_name, &value);
+                    err && err != STATUS_OBJECT_NAME_NOT_FOUND) {
+                        Trace(TRACE_LEVEL_ERROR, "WdfRegistryQueryULong('%!USTR!') %!STATUS!", &value_name, err);
+                }
+
+                value = max(min(value, ULONG(MAX_HUB_PORTS)), 1UL);
+        }
+
+        return r;
+}
+
+/*
+ * The table is allocated once and is never resized, lookups do not need a lock.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto create_port_table(_In_ WDFDEVICE vhci, _In_ int usb2_ports, _In_ int usb3_ports)
+{
+        PAGED_CODE();
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        auto total = usb2_ports + usb3_ports;
+        auto bitmap_size = port_bitmap::words(total)*sizeof(*ctx.claimed_ports);
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = vhci;
+
+        WDFMEMORY mem{};
+        void *buf{};
+        if (auto err = WdfMemoryCreate(&attr, NonPagedPoolNx, pooltag, total*sizeof(*ctx.ports) + bitmap_size, 
+                                       &mem, &buf)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
+                return err;
+        }
+
+        RtlZeroMemory(buf, total*sizeof(*ctx.ports) + bitmap_size);
+
+        ctx.ports = static_cast<port_slot*>(buf);
+        ctx.claimed_ports = reinterpret_cast<LONG*>(ctx.ports + total);
+
+        for (int i = 0; i < total; ++i) {
+                ExInitializeRundownProtection(&ctx.ports[i].readers);
+        }
+
+        ctx.usb2_ports = usb2_ports;
+        ctx.usb3_ports = usb3_ports;
+
+        Trace(TRACE_LEVEL_INFORMATION, "usb2 ports %d, usb3 ports %d", usb2_ports, usb3_ports);
+        return STATUS_SUCCESS;
+}
+
+/*
+ * UDE does not document the maximum number of ports, the default is used if configured one is rejected.
+ */
 _Function_class_(init_func_t)
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -366,18 +455,36 @@ PAGED auto add_usbdevice_emulation(_In_ WDFDEVICE vhci)
 {
         PAGED_CODE();
 
+        auto [usb2, usb3] = read_ports_config();
+
         UDECX_WDF_DEVICE_CONFIG cfg;
         UDECX_WDF_DEVICE_CONFIG_INIT(&cfg, query_usb_capability);
 
-        cfg.NumberOfUsb20Ports = USB2_PORTS;
-        cfg.NumberOfUsb30Ports = USB3_PORTS;
+        cfg.NumberOfUsb20Ports = static_cast<USHORT>(usb2);
+        cfg.NumberOfUsb30Ports = static_cast<USHORT>(usb3);
 
-        if (auto err = UdecxWdfDeviceAddUsbDeviceEmulation(vhci, &cfg)) {
+        if (auto err = UdecxWdfDeviceAddUsbDeviceEmulation(vhci, &cfg); !err) {
+                //
+        } else if (usb2 == USB2_PORTS && usb3 == USB3_PORTS) {
                 Trace(TRACE_LEVEL_ERROR, "UdecxWdfDeviceAddUsbDeviceEmulation %!STATUS!", err);
                 return err;
+        } else {
+                Trace(TRACE_LEVEL_ERROR, "UdecxWdfDeviceAddUsbDeviceEmulation(usb2 ports %lu, usb3 ports %lu) %!STATUS!, "
+                                         "using defaults", usb2, usb3, err);
+
+                cfg.NumberOfUsb20Ports = USB2_PORTS;
+                cfg.NumberOfUsb30Ports = USB3_PORTS;
+
+                usb2 = USB2_PORTS;
+                usb3 = USB3_PORTS;
+
+                if (err = UdecxWdfDeviceAddUsbDeviceEmulation(vhci, &cfg); err) {
+                        Trace(TRACE_LEVEL_ERROR, "UdecxWdfDeviceAddUsbDeviceEmulation %!STATUS!", err);
+                        return err;
+                }
         }
 
-        return STATUS_SUCCESS;
+        return create_port_table(vhci, int(usb2), int(usb3));
 }
 
 _Function_class_(init_func_t)
@@ -453,51 +560,89 @@ PAGED auto create_vhci(_Out_ WDFDEVICE &vhci, _In_ WDFDEVICE_INIT *init)
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
-auto get_port_range(_In_ usb_device_speed speed)
+auto get_port_range(_In_ const vhci_ctx &ctx, _In_ usb_device_speed speed)
 {
         struct{ int begin;  int end; } r;
 
         if (speed < USB_SPEED_SUPER) {
                 r.begin = 0;
-                r.end = USB2_PORTS;
+                r.end = ctx.usb2_ports;
         } else {
-                r.begin = USB2_PORTS;
-                r.end = TOTAL_PORTS;
+                r.begin = ctx.usb2_ports;
+                r.end = total_ports(ctx);
         }
 
         return r;
 }
 
 _IRQL_requires_same_
-_IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto make_device_state(
-        _In_ WDFOBJECT parent, _In_ const device_ctx_ext &ext, _In_ int port, _In_ vhci::state state)
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto is_dirty(_In_ const fileobject_ctx &fobj, _In_ int i)
 {
-        PAGED_CODE();
+        return event_slots::is_dirty(fobj.dirty, i);
+}
 
-        WDF_OBJECT_ATTRIBUTES attr;
-        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
-        attr.EvtDestroyCallback = [] (auto p) { TraceDbg("destroy %04x", ptr04x(p)); };
-        attr.ParentObject = parent;
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline void set_dirty(_Inout_ fileobject_ctx &fobj, _In_ int i, _In_ bool dirty)
+{
+        event_slots::set_dirty(fobj.dirty, i, dirty);
+}
 
-        WDFMEMORY mem{};
-        vhci::device_state *r{};
-        if (auto err = WdfMemoryCreate(&attr, PagedPool, 0, sizeof(*r), &mem, reinterpret_cast<PVOID*>(&r))) {
-                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
-                return mem;
-        }
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto same_location(_In_ const vhci::imported_device_location &a, _In_ const vhci::imported_device_location &b)
+{
+        return !(strcmp(a.busid, b.busid) || strcmp(a.service, b.service) || strcmp(a.host, b.host));
+}
+
+/*
+ * unplugging and unplugged are posted after the port was reclaimed, see device::detach.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+inline auto owns_port(_In_ const vhci::device_state &evt)
+{
+        using enum vhci::state;
+        return evt.port && !(evt.state == unplugging || evt.state == unplugged);
+}
+
+/*
+ * @return the slot of the same location among the slots of devices without a port, 
+ *         a free slot or the oldest one if all are taken
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto find_portless_slot(_In_ const fileobject_ctx &fobj, _In_ const vhci::device_state &evt)
+{
+        auto same = [&evt] (auto &slot) { return same_location(slot.state, evt); };
+        return event_slots::find(fobj.events, fobj.dirty, fobj.max_events/2, fobj.max_events, same);
+}
 
-        RtlZeroMemory(r, sizeof(*r));
-        r->size = sizeof(*r);
-        r->state = state;
+/*
+ * @param prev the other slot of the same device if it is dirty, its state is superseded
+ * @return a slot for the state, see fileobject_ctx::events
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto find_slot(_Out_ int &prev, _In_ const fileobject_ctx &fobj, _In_ const vhci::device_state &evt)
+{
+        int i = -1;
+        prev = -1;
 
-        if (auto err = fill(*r, ext, port)) {
-                WdfObjectDelete(mem);
-                mem = WDF_NO_HANDLE;
+        if (owns_port(evt)) { // an attach or a detach, so a linear lookup is rare
+                i = evt.port - 1;
+                if (auto j = find_portless_slot(fobj, evt); is_dirty(fobj, j) && same_location(fobj.events[j].state, evt)) {
+                        prev = j;
+                }
+        } else {
+                i = find_portless_slot(fobj, evt);
+                if (auto j = evt.port - 1; evt.port && is_dirty(fobj, j) && same_location(fobj.events[j].state, evt)) {
+                        prev = j;
+                }
         }
 
-        TraceDbg("%04x", ptr04x(mem));
-        return mem;
+        return i;
 }
 
 /*
@@ -505,56 +650,49 @@ PAGED auto make_device_state(
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void process_event(_In_ WDFQUEUE queue, _Inout_ fileobject_ctx &fobj, _In_ WDFMEMORY evt)
+PAGED void process_event(
+        _In_ WDFQUEUE queue, _Inout_ fileobject_ctx &fobj, _In_ const vhci::device_state &evt, _In_ UINT64 seq)
 {
         PAGED_CODE();
 
         auto fileobj = get_handle(&fobj);
+
+        int prev;
+        auto i = find_slot(prev, fobj, evt);
+
+        if (prev >= 0) {
+                TraceDbg("fobj %04x, '%!vhci_state!' in [%d] is superseded", 
+                          ptr04x(fileobj), int(fobj.events[prev].state.state), prev);
+                set_dirty(fobj, prev, false);
+        }
+
+        if (auto &slot = fobj.events[i]; !is_dirty(fobj, i)) {
+                TraceDbg("fobj %04x, add [%d]", ptr04x(fileobj), i);
+        } else if (same_location(slot.state, evt)) {
+                TraceDbg("fobj %04x, replace '%!vhci_state!' in [%d]", ptr04x(fileobj), int(slot.state.state), i);
+        } else if (i < fobj.max_events/2) { // the previous device of the port, its final state will be posted
+                TraceDbg("fobj %04x, port %d, replace the state of the previous device", ptr04x(fileobj), evt.port);
+        } else {
+                Trace(TRACE_LEVEL_WARNING, "fobj %04x, more than %d devices without a port have pending states, "
+                                           "drop [%d] seq %I64u", ptr04x(fileobj), fobj.max_events/2, i, slot.seq);
+        }
+
+        fobj.events[i] = { .seq = seq, .state = evt };
+        set_dirty(fobj, i, true);
+
         WDFREQUEST request{};
 
         switch (auto st = WdfIoQueueRetrieveRequestByFileObject(queue, fileobj, &request)) {
         case STATUS_SUCCESS:
-                NT_ASSERT(!WdfCollectionGetCount(fobj.events));
-                vhci::complete_read(request, evt);
+                vhci::complete_read(request, fobj);
                 break;
         case STATUS_NO_MORE_ENTRIES:
-                if (auto err = WdfCollectionAdd(fobj.events, evt)) { // append and increment reference count
-                        Trace(TRACE_LEVEL_ERROR, "WdfCollectionAdd %!STATUS!", err);
-                } else if (auto cnt = WdfCollectionGetCount(fobj.events); cnt > fobj.MAX_EVENTS) {
-                        auto head = WdfCollectionGetFirstItem(fobj.events);
-                        WdfCollectionRemove(fobj.events, head); // decrements reference count
-
-                        TraceDbg("fobj %04x, drop %04x[0], add %04x[%lu]",
-                                  ptr04x(fileobj), ptr04x(head), ptr04x(evt), --cnt - 1);
-                } else {
-                        TraceDbg("fobj %04x, add %04x[%lu]", ptr04x(fileobj), ptr04x(evt), cnt - 1);
-                }
                 break;
         default:
                 Trace(TRACE_LEVEL_ERROR, "WdfIoQueueRetrieveRequestByFileObject %!STATUS!", st);
         }
 }
 
-_IRQL_requires_same_
-_IRQL_requires_(PASSIVE_LEVEL)
-PAGED void process_event(_In_ vhci_ctx &vhci, _In_ WDFMEMORY evt)
-{
-        PAGED_CODE();
-
-        int cnt = 0;
-        wdf::WaitLock lck(vhci.events_lock);
-
-        for (auto head = &vhci.fileobjects, entry = head->Flink; entry != head; entry = entry->Flink) {
-                auto &fobj = *CONTAINING_RECORD(entry, fileobject_ctx, entry);
-                if (fobj.process_events) {
-                        process_event(vhci.reads, fobj, evt);
-                        ++cnt;
-                }
-        }
-
-        NT_ASSERT(cnt == vhci.events_subscribers);
-}
-
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto get_detach_function(_In_ vhci::detach_call how)
@@ -579,6 +717,17 @@ PAGED auto get_detach_function(_In_ vhci::detach_call how)
         return f;
 }
 
+/*
+ * The counter and the slot are updated under the lock, vhci::get_generation can't see one without another.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void port_changed(_Inout_ vhci_ctx &vhci, _Inout_ port_slot &slot)
+{
+        wdf::Lock lck(vhci.generation_lock);
+        WriteRelease64(&slot.generation, ++vhci.generation);
+}
+
 } // namespace
 
 
@@ -593,58 +742,63 @@ int usbip::vhci::claim_roothub_port(_In_ UDECXUSBDEVICE device)
         auto &vhci = *get_vhci_ctx(dev.vhci); 
 
         NT_ASSERT(!dev.port);
-        int port = 0;
+        auto [begin, end] = get_port_range(vhci, dev.speed());
 
-        auto [begin, end] = get_port_range(dev.speed());
+        auto i = port_bitmap::claim(vhci.claimed_ports, begin, end);
+        if (i < 0) {
+                return 0;
+        }
 
-        wdf::Lock lck(vhci.devices_lock); // function must be resident, do not use PAGED
+        auto &slot = vhci.ports[i];
+        NT_ASSERT(!slot.device);
 
-        for (auto i = begin; i < end; ++i) {
-                NT_ASSERT(i < ARRAYSIZE(vhci.devices));
+        int port = i + 1;
+        NT_ASSERT(is_valid_port(vhci, port));
 
-                if (auto &handle = vhci.devices[i]; !handle) {
-                        WdfObjectReference(handle = device);
-                        
-                        port = i + 1;
-                        NT_ASSERT(is_valid_port(port));
+        dev.port = port; // before get_device can find it
+        WdfObjectReference(device);
 
-                        dev.port = port;
-                        break;
-                }
-        }
+        InterlockedExchangePointer(reinterpret_cast<PVOID volatile*>(&slot.device), device);
+        port_changed(vhci, slot);
 
-        lck.release();
         return port;
 }
 
+/*
+ * The port is released after get_device calls that can see the device have finished,
+ * each of them has added its own reference by then. New calls fail to acquire rundown protection
+ * until it is reinitialized, the slot is empty anyway.
+ */
 _IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_max_(APC_LEVEL)
 int usbip::vhci::reclaim_roothub_port(_In_ UDECXUSBDEVICE device)
 {
         auto &dev = *get_device_ctx(device);
         auto &vhci = *get_vhci_ctx(dev.vhci); 
 
-        static_assert(!is_valid_port(0));
-        int portnum = 0;
-
-        wdf::Lock lck(vhci.devices_lock); 
-        if (auto &port = dev.port) {
-                NT_ASSERT(is_valid_port(port));
-                portnum = port;
+        auto port = ReadNoFence(reinterpret_cast<volatile LONG*>(&dev.port));
+        if (!port) {
+                return 0;
+        }
 
-                auto &handle = vhci.devices[port - 1];
-                NT_ASSERT(handle == device);
+        NT_ASSERT(is_valid_port(vhci, port));
+        auto &slot = vhci.ports[port - 1];
 
-                handle = WDF_NO_HANDLE;
-                port = 0;
+        if (InterlockedCompareExchangePointer(reinterpret_cast<PVOID volatile*>(&slot.device), nullptr, device) != device) {
+                return 0; // concurrent call has reclaimed it
         }
-        lck.release(); // explicit call to satisfy code analyzer and get rid of warning C28166
 
-        if (portnum) {
-                WdfObjectDereference(device);
-        }
-        
-        return portnum;
+        port_changed(vhci, slot);
+
+        ExWaitForRundownProtectionRelease(&slot.readers);
+        ExReInitializeRundownProtection(&slot.readers); // before the port can be claimed again
+
+        dev.port = 0;
+
+        NT_VERIFY(port_bitmap::release(vhci.claimed_ports, port - 1));
+
+        WdfObjectDereference(device);
+        return port;
 }
 
 _IRQL_requires_same_
@@ -652,22 +806,43 @@ _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef usbip::vhci::get_device(_In_ WDFDEVICE vhci, _In_ int port)
 {
         wdf::ObjectRef ptr;
-        if (!is_valid_port(port)) {
+
+        auto &ctx = *get_vhci_ctx(vhci);
+        if (!is_valid_port(ctx, port)) {
                 return ptr;
         }
 
-        auto &ctx = *get_vhci_ctx(vhci);
+        auto &slot = ctx.ports[port - 1];
+        if (!ExAcquireRundownProtection(&slot.readers)) {
+                return ptr; // the port is being reclaimed
+        }
 
-        wdf::Lock lck(ctx.devices_lock); 
-        if (auto handle = ctx.devices[port - 1]) {
-                NT_ASSERT(get_device_ctx(handle)->port == port);
+        if (auto handle = static_cast<UDECXUSBDEVICE>(ReadPointerAcquire(reinterpret_cast<PVOID volatile*>(&slot.device)))) {
                 ptr.reset(handle); // adds reference
         }
-        lck.release(); // explicit call to satisfy code analyzer and get rid of warning C28166
 
+        ExReleaseRundownProtection(&slot.readers);
         return ptr;
 }
 
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG64 usbip::vhci::get_generation(_In_ WDFDEVICE vhci)
+{
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        wdf::Lock lck(ctx.generation_lock); // port_slot::generation is set for each counted change
+        return ctx.generation;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG64 usbip::vhci::get_generation(_In_ WDFDEVICE vhci, _In_ int port)
+{
+        auto &ctx = *get_vhci_ctx(vhci);
+        return is_valid_port(ctx, port) ? ReadAcquire64(&ctx.ports[port - 1].generation) : 0;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED void usbip::vhci::detach_all_devices(_In_ WDFDEVICE vhci, _In_ detach_call how)
@@ -677,7 +852,7 @@ PAGED void usbip::vhci::detach_all_devices(_In_ WDFDEVICE vhci, _In_ detach_call
         TraceDbg("%04x", ptr04x(vhci));
         auto detach = get_detach_function(how);
 
-        for (int port = 1; port <= ARRAYSIZE(vhci_ctx::devices); ++port) {
+        for (int port = 1, cnt = total_ports(*get_vhci_ctx(vhci)); port <= cnt; ++port) {
                 if (auto dev = get_device(vhci, port); auto hdev = dev.get<UDECXUSBDEVICE>()) {
                         detach(hdev);
                 }
@@ -704,32 +879,36 @@ PAGED NTSTATUS usbip::vhci::fill(_Out_ imported_device &dev, _In_ const device_c
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt)
+PAGED void usbip::vhci::complete_read(_In_ WDFREQUEST request, _Inout_ fileobject_ctx &fobj)
 {
         PAGED_CODE();
 
         device_state *dst{};
-        auto dst_sz = sizeof(*dst);
+        size_t length{};
+        ULONG cnt = 0;
+
+        auto st = WdfRequestRetrieveOutputBuffer(request, sizeof(*dst), reinterpret_cast<PVOID*>(&dst), &length);
 
-        auto st = WdfRequestRetrieveOutputBuffer(request, dst_sz, reinterpret_cast<PVOID*>(&dst), nullptr);
-        
         if (NT_SUCCESS(st)) {
-                size_t size{};
-                *dst = *reinterpret_cast<device_state*>(WdfMemoryGetBuffer(evt, &size));
-                NT_ASSERT(size == dst_sz);
+                auto dirty = event_slots::dirty_by_seq(fobj.events, fobj.dirty, fobj.max_events, fobj.order);
+
+                for (auto max_cnt = length/sizeof(*dst); cnt < max_cnt && cnt < ULONG(dirty); ++cnt) {
+                        auto i = fobj.order[cnt];
+                        dst[cnt] = fobj.events[i].state;
+                        set_dirty(fobj, i, false);
+                }
         } else {
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestRetrieveOutputBuffer %!STATUS!", st);
-                dst_sz = 0;
         }
 
-        TraceDbg("fobj %04x, req %04x, device_state %04x, %!STATUS!", ptr04x(WdfRequestGetFileObject(request)), 
-                  ptr04x(request), ptr04x(evt), st);
+        TraceDbg("fobj %04x, req %04x, %lu device_state(s), %!STATUS!", 
+                  ptr04x(WdfRequestGetFileObject(request)), ptr04x(request), cnt, st);
 
-        WdfRequestCompleteWithInformation(request, st, dst_sz);
+        WdfRequestCompleteWithInformation(request, st, cnt*sizeof(*dst));
 }
 
 /*
- * Each WDFMEMORY object is shared between FILEOBJECT-s, thus parent is set to WDFDEVICE.
+ * The state is written into the slot of each subscriber, nothing is allocated.
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
@@ -739,24 +918,38 @@ PAGED void usbip::vhci::device_state_changed(
         PAGED_CODE();
 
         auto &ctx = *get_vhci_ctx(vhci);
-        auto subscribers = ctx.events_subscribers;
 
         TraceDbg("%!USTR!:%!USTR!/%!USTR!, port %d, %!vhci_state!, subscribers %d", 
-                  &ext.node_name, &ext.service_name, &ext.busid, port, int(state), subscribers);
+                  &ext.node_name, &ext.service_name, &ext.busid, port, int(state), ctx.events_subscribers);
 
-        if (!subscribers) {
-                wdf::WaitLock lck(ctx.events_lock);
-                if (!ctx.events_subscribers) {
-                        return; // don't create device_state unnecessarily
-                }
+        wdf::WaitLock lck(ctx.events_lock);
+        if (!ctx.events_subscribers) {
+                return;
         }
 
-        if (auto evt = make_device_state(vhci, ext, port, state)) {
-                process_event(ctx, evt);
-                WdfObjectDelete(evt); // will be deleted after its reference count becomes zero
-        } else {
-                Trace(TRACE_LEVEL_ERROR, "Failed to create state '%!vhci_state!'", int(state));
+        auto &evt = ctx.event;
+
+        RtlZeroMemory(&evt, sizeof(evt)); // locations are compared by strcmp
+        evt.size = sizeof(evt);
+        evt.state = state;
+
+        if (auto err = fill(evt, ext, port)) {
+                Trace(TRACE_LEVEL_ERROR, "Failed to fill state '%!vhci_state!' %!STATUS!", int(state), err);
+                return;
+        }
+
+        auto seq = ++ctx.events_seq;
+        int cnt = 0;
+
+        for (auto head = &ctx.fileobjects, entry = head->Flink; entry != head; entry = entry->Flink) {
+                auto &fobj = *CONTAINING_RECORD(entry, fileobject_ctx, entry);
+                if (fobj.process_events) {
+                        process_event(ctx.reads, fobj, evt, seq);
+                        ++cnt;
+                }
         }
+
+        NT_ASSERT(cnt == ctx.events_subscribers);
 }
 
 /*
@@ -25,13 +25,24 @@ _IRQL_requires_max_(DISPATCH_LEVEL)
 int claim_roothub_port(_In_ UDECXUSBDEVICE device);
 
 _IRQL_requires_same_
-_IRQL_requires_max_(DISPATCH_LEVEL)
+_IRQL_requires_max_(APC_LEVEL)
 int reclaim_roothub_port(_In_ UDECXUSBDEVICE device);
 
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 wdf::ObjectRef get_device(_In_ WDFDEVICE vhci, _In_ int port);
 
+/*
+ * Each port that has changed after the call has port_slot::generation greater than the result.
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG64 get_generation(_In_ WDFDEVICE vhci);
+
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+LONG64 get_generation(_In_ WDFDEVICE vhci, _In_ int port);
+
 enum class detach_call { async_wait, async_nowait, direct };
 
 _IRQL_requires_same_
@@ -50,9 +61,13 @@ inline auto fill(_Out_ imported_device &dev, _In_ const device_ctx &ctx)
         return fill(dev, *ctx.ext, ctx.port);
 }
 
+/*
+ * Copy as many pending states as fit into the buffer of IRP_MJ_READ, the oldest changes first.
+ * vhci_ctx::events_lock must be acquired.
+ */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void complete_read(_In_ WDFREQUEST request, _In_ WDFMEMORY evt);
+PAGED void complete_read(_In_ WDFREQUEST request, _Inout_ fileobject_ctx &fobj);
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
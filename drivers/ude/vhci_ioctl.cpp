@@ -12,6 +12,10 @@
 #include "network.h"
 #include "ioctl.h"
 #include "persistent.h"
+#include "descriptor_prefetch.h"
+#include "request_list.h"
+#include "compression.h"
+#include "devices_since.h"
 
 #include <usbip\proto_op.h>
 
@@ -88,11 +92,51 @@ PAGED void log(_In_ const usbip_usb_device &d)
 }
 
 /*
+ * @param str NUL-terminated string, op_extensions is placed at the end of the buffer
+ * @see op_extensions
+ */
+template<size_t N>
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+auto put_extensions(_Inout_ char (&str)[N], _In_ UINT32 flags)
+{
+        op_extensions e{ RtlUlongByteSwap(OP_EXTENSIONS_MAGIC), RtlUlongByteSwap(flags) };
+        static_assert(N > sizeof(e));
+
+        auto ok = strnlen(str, N) < N - sizeof(e);
+        if (ok) {
+                RtlCopyMemory(str + N - sizeof(e), &e, sizeof(e));
+        }
+
+        return ok;
+}
+
+/*
+ * @return OP_EXT_* flags, zero if the server does not support extensions
+ */
+template<size_t N>
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+UINT32 get_extensions(_In_ const char (&str)[N])
+{
+        op_extensions e;
+        static_assert(N > sizeof(e));
+
+        if (strnlen(str, N) >= N - sizeof(e)) {
+                return 0;
+        }
+
+        RtlCopyMemory(&e, str + N - sizeof(e), sizeof(e));
+        return RtlUlongByteSwap(e.magic) == OP_EXTENSIONS_MAGIC ? RtlUlongByteSwap(e.flags) : 0;
+}
+
+/*
+ * @param extensions OP_EXT_* flags to request
  * @see <linux>/tools/usb/usbip/src/usbipd.c, recv_request_import
  */
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto send_req_import(_In_ device_ctx_ext &ext)
+PAGED auto send_req_import(_In_ device_ctx_ext &ext, _In_ UINT32 extensions)
 {
         PAGED_CODE();
 
@@ -108,6 +152,11 @@ PAGED auto send_req_import(_In_ device_ctx_ext &ext)
                 return err;
         }
 
+        if (extensions && !put_extensions(req.body.busid, extensions)) {
+                Trace(TRACE_LEVEL_WARNING, "busid '%s' is too long, extensions %#x are not requested",
+                                            req.body.busid, extensions);
+        }
+
         PACK_OP_COMMON(false, &req.hdr);
         PACK_OP_IMPORT_REQUEST(false, &req.body);
 
@@ -116,7 +165,8 @@ PAGED auto send_req_import(_In_ device_ctx_ext &ext)
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED NTSTATUS recv_rep_import(_In_ device_ctx_ext &ext, _In_ memory pool, _Out_ op_import_reply &reply)
+PAGED NTSTATUS recv_rep_import(
+        _Inout_ device_ctx_ext &ext, _In_ UINT32 extensions, _In_ memory pool, _Out_ op_import_reply &reply)
 {
         PAGED_CODE();
         RtlZeroMemory(&reply, sizeof(reply));
@@ -140,22 +190,27 @@ PAGED NTSTATUS recv_rep_import(_In_ device_ctx_ext &ext, _In_ memory pool, _Out_
                 return USBIP_ERROR_PROTOCOL;
         }
 
+        ext.extensions = extensions ? get_extensions(reply.udev.path) & extensions : 0; // the server can't add flags
+        if (ext.extensions) {
+                Trace(TRACE_LEVEL_INFORMATION, "extensions %#x", ext.extensions);
+        }
+
         return STATUS_SUCCESS;
 }
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext)
+PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext, _In_ UINT32 extensions)
 {
         PAGED_CODE();
 
-        if (auto err = send_req_import(ext)) {
+        if (auto err = send_req_import(ext, extensions)) {
                 Trace(TRACE_LEVEL_ERROR, "Send OP_REQ_IMPORT %!STATUS!", err);
                 return err;
         }
 
         op_import_reply reply;
-        if (auto err = recv_rep_import(ext, memory::stack, reply)) {
+        if (auto err = recv_rep_import(ext, extensions, memory::stack, reply)) {
                 return err;
         }
  
@@ -169,6 +224,8 @@ PAGED auto import_remote_device(_Inout_ device_ctx_ext &ext)
                 d->product = udev.idProduct;
         }
 
+        ext.bcdDevice = udev.bcdDevice;
+
         return STATUS_SUCCESS;
 }
 
@@ -273,7 +330,7 @@ PAGED NTSTATUS connected(_In_ WDFREQUEST request, _Inout_ device_ctx_ext* &ext)
         auto vhci = get_vhci(request);
         device_state_changed(vhci, *ext, 0, vhci::state::connected);
 
-        if (auto err = import_remote_device(*ext)) {
+        if (auto err = import_remote_device(*ext, requested_extensions(*get_vhci_ctx(vhci)))) {
                 return err;
         }
 
@@ -283,6 +340,8 @@ PAGED NTSTATUS connected(_In_ WDFREQUEST request, _Inout_ device_ctx_ext* &ext)
         }
         ext = nullptr; // now dev owns it
 
+        prefetch_descriptors(*get_device_ctx(dev));
+
         if (auto err = start_device(r->port, dev)) {
                 WdfObjectDelete(dev); // UdecxUsbDevicePlugIn failed or was not called
                 return err;
@@ -579,7 +638,7 @@ PAGED NTSTATUS plugout_hardware(_In_ WDFREQUEST request)
 
         if (auto vhci = get_vhci(request); r->port <= 0) {
                 detach_all_devices(vhci, vhci::detach_call::async_wait); // detach_call::direct can't be used here
-        } else if (!is_valid_port(r->port)) {
+        } else if (!is_valid_port(*get_vhci_ctx(vhci), r->port)) {
                 st = STATUS_INVALID_PARAMETER;
         } else if (auto dev = vhci::get_device(vhci, r->port)) {
                 st = device::async_detach_and_wait(dev.get<UDECXUSBDEVICE>());
@@ -617,7 +676,7 @@ PAGED NTSTATUS get_imported_devices(_In_ WDFREQUEST request)
         auto vhci = get_vhci(request);
         ULONG cnt = 0;
 
-        for (int port = 1; port <= ARRAYSIZE(vhci_ctx::devices); ++port) {
+        for (int port = 1, total = total_ports(ctx); port <= total; ++port) {
                 if (auto dev = vhci::get_device(vhci, port); !dev) {
                         //
                 } else if (cnt == max_cnt) {
@@ -636,6 +695,144 @@ PAGED NTSTATUS get_imported_devices(_In_ WDFREQUEST request)
         return STATUS_SUCCESS;
 }
 
+/*
+ * Costs a scan of port_slot::generation if nothing has changed, devices are not referenced.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_imported_devices_since(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        size_t outlen;
+        vhci::ioctl::get_imported_devices_since *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_imported_devices_since.size %lu != sizeof(get_imported_devices_since) %Iu", 
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        auto devices_size = outlen - offsetof(vhci::ioctl::get_imported_devices_since, devices); // size of array
+
+        auto max_cnt = devices_size/sizeof(*r->devices);
+        NT_ASSERT(max_cnt);
+
+        auto vhci = get_vhci(request);
+        auto &ctx = *get_vhci_ctx(vhci);
+
+        auto gen = vhci::get_generation(vhci); // before the scan, see devices_since::scan
+        auto since = devices_since::since(ctx.instance, r->instance, r->generation);
+
+        ULONG cnt = 0;
+
+        auto port_generation = [vhci] (auto port) { return vhci::get_generation(vhci, port); };
+        auto get_device = [vhci] (auto port) { return vhci::get_device(vhci, port); };
+
+        auto report = [r, max_cnt, &cnt] (auto port, const auto &dev) -> NTSTATUS
+        {
+                if (cnt == max_cnt) {
+                        return STATUS_BUFFER_TOO_SMALL;
+                }
+
+                auto &d = r->devices[cnt++];
+
+                if (!dev) {
+                        RtlZeroMemory(&d, sizeof(d));
+                        d.port = port;
+                        d.removed = true;
+                } else if (auto err = fill(d, *get_device_ctx(dev.get()))) {
+                        return err;
+                } else {
+                        d.removed = false;
+                }
+
+                return STATUS_SUCCESS;
+        };
+
+        if (auto err = devices_since::scan(total_ports(ctx), since, port_generation, get_device, report)) {
+                return err;
+        }
+
+        r->instance = ctx.instance;
+        r->generation = gen;
+        r->full = !since;
+
+        TraceDbg("generation %I64d -> %I64d, %lu change(s) reported", since, gen, cnt);
+
+        auto written = vhci::ioctl::get_imported_devices_since_size(cnt);
+        NT_ASSERT(written <= outlen);
+        WdfRequestSetInformation(request, written);
+
+        return STATUS_SUCCESS;
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED NTSTATUS get_device_statistics(_In_ WDFREQUEST request)
+{
+        PAGED_CODE();
+        WdfRequestSetInformation(request, 0);
+
+        size_t outlen;
+        vhci::ioctl::get_device_statistics *r;
+
+        if (auto err = WdfRequestRetrieveOutputBuffer(request, sizeof(*r), reinterpret_cast<PVOID*>(&r), &outlen)) {
+                return err;
+        } else if (r->size != sizeof(*r)) {
+                Trace(TRACE_LEVEL_ERROR, "get_device_statistics.size %lu != sizeof(get_device_statistics) %Iu", 
+                                          r->size, sizeof(*r));
+
+                return USBIP_ERROR_ABI;
+        }
+
+        auto devices_size = outlen - offsetof(vhci::ioctl::get_device_statistics, devices); // size of array
+
+        auto max_cnt = devices_size/sizeof(*r->devices);
+        NT_ASSERT(max_cnt);
+
+        auto vhci = get_vhci(request);
+        ULONG cnt = 0;
+
+        for (int port = 1, total = total_ports(*get_vhci_ctx(vhci)); port <= total; ++port) {
+
+                auto gen = vhci::get_generation(vhci, port); // before get_device
+                auto dev = vhci::get_device(vhci, port);
+                if (!dev) {
+                        continue;
+                }
+
+                if (cnt == max_cnt) {
+                        return STATUS_BUFFER_TOO_SMALL;
+                }
+
+                auto &ctx = *get_device_ctx(dev.get());
+                auto &s = r->devices[cnt++];
+
+                s.port = port;
+                s.generation = gen;
+
+                s.bytes_in = ReadNoFence64(&ctx.bytes_in);
+                s.bytes_out = ReadNoFence64(&ctx.bytes_out);
+                s.urbs = ReadNoFence64(&ctx.completed_urbs);
+                s.in_flight = device::count_requests(ctx);
+
+                for (ULONG i = 0; i < ARRAYSIZE(s.latency); ++i) {
+                        s.latency[i] = ReadNoFence64(&ctx.latency[i]);
+                }
+        }
+
+        auto written = vhci::ioctl::get_device_statistics_size(cnt);
+        NT_ASSERT(written <= outlen);
+        WdfRequestSetInformation(request, written);
+
+        return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto set_persistent(_In_ WDFREQUEST request)
@@ -774,6 +971,10 @@ PAGED decltype(get_persistent) *get_parallel_handler(_In_ ULONG IoControlCode)
         switch (IoControlCode) {
         case vhci::ioctl::GET_IMPORTED_DEVICES:
                 return get_imported_devices;
+        case vhci::ioctl::GET_IMPORTED_DEVICES_SINCE:
+                return get_imported_devices_since;
+        case vhci::ioctl::GET_DEVICE_STATISTICS:
+                return get_device_statistics;
         case vhci::ioctl::SET_PERSISTENT:
                 return set_persistent;
         case vhci::ioctl::GET_PERSISTENT:
@@ -821,6 +1022,47 @@ PAGED void device_control_parallel(
         }
 }
 
+/*
+ * Slots are allocated for subscribers only, the parent is WDFFILEOBJECT.
+ * A slot for each port and the same number for devices without a port, see fileobject_ctx::events.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto alloc_events(_Inout_ fileobject_ctx &fobj, _In_ WDFFILEOBJECT fileobj, _In_ const vhci_ctx &vhci)
+{
+        PAGED_CODE();
+        NT_ASSERT(!fobj.events);
+
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = fileobj;
+
+        auto cnt = 2*total_ports(vhci);
+
+        auto events_size = cnt*sizeof(*fobj.events);
+        static_assert(alignof(pending_event) >= alignof(UINT64));
+
+        auto dirty_size = event_slots::bitmap_words(cnt)*sizeof(*fobj.dirty);
+        auto size = events_size + dirty_size + cnt*sizeof(*fobj.order);
+
+        WDFMEMORY mem{};
+        void *ptr{};
+
+        if (auto err = WdfMemoryCreate(&attr, PagedPool, 0, size, &mem, &ptr)) {
+                Trace(TRACE_LEVEL_ERROR, "WdfMemoryCreate %!STATUS!", err);
+                return err;
+        }
+
+        RtlZeroMemory(ptr, size);
+
+        fobj.events = static_cast<pending_event*>(ptr);
+        fobj.dirty = reinterpret_cast<UINT64*>(static_cast<char*>(ptr) + events_size);
+        fobj.order = reinterpret_cast<int*>(static_cast<char*>(ptr) + events_size + dirty_size);
+        fobj.max_events = cnt;
+
+        return STATUS_SUCCESS;
+}
+
 _Function_class_(EVT_WDF_IO_QUEUE_IO_READ)
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
@@ -833,7 +1075,7 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
 
         TraceDbg("fobj %04x, request %04x, length %Iu", ptr04x(fileobj), ptr04x(request), length);
 
-        if (length != sizeof(vhci::device_state)) {
+        if (!length || length % sizeof(vhci::device_state)) { // a read can return a few events
                 WdfRequestCompleteWithInformation(request, STATUS_INVALID_BUFFER_SIZE, 0);
                 return;
         }
@@ -844,13 +1086,16 @@ PAGED void device_read(_In_ WDFQUEUE queue, _In_ WDFREQUEST request, _In_ size_t
         wdf::WaitLock lck(vhci.events_lock);
 
         if (auto &val = fobj.process_events; !val) {
+                if (auto err = alloc_events(fobj, fileobj, vhci)) {
+                        WdfRequestCompleteWithInformation(request, err, 0);
+                        return;
+                }
                 ++vhci.events_subscribers;
                 val = true;
         }
 
-        if (auto evt = (WDFMEMORY)WdfCollectionGetFirstItem(fobj.events)) {
-                vhci::complete_read(request, evt);
-                WdfCollectionRemove(fobj.events, evt); // decrements reference count
+        if (has_events(fobj)) {
+                vhci::complete_read(request, fobj);
         } else if (auto err = WdfRequestForwardToIoQueue(request, vhci.reads)) {
                 Trace(TRACE_LEVEL_ERROR, "WdfRequestForwardToIoQueue %!STATUS!", err);
                 if (err == STATUS_WDF_BUSY) { // the queue is not accepting new requests, purged
@@ -138,6 +138,8 @@ auto usbip::alloc_wsk_context(
         if (ctx) {
                 ctx->dev = dev;
                 ctx->request = request;
+                ctx->segment = nullptr;
+                ctx->compressed = nullptr;
         }
 
         return ctx;
@@ -156,6 +158,11 @@ void usbip::free(_In_opt_ wsk_context *ctx, _In_ bool reuse_irp)
 
         ctx->mdl_buf.reset();
 
+        if (auto ptr = ctx->compressed) {
+                ExFreePoolWithTag(ptr, g_tag);
+                ctx->compressed = nullptr;
+        }
+
         if (reuse_irp) {
                 IoReuseIrp(ctx->wsk_irp, STATUS_SUCCESS);
         }
@@ -13,6 +13,7 @@ namespace usbip
 {
 
 struct device_ctx;
+struct segmented_transfer;
 
 struct wsk_context
 {
@@ -21,7 +22,9 @@ struct wsk_context
         // transient data
 
         WDFREQUEST request; // can be WDF_NO_HANDLE
+        segmented_transfer *segment; // holds a reference if a segment is sent without WDFREQUEST
         Mdl mdl_buf; // describes URB_FROM_IRP()->TransferBuffer(MDL)
+        void *compressed; // LZ4 block that mdl_buf describes, is owned, see compress_transfer
 
         // preallocated data
 
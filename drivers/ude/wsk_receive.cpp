@@ -13,6 +13,13 @@
 #include "network.h"
 #include "driver.h"
 #include "ioctl.h"
+#include "frame_clock.h"
+#include "jitter_buffer.h"
+#include "descriptor_cache.h"
+#include "local_requests.h"
+#include "flow_control.h"
+#include "segmented_transfer.h"
+#include "compression.h"
 
 #include <libdrv\usbd_helper.h>
 #include <libdrv\dbgcommon.h>
@@ -21,15 +28,44 @@
 #include <libdrv\pdu.h>
 #include <libdrv\ch9.h>
 
+#include <usbip\proto_op.h>
+#include <usbip\lz4.h>
+
 extern "C" {
 #include <usbdlib.h>
 }
 
+/*
+ * Interrupt-heavy devices produce bursts of small RET_SUBMIT, two WskReceive calls per PDU
+ * (header and payload) cost more than the data itself. If there is nothing to copy from the buffer,
+ * it is refilled with all data that are available in the socket, up to its size.
+ * Large payloads are received directly into URB's buffer as before, only their beginning
+ * that is already in the buffer is copied.
+ *
+ * Is used by receive thread only.
+ */
+struct usbip::recv_buffer
+{
+	MDL *mdl; // describes data[RECV_BUFFER_SIZE]
+	UCHAR *data;
+	ULONG start; // [start, end) are not consumed yet
+	ULONG end;
+
+	// statistics
+	UINT64 pdus;
+	UINT64 receives; // WskReceive calls
+};
+
 namespace
 {
 
 using namespace usbip;
 
+enum : ULONG { 
+	RECV_BUFFER_SIZE = 8*1024,
+	DIRECT_RECEIVE_SIZE = 1024, // if the buffer is empty and the rest is larger, it is received directly
+};
+
 constexpr auto check(_In_ ULONG TransferBufferLength, _In_ int actual_length)
 {
 	return  actual_length >= 0 && static_cast<ULONG>(actual_length) <= TransferBufferLength ? 
@@ -238,23 +274,29 @@ PAGED auto fill_isoc_data(_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer
 
 /*
  * Layout: transfer buffer(IN only), usbip_iso_packet_descriptor[].
+ * @param buffer is nullptr for OUT transfer
  */
 _IRQL_requires_same_
 _IRQL_requires_max_(PASSIVE_LEVEL)
-PAGED auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_submit &ret, _Inout_ URB &urb)
+PAGED auto isoch_transfer(
+	_In_ wsk_context &ctx, _In_ const usbip_header_ret_submit &ret, 
+	_Inout_ _URB_ISOCH_TRANSFER &r, _In_opt_ UCHAR *buffer)
 {
 	PAGED_CODE();
 	auto cnt = ret.number_of_packets;
 
-	auto &r = urb.UrbIsochronousTransfer;
 	r.ErrorCount = ret.error_count;
 
 	if (cnt && cnt == ret.error_count) {
 		r.Hdr.Status = USBD_STATUS_ISOCH_REQUEST_FAILED;
 	}
 
+	if (cnt && cnt != ret.error_count) {
+		update_frame_clock(*ctx.dev, ret.start_frame);
+	}
+
 	if (r.TransferFlags & USBD_START_ISO_TRANSFER_ASAP) {
-		r.StartFrame = ret.start_frame;
+		r.StartFrame = to_local_frame(*ctx.dev, ret.start_frame);
 	}
 
 	if (cnt >= 0 && ULONG(cnt) == r.NumberOfPackets) {
@@ -265,6 +307,14 @@ PAGED auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_sub
 		return STATUS_INVALID_PARAMETER;
 	}
 
+	return fill_isoc_data(r, buffer, ret.actual_length, ctx.isoc);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_max_(PASSIVE_LEVEL)
+PAGED auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_submit &ret, _Inout_ URB &urb)
+{
+	PAGED_CODE();
 	UCHAR *buffer{};
 
 	if (is_transfer_dir_in(ctx.hdr)) { // TransferFlags can have wrong direction
@@ -275,7 +325,7 @@ PAGED auto isoch_transfer(_In_ wsk_context &ctx, _In_ const usbip_header_ret_sub
 		}
 	}
 
-	return fill_isoc_data(r, buffer, ret.actual_length, ctx.isoc);
+	return isoch_transfer(ctx, ret, urb.UrbIsochronousTransfer, buffer);
 }
 
 _IRQL_requires_same_
@@ -289,10 +339,14 @@ PAGED void complete_and_set_null(_Inout_ WDFREQUEST &request, _In_ NTSTATUS stat
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void post_control_transfer(_In_ const device_ctx &dev, _In_ const _URB_CONTROL_TRANSFER &r, _In_ void *TransferBuffer)
+PAGED void post_control_transfer(_Inout_ device_ctx &dev, _In_ const _URB_CONTROL_TRANSFER &r, _In_ void *TransferBuffer)
 {
 	PAGED_CODE();
 
+	if (USBD_SUCCESS(r.Hdr.Status) && (r.TransferFlags & USBD_DEFAULT_PIPE_TRANSFER)) {
+		track_control_response(dev, get_setup_packet(r), TransferBuffer, r.TransferBufferLength);
+	}
+
 	auto dsc = static_cast<USB_COMMON_DESCRIPTOR*>(TransferBuffer);
 	auto dsc_len = static_cast<UINT16>(r.TransferBufferLength);
 
@@ -314,9 +368,6 @@ PAGED void post_control_transfer(_In_ const device_ctx &dev, _In_ const _URB_CON
 		    dsc_len > sizeof(d) && d.bLength == sizeof(d) && d.wTotalLength == dsc_len) {
 			NT_ASSERT(libdrv::is_valid(d));
 			log(d);
-			if (dev.speed() == USB_SPEED_FULL) {
-				fix_full_speed_endpoint_interval(&d);
-			}
 		}
 		break;
 	case USB_DEVICE_DESCRIPTOR_TYPE:
@@ -327,11 +378,17 @@ PAGED void post_control_transfer(_In_ const device_ctx &dev, _In_ const _URB_CON
 		}
 		break;
 	}
+
+	fix_descriptor(dev, dsc, dsc_len);
+
+	if (USBD_SUCCESS(r.Hdr.Status)) {
+		cache_descriptor(dev, get_setup_packet(r), dsc, dsc_len);
+	}
 }
 
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
-PAGED void post_process_transfer_buffer(_In_ const device_ctx &dev, _In_ const URB &urb, _In_ void *TransferBuffer)
+PAGED void post_process_transfer_buffer(_Inout_ device_ctx &dev, _In_ const URB &urb, _In_ void *TransferBuffer)
 {
 	PAGED_CODE();
 
@@ -472,6 +529,72 @@ PAGED auto prepare_wsk_mdl(_Out_ MDL* &mdl, _Inout_ wsk_context &ctx, _Inout_ UR
 	return STATUS_SUCCESS;
 }
 
+/*
+ * @param mdl, offset are advanced by len
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto copy_to_mdl(_Inout_ MDL* &mdl, _Inout_ ULONG &offset, _In_ const UCHAR *src, _In_ ULONG len)
+{
+	PAGED_CODE();
+
+	while (len) {
+		if (!mdl) {
+			return STATUS_BUFFER_TOO_SMALL;
+		}
+
+		auto dst = static_cast<UCHAR*>(MmGetSystemAddressForMdlSafe(mdl, NormalPagePriority | MdlMappingNoExecute));
+		if (!dst) {
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+
+		auto cnt = MmGetMdlByteCount(mdl);
+		NT_ASSERT(offset < cnt);
+
+		auto n = min(len, cnt - offset);
+		RtlCopyMemory(dst + offset, src, n);
+
+		src += n;
+		len -= n;
+
+		if ((offset += n) == cnt) {
+			mdl = mdl->Next;
+			offset = 0;
+		}
+	}
+
+	return STATUS_SUCCESS;
+}
+
+/*
+ * Receive what is available in the socket, at least one byte.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto refill(_Inout_ device_ctx &dev, _Inout_ recv_buffer &rb)
+{
+	PAGED_CODE();
+	NT_ASSERT(rb.start == rb.end);
+
+	rb.start = rb.end = 0;
+	WSK_BUF buf{ .Mdl = rb.mdl, .Length = RECV_BUFFER_SIZE };
+
+	SIZE_T actual{};
+	auto st = receive(dev.sock(), &buf, 0, &actual);
+	++rb.receives;
+
+	TraceWSK("recv_buffer %!STATUS!, %Iu byte(s)", st, actual);
+
+	if (NT_ERROR(st)) {
+		return st;
+	} else if (!actual) {
+		return STATUS_CONNECTION_DISCONNECTED; // EOF
+	}
+
+	rb.end = ULONG(actual);
+	return STATUS_SUCCESS;
+}
+
 _IRQL_requires_same_
 _IRQL_requires_(PASSIVE_LEVEL)
 PAGED auto receive(_Inout_ wsk_context &ctx, _Inout_ WSK_BUF &buf)
@@ -481,13 +604,45 @@ PAGED auto receive(_Inout_ wsk_context &ctx, _Inout_ WSK_BUF &buf)
 	auto &dev = *ctx.dev;
 	NT_ASSERT(verify(buf, ctx.is_isoc));
 
+	WSK_BUF rest = buf;
+
+	if (auto rb = dev.recv_buf) {
+		while (rest.Length) {
+			if (rb->start == rb->end) {
+				if (rest.Length > DIRECT_RECEIVE_SIZE) {
+					break;
+				} else if (auto err = refill(dev, *rb)) {
+					return err;
+				}
+			}
+
+			auto n = min(ULONG(rest.Length), rb->end - rb->start);
+			auto offset = ULONG(rest.Offset);
+
+			if (auto err = copy_to_mdl(rest.Mdl, offset, rb->data + rb->start, n)) {
+				Trace(TRACE_LEVEL_ERROR, "copy_to_mdl %!STATUS!", err);
+				return err;
+			}
+
+			rest.Offset = offset;
+			rest.Length -= n;
+			rb->start += n;
+		}
+
+		if (!rest.Length) {
+			return STATUS_SUCCESS;
+		}
+
+		++rb->receives;
+	}
+
 	SIZE_T actual{};
-	auto st = receive(dev.sock(), &buf, WSK_FLAG_WAITALL, &actual);
+	auto st = receive(dev.sock(), &rest, WSK_FLAG_WAITALL, &actual);
 
 	TraceWSK("req %04x, %!STATUS!, %Iu byte(s)", ptr04x(ctx.request), st, actual);
 
 	return  NT_ERROR(st) ? st :
-		actual == buf.Length ? STATUS_SUCCESS :
+		actual == rest.Length ? STATUS_SUCCESS :
 		actual ? STATUS_RECEIVE_PARTIAL : 
 		STATUS_CONNECTION_DISCONNECTED; // EOF
 }
@@ -538,6 +693,104 @@ PAGED auto recv_payload(_Inout_ wsk_context &ctx, _In_ size_t length)
 	return receive(ctx, buf);
 }
 
+/*
+ * @return the size of LZ4 block if the payload of RET_SUBMIT is compressed, see OP_EXT_COMPRESSION_LZ4
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto compressed_size(_In_ const device_ctx &dev, _In_ const usbip_header &hdr) -> size_t
+{
+	PAGED_CODE();
+	auto &ret = hdr.u.ret_submit;
+
+	return  dev.ext->extensions & OP_EXT_COMPRESSION_LZ4 && hdr.base.command == USBIP_RET_SUBMIT && 
+		hdr.base.direction == USBIP_DIR_IN && !ret.number_of_packets && 
+		ret.actual_length > 0 && ret.start_frame > 0 ? ret.start_frame : 0;
+}
+
+/*
+ * The block is received into a temporary buffer because the transfer buffer can be smaller.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto recv_compressed(_Inout_ wsk_context &ctx, _In_ size_t length)
+{
+	PAGED_CODE();
+	auto &ret = get_ret_submit(ctx);
+
+	if (length > lz4::compress_bound(ret.actual_length)) {
+		Trace(TRACE_LEVEL_ERROR, "LZ4 block of %Iu bytes, actual_length(%d)", length, ret.actual_length);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	unique_ptr block(libdrv::uninitialized, NonPagedPoolNx, length);
+
+	if (auto ptr = block.get()) {
+		ctx.mdl_buf = Mdl(ptr, ULONG(length));
+	} else {
+		Trace(TRACE_LEVEL_ERROR, "Can't allocate %Iu bytes", length);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	if (auto err = ctx.mdl_buf.prepare_nonpaged()) {
+		Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
+		return err;
+	}
+
+	WSK_BUF buf{ .Mdl = ctx.mdl_buf.get(), .Length = length };
+	auto err = receive(ctx, buf);
+
+	ctx.mdl_buf.reset(); // describes the block
+	return err ? err : decompress_transfer(ctx.request, block.get(), ULONG(length), ret.actual_length);
+}
+
+/*
+ * RET_SUBMIT for isochronous IN transfer that was sent by jitter buffer.
+ * @see device::send_isoch_prefetch
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto recv_prefetched(_Inout_ wsk_context &ctx, _Inout_ jitter_slot &slot, _In_ size_t length)
+{
+	PAGED_CODE();
+
+	auto &ret = get_ret_submit(ctx);
+	auto &r = *slot.urb;
+
+	if (auto err = prepare_isoc(ctx, ret.number_of_packets)) {
+		return err;
+	}
+
+	if (ULONG(ret.number_of_packets) != r.NumberOfPackets || check(r.TransferBufferLength, ret.actual_length)) {
+		Trace(TRACE_LEVEL_ERROR, "number_of_packets(%d), actual_length(%d)", ret.number_of_packets, ret.actual_length);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (ret.actual_length) {
+		ctx.mdl_buf = Mdl(slot.buffer, ULONG(ret.actual_length));
+		if (auto err = ctx.mdl_buf.prepare_nonpaged()) {
+			Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!", err);
+			return err;
+		}
+	}
+
+	WSK_BUF buf{ .Mdl = make_mdl_chain(ctx), .Length = length };
+	return receive(ctx, buf);
+}
+
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED auto ret_prefetched(_Inout_ wsk_context &ctx, _Inout_ jitter_slot &slot)
+{
+	PAGED_CODE();
+
+	auto &ret = get_ret_submit(ctx);
+	auto &r = *slot.urb;
+
+	r.Hdr.Status = ret.status ? to_windows_status(ret.status) : USBD_STATUS_SUCCESS;
+	return isoch_transfer(ctx, ret, r, slot.buffer);
+}
+
 /*
  * For RET_UNLINK irp was completed right after CMD_UNLINK was issued.
  * @see send_cmd_unlink
@@ -631,15 +884,35 @@ PAGED void recv_loop(_Inout_ device_ctx &dev, _Inout_ wsk_context &ctx)
 		NT_ASSERT(!ctx.request); // must be completed and zeroed on every loop
 		ctx.request = ret_command(ctx);
 
-		if (auto sz = get_payload_size(ctx.hdr); !sz) {
+		if (auto rb = dev.recv_buf) {
+			++rb->pdus;
+		}
+
+		auto slot = ctx.request ? nullptr : jitter_slot_take(dev, ctx.hdr);
+
+		if (!(ctx.request || slot)) {
+			segment_received(dev, ctx.hdr); // OUT, has no payload
+		}
+
+		auto lz4 = compressed_size(dev, ctx.hdr);
+		auto sz = lz4 ? lz4 : get_payload_size(ctx.hdr);
+
+		if (!sz) {
 			//
 		} else if (dev.unplugged) {
 			status = STATUS_CANCELLED; // do not receive payload
+		} else if (slot) {
+			status = recv_prefetched(ctx, *slot, sz);
 		} else {
-			auto f = ctx.request ? recv_payload : drain_payload;
+			auto f = !ctx.request ? drain_payload : lz4 ? recv_compressed : recv_payload;
 			status = f(ctx, sz);
 		}
 
+		if (slot) { // isochronous transfer always has payload
+			auto st = status ? status : sz ? ret_prefetched(ctx, *slot) : STATUS_INVALID_PARAMETER;
+			jitter_slot_received(dev, *slot, st);
+		}
+
 		if (auto &req = ctx.request) {
 			auto st = status ? status : ret_submit(ctx);
 			complete_and_set_null(req, st);
@@ -647,9 +920,60 @@ PAGED void recv_loop(_Inout_ device_ctx &dev, _Inout_ wsk_context &ctx)
 	}
 }
 
+/*
+ * Must be called before segmented_transfer_completed, it frees req.segments.
+ * TransferBufferLength is at the same offset in URBs of all transfer types.
+ * @see vhci::device_statistics
+ */
+_IRQL_requires_same_
+_IRQL_requires_max_(DISPATCH_LEVEL)
+void update_statistics(_In_ const request_ctx &req, _In_ const endpoint_ctx &endp, _In_ const URB &urb)
+{
+	if (!req.submitted) {
+		return;
+	}
+
+	auto &dev = *get_device_ctx(endp.device);
+
+	auto &r = urb.UrbBulkOrInterruptTransfer;
+	static_assert(offsetof(URB, UrbBulkOrInterruptTransfer.TransferBufferLength) == offsetof(URB, UrbControlTransfer.TransferBufferLength));
+	static_assert(offsetof(URB, UrbBulkOrInterruptTransfer.TransferBufferLength) == offsetof(URB, UrbIsochronousTransfer.TransferBufferLength));
+
+	auto &epd = endp.descriptor;
+	auto dir_in = usb_endpoint_type(epd) == UsbdPipeTypeControl ? 
+		      IsTransferDirectionIn(r.TransferFlags) : usb_endpoint_dir_in(epd);
+
+	LONG64 len = r.TransferBufferLength;
+	if (auto st = req.segments) {
+		len += st->actual_length;
+	}
+
+	InterlockedAdd64(dir_in ? &dev.bytes_in : &dev.bytes_out, len);
+	InterlockedIncrement64(&dev.completed_urbs);
+
+	auto usec = ULONGLONG(KeQueryInterruptTime() - req.submitted)/10; // 100ns units
+	auto i = usec ? RtlFindMostSignificantBit(usec) : 0; // log2
+
+	InterlockedIncrement64(&dev.latency[min(i, vhci::LATENCY_BUCKETS - 1)]);
+}
+
 } // namespace
 
 
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void usbip::fix_descriptor(_In_ const device_ctx &dev, _Inout_ void *data, _In_ USHORT length)
+{
+	PAGED_CODE();
+
+	auto &d = *static_cast<USB_CONFIGURATION_DESCRIPTOR*>(data);
+
+	if (length > sizeof(d) && d.bLength == sizeof(d) && d.bDescriptorType == USB_CONFIGURATION_DESCRIPTOR_TYPE &&
+	    d.wTotalLength == length && dev.speed() == USB_SPEED_FULL) {
+		fix_full_speed_endpoint_interval(&d);
+	}
+}
+
 _IRQL_requires_same_
 _Function_class_(KSTART_ROUTINE)
 PAGED void usbip::recv_thread_function(_In_ void *context)
@@ -662,12 +986,30 @@ PAGED void usbip::recv_thread_function(_In_ void *context)
 	//KeSetPriorityThread(KeGetCurrentThread(), LOW_REALTIME_PRIORITY);
 	auto dev = get_device_ctx(device);
 
+	unique_ptr data(libdrv::uninitialized, NonPagedPoolNx, RECV_BUFFER_SIZE);
+	Mdl mdl(data.get(), data ? RECV_BUFFER_SIZE : 0);
+
+	recv_buffer rb{ .mdl = mdl.get(), .data = data.get<UCHAR>() };
+
+	if (!(rb.data && rb.mdl)) {
+		Trace(TRACE_LEVEL_ERROR, "Can't allocate %lu bytes, PDUs will be received directly", RECV_BUFFER_SIZE);
+	} else if (auto err = mdl.prepare_nonpaged()) {
+		Trace(TRACE_LEVEL_ERROR, "prepare_nonpaged %!STATUS!, PDUs will be received directly", err);
+	} else {
+		dev->recv_buf = &rb;
+	}
+
 	if (auto ctx = alloc_wsk_context(dev, WDF_NO_HANDLE)) {
 		recv_loop(*dev, *ctx);
 		NT_ASSERT(!ctx->request);
 		free(ctx, true);
 	}
 
+	if (dev->recv_buf) {
+		dev->recv_buf = nullptr;
+		TraceDbg("dev %04x, %!UINT64! PDUs, %!UINT64! receives", ptr04x(device), rb.pdus, rb.receives);
+	}
+
 	if (!dev->unplugged) {
 		TraceDbg("dev %04x, detaching", ptr04x(device));
 		device::detach(device);
@@ -700,6 +1042,10 @@ void usbip::complete(_In_ WDFREQUEST request, _In_ NTSTATUS status)
 		return;
 	}
 
+	if (defer_segmented_completion(request, status)) {
+		return;
+	}
+
 	auto &urb = *libdrv::urb_from_irp(irp);
 	auto &urb_st = urb.UrbHeader.Status;
 
@@ -713,6 +1059,14 @@ void usbip::complete(_In_ WDFREQUEST request, _In_ NTSTATUS status)
 	}
 
 	auto endp = get_endpoint_ctx(req.endpoint);
+
+	if (!status && USBD_SUCCESS(urb_st)) {
+		update_statistics(req, *endp, urb);
+		compression_completed(request, urb);
+	}
+
+	segmented_transfer_completed(request, urb, status);
+	flow_control_completed(request, status || !USBD_SUCCESS(urb_st) ? nullptr : &urb);
 	
 	if (libdrv::RaiseIrql lvl(DISPATCH_LEVEL); auto boost = endp->priority_boost) {
 		WdfRequestCompleteWithPriorityBoost(request, status, boost); // UdecxUrbComplete has no PriorityBoost
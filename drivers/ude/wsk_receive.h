@@ -10,10 +10,20 @@
 namespace usbip
 {
 
+struct device_ctx;
+
 _IRQL_requires_same_
 _Function_class_(KSTART_ROUTINE)
 PAGED void recv_thread_function(_In_ void *context);
 
+/*
+ * Patch a response on GET_DESCRIPTOR before it is cached or passed to the OS.
+ * Is called for URBs and for prefetched descriptors, see prefetch_descriptors.
+ */
+_IRQL_requires_same_
+_IRQL_requires_(PASSIVE_LEVEL)
+PAGED void fix_descriptor(_In_ const device_ctx &dev, _Inout_ void *data, _In_ USHORT length);
+
 _IRQL_requires_same_
 _IRQL_requires_max_(DISPATCH_LEVEL)
 void complete(_In_ WDFREQUEST request, _In_ NTSTATUS status);
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Decides whether the next transfer of an endpoint is compressed, see OP_EXT_COMPRESSION_LZ4.
+ * Does not depend on Windows headers and the standard library, it is not thread-safe.
+ *
+ * Compression pays off if it reduces the size noticeably and the time to compress a transfer is less
+ * than the time it saves on the link, compress_rate*(1 - ratio) > link_rate, otherwise CPU becomes the bottleneck. The ratio and the rates are exponential moving averages.
+ * If compression is not worthwhile, the next transfers are sent as is, then one is compressed again
+ * to reevaluate. The interval doubles while the result stays poor.
+ */
+
+namespace usbip
+{
+
+struct compression_policy
+{
+        enum : unsigned int {
+                MIN_LENGTH = 4096, // shorter transfers are not compressed
+                MAX_LENGTH = 64*1024, // longer ones too, this bounds the time spent by the compressor
+                RATIO_SCALE = 1024,
+                MAX_RATIO = 7*RATIO_SCALE/8, // compressed*RATIO_SCALE/original
+                MIN_SKIP = 16, // transfers that are sent uncompressed before the next probe
+                MAX_SKIP = 1024,
+        };
+
+        unsigned int ratio; // zero if there are no samples
+        unsigned long long compress_rate; // bytes per millisecond, zero if there are no samples
+        unsigned long long link_rate; // bytes on the wire per millisecond, zero if there are no samples
+
+        unsigned int skip; // remaining transfers to send uncompressed
+        unsigned int interval; // the current value of skip, zero if compression is worthwhile
+
+        bool worthwhile() const
+        {
+                return ratio <= MAX_RATIO && (!link_rate || compress_rate*(RATIO_SCALE - ratio) > link_rate*RATIO_SCALE);
+        }
+
+        /*
+         * @return true if the transfer must be compressed
+         */
+        bool next(unsigned long long length)
+        {
+                if (length < MIN_LENGTH || length > MAX_LENGTH) {
+                        return false;
+                }
+
+                if (skip) {
+                        --skip;
+                        return false;
+                }
+
+                return true;
+        }
+
+        /*
+         * @param compressed zero if the result is not smaller than the original
+         * @param usec spent by the compressor
+         */
+        void compressed(unsigned long long original, unsigned long long compressed, unsigned long long usec)
+        {
+                auto r = compressed && compressed < original ?
+                         static_cast<unsigned int>(compressed*RATIO_SCALE/original) : RATIO_SCALE;
+
+                ratio = ratio ? (7*ratio + r)/8 : r;
+                average(compress_rate, original*1000/(usec ? usec : 1));
+
+                if (worthwhile()) {
+                        interval = 0;
+                } else {
+                        interval = !interval ? MIN_SKIP : 2*interval < MAX_SKIP ? 2*interval : MAX_SKIP;
+                        skip = interval;
+                }
+        }
+
+        /*
+         * A transfer has completed successfully.
+         * @param wire_bytes of the payload that was sent
+         * @param usec from submission to completion
+         */
+        void completed(unsigned long long wire_bytes, unsigned long long usec)
+        {
+                if (wire_bytes && usec) {
+                        average(link_rate, wire_bytes*1000/usec);
+                }
+        }
+
+private:
+        static void average(unsigned long long &avg, unsigned long long sample)
+        {
+                avg = avg ? (7*avg + sample)/8 : sample;
+        }
+};
+
+} // namespace usbip
@@ -7,6 +7,20 @@ constexpr auto &tcp_port = "3240";
 constexpr auto &driver_filename = L"usbip2_ude"; // used by filter driver
 constexpr auto &persistent_devices_value_name = L"PersistentDevices";
 
+constexpr auto &jitter_buffer_depth_value_name = L"IsochJitterBufferDepth"; // REG_DWORD, zero or absent - disabled
+constexpr auto &jitter_buffer_underrun_rate_value_name = L"IsochJitterBufferUnderrunRate"; // REG_DWORD, per mille
+
+constexpr auto &local_requests_value_name = L"LocalStandardRequests"; // REG_DWORD, zero or absent - disabled
+constexpr auto &local_requests_classes_value_name = L"LocalStandardRequestsClasses"; // REG_BINARY, USB class codes
+
+constexpr auto &usb2_ports_value_name = L"Usb2Ports"; // REG_DWORD, number of root hub ports
+constexpr auto &usb3_ports_value_name = L"Usb3Ports";
+
+constexpr auto &bulk_in_flow_control_value_name = L"BulkInFlowControl"; // REG_DWORD, zero or absent - disabled
+constexpr auto &bulk_out_segment_size_value_name = L"BulkOutSegmentSize"; // REG_DWORD, bytes, zero or absent - disabled
+constexpr auto &descriptor_prefetch_value_name = L"DescriptorPrefetch"; // REG_DWORD, zero or absent - disabled
+constexpr auto &payload_compression_value_name = L"PayloadCompression"; // REG_DWORD, zero or absent - disabled
+
 enum op_status_t // op_common.status
 {
         ST_OK,
@@ -23,4 +37,9 @@ enum {
         BUS_ID_SIZE = 32 
 };
 
+enum { 
+        MAX_HUB_PORTS = 127, // upper limit for the number of USB2 or USB3 ports of the root hub
+        MAX_PORTS = 2*MAX_HUB_PORTS, // USB2 ports are followed by USB3 ones
+};
+
 } // namespace usbip
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * LZ4 block format, see https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * Is used by the driver and by userspace, does not depend on Windows headers and the standard library.
+ * The compressor is greedy with a single hash table, it favours speed over ratio.
+ * The decompressor validates its input, it is received from the network.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+namespace usbip::lz4
+{
+
+enum : size_t {
+        MIN_MATCH = 4,
+        LAST_LITERALS = 5, // the last bytes of a block are always literals
+        MFLIMIT = 12, // the last match must start at least that number of bytes before the end of a block
+        MAX_DISTANCE = 65535,
+        MAX_INPUT_SIZE = 0x7E000000,
+
+        HASH_LOG = 12,
+        HASH_TABLE_SIZE = size_t(1) << HASH_LOG, // entries of the table that compress() requires
+};
+
+using hash_entry = unsigned int; // offset from the beginning of the input
+
+/*
+ * @return the size of a buffer for incompressible input
+ */
+constexpr auto compress_bound(size_t n)
+{
+        return n + n/255 + 16;
+}
+
+namespace detail
+{
+
+inline auto read32(const unsigned char *p)
+{
+        unsigned int v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+}
+
+constexpr auto hash(unsigned int v)
+{
+        return (v*2654435761U) >> (32 - HASH_LOG);
+}
+
+constexpr auto length_bytes(size_t len) // the token nibble and extension bytes
+{
+        return len < 15 ? 0 : (len - 15)/255 + 1;
+}
+
+inline auto write_length(unsigned char *op, size_t len)
+{
+        for (len -= 15; len >= 255; len -= 255) {
+                *op++ = 255;
+        }
+
+        *op++ = static_cast<unsigned char>(len);
+        return op;
+}
+
+inline auto write_literals(unsigned char *op, const unsigned char *src, size_t len)
+{
+        auto token = op++;
+        *token = static_cast<unsigned char>((len < 15 ? len : 15) << 4);
+
+        if (len >= 15) {
+                op = write_length(op, len);
+        }
+
+        memcpy(op, src, len);
+        return op + len;
+}
+
+} // namespace detail
+
+/*
+ * @param table must have HASH_TABLE_SIZE entries, the content is not preserved
+ * @return compressed size, zero if it does not fit into dst
+ */
+inline size_t compress(
+        const void *src, size_t len, void *dst, size_t capacity, hash_entry *table)
+{
+        using namespace detail;
+
+        if (len > MAX_INPUT_SIZE) {
+                return 0;
+        }
+
+        auto base = static_cast<const unsigned char*>(src);
+        auto end = base + len;
+        auto ip = base;
+        auto anchor = base; // the first literal that is not written yet
+
+        auto op = static_cast<unsigned char*>(dst);
+        auto oend = op + capacity;
+
+        memset(table, 0, HASH_TABLE_SIZE*sizeof(*table));
+
+        if (len > MFLIMIT) {
+                auto mflimit = end - MFLIMIT;
+                auto matchlimit = end - LAST_LITERALS;
+
+                while (ip < mflimit) {
+                        auto v = read32(ip);
+                        auto &e = table[hash(v)];
+
+                        auto ref = base + e;
+                        e = static_cast<hash_entry>(ip - base);
+
+                        if (ref >= ip || size_t(ip - ref) > MAX_DISTANCE || read32(ref) != v) {
+                                ++ip;
+                                continue;
+                        }
+
+                        while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                                --ip;
+                                --ref;
+                        }
+
+                        auto mp = ip + MIN_MATCH;
+                        for (auto r = ref + MIN_MATCH; mp < matchlimit && *mp == *r; ++mp, ++r);
+
+                        size_t lit = ip - anchor;
+                        size_t mlen = mp - ip - MIN_MATCH;
+
+                        if (size_t(oend - op) < 1 + length_bytes(lit) + lit + 2 + length_bytes(mlen)) {
+                                return 0;
+                        }
+
+                        auto token = op;
+                        op = write_literals(op, anchor, lit);
+
+                        auto offset = static_cast<unsigned int>(ip - ref);
+                        *op++ = static_cast<unsigned char>(offset);
+                        *op++ = static_cast<unsigned char>(offset >> 8);
+
+                        *token |= static_cast<unsigned char>(mlen < 15 ? mlen : 15);
+                        if (mlen >= 15) {
+                                op = write_length(op, mlen);
+                        }
+
+                        anchor = ip = mp;
+
+                        if (ip < mflimit) { // improves the ratio of repeated data
+                                table[hash(read32(ip - 2))] = static_cast<hash_entry>(ip - 2 - base);
+                        }
+                }
+        }
+
+        size_t lit = end - anchor;
+        if (size_t(oend - op) < 1 + length_bytes(lit) + lit) {
+                return 0;
+        }
+
+        op = write_literals(op, anchor, lit);
+        return op - static_cast<unsigned char*>(dst);
+}
+
+/*
+ * @param size of decompressed data
+ * @return false if input is malformed or does not fit into dst
+ */
+inline bool decompress(const void *src, size_t len, void *dst, size_t capacity, size_t &size)
+{
+        auto ip = static_cast<const unsigned char*>(src);
+        auto iend = ip + len;
+
+        auto obase = static_cast<unsigned char*>(dst);
+        auto op = obase;
+        auto oend = op + capacity;
+
+        auto read_length = [&ip, iend] (size_t &n)
+        {
+                for (unsigned char b = 255; b == 255; n += b) {
+                        if (ip == iend) {
+                                return false;
+                        }
+                        b = *ip++;
+                }
+                return true;
+        };
+
+        size = 0;
+
+        while (ip < iend) {
+                unsigned int token = *ip++;
+
+                size_t lit = token >> 4;
+                if (lit == 15 && !read_length(lit)) {
+                        return false;
+                }
+
+                if (size_t(iend - ip) < lit || size_t(oend - op) < lit) {
+                        return false;
+                }
+
+                memcpy(op, ip, lit);
+                op += lit;
+                ip += lit;
+
+                if (ip == iend) { // the last sequence has no match
+                        break;
+                } else if (iend - ip < 2) {
+                        return false;
+                }
+
+                size_t offset = ip[0] | ip[1] << 8;
+                ip += 2;
+
+                if (!offset || offset > size_t(op - obase)) {
+                        return false;
+                }
+
+                size_t mlen = token & 15;
+                if (mlen == 15 && !read_length(mlen)) {
+                        return false;
+                }
+
+                mlen += MIN_MATCH;
+                if (size_t(oend - op) < mlen) {
+                        return false;
+                }
+
+                auto ref = op - offset;
+
+                if (offset >= mlen) {
+                        memcpy(op, ref, mlen);
+                } else {
+                        for (size_t i = 0; i < mlen; ++i) { // overlapped, repeats the pattern
+                                op[i] = ref[i];
+                        }
+                }
+
+                op += mlen;
+        }
+
+        size = op - obase;
+        return true;
+}
+
+} // namespace usbip::lz4
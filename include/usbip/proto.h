@@ -77,6 +77,11 @@ struct usbip_header_cmd_submit {
 	INT32	transfer_buffer_length;
 
 	/* it is difficult for usbip to sync frames (reserved only?) */
+	/*
+	 * If OP_EXT_COMPRESSION_LZ4 was negotiated, it is the size of LZ4 block that follows
+	 * instead of the transfer buffer of bulk OUT, zero if the payload is not compressed.
+	 * The same applies to RET_SUBMIT of bulk IN, transfer_buffer_length/actual_length are not changed.
+	 */
 	INT32	start_frame;
 
 	/* the number of iso descriptors that follows this header */
@@ -96,7 +101,7 @@ struct usbip_header_cmd_submit {
 struct usbip_header_ret_submit {
 	INT32	status;
 	INT32	actual_length; /* returned data length */
-	INT32	start_frame; /* ISO and INT */
+	INT32	start_frame; /* ISO and INT, LZ4 block size of bulk IN, see usbip_header_cmd_submit */
 	INT32	number_of_packets;  /* ISO only */
 	INT32	error_count; /* ISO only */
 };
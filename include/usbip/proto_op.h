@@ -89,6 +89,31 @@ struct op_import_reply {
 	usbip_net_pack_usb_device(pack, &(reply)->udev);\
 } while (0)
 
+/*
+ * Protocol extensions are negotiated by OP_REQ_IMPORT/OP_REP_IMPORT, this costs no round-trips.
+ *
+ * A client puts op_extensions at the end of op_import_request.busid, after its terminating NUL.
+ * A server that supports extensions replies with op_extensions at the end of op_import_reply.udev.path,
+ * flags are the subset of requested ones that will be used on the connection.
+ *
+ * Servers that are not aware of extensions compare busid as a string and reply with zeroes in the unused
+ * part of path, so the client sees no extensions. An unknown OP_ code can't be used for that,
+ * such servers close the connection.
+ *
+ * The fields are in network byte order.
+ */
+struct op_extensions
+{
+        UINT32 magic; // OP_EXTENSIONS_MAGIC
+        UINT32 flags; // OP_EXT_*
+};
+
+enum : UINT32 { OP_EXTENSIONS_MAGIC = 0x55495058 }; // "UIPX"
+
+enum : UINT32 {
+        OP_EXT_COMPRESSION_LZ4 = 1 << 0, // see usbip_header_cmd_submit.start_frame
+};
+
 /* ---------------------------------------------------------------------- */
 /* Export a USB device to a remote host. */
 #define OP_EXPORT	0x06
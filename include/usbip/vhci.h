@@ -64,6 +64,24 @@ struct device_state : base, imported_device
         state state;
 };
 
+enum { LATENCY_BUCKETS = 24 };
+
+/*
+ * Transfer counters of a device since it was attached, a client calculates rates from their differences.
+ */
+struct device_statistics
+{
+        int port;
+        UINT64 generation; // of the port, see ioctl::get_imported_devices_since; counters start anew if it changes
+
+        UINT64 bytes_in; // actual length of completed IN transfers
+        UINT64 bytes_out;
+        UINT64 urbs; // completed successfully
+        UINT32 in_flight; // URBs that are waiting for completion from a server
+
+        UINT64 latency[LATENCY_BUCKETS]; // round trip of completed URBs, [i] counts [2^i, 2^(i+1)) microseconds
+};
+
 } // namespace usbip::vhci
 
 
@@ -76,6 +94,8 @@ enum class function { // 12 bit
         get_imported_devices,
         set_persistent,
         get_persistent,
+        get_imported_devices_since,
+        get_device_statistics,
 };
 
 constexpr auto make(function id)
@@ -89,6 +109,8 @@ enum {
         GET_IMPORTED_DEVICES = make(function::get_imported_devices),
         SET_PERSISTENT = make(function::set_persistent),
         GET_PERSISTENT = make(function::get_persistent),
+        GET_IMPORTED_DEVICES_SINCE = make(function::get_imported_devices_since),
+        GET_DEVICE_STATISTICS = make(function::get_device_statistics),
 };
 
 struct plugin_hardware : base, imported_device_location {};
@@ -108,4 +130,36 @@ constexpr auto get_imported_devices_size(_In_ ULONG n)
         return offsetof(get_imported_devices, devices) + n*sizeof(*get_imported_devices::devices);
 }
 
+struct imported_device_change : imported_device
+{
+        bool removed; // the port is free, only imported_device_location::port is set
+};
+
+/*
+ * Ports that were claimed or reclaimed after the given generation.
+ * If a port has changed a few times, its current state is returned once.
+ */
+struct get_imported_devices_since : base
+{
+        UINT64 instance; // IN, of the previous call; OUT, of the driver, all devices are returned if they differ
+        UINT64 generation; // IN, of the previous call or zero to get all devices; OUT, for the next call
+        bool full; // OUT, devices[] is the full list, the state of the previous calls must be discarded
+        imported_device_change devices[ANYSIZE_ARRAY];
+};
+
+constexpr auto get_imported_devices_since_size(_In_ ULONG n)
+{
+        return offsetof(get_imported_devices_since, devices) + n*sizeof(*get_imported_devices_since::devices);
+}
+
+struct get_device_statistics : base
+{
+        device_statistics devices[ANYSIZE_ARRAY];
+};
+
+constexpr auto get_device_statistics_size(_In_ ULONG n)
+{
+        return offsetof(get_device_statistics, devices) + n*sizeof(*get_device_statistics::devices);
+}
+
 } // namespace usbip::vhci::ioctl
@@ -8,7 +8,11 @@
 #include "win_socket.h"
 
 #include <usbspec.h>
+
 #include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
 
 namespace usbip
 {
@@ -109,4 +113,56 @@ USBIP_API bool enum_exportable_devices(
         _In_ const usb_interface_f &on_intf,
         _In_opt_ const usb_device_cnt_f &on_dev_cnt = nullptr);
 
+/**
+ * Send OP_REQ_IMPORT and receive OP_REP_IMPORT.
+ * After that the connection carries CMD_SUBMIT and RET_SUBMIT of the device, see urb_client.
+ * The server exports the device to one client at a time, the driver can't attach it meanwhile.
+ * @param s socket handle
+ * @param busid of exportable device
+ * @param dev is set if true is returned
+ * @return call GetLastError() if false is returned
+ */
+USBIP_API bool import_device(_In_ SOCKET s, _In_ const char *busid, _Out_ usb_device &dev);
+
+struct remote_host
+{
+        std::string hostname;
+        std::string service;
+};
+
+/**
+ * Callbacks of enum_exportable_devices_many.
+ * They are called from worker threads, but never concurrently, thus need no synchronization.
+ * Callbacks of different hosts can interleave, callbacks of the same host are called in order.
+ * The first parameter is zero-based index of a host in hosts.
+ */
+struct enum_devices_callbacks
+{
+        std::function<void(_In_ int host, _In_ int idx, _In_ const usb_device &dev)> on_dev;
+        std::function<void(_In_ int host, _In_ int dev_idx, _In_ const usb_device &dev, _In_ int idx, _In_ const usb_interface &intf)> on_intf;
+        std::function<void(_In_ int host, _In_ int count)> on_dev_cnt;
+
+        /*
+         * Is called once for every host after its other callbacks.
+         * @param error zero if success, ERROR_TIMEOUT if the deadline was reached
+         */
+        std::function<void(_In_ int host, _In_ DWORD error)> on_done;
+};
+
+/**
+ * Resolve, connect and enumerate exportable devices of several hosts concurrently.
+ * Unreachable host does not delay the others. The call returns when all hosts are done.
+ * 
+ * @param hosts to enumerate
+ * @param timeout for each host, each recv of OP_REP_DEVLIST waits for the time that is left
+ * @param cb callbacks, any of them can be empty
+ * @param max_parallel number of hosts that are enumerated at the same time
+ * @return call GetLastError() if false is returned, errors of particular hosts are passed to on_done
+ */
+USBIP_API bool enum_exportable_devices_many(
+        _In_ const std::vector<remote_host> &hosts,
+        _In_ std::chrono::milliseconds timeout,
+        _In_ const enum_devices_callbacks &cb,
+        _In_ unsigned int max_parallel = 8);
+
 } // namespace usbip
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace usbip
+{
+
+/*
+ * OP_REP_DEVLIST is a stream of small records: usbip_usb_device is followed by bNumInterfaces of usbip_usb_interface.
+ * A recv() with MSG_WAITALL for each of them costs a syscall per record, hundreds for a large server.
+ * The reader receives as much as is available and parses records from its buffer.
+ *
+ * It can read ahead the data that follow the records it was asked for, thus the socket must not be read directly
+ * after the reader was used. The server closes the connection after OP_REP_DEVLIST, so nothing is lost.
+ *
+ * Does not depend on Windows headers, see userspace/tests.
+ *
+ * @param Recv callable long long(char *buf, size_t len) that receives at most len bytes,
+ *        returns the number of received bytes, zero on EOF, negative on error
+ */
+template<typename Recv>
+class buffered_reader
+{
+public:
+        explicit buffered_reader(_In_ Recv recv, _In_ size_t size = 64*1024) : m_recv(std::move(recv)), m_buf(size)
+        {
+                assert(size);
+        }
+
+        bool read(_Out_ void *buf, _In_ size_t len);
+
+        template<typename T>
+        auto read(_Out_ T &r) { return read(&r, sizeof(r)); }
+
+private:
+        Recv m_recv;
+        std::vector<char> m_buf;
+
+        size_t m_start{}; // of unread data
+        size_t m_end{};
+};
+
+template<typename Recv>
+bool buffered_reader<Recv>::read(_Out_ void *buf, _In_ size_t len)
+{
+        auto dst = static_cast<char*>(buf);
+
+        while (len) {
+                if (m_start == m_end) {
+                        auto bypass = len >= m_buf.size(); // does not fit, receive into the destination
+                        auto ret = bypass ? m_recv(dst, len) : m_recv(m_buf.data(), m_buf.size());
+
+                        if (ret <= 0) {
+                                return false;
+                        }
+
+                        auto cnt = static_cast<size_t>(ret);
+
+                        if (bypass) {
+                                dst += cnt;
+                                len -= cnt;
+                                continue;
+                        }
+
+                        m_start = 0;
+                        m_end = cnt;
+                }
+
+                auto cnt = std::min(len, m_end - m_start);
+                memcpy(dst, m_buf.data() + m_start, cnt);
+
+                m_start += cnt;
+                dst += cnt;
+                len -= cnt;
+        }
+
+        return true;
+}
+
+} // namespace usbip
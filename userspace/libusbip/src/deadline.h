@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <chrono>
+
+namespace usbip
+{
+
+/*
+ * Per-host deadline of enum_exportable_devices_many.
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+class deadline
+{
+public:
+        using clock = std::chrono::steady_clock;
+
+        explicit deadline(_In_ std::chrono::milliseconds timeout) : m_at(clock::now() + timeout) {}
+
+        auto expired() const { return clock::now() >= m_at; }
+
+        /*
+         * Zero timeout of a socket means infinite, thus a time that is left is rounded up.
+         * @return zero if expired, at least one millisecond otherwise
+         */
+        auto left() const
+        {
+                using namespace std::chrono;
+
+                auto d = m_at - clock::now();
+                return d > clock::duration::zero() ? ceil<milliseconds>(d) : milliseconds::zero();
+        }
+
+private:
+        clock::time_point m_at;
+};
+
+/*
+ * Makes a recv callable of buffered_reader that never blocks past the deadline.
+ * A server that trickles the data would otherwise reset the receive timeout with each chunk.
+ * The caller checks deadline::expired() after a failure to tell a timeout from an error.
+ *
+ * @param set_timeout callable bool(std::chrono::milliseconds) that sets the receive timeout of the socket
+ * @param recv callable long long(char *buf, size_t len), see buffered_reader
+ */
+template<typename SetTimeout, typename Recv>
+auto recv_before(_In_ const deadline &dl, _In_ SetTimeout set_timeout, _In_ Recv recv)
+{
+        return [&dl, set_timeout, recv] (_Out_ char *buf, _In_ size_t len) -> long long
+        {
+                auto left = dl.left();
+                return left.count() && set_timeout(left) ? recv(buf, len) : -1;
+        };
+}
+
+} // namespace usbip
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <stop_token>
+
+namespace usbip
+{
+
+/*
+ * Runs blocking operations (attach, detach, network requests) on background threads.
+ * Threads are started on demand up to the limit, so a batch of jobs runs concurrently.
+ * It does not depend on wxWidgets, so usbip.exe can use it too.
+ *
+ * A job receives stop_token that is signalled by cancel() or by the destructor.
+ * Use std::stop_callback to interrupt a blocking call, for example by CancelSynchronousIo or APC,
+ * stop() waits for running jobs.
+ * Results must be passed by the job itself, e.g. wxEvtHandler::CallAfter in GUI.
+ */
+class job_queue
+{
+public:
+        using job = std::function<void(std::stop_token)>;
+
+        /*
+         * Is called on the thread of the job after it has run.
+         * @param error exception that the job has thrown, nullptr if it has returned
+         */
+        using completion = std::function<void(std::exception_ptr error)>;
+
+        explicit job_queue(_In_ unsigned int max_threads = 32) : m_max_threads(max_threads ? max_threads : 1) {}
+        ~job_queue() { stop(); }
+
+        job_queue(const job_queue&) = delete;
+        job_queue& operator=(const job_queue&) = delete;
+
+        void post(_In_ job f, _In_ completion done)
+        {
+                std::lock_guard lck(m_mtx);
+
+                m_jobs.push_back({std::move(f), std::move(done), m_cancel.get_token()});
+
+                if (m_jobs.size() > m_idle && m_threads.size() < m_max_threads) {
+                        m_threads.emplace_back([this] (auto stop) { run(stop); });
+                }
+
+                m_cv.notify_one();
+        }
+
+        /*
+         * Jobs that have not been started yet are discarded, running jobs are requested to stop.
+         * Discarded jobs are not completed. Does not wait for running jobs.
+         */
+        void cancel()
+        {
+                std::lock_guard lck(m_mtx);
+
+                m_jobs.clear();
+                m_cancel.request_stop();
+                m_cancel = std::stop_source();
+        }
+
+        /*
+         * @return jobs that are queued or running
+         */
+        auto pending() const
+        {
+                std::lock_guard lck(m_mtx);
+                return m_jobs.size() + m_running;
+        }
+
+        /*
+         * Cancel all jobs and join the threads.
+         */
+        void stop()
+        {
+                cancel();
+
+                std::vector<std::jthread> v;
+                {
+                        std::lock_guard lck(m_mtx);
+                        v.swap(m_threads);
+                }
+
+                v.clear(); // request_stop and join
+        }
+
+private:
+        struct entry
+        {
+                job f;
+                completion done;
+                std::stop_token token;
+        };
+
+        const unsigned int m_max_threads;
+
+        mutable std::mutex m_mtx;
+        std::condition_variable_any m_cv;
+
+        std::deque<entry> m_jobs;
+        std::stop_source m_cancel;
+
+        std::vector<std::jthread> m_threads;
+        size_t m_idle{}; // threads that are waiting for a job
+        size_t m_running{};
+
+        void run(_In_ std::stop_token stop)
+        {
+                std::unique_lock lck(m_mtx);
+
+                while (true) {
+                        ++m_idle;
+                        auto ok = m_cv.wait(lck, stop, [this] { return !m_jobs.empty(); });
+                        --m_idle;
+
+                        if (!ok) {
+                                break;
+                        }
+
+                        auto e = std::move(m_jobs.front());
+                        m_jobs.pop_front();
+
+                        ++m_running;
+                        lck.unlock();
+
+                        if (!e.token.stop_requested()) { // was cancelled after it had been dequeued
+                                std::exception_ptr error;
+                                try {
+                                        e.f(e.token);
+                                } catch (...) {
+                                        error = std::current_exception();
+                                }
+
+                                if (e.done) {
+                                        e.done(error);
+                                }
+                        }
+
+                        lck.lock();
+                        --m_running;
+                }
+        }
+};
+
+} // namespace usbip
@@ -5,6 +5,8 @@
 #include "..\remote.h"
 #include "..\win_handle.h"
 
+#include "buffered_reader.h"
+#include "deadline.h"
 #include "device_speed.h"
 #include "op_common.h"
 #include "last_error.h"
@@ -14,6 +16,10 @@
 #include <usbip\proto_op.h>
 
 #include <chrono>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
 
 #include <ws2tcpip.h>
 #include <mstcpip.h>
@@ -151,6 +157,28 @@ auto recv(_In_ SOCKET s, _In_ void *buf, _In_ size_t len, _Out_opt_ bool *eof =
 	}
 }
 
+/*
+ * Receives at most len bytes for buffered_reader.
+ * @return the number of received bytes, zero on EOF, negative on error
+ */
+long long recv_some(_In_ SOCKET s, _Out_ char *buf, _In_ size_t len)
+{
+	assert(s != INVALID_SOCKET);
+
+	switch (auto ret = ::recv(s, buf, static_cast<int>(std::min(len, size_t(INT_MAX))), 0)) {
+	case SOCKET_ERROR:
+		if (wsa_set_last_error wsa; wsa) {
+			libusbip::output("recv error {}", wsa.error);
+		}
+		return -1;
+	case 0: // connection has been gracefully closed
+		libusbip::output("recv EOF");
+		return 0;
+	default:
+		return ret;
+	}
+}
+
 auto send(_In_ SOCKET s, _In_ const void *buf, _In_ size_t len)
 {
 	assert(s != INVALID_SOCKET);
@@ -364,6 +392,75 @@ auto resolve(_Inout_ set_last_error &last, _In_ const char *hostname, _In_ const
 	return ptr;
 }
 
+/*
+ * @param recv see buffered_reader
+ */
+template<typename Recv>
+bool enum_devlist(
+	_In_ SOCKET s, 
+	_In_ Recv recv,
+	_In_ const usb_device_f &on_dev, 
+	_In_ const usb_interface_f &on_intf,
+	_In_opt_ const usb_device_cnt_f &on_dev_cnt)
+{
+	assert(s != INVALID_SOCKET);
+	
+	if (!send_op_common(s, OP_REQ_DEVLIST)) {
+		return false;
+	}
+
+	if (auto err = recv_op_common(s, OP_REP_DEVLIST)) {
+		SetLastError(err);
+		return false;
+	}
+
+	buffered_reader rd(std::move(recv));
+	op_devlist_reply reply{};
+	
+	if (rd.read(reply)) {
+		PACK_OP_DEVLIST_REPLY(false, &reply);
+	} else {
+		return false;
+	}
+
+	libusbip::output("{} exportable device(s)", reply.ndev);
+	assert(reply.ndev <= INT_MAX);
+
+	if (on_dev_cnt) {
+		on_dev_cnt(reply.ndev);
+	}
+
+	usb_device lib_dev;
+
+	for (UINT32 i = 0; i < reply.ndev; ++i) {
+
+		usbip_usb_device dev{};
+
+		if (rd.read(dev)) {
+			usbip_net_pack_usb_device(false, &dev);
+			lib_dev = as_usb_device(dev);
+			on_dev(i, lib_dev);
+		} else {
+			return false;
+		}
+
+		for (int j = 0; j < dev.bNumInterfaces; ++j) {
+
+			usbip_usb_interface intf{};
+
+			if (rd.read(intf)) {
+				usbip_net_pack_usb_interface(false, &intf);
+				static_assert(sizeof(intf) == sizeof(usb_interface));
+				on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(intf));
+			} else {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
 inline auto connect_by_name(_In_ SOCKET s, _In_ LPCWSTR hostname, _In_ _In_ LPCWSTR service) noexcept
 {
 	return WSAConnectByName(s, const_cast<wchar_t*>(hostname), const_cast<wchar_t*>(service), 
@@ -372,6 +469,165 @@ inline auto connect_by_name(_In_ SOCKET s, _In_ LPCWSTR hostname, _In_ _In_ LPCW
 				nullptr, nullptr);
 }
 
+struct enum_many_ctx
+{
+	const std::vector<remote_host> &hosts;
+	std::chrono::milliseconds timeout;
+	const enum_devices_callbacks &cb;
+
+	std::atomic<size_t> next; // index of a host to enumerate
+	std::mutex mtx; // callbacks are not called concurrently
+};
+
+/*
+ * Cancels usbip::connect(CANCEL_BY_APC) of a worker thread.
+ */
+void CALLBACK on_deadline(_Inout_ PTP_CALLBACK_INSTANCE, _Inout_opt_ void *context, _Inout_ PTP_TIMER)
+{
+	if (!QueueUserAPC([] (auto) {}, static_cast<HANDLE>(context), 0)) {
+		auto err = GetLastError();
+		libusbip::output("QueueUserAPC error {}", err);
+	}
+}
+
+void start_timer(_In_ PTP_TIMER timer, _In_ std::chrono::milliseconds timeout)
+{
+	using hundred_ns = std::chrono::duration<LONGLONG, std::ratio<1, 10'000'000>>;
+
+	ULARGE_INTEGER due { 
+		.QuadPart = static_cast<ULONGLONG>(-std::chrono::duration_cast<hundred_ns>(timeout).count()) // relative
+	};
+
+	FILETIME ft { .dwLowDateTime = due.LowPart, .dwHighDateTime = due.HighPart };
+	SetThreadpoolTimer(timer, &ft, 0, 0);
+}
+
+/*
+ * APC that is already queued must not cancel connect of the next host.
+ */
+void stop_timer(_In_ PTP_TIMER timer)
+{
+	SetThreadpoolTimer(timer, nullptr, 0, 0);
+	WaitForThreadpoolTimerCallbacks(timer, true);
+	SleepEx(0, true); // run queued APC
+}
+
+auto set_timeout(_Inout_ set_last_error &last, _In_ SOCKET s, _In_ std::chrono::milliseconds timeout, _In_ bool send = true)
+{
+	auto ms = static_cast<int>(std::min(timeout.count(), static_cast<long long>(INT_MAX)));
+
+	return  do_setsockopt(last, s, SOL_SOCKET, SO_RCVTIMEO, ms) &&
+		(!send || do_setsockopt(last, s, SOL_SOCKET, SO_SNDTIMEO, ms));
+}
+
+DWORD enum_host(_Inout_ enum_many_ctx &ctx, _In_ int host, _In_ PTP_TIMER timer)
+{
+	auto &h = ctx.hosts[host];
+	deadline dl(ctx.timeout);
+
+	start_timer(timer, ctx.timeout);
+	auto sock = usbip::connect(h.hostname.c_str(), h.service.c_str(), CANCEL_BY_APC);
+	auto err = sock ? ERROR_SUCCESS : GetLastError();
+	stop_timer(timer);
+
+	switch (err) {
+	case ERROR_SUCCESS:
+		break;
+	case WSA_E_CANCELLED:
+	case ERROR_CANCELLED:
+		return ERROR_TIMEOUT;
+	default:
+		return err;
+	}
+
+	auto left = dl.left();
+	if (!left.count()) {
+		return ERROR_TIMEOUT;
+	}
+
+	if (set_last_error last(ERROR_SUCCESS); !set_timeout(last, sock.get(), left)) {
+		return last.error;
+	}
+
+	auto set_rcvtimeo = [s = sock.get()] (auto timeout)
+	{
+		set_last_error last(ERROR_SUCCESS);
+		return set_timeout(last, s, timeout, false);
+	};
+
+	auto recv = recv_before(dl, set_rcvtimeo, [s = sock.get()] (auto buf, auto len) { return recv_some(s, buf, len); });
+
+	auto &cb = ctx.cb;
+
+	auto on_dev = [&ctx, &cb, host] (auto idx, auto &dev)
+	{
+		if (cb.on_dev) {
+			std::lock_guard lck(ctx.mtx);
+			cb.on_dev(host, idx, dev);
+		}
+	};
+
+	auto on_intf = [&ctx, &cb, host] (auto dev_idx, auto &dev, auto idx, auto &intf)
+	{
+		if (cb.on_intf) {
+			std::lock_guard lck(ctx.mtx);
+			cb.on_intf(host, dev_idx, dev, idx, intf);
+		}
+	};
+
+	auto on_dev_cnt = [&ctx, &cb, host] (auto count)
+	{
+		if (cb.on_dev_cnt) {
+			std::lock_guard lck(ctx.mtx);
+			cb.on_dev_cnt(host, count);
+		}
+	};
+
+	if (enum_devlist(sock.get(), recv, on_dev, on_intf, on_dev_cnt)) {
+		return ERROR_SUCCESS;
+	}
+
+	err = GetLastError();
+	return err == WSAETIMEDOUT || dl.expired() ? ERROR_TIMEOUT : err;
+}
+
+void enum_hosts(_Inout_ enum_many_ctx &ctx)
+{
+	DWORD init_err = ERROR_SUCCESS;
+
+	NullableHandle thread(OpenThread(THREAD_SET_CONTEXT, false, GetCurrentThreadId())); // for on_deadline
+	if (!thread) {
+		init_err = GetLastError();
+		libusbip::output("OpenThread error {}", init_err);
+	}
+
+	std::unique_ptr<TP_TIMER, decltype(CloseThreadpoolTimer)&> timer(nullptr, CloseThreadpoolTimer);
+
+	if (thread) {
+		timer.reset(CreateThreadpoolTimer(on_deadline, thread.get(), nullptr));
+		if (!timer) {
+			init_err = GetLastError();
+			libusbip::output("CreateThreadpoolTimer error {}", init_err);
+		}
+	}
+
+	for (size_t i; (i = ctx.next++) < ctx.hosts.size(); ) {
+
+		auto host = static_cast<int>(i);
+		auto err = init_err ? init_err : enum_host(ctx, host, timer.get());
+
+		if (err) {
+			auto &h = ctx.hosts[i];
+			libusbip::output("{}:{} error {}", h.hostname, h.service, err);
+		}
+
+		if (ctx.cb.on_done) {
+			std::lock_guard lck(ctx.mtx);
+			ctx.cb.on_done(host, err);
+		}
+	}
+}
+
 } // namespace
 
 
@@ -470,60 +726,78 @@ bool usbip::enum_exportable_devices(
 	_In_ const usb_device_f &on_dev, 
 	_In_ const usb_interface_f &on_intf,
 	_In_opt_ const usb_device_cnt_f &on_dev_cnt)
+{
+	return enum_devlist(s, [s] (auto buf, auto len) { return recv_some(s, buf, len); }, on_dev, on_intf, on_dev_cnt);
+}
+
+bool usbip::import_device(_In_ SOCKET s, _In_ const char *busid, _Out_ usb_device &dev)
 {
 	assert(s != INVALID_SOCKET);
-	
-	if (!send_op_common(s, OP_REQ_DEVLIST)) {
+
+	op_import_request req{};
+	if (!busid || strlen(busid) >= sizeof(req.busid)) {
+		SetLastError(ERROR_INVALID_PARAMETER);
 		return false;
 	}
 
-	if (auto err = recv_op_common(s, OP_REP_DEVLIST)) {
+	strcpy_s(req.busid, busid);
+	PACK_OP_IMPORT_REQUEST(true, &req);
+
+	if (!(send_op_common(s, OP_REQ_IMPORT) && send(s, &req, sizeof(req)))) {
+		return false;
+	}
+
+	if (auto err = recv_op_common(s, OP_REP_IMPORT)) {
 		SetLastError(err);
 		return false;
 	}
 
-	op_devlist_reply reply{};
+	op_import_reply reply{};
 	
 	if (recv(s, &reply, sizeof(reply))) {
-		PACK_OP_DEVLIST_REPLY(false, &reply);
+		PACK_OP_IMPORT_REPLY(false, &reply);
 	} else {
 		return false;
 	}
 
-	libusbip::output("{} exportable device(s)", reply.ndev);
-	assert(reply.ndev <= INT_MAX);
-
-	if (on_dev_cnt) {
-		on_dev_cnt(reply.ndev);
+	if (strncmp(reply.udev.busid, busid, sizeof(reply.udev.busid))) {
+		std::string_view got(reply.udev.busid, strnlen(reply.udev.busid, sizeof(reply.udev.busid)));
+		libusbip::output("{}: busid '{}' expected, got '{}'", __func__, busid, got);
+		SetLastError(USBIP_ERROR_PROTOCOL);
+		return false;
 	}
 
-	usb_device lib_dev;
+	dev = as_usb_device(reply.udev);
+	return true;
+}
 
-	for (UINT32 i = 0; i < reply.ndev; ++i) {
+/*
+ * Each worker thread takes the next host when it is done with the previous one.
+ * A thread is blocked by a host for at most its timeout.
+ */
+bool usbip::enum_exportable_devices_many(
+	_In_ const std::vector<remote_host> &hosts,
+	_In_ std::chrono::milliseconds timeout,
+	_In_ const enum_devices_callbacks &cb,
+	_In_ unsigned int max_parallel)
+{
+	enum_many_ctx ctx { .hosts = hosts, .timeout = timeout, .cb = cb };
 
-		usbip_usb_device dev{};
+	auto cnt = std::min(static_cast<size_t>(std::max(max_parallel, 1U)), hosts.size());
+	std::vector<std::jthread> workers;
 
-		if (recv(s, &dev, sizeof(dev))) {
-			usbip_net_pack_usb_device(false, &dev);
-			lib_dev = as_usb_device(dev);
-			on_dev(i, lib_dev);
-		} else {
-			return false;
+	try {
+		workers.reserve(cnt);
+		while (workers.size() < cnt) {
+			workers.emplace_back(enum_hosts, std::ref(ctx));
 		}
-
-		for (int j = 0; j < dev.bNumInterfaces; ++j) {
-
-			usbip_usb_interface intf{};
-
-			if (recv(s, &intf, sizeof(intf))) {
-				usbip_net_pack_usb_interface(false, &intf);
-				static_assert(sizeof(intf) == sizeof(usb_interface));
-				on_intf(i, lib_dev, j, reinterpret_cast<usb_interface&>(intf));
-			} else {
-				return false;
-			}
+	} catch (std::exception &e) {
+		libusbip::output("{} of {} worker thread(s) started, {}", workers.size(), cnt, e.what());
+		if (workers.empty()) {
+			SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return false;
 		}
 	}
 
-	return true;
+	return true; // std::jthread joins
 }
@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "..\urb_client.h"
+
+#include "urb_tracker.h"
+#include "last_error.h"
+#include "output.h"
+
+#include <resources\messages.h>
+
+#include <span>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = urb_tracker::clock_type;
+using pending_urb = urb_tracker::pending_urb;
+
+auto recv(_In_ SOCKET s, _Out_ void *buf, _In_ size_t len)
+{
+        switch (auto ret = ::recv(s, static_cast<char*>(buf), static_cast<int>(len), MSG_WAITALL)) {
+        case SOCKET_ERROR:
+                return DWORD(WSAGetLastError());
+        case 0:
+                return len ? DWORD(WSAECONNRESET) : DWORD(ERROR_SUCCESS);
+        default:
+                return size_t(ret) == len ? DWORD(ERROR_SUCCESS) : DWORD(WSAECONNRESET);
+        }
+}
+
+} // namespace
+
+
+struct usbip::urb_client::impl
+{
+        SOCKET raw; // for the receiver, sock is closed concurrently by the destructor
+        Socket sock;
+        unsigned int max_batch;
+
+        std::mutex send_mtx; // the order of PDUs in the stream
+        std::vector<usbip_header> headers; // queued, network byte order
+        std::vector<std::span<const char>> payloads; // the same index as headers
+        std::vector<WSABUF> bufs;
+
+        mutable std::mutex mtx;
+        std::condition_variable idle;
+
+        urb_tracker tracker; // protected by mtx
+        size_t in_flight{}; // submitted and not completed
+        DWORD error{};
+
+        std::thread receiver;
+
+        bool queue(_In_ const usbip_header &hdr, _In_ std::span<const char> payload);
+        bool send_queued();
+
+        void receive();
+        DWORD ret_submit(_In_ const usbip_header &hdr, _Inout_ std::vector<char> &buf);
+        void ret_unlink(_In_ const usbip_header &hdr);
+        void complete(_In_ seqnum_t seqnum, _Inout_ pending_urb &urb, _In_ INT32 status, 
+                      _In_ INT32 actual_length = 0, _In_opt_ const char *data = nullptr);
+};
+
+/*
+ * Must be called under send_mtx.
+ */
+bool usbip::urb_client::impl::queue(_In_ const usbip_header &hdr, _In_ std::span<const char> payload)
+{
+        headers.push_back(to_net(hdr));
+        payloads.push_back(payload);
+
+        return headers.size() < max_batch || send_queued();
+}
+
+/*
+ * Must be called under send_mtx.
+ * Blocking WSASend returns when all buffers were sent.
+ */
+bool usbip::urb_client::impl::send_queued()
+{
+        if (headers.empty()) {
+                return true;
+        }
+
+        bufs.clear();
+
+        for (size_t i = 0; i < headers.size(); ++i) {
+                bufs.push_back({ .len = sizeof(headers[i]), .buf = reinterpret_cast<char*>(&headers[i]) });
+
+                if (auto &p = payloads[i]; !p.empty()) {
+                        bufs.push_back({ .len = ULONG(p.size()), .buf = const_cast<char*>(p.data()) });
+                }
+        }
+
+        headers.clear();
+        payloads.clear();
+
+        if (DWORD sent{}; !WSASend(sock.get(), bufs.data(), DWORD(bufs.size()), &sent, 0, nullptr, nullptr)) {
+                return true;
+        }
+
+        wsa_set_last_error wsa;
+        libusbip::output("WSASend error {}", wsa.error);
+
+        shutdown(sock.get(), SD_BOTH); // the receiver completes URBs in flight
+        return false;
+}
+
+void usbip::urb_client::impl::receive()
+{
+        std::vector<char> buf; // for IN payload of all URBs
+        DWORD err{};
+
+        while (!err) {
+                usbip_header hdr;
+                if (err = recv(raw, &hdr, sizeof(hdr)); err) {
+                        break;
+                }
+
+                byteswap_header(hdr);
+
+                switch (hdr.base.command) {
+                case USBIP_RET_SUBMIT:
+                        err = ret_submit(hdr, buf);
+                        break;
+                case USBIP_RET_UNLINK:
+                        ret_unlink(hdr);
+                        break;
+                default:
+                        libusbip::output("{}: unexpected command {}", __func__, hdr.base.command);
+                        err = USBIP_ERROR_PROTOCOL;
+                }
+        }
+
+        std::vector<std::pair<seqnum_t, pending_urb>> rest;
+        {
+                std::lock_guard lck(mtx);
+                error = err;
+                rest = tracker.take_all();
+        }
+
+        for (auto &[seqnum, urb]: rest) {
+                complete(seqnum, urb, URB_SHUTDOWN);
+        }
+
+        idle.notify_all();
+}
+
+DWORD usbip::urb_client::impl::ret_submit(_In_ const usbip_header &hdr, _Inout_ std::vector<char> &buf)
+{
+        auto seqnum = hdr.base.seqnum;
+
+        pending_urb urb;
+        UINT32 len{};
+        urb_tracker::ret_error ret_err{};
+        {
+                std::lock_guard lck(mtx);
+                ret_err = tracker.take_ret_submit(hdr, urb, len);
+        }
+
+        auto &ret = hdr.u.ret_submit;
+        DWORD err{};
+
+        switch (ret_err) {
+        case urb_tracker::ret_error::unknown_seqnum:
+                libusbip::output("{}: unknown seqnum {}", __func__, seqnum);
+                return USBIP_ERROR_PROTOCOL;
+        case urb_tracker::ret_error::bad_header:
+                libusbip::output("{}: seqnum {}, actual_length {}, number_of_packets {}",
+                                  __func__, seqnum, ret.actual_length, ret.number_of_packets);
+                err = USBIP_ERROR_PROTOCOL;
+                break;
+        case urb_tracker::ret_error::none:
+                if (len > buf.size()) {
+                        buf.resize(len);
+                }
+                err = recv(raw, buf.data(), len);
+        }
+
+        if (err) {
+                complete(seqnum, urb, URB_SHUTDOWN);
+        } else {
+                complete(seqnum, urb, ret.status, ret.actual_length, urb.dir_in ? buf.data() : nullptr);
+        }
+
+        return err;
+}
+
+void usbip::urb_client::impl::ret_unlink(_In_ const usbip_header &hdr)
+{
+        seqnum_t seqnum{};
+        pending_urb urb;
+        {
+                std::lock_guard lck(mtx);
+                if (!tracker.take_ret_unlink(hdr, seqnum, urb)) {
+                        return;
+                }
+        }
+
+        complete(seqnum, urb, URB_UNLINKED);
+}
+
+void usbip::urb_client::impl::complete(
+        _In_ seqnum_t seqnum, _Inout_ pending_urb &urb, _In_ INT32 status, 
+        _In_ INT32 actual_length, _In_opt_ const char *data)
+{
+        urb_result r;
+        {
+                std::lock_guard lck(mtx);
+                r = tracker.completed(seqnum, urb, status, actual_length, data, clock_type::now());
+        }
+
+        if (urb.f) try {
+                urb.f(r);
+        } catch (std::exception &e) {
+                libusbip::output("{}: seqnum {}, callback exception '{}'", __func__, seqnum, e.what());
+        }
+
+        bool empty{};
+        {
+                std::lock_guard lck(mtx);
+                empty = !--in_flight; // after the callback, it can submit the next URB
+        }
+
+        if (empty) {
+                idle.notify_all();
+        }
+}
+
+
+usbip::urb_client::urb_client(_Inout_ Socket &&s, _In_ UINT32 devid, _In_ unsigned int max_batch) :
+        m_impl(new impl{
+                .raw = s.get(),
+                .sock = std::move(s),
+                .max_batch = max_batch ? max_batch : 1,
+                .tracker = urb_tracker(devid) })
+{
+        assert(m_impl->sock);
+
+        m_impl->headers.reserve(m_impl->max_batch);
+        m_impl->payloads.reserve(m_impl->max_batch);
+        m_impl->bufs.reserve(2*m_impl->max_batch);
+
+        m_impl->receiver = std::thread(&impl::receive, m_impl);
+}
+
+/*
+ * closesocket() fails the blocking recv() of the receiver.
+ */
+usbip::urb_client::~urb_client()
+{
+        {
+                std::lock_guard lck(m_impl->send_mtx);
+                m_impl->send_queued();
+
+                shutdown(m_impl->sock.get(), SD_BOTH);
+                m_impl->sock.close();
+        }
+
+        m_impl->receiver.join();
+        delete m_impl;
+}
+
+seqnum_t usbip::urb_client::submit(_In_ const urb_request &r, _In_ completion f)
+{
+        if (!urb_tracker::is_valid(r)) {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return 0;
+        }
+
+        auto &m = *m_impl;
+        std::lock_guard send_lck(m.send_mtx);
+
+        usbip_header hdr;
+        {
+                std::lock_guard lck(m.mtx);
+
+                if (m.error) {
+                        SetLastError(m.error);
+                        return 0;
+                }
+
+                hdr = m.tracker.submit(r, std::move(f), clock_type::now());
+                ++m.in_flight;
+        }
+
+        m.queue(hdr, std::span(r.out, r.out_length)); // on error the receiver completes URB
+        return hdr.base.seqnum;
+}
+
+bool usbip::urb_client::unlink(_In_ seqnum_t seqnum)
+{
+        auto &m = *m_impl;
+        std::lock_guard send_lck(m.send_mtx);
+
+        usbip_header hdr;
+        {
+                std::lock_guard lck(m.mtx);
+
+                if (m.error) {
+                        SetLastError(m.error);
+                        return false;
+                }
+
+                if (!m.tracker.unlink(seqnum, hdr)) {
+                        SetLastError(ERROR_NOT_FOUND);
+                        return false;
+                }
+        }
+
+        m.headers.push_back(to_net(hdr));
+        m.payloads.emplace_back();
+
+        return m.send_queued();
+}
+
+bool usbip::urb_client::flush()
+{
+        std::lock_guard lck(m_impl->send_mtx);
+        return m_impl->send_queued();
+}
+
+bool usbip::urb_client::wait_idle(_In_ std::chrono::milliseconds timeout)
+{
+        auto &m = *m_impl;
+
+        std::unique_lock lck(m.mtx);
+        return m.idle.wait_for(lck, timeout, [&m] { return !m.in_flight; });
+}
+
+auto usbip::urb_client::get_stats(_In_ UINT8 ep, _In_ bool dir_in) const -> endpoint_stats
+{
+        std::lock_guard lck(m_impl->mtx);
+        return m_impl->tracker.get_stats(ep, dir_in);
+}
+
+DWORD usbip::urb_client::get_error() const
+{
+        std::lock_guard lck(m_impl->mtx);
+        return m_impl->error;
+}
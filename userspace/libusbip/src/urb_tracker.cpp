@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "urb_tracker.h"
+
+#include <algorithm>
+#include <bit>
+#include <climits>
+
+#ifdef _MSC_VER
+  #include <stdlib.h>
+#endif
+
+namespace
+{
+
+inline auto byteswap(UINT32 v) noexcept
+{
+#ifdef _MSC_VER
+        return static_cast<UINT32>(_byteswap_ulong(v));
+#else
+        return __builtin_bswap32(v);
+#endif
+}
+
+} // namespace
+
+
+/*
+ * The same as byteswap_header of the driver, see libdrv\pdu.cpp.
+ */
+void usbip::byteswap_header(usbip_header &hdr) noexcept
+{
+        UINT32 *base[] { &hdr.base.command, &hdr.base.seqnum, &hdr.base.devid, &hdr.base.direction, &hdr.base.ep };
+
+        for (auto v: base) {
+                *v = byteswap(*v);
+        }
+
+        static_assert(sizeof(hdr.u) == 5*sizeof(UINT32) + sizeof(hdr.u.cmd_submit.setup));
+        auto u = reinterpret_cast<UINT32*>(&hdr.u);
+
+        for (auto i = 0; i < 5; ++i) { // all fields of every command except cmd_submit.setup, the rest is zeroes
+                u[i] = byteswap(u[i]);
+        }
+}
+
+seqnum_t usbip::urb_tracker::alloc_seqnum() noexcept
+{
+        auto n = m_next_seqnum++;
+        if (!m_next_seqnum) {
+                m_next_seqnum = 1;
+        }
+        return n;
+}
+
+bool usbip::urb_tracker::is_valid(const urb_request &r) noexcept
+{
+        return r.ep <= 0xF && !(r.dir_in && r.out_length) && !(r.out_length && !r.out) &&
+               r.out_length <= INT32_MAX && r.in_length <= INT32_MAX;
+}
+
+usbip_header usbip::urb_tracker::submit(const urb_request &r, completion f, clock_type::time_point now)
+{
+        auto seqnum = alloc_seqnum();
+        auto length = r.dir_in ? r.in_length : r.out_length;
+
+        m_urbs.emplace(seqnum, pending_urb {
+                .ep = r.ep,
+                .dir_in = r.dir_in,
+                .length = length,
+                .submitted = now,
+                .f = std::move(f),
+        });
+
+        auto &st = m_stats[stats_index(r.ep, r.dir_in)];
+        ++st.submitted;
+        ++st.in_flight;
+
+        usbip_header hdr {
+                .base {
+                        .command = USBIP_CMD_SUBMIT,
+                        .seqnum = seqnum,
+                        .devid = m_devid,
+                        .direction = UINT32(r.dir_in ? USBIP_DIR_IN : USBIP_DIR_OUT),
+                        .ep = r.ep,
+                },
+                .u {
+                        .cmd_submit {
+                                .transfer_flags = r.transfer_flags,
+                                .transfer_buffer_length = INT32(length),
+                                .start_frame = 0,
+                                .number_of_packets = number_of_packets_non_isoch,
+                                .interval = r.interval,
+                                .setup = {},
+                        }
+                }
+        };
+
+        std::ranges::copy(r.setup, hdr.u.cmd_submit.setup);
+        return hdr;
+}
+
+bool usbip::urb_tracker::unlink(seqnum_t seqnum, usbip_header &hdr)
+{
+        auto i = m_urbs.find(seqnum);
+        if (i == m_urbs.end()) {
+                return false;
+        }
+
+        hdr = {};
+
+        hdr.base.command = USBIP_CMD_UNLINK;
+        hdr.base.seqnum = alloc_seqnum();
+        hdr.base.devid = m_devid;
+        hdr.base.direction = i->second.dir_in ? USBIP_DIR_IN : USBIP_DIR_OUT;
+        hdr.base.ep = i->second.ep;
+        hdr.u.cmd_unlink.seqnum = seqnum;
+
+        m_unlinks.emplace(hdr.base.seqnum, seqnum);
+        return true;
+}
+
+auto usbip::urb_tracker::take_ret_submit(const usbip_header &hdr, pending_urb &urb, UINT32 &payload) -> ret_error
+{
+        payload = 0;
+
+        auto i = m_urbs.find(hdr.base.seqnum);
+        if (i == m_urbs.end()) {
+                return ret_error::unknown_seqnum;
+        }
+
+        urb = std::move(i->second);
+        m_urbs.erase(i);
+
+        auto &ret = hdr.u.ret_submit;
+
+        if (ret.actual_length < 0 || UINT32(ret.actual_length) > urb.length ||
+            !(ret.number_of_packets == number_of_packets_non_isoch || !ret.number_of_packets)) {
+                return ret_error::bad_header;
+        }
+
+        if (urb.dir_in) { // RET_SUBMIT of OUT transfer has no payload
+                payload = ret.actual_length;
+        }
+
+        return ret_error::none;
+}
+
+bool usbip::urb_tracker::take_ret_unlink(const usbip_header &hdr, seqnum_t &seqnum, pending_urb &urb)
+{
+        if (auto i = m_unlinks.find(hdr.base.seqnum); i == m_unlinks.end()) {
+                return false;
+        } else {
+                seqnum = i->second;
+                m_unlinks.erase(i);
+        }
+
+        if (hdr.u.ret_unlink.status != URB_UNLINKED) {
+                return false;
+        } else if (auto i = m_urbs.find(seqnum); i == m_urbs.end()) {
+                return false;
+        } else {
+                urb = std::move(i->second);
+                m_urbs.erase(i);
+        }
+
+        return true;
+}
+
+auto usbip::urb_tracker::take_all() -> std::vector<std::pair<seqnum_t, pending_urb>>
+{
+        std::vector<std::pair<seqnum_t, pending_urb>> v;
+        v.reserve(m_urbs.size());
+
+        for (auto &[seqnum, urb]: m_urbs) {
+                v.emplace_back(seqnum, std::move(urb));
+        }
+
+        m_urbs.clear();
+        m_unlinks.clear();
+
+        return v;
+}
+
+int usbip::urb_tracker::latency_bucket(std::chrono::nanoseconds latency) noexcept
+{
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        if (usec <= 0) {
+                return 0;
+        }
+
+        auto i = std::bit_width(static_cast<unsigned long long>(usec)) - 1;
+        return std::min(static_cast<int>(i), URB_LATENCY_BUCKETS - 1);
+}
+
+usbip::urb_result usbip::urb_tracker::completed(
+        seqnum_t seqnum, const pending_urb &urb, INT32 status, INT32 actual_length,
+        const char *data, clock_type::time_point now)
+{
+        auto latency = now - urb.submitted;
+        auto &st = m_stats[stats_index(urb.ep, urb.dir_in)];
+
+        --st.in_flight;
+        ++st.completed;
+
+        if (status == URB_UNLINKED) {
+                ++st.unlinked;
+        } else if (status) {
+                ++st.errors;
+        } else {
+                st.bytes += actual_length;
+                ++st.latency[latency_bucket(latency)];
+        }
+
+        return urb_result {
+                .seqnum = seqnum,
+                .status = status,
+                .actual_length = actual_length,
+                .data = data,
+                .latency = latency
+        };
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "../urb_types.h"
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace usbip
+{
+
+/*
+ * All fields of usbip_header except cmd_submit.setup, host <-> network byte order.
+ */
+void byteswap_header(usbip_header &hdr) noexcept;
+
+inline auto to_net(usbip_header hdr) noexcept
+{
+        byteswap_header(hdr);
+        return hdr;
+}
+
+/*
+ * The part of urb_client that does no I/O: PDUs, seqnums of URBs and unlinks, per-endpoint statistics.
+ * It is not thread-safe, urb_client calls it under its lock.
+ * Does not depend on Windows headers, see userspace/tests.
+ */
+class urb_tracker
+{
+public:
+        using clock_type = std::chrono::steady_clock;
+        using completion = std::function<void(const urb_result&)>;
+
+        struct pending_urb
+        {
+                UINT8 ep;
+                bool dir_in;
+                UINT32 length; // transfer_buffer_length
+                clock_type::time_point submitted;
+                completion f;
+        };
+
+        enum class ret_error { none, unknown_seqnum, bad_header };
+
+        /*
+         * @param next_seqnum of the first URB
+         */
+        explicit urb_tracker(UINT32 devid, seqnum_t next_seqnum = 1) : m_devid(devid), m_next_seqnum(next_seqnum) {}
+
+        static bool is_valid(const urb_request &r) noexcept;
+
+        /*
+         * Registers the URB and counts it as submitted.
+         * @param r must be valid, see is_valid()
+         * @return CMD_SUBMIT in host byte order
+         */
+        usbip_header submit(const urb_request &r, completion f, clock_type::time_point now);
+
+        /*
+         * @param hdr receives CMD_UNLINK in host byte order
+         * @return false if there is no such URB in flight
+         */
+        bool unlink(seqnum_t seqnum, usbip_header &hdr);
+
+        /*
+         * Takes the URB of RET_SUBMIT, the header must be in host byte order.
+         * @param payload the length of IN data that follows the header
+         */
+        ret_error take_ret_submit(const usbip_header &hdr, pending_urb &urb, UINT32 &payload);
+
+        /*
+         * If CMD_UNLINK was received after RET_SUBMIT was sent, the status is zero and URB was already completed.
+         * @see <linux>/Documentation/usb/usbip_protocol.rst
+         * @return true if the URB was unlinked and it must be completed with URB_UNLINKED
+         */
+        bool take_ret_unlink(const usbip_header &hdr, seqnum_t &seqnum, pending_urb &urb);
+
+        /*
+         * The connection was closed, the URBs must be completed with URB_SHUTDOWN.
+         */
+        std::vector<std::pair<seqnum_t, pending_urb>> take_all();
+
+        /*
+         * Updates the statistics of the endpoint of the URB.
+         * @return the argument of its callback
+         */
+        urb_result completed(seqnum_t seqnum, const pending_urb &urb, INT32 status, INT32 actual_length,
+                             const char *data, clock_type::time_point now);
+
+        const endpoint_stats& get_stats(UINT8 ep, bool dir_in) const noexcept
+        {
+                return m_stats[stats_index(ep, dir_in)];
+        }
+
+        auto pending() const noexcept { return m_urbs.size(); }
+
+        static int latency_bucket(std::chrono::nanoseconds latency) noexcept;
+
+private:
+        UINT32 m_devid;
+        seqnum_t m_next_seqnum;
+
+        std::unordered_map<seqnum_t, pending_urb> m_urbs; // waiting for RET_SUBMIT
+        std::unordered_map<seqnum_t, seqnum_t> m_unlinks; // seqnum of CMD_UNLINK -> seqnum of URB
+        std::array<endpoint_stats, 2*16> m_stats{}; // see stats_index
+
+        seqnum_t alloc_seqnum() noexcept;
+
+        static int stats_index(UINT8 ep, bool dir_in) noexcept { return (ep & 0xF) << 1 | dir_in; }
+};
+
+} // namespace usbip
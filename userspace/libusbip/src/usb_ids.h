@@ -56,7 +56,11 @@ namespace usbip
 class USBIP_API UsbIds
 {
 public:
-	UsbIds(std::string_view content);
+	/*
+	 * @param lazy only vendor lines are parsed, products of a vendor and classes 
+	 *        are parsed on the first lookup; content must outlive the object in both modes
+	 */
+	UsbIds(std::string_view content, bool lazy = false);
 	~UsbIds();
 
 	UsbIds(const UsbIds&) = delete;
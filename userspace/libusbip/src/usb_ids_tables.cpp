@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2022 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usb_ids_tables.h"
+
+#include <cassert>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip;
+
+uint16_t remove_prefix_hex(std::string_view &s, int cnt)
+{
+        int val{};
+        auto end = s.data() + cnt;
+
+        auto [ptr, ec] = std::from_chars(s.data(), end, val, 16);
+
+        if (ec != std::errc{}) {
+                return 0;
+        }
+
+        assert(ptr == end);
+        s.remove_prefix(cnt);
+
+        auto res = static_cast<uint16_t>(val);
+        assert(res == val);
+
+        return res;
+}
+
+/*
+ * @param f bool(std::string_view &line, std::string_view &tail), returns true to stop
+ */
+template<typename F>
+void for_each_line(std::string_view text, F &&f)
+{
+        while (!text.empty()) {
+                auto pos = text.find('\n'); // usb.ids must be in Unix format, 0xA line endings
+                if (pos == text.npos) {
+                        std::string_view tail;
+                        f(text, tail);
+                        break;
+                }
+
+                auto line = text.substr(0, pos);
+                text.remove_prefix(pos + 1); // line + '\n'
+
+                if (!line.empty() && f(line, text)) {
+                        break;
+                }
+        }
+}
+
+/*
+ * usb.ids is sorted, but this is not guaranteed. The first of duplicates is kept.
+ */
+template<typename Key>
+void sort_unique(usb_ids_table<Key> &v, typename usb_ids_table<Key>::iterator first)
+{
+        auto key = &usb_ids_entry<Key>::key;
+        std::ranges::subrange r(first, v.end());
+
+        if (!std::ranges::is_sorted(r, {}, key)) {
+                std::ranges::stable_sort(r, {}, key);
+        }
+
+        auto dups = std::ranges::unique(r, {}, key);
+        v.erase(dups.begin(), dups.end());
+}
+
+template<typename Key>
+inline void sort_unique(usb_ids_table<Key> &v)
+{
+        sort_unique(v, v.begin());
+}
+
+template<typename Key>
+auto find(const usb_ids_table<Key> &v, Key key) noexcept
+{
+        auto i = std::ranges::lower_bound(v, key, {}, &usb_ids_entry<Key>::key);
+        return i != v.end() && i->key == key ? i->name : std::string_view();
+}
+
+constexpr std::string_view classes_section = "# List of known device classes, subclasses and protocols";
+
+constexpr auto product_key(uint16_t vid, uint16_t pid) noexcept
+{
+        return uint32_t(vid) << 16 | pid;
+}
+
+constexpr auto subclass_key(uint8_t cls, uint8_t subcls) noexcept
+{
+        return uint16_t(cls << 8 | subcls);
+}
+
+constexpr auto protocol_key(uint8_t cls, uint8_t subcls, uint8_t prot) noexcept
+{
+        return uint32_t(subclass_key(cls, subcls)) << 8 | prot;
+}
+
+} // namespace
+
+
+usbip::usb_ids_tables::usb_ids_tables(std::string_view content, bool lazy) : m_lazy(lazy)
+{
+        load(content);
+}
+
+/*
+ * Names are views of the content, tables are flat arrays sorted by key.
+ * There are no per-entry allocations, a lookup is a binary search.
+ */
+void usbip::usb_ids_tables::load(std::string_view content)
+{
+        if (m_lazy) {
+                index_vendors(content);
+                sort_unique(m_vendors);
+                sort_unique(m_vendor_blocks);
+                return;
+        }
+
+        m_products.reserve(m_products.size() + std::ranges::count(content, '\n')); // most of the lines are products
+
+        uint16_t vid{};
+        uint16_t pid{};
+
+        for_each_line(content, [this, &vid, &pid] (auto &line, auto &tail)
+        {
+                return parse_vid_pid(vid, pid, line, tail);
+        });
+
+        sort_unique(m_vendors);
+        sort_unique(m_products);
+
+        parse_classes();
+}
+
+/*
+ * Only vendor lines are parsed. Lines of products start with '\t', memchr() skips them
+ * and only the offsets of vendor lines and product blocks are recorded.
+ * Products are parsed by parse_products() on demand.
+ */
+void usbip::usb_ids_tables::index_vendors(std::string_view content)
+{
+        uint16_t vid{};
+        const char *block{}; // the first line of products of vid
+
+        auto end_block = [this, &vid, &block] (auto end)
+        {
+                if (block) {
+                        m_vendor_blocks.emplace_back(vid, std::string_view(block, end));
+                        block = nullptr;
+                }
+        };
+
+        auto end = content.data() + content.size();
+
+        for (auto p = content.data(); p < end; ) {
+
+                auto eol = static_cast<const char*>(memchr(p, '\n', end - p));
+                auto next = eol ? eol + 1 : end;
+
+                if (*p == '\t' || *p == '\n') { // product, interface or empty line
+                        p = next;
+                        continue;
+                }
+
+                std::string_view line(p, (eol ? eol : end) - p);
+                p = next;
+
+                if (line.starts_with('#')) {
+                        if (!line.starts_with(classes_section)) {
+                                continue;
+                        }
+                        end_block(line.data());
+                        m_classes_text = std::string_view(next, end);
+                        return;
+                }
+
+                end_block(line.data());
+
+                if (vid = remove_prefix_hex(line, 4); vid) { // vendor  vendor_name
+                        block = next;
+                        line.remove_prefix(2); // vendor_name
+                        m_vendors.emplace_back(vid, line);
+                }
+        }
+
+        end_block(end);
+}
+
+/*
+ * Lazy mode, must be called under m_mtx.
+ * Products of other vendors are already sorted and unique.
+ */
+void usbip::usb_ids_tables::parse_products(uint16_t vid)
+{
+        m_parsed.set(vid);
+
+        auto block = find(m_vendor_blocks, vid);
+        if (block.empty()) {
+                return;
+        }
+
+        auto cnt = m_products.size();
+        uint16_t pid{};
+
+        for_each_line(block, [this, vid, &pid] (auto &line, auto &tail) mutable
+        {
+                return parse_vid_pid(vid, pid, line, tail);
+        });
+
+        sort_unique(m_products, m_products.begin() + cnt);
+        std::ranges::inplace_merge(m_products, m_products.begin() + cnt, {}, &usb_ids_entry<uint32_t>::key);
+}
+
+void usbip::usb_ids_tables::parse_classes()
+{
+        m_classes_parsed = true;
+
+        uint8_t cls{};
+        uint8_t subcls{};
+
+        for_each_line(m_classes_text, [this, &cls, &subcls] (auto &line, auto &tail)
+        {
+                return parse_class_sub_proto(cls, subcls, line, tail);
+        });
+
+        sort_unique(m_classes);
+        sort_unique(m_subclasses);
+        sort_unique(m_protocols);
+}
+
+bool usbip::usb_ids_tables::parse_vid_pid(
+        uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail)
+{
+        if (line.starts_with(classes_section)) {
+                m_classes_text = tail;
+                return true;
+        } else if (line.starts_with('#')) {
+                // continue;
+        } else if (line.starts_with("\t\t")) { // \t \t interface  interface_name
+                assert(!"\\t\\t detected");
+        } else if (line.starts_with('\t')) { // \t device  device_name
+                line.remove_prefix(1);
+                if (pid = remove_prefix_hex(line, 4); pid) {
+                        line.remove_prefix(2); // device_name
+                        m_products.emplace_back(product_key(vid, pid), line);
+                }
+        } else if (vid = remove_prefix_hex(line, 4); vid) { // vendor  vendor_name
+                line.remove_prefix(2); // vendor_name
+                m_vendors.emplace_back(vid, line);
+        }
+
+        return false;
+}
+
+bool usbip::usb_ids_tables::parse_class_sub_proto(
+        uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view&)
+{
+        if (line.starts_with("# List of Audio Class Terminal Types")) {
+                return true;
+        } else if (line.starts_with('#')) {
+                // continue;
+        } else if (line.starts_with("\t\t")) {
+                line.remove_prefix(2);
+                if (auto prot = (uint8_t)remove_prefix_hex(line, 2)) {
+                        line.remove_prefix(2);
+                        m_protocols.emplace_back(protocol_key(cls, subcls, prot), line);
+                }
+        } else if (line.starts_with('\t')) {
+                line.remove_prefix(1);
+                if (subcls = (uint8_t)remove_prefix_hex(line, 2); subcls) {
+                        line.remove_prefix(2);
+                        m_subclasses.emplace_back(subclass_key(cls, subcls), line);
+                }
+        } else if (line.starts_with("C ")) {
+                line.remove_prefix(2);
+
+                cls = (uint8_t)remove_prefix_hex(line, 2); // "C 00  (Defined at Interface level)"
+                line.remove_prefix(2);
+
+                m_classes.emplace_back(cls, line);
+        }
+
+        return false;
+}
+
+std::pair<std::string_view, std::string_view>
+usbip::usb_ids_tables::find_product(uint16_t vid, uint16_t pid) noexcept
+{
+        std::pair<std::string_view, std::string_view> res;
+
+        res.first = find(m_vendors, vid);
+        if (res.first.empty()) {
+                return res;
+        }
+
+        if (!m_lazy) {
+                res.second = find(m_products, product_key(vid, pid));
+                return res;
+        }
+
+        std::lock_guard lck(m_mtx);
+
+        try {
+                if (!m_parsed.test(vid)) {
+                        parse_products(vid);
+                }
+                res.second = find(m_products, product_key(vid, pid));
+        } catch (std::exception &e) {
+                on_error(__func__, e);
+        }
+
+        return res;
+}
+
+std::tuple<std::string_view, std::string_view, std::string_view>
+usbip::usb_ids_tables::find_class_subclass_proto(
+        uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) noexcept
+{
+        std::tuple<std::string_view, std::string_view, std::string_view>  res;
+
+        std::unique_lock lck(m_mtx, std::defer_lock);
+        if (m_lazy) {
+                lck.lock();
+        }
+
+        if (!m_classes_parsed) try {
+                parse_classes();
+        } catch (std::exception &e) {
+                on_error(__func__, e);
+                return res;
+        }
+
+        auto &[cls, subcls, prot] = res;
+
+        cls = find(m_classes, class_id);
+        if (cls.empty()) {
+                return res;
+        }
+
+        subcls = find(m_subclasses, subclass_key(class_id, subclass_id));
+        if (subcls.empty()) {
+                return res;
+        }
+
+        prot = find(m_protocols, protocol_key(class_id, subclass_id, prot_id));
+        return res;
+}
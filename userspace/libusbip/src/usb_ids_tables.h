@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 - 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <tuple>
+#include <vector>
+#include <bitset>
+#include <mutex>
+#include <exception>
+
+namespace usbip
+{
+
+/*
+ * Sorted by key, the keys are unique.
+ */
+template<typename Key>
+struct usb_ids_entry
+{
+        Key key;
+        std::string_view name;
+};
+
+template<typename Key>
+using usb_ids_table = std::vector<usb_ids_entry<Key>>;
+
+/*
+ * Parsed usb.ids of UsbIds, names are views of the content.
+ * Does not depend on Windows headers, see userspace/tests.
+ *
+ * Lookups are not const because of the lazy mode: products of a vendor and classes are parsed
+ * when they are looked up for the first time and are kept for next lookups.
+ */
+class usb_ids_tables
+{
+public:
+        /*
+         * @param lazy see UsbIds
+         */
+        usb_ids_tables(std::string_view content, bool lazy);
+        virtual ~usb_ids_tables() = default;
+
+        auto operator!() const noexcept { return m_vendors.empty() || m_classes_text.empty(); }
+        explicit operator bool() const noexcept { return !!*this; }
+
+        void load(std::string_view content);
+
+        std::pair<std::string_view, std::string_view> find_product(uint16_t vid, uint16_t pid) noexcept;
+
+        std::tuple<std::string_view, std::string_view, std::string_view>
+                find_class_subclass_proto(uint8_t class_id, uint8_t subclass_id, uint8_t prot_id) noexcept;
+
+protected:
+        bool m_lazy{};
+        std::mutex m_mtx; // lazy mode only
+
+        usb_ids_table<uint16_t> m_vendors; // vid
+        usb_ids_table<uint32_t> m_products; // product_key()
+
+        usb_ids_table<uint16_t> m_vendor_blocks; // lazy mode, vid -> lines of its products
+        std::bitset<0x10000> m_parsed; // lazy mode, vid -> its products are in m_products
+
+        std::string_view m_classes_text; // lines after classes_section
+        bool m_classes_parsed{};
+
+        usb_ids_table<uint8_t> m_classes;
+        usb_ids_table<uint16_t> m_subclasses; // subclass_key()
+        usb_ids_table<uint32_t> m_protocols; // protocol_key()
+
+        /*
+         * A lookup has failed to parse the lines it needs.
+         */
+        virtual void on_error(const char* /*func*/, const std::exception&) noexcept {}
+
+private:
+        void index_vendors(std::string_view content);
+        void parse_products(uint16_t vid);
+        void parse_classes();
+
+        bool parse_vid_pid(uint16_t &vid, uint16_t &pid, std::string_view &line, std::string_view &tail);
+        bool parse_class_sub_proto(uint8_t &cls, uint8_t &subcls, std::string_view &line, std::string_view &tail);
+};
+
+} // namespace usbip
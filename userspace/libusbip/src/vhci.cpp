@@ -10,6 +10,8 @@
 #include <resources\messages.h>
 #include <cfgmgr32.h>
 
+#include <span>
+
 #include <initguid.h>
 #include <usbip\vhci.h>
 
@@ -249,6 +251,127 @@ std::vector<usbip::imported_device> usbip::vhci::get_imported_devices(_In_ HANDL
         return result;
 }
 
+auto usbip::vhci::get_imported_devices_since(
+        _In_ HANDLE dev, _In_ UINT64 instance, _In_ UINT64 generation, _Out_ bool &success) 
+        -> imported_devices_delta
+{
+        success = false;
+        imported_devices_delta result{};
+
+        constexpr auto devices_offset = offsetof(ioctl::get_imported_devices_since, devices);
+
+        ioctl::get_imported_devices_since *r{};
+        std::vector<char> buf;
+
+        for (auto cnt = 4; true; cnt <<= 1) {
+                buf.resize(ioctl::get_imported_devices_since_size(cnt));
+
+                r = reinterpret_cast<ioctl::get_imported_devices_since*>(buf.data());
+                r->size = sizeof(*r);
+                r->instance = instance;
+                r->generation = generation;
+
+                if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+                    DeviceIoControl(dev, ioctl::GET_IMPORTED_DEVICES_SINCE, r, DWORD(devices_offset), 
+                                    buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+
+                        if (BytesReturned < devices_offset) [[unlikely]] {
+                                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                                return result;
+                        }
+                                
+                        buf.resize(BytesReturned);
+                        break;
+
+                } else if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+                        return result;
+                }
+        }
+
+        auto devices_size = buf.size() - devices_offset;
+        success = !(devices_size % sizeof(*r->devices));
+
+        if (!success) {
+                libusbip::output("{}: N*sizeof(imported_device_change) != {}", __func__, devices_size);
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return result;
+        }
+
+        result.instance = r->instance;
+        result.generation = r->generation;
+        result.full = r->full;
+
+        for (auto &d: std::span(r->devices, devices_size/sizeof(*r->devices))) {
+                if (d.removed) {
+                        result.removed.push_back(d.port);
+                } else {
+                        result.devices.push_back(make_imported_device(d));
+                }
+        }
+
+        return result;
+}
+
+auto usbip::vhci::get_device_statistics(_In_ HANDLE dev, _Out_ bool &success) -> std::vector<usbip::device_statistics>
+{
+        success = false;
+        std::vector<usbip::device_statistics> result;
+
+        constexpr auto devices_offset = offsetof(ioctl::get_device_statistics, devices);
+
+        ioctl::get_device_statistics *r{};
+        std::vector<char> buf;
+
+        for (auto cnt = 4; true; cnt <<= 1) {
+                buf.resize(ioctl::get_device_statistics_size(cnt));
+
+                r = reinterpret_cast<ioctl::get_device_statistics*>(buf.data());
+                r->size = sizeof(*r);
+
+                if (DWORD BytesReturned{}; // must be set if the last arg is NULL
+                    DeviceIoControl(dev, ioctl::GET_DEVICE_STATISTICS, r, DWORD(devices_offset), 
+                                    buf.data(), DWORD(buf.size()), &BytesReturned, nullptr)) {
+
+                        if (BytesReturned < devices_offset) [[unlikely]] {
+                                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                                return result;
+                        }
+                                
+                        buf.resize(BytesReturned);
+                        break;
+
+                } else if (GetLastError() != ERROR_INSUFFICIENT_BUFFER) {
+                        return result;
+                }
+        }
+
+        auto devices_size = buf.size() - devices_offset;
+        success = !(devices_size % sizeof(*r->devices));
+
+        if (!success) {
+                libusbip::output("{}: N*sizeof(device_statistics) != {}", __func__, devices_size);
+                SetLastError(USBIP_ERROR_DRIVER_RESPONSE);
+                return result;
+        }
+
+        static_assert(usbip::LATENCY_BUCKETS == LATENCY_BUCKETS); // of the driver
+
+        for (auto &s: std::span(r->devices, devices_size/sizeof(*r->devices))) {
+                auto &d = result.emplace_back(usbip::device_statistics {
+                        .port = s.port,
+                        .generation = s.generation,
+                        .bytes_in = s.bytes_in,
+                        .bytes_out = s.bytes_out,
+                        .urbs = s.urbs,
+                        .in_flight = s.in_flight,
+                });
+
+                std::copy(std::begin(s.latency), std::end(s.latency), d.latency.begin());
+        }
+
+        return result;
+}
+
 int usbip::vhci::attach(_In_ HANDLE dev, _In_ const device_location &location)
 {
         ioctl::plugin_hardware r {{ .size = sizeof(r) }};
@@ -327,3 +450,36 @@ bool usbip::vhci::read_device_state(_In_ HANDLE dev, _Out_ usbip::device_state &
                 return get_device_state(result, &r, actual);
         }
 }
+
+size_t usbip::vhci::read_device_states(
+        _In_ HANDLE dev, _Out_writes_to_(count, return) usbip::device_state *result, _In_ size_t count)
+{
+        if (!(result && count)) {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return 0;
+        }
+
+        std::vector<vhci::device_state> v(count);
+        auto size = static_cast<DWORD>(v.size()*sizeof(v[0]));
+
+        DWORD actual{};
+        if (!ReadFile(dev, v.data(), size, &actual, nullptr)) {
+                return 0;
+        } else if (!actual) {
+                SetLastError(ERROR_HANDLE_EOF);
+                return 0;
+        } else if (actual % sizeof(v[0])) {
+                SetLastError(ERROR_INVALID_DATA);
+                return 0;
+        }
+
+        auto cnt = actual/sizeof(v[0]);
+
+        for (size_t i = 0; i < cnt; ++i) {
+                if (!get_device_state(result[i], &v[i], sizeof(v[i]))) {
+                        return 0;
+                }
+        }
+
+        return cnt;
+}
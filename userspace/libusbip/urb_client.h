@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "dllspec.h"
+#include "win_socket.h"
+#include "remote.h"
+#include "urb_types.h"
+
+#include <functional>
+
+namespace usbip
+{
+
+/**
+ * @return usbip_header_basic.devid of imported device
+ */
+constexpr UINT32 make_devid(_In_ const usb_device &dev) noexcept
+{
+        return dev.busnum << 16 | (dev.devnum & 0xFFFF);
+}
+
+/*
+ * Client side of the data path of a device that was imported by import_device(), the driver is not involved.
+ * It is intended for tools like load generators and benchmarks, thousands of URBs can be in flight.
+ *
+ * PDUs are queued by submit() and unlink() and are sent by one gather send per batch,
+ * when max_batch of them are queued or by flush(). OUT payload is not copied.
+ * RET_SUBMIT and RET_UNLINK are received by a dedicated thread. It runs completion callbacks in the order
+ * of arrival, IN payload is received into a buffer that is reused for all URBs.
+ * A callback must not block, it can submit the next URB.
+ *
+ * Isochronous transfers are not supported.
+ */
+class USBIP_API urb_client
+{
+public:
+        using completion = std::function<void(const urb_result&)>;
+
+        urb_client(_Inout_ Socket &&s, _In_ UINT32 devid, _In_ unsigned int max_batch = 32);
+        ~urb_client(); // closes the connection, callbacks of URBs in flight get URB_SHUTDOWN
+
+        urb_client(const urb_client&) = delete;
+        urb_client& operator=(const urb_client&) = delete;
+
+        /*
+         * The callback is called once if non-zero is returned, even if sending of the batch failed.
+         * @return zero if failed, call GetLastError()
+         */
+        seqnum_t submit(_In_ const urb_request &r, _In_ completion f);
+
+        /*
+         * Sends CMD_UNLINK immediately. If the server unlinks URB, its callback gets URB_UNLINKED.
+         * @return call GetLastError() if false is returned
+         */
+        bool unlink(_In_ seqnum_t seqnum);
+
+        /*
+         * Send queued PDUs.
+         * @return call GetLastError() if false is returned
+         */
+        bool flush();
+
+        /*
+         * Wait until there are no URBs in flight and their callbacks have returned.
+         * If the connection was closed, URBs in flight are completed with URB_SHUTDOWN.
+         * @return false on timeout
+         */
+        bool wait_idle(_In_ std::chrono::milliseconds timeout);
+
+        endpoint_stats get_stats(_In_ UINT8 ep, _In_ bool dir_in) const;
+
+        /*
+         * @return why the connection was closed, zero if it is alive
+         */
+        DWORD get_error() const;
+
+private:
+        struct impl;
+        impl *m_impl;
+};
+
+} // namespace usbip
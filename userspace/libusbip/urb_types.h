@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <usbip/proto.h>
+
+#include <array>
+#include <chrono>
+
+/*
+ * Types of urb_client, see urb_client.h.
+ * Does not depend on Windows headers except basetsd.h, see userspace/tests.
+ */
+
+namespace usbip
+{
+
+enum : INT32 { // urb_result::status, negative Linux errno
+        URB_UNLINKED = -104, // ECONNRESET
+        URB_SHUTDOWN = -108, // ESHUTDOWN, the connection was closed before RET_SUBMIT
+};
+
+struct urb_request
+{
+        UINT8 ep; // endpoint number, zero for the default control pipe
+        bool dir_in;
+        UINT32 transfer_flags; // Linux URB_* flags
+        std::array<UINT8, 8> setup; // control transfer only
+        const char *out; // payload of OUT transfer, must be valid until it is sent, see urb_client::flush
+        UINT32 out_length;
+        UINT32 in_length; // of IN transfer
+        INT32 interval; // interrupt transfer only
+};
+
+struct urb_result
+{
+        seqnum_t seqnum;
+        INT32 status; // zero, negative Linux errno from the server, URB_UNLINKED or URB_SHUTDOWN
+        INT32 actual_length; // of IN or OUT transfer
+        const char *data; // IN payload of actual_length bytes, is valid during the callback only; nullptr for OUT
+        std::chrono::nanoseconds latency; // since submit()
+};
+
+enum { URB_LATENCY_BUCKETS = 24 };
+
+struct endpoint_stats
+{
+        UINT64 submitted;
+        UINT64 completed; // all statuses
+        UINT64 errors; // except URB_UNLINKED
+        UINT64 unlinked;
+        UINT64 bytes; // actual_length of successful URBs
+        UINT32 in_flight;
+        std::array<UINT64, URB_LATENCY_BUCKETS> latency; // of successful URBs, [i] counts [2^i, 2^(i+1)) microseconds
+};
+
+} // namespace usbip
@@ -10,6 +10,7 @@
 
 #include <string>
 #include <vector>
+#include <array>
 
 /*
  * Strings encoding is UTF8. 
@@ -45,6 +46,24 @@ struct device_state
         state state;
 };
 
+enum { LATENCY_BUCKETS = 24 }; // of device_statistics::latency
+
+/*
+ * Counters since a device was attached, rates are calculated from their differences.
+ */
+struct device_statistics
+{
+        int port;
+        UINT64 generation; // of the port, another device was attached if it changed
+
+        UINT64 bytes_in;
+        UINT64 bytes_out;
+        UINT64 urbs; // completed successfully
+        UINT32 in_flight; // URBs that are waiting for completion from a server
+
+        std::array<UINT64, LATENCY_BUCKETS> latency; // round trip of URBs, [i] counts [2^i, 2^(i+1)) microseconds
+};
+
 } // namespace usbip
 
 
@@ -65,6 +84,32 @@ USBIP_API Handle open(_In_ bool overlapped = false);
  */
 USBIP_API std::vector<imported_device> get_imported_devices(_In_ HANDLE dev, _Out_ bool &success);
 
+struct imported_devices_delta
+{
+        UINT64 instance; // of the driver, pass it to the next call
+        UINT64 generation; // pass it to the next call
+        bool full; // devices is the full list, discard the result of the previous calls
+        std::vector<imported_device> devices; // attached to the ports since the previous call
+        std::vector<int> removed; // ports that became free since the previous call
+};
+
+/**
+ * Cheap polling of imported devices, only changes are returned.
+ * @param dev handle of the driver device
+ * @param instance the member of the previous result, zero to get all devices
+ * @param generation the member of the previous result, zero to get all devices
+ * @param success call GetLastError() if false is returned
+ */
+USBIP_API imported_devices_delta get_imported_devices_since(
+        _In_ HANDLE dev, _In_ UINT64 instance, _In_ UINT64 generation, _Out_ bool &success);
+
+/**
+ * @param dev handle of the driver device
+ * @param success call GetLastError() if false is returned
+ * @return statistics of imported devices
+ */
+USBIP_API std::vector<usbip::device_statistics> get_device_statistics(_In_ HANDLE dev, _Out_ bool &success);
+
 /**
  * @param dev handle of the driver device
  * @param location remote device to attach to
@@ -105,4 +150,14 @@ USBIP_API bool get_device_state(_Out_ device_state &result, _In_ const void *dat
  */
 USBIP_API bool read_device_state(_In_ HANDLE dev, _Out_ device_state &result);
 
+/**
+ * The call blocks until at least one state is available and returns all states 
+ * that are queued by the driver, but no more than count.
+ * @param dev handle of the driver device that must be opened for serialized I/O
+ * @param result array of count elements, receives states in the order they happened
+ * @param count of elements in result
+ * @return number of states in result, call GetLastError() if zero is returned
+ */
+USBIP_API size_t read_device_states(_In_ HANDLE dev, _Out_writes_to_(count, return) device_state *result, _In_ size_t count);
+
 } // namespace usbip::vhci
@@ -0,0 +1,203 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Statistics and reports of "usbip bench", see usbip/bench_stats.h.
+// sources: ../usbip/bench_stats.cpp
+
+#include "test.h"
+
+#include <usbip/bench_stats.h>
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip::bench;
+
+auto near(double a, double b)
+{
+        return std::abs(a - b) < 1e-9;
+}
+
+auto bulk_out(std::uint64_t bytes)
+{
+        std::vector<double> latency{100, 200, 300, 400};
+
+        return result {
+                .test = "bulk_out",
+                .queue_depth = 4,
+                .transfer_size = 16384,
+                .errors = 0,
+                .seconds = 0.5,
+                .bytes = bytes,
+                .latency = summarize(latency),
+        };
+}
+
+TEST(percentile)
+{
+        CHECK(percentile({}, 0.5) == 0);
+
+        std::vector<double> one{7};
+        CHECK(percentile(one, 0) == 7 && percentile(one, 1) == 7);
+
+        std::vector<double> v{10, 20, 30, 40, 50};
+        CHECK(near(percentile(v, 0), 10));
+        CHECK(near(percentile(v, 0.5), 30));
+        CHECK(near(percentile(v, 0.9), 46));
+        CHECK(near(percentile(v, 1), 50));
+        CHECK(near(percentile(v, 7), 50)); // clamped
+}
+
+TEST(summarize)
+{
+        std::vector<double> none;
+        CHECK(!summarize(none).count);
+
+        std::vector<double> v{4, 2, 8, 6};
+        auto s = summarize(v);
+
+        CHECK(v.front() == 2 && v.back() == 8); // sorted in place
+        CHECK(s.count == 4);
+        CHECK(s.min == 2 && s.max == 8);
+        CHECK(near(s.mean, 5));
+        CHECK(near(s.stddev, std::sqrt(5.0)));
+        CHECK(near(s.p50, 5));
+}
+
+TEST(rates)
+{
+        auto r = bulk_out(4*16384);
+
+        CHECK(near(r.mb_per_sec(), 4*16384/0.5/1e6));
+        CHECK(near(r.ops_per_sec(), 8));
+
+        r.seconds = 0;
+        CHECK(r.mb_per_sec() == 0 && r.ops_per_sec() == 0);
+}
+
+TEST(is_valid)
+{
+        CHECK(is_valid(bulk_out(4*16384)));
+        CHECK(!is_valid(bulk_out(0))); // 0 MB/s, actual_length of OUT was lost
+
+        auto failed = bulk_out(0);
+        failed.latency = {};
+        CHECK(is_valid(failed)); // nothing has completed, errors are reported separately
+
+        std::vector<double> latency{1000};
+        result attach{ .test = "attach", .queue_depth = 1, .transfer_size = 0, .errors = 0, .seconds = 0.001, 
+                       .bytes = 0, .latency = summarize(latency) };
+        CHECK(is_valid(attach)); // transfers nothing
+}
+
+TEST(reports)
+{
+        std::vector<result> v{ bulk_out(4*16384) };
+        v[0].test = "a\"b";
+
+        auto csv = to_csv(v);
+        CHECK(csv.starts_with("test,queue_depth,transfer_size,count,errors,seconds,bytes,mb_per_sec,ops_per_sec,"));
+        CHECK(csv.find("\na\"b,4,16384,4,0,0.500000,65536,0.131,8.000,100.000,250.000,") != csv.npos);
+        CHECK(std::count(csv.begin(), csv.end(), '\n') == 2);
+
+        auto json = to_json(v);
+        CHECK(json.find(R"("test": "a\"b", "queue_depth": 4)") != json.npos);
+        CHECK(json.find(R"("mb_per_sec": 0.131)") != json.npos);
+
+        CHECK(to_json({}) == "{\n  \"results\": []\n}\n");
+
+        auto text = to_text(v);
+        CHECK(text.find("a\"b") != text.npos);
+        CHECK(std::count(text.begin(), text.end(), '\n') == 2);
+}
+
+TEST(csv_round_trip)
+{
+        std::vector<result> v{ bulk_out(4*16384), bulk_out(8*16384) };
+        v[1].queue_depth = 32;
+        v[1].errors = 3;
+
+        std::vector<result> r;
+        CHECK(from_csv(r, to_csv(v)));
+        CHECK(r.size() == 2);
+
+        for (size_t i = 0; i < r.size(); ++i) {
+                CHECK(r[i].test == v[i].test);
+                CHECK(r[i].queue_depth == v[i].queue_depth && r[i].transfer_size == v[i].transfer_size);
+                CHECK(r[i].errors == v[i].errors && r[i].bytes == v[i].bytes);
+                CHECK(r[i].latency.count == v[i].latency.count);
+                CHECK(near(r[i].seconds, v[i].seconds));
+                CHECK(near(r[i].latency.p99, v[i].latency.p99));
+                CHECK(near(r[i].mb_per_sec(), v[i].mb_per_sec()));
+        }
+
+        auto crlf = to_csv(v);
+        for (size_t pos = 0; (pos = crlf.find('\n', pos)) != crlf.npos; pos += 2) {
+                crlf.insert(pos, 1, '\r'); // edited on Windows
+        }
+        CHECK(from_csv(r, crlf) && r.size() == 2);
+
+        CHECK(from_csv(r, to_csv({})) && r.empty());
+}
+
+TEST(csv_malformed)
+{
+        auto csv = to_csv(std::vector<result>{ bulk_out(4*16384) });
+        std::vector<result> r;
+
+        CHECK(!from_csv(r, ""));
+        CHECK(!from_csv(r, csv.substr(csv.find('\n') + 1))); // no header
+        CHECK(!from_csv(r, csv.substr(0, csv.rfind(',')))); // truncated row
+        CHECK(!from_csv(r, csv.substr(0, csv.size() - 1) + ",1\n")); // extra column
+
+        auto bad = csv;
+        bad.replace(bad.find(",4,16384,"), 9, ",x,16384,");
+        CHECK(!from_csv(r, bad));
+}
+
+TEST(compare)
+{
+        std::vector<result> baseline{ bulk_out(4*16384) };
+        std::vector<double> latency{100, 200, 300, 400};
+
+        auto current = baseline;
+        CHECK(compare(baseline, current, 0.1).empty());
+
+        current[0].seconds = 0.5*1.05; // 5% slower
+        CHECK(compare(baseline, current, 0.1).empty());
+
+        current[0].seconds = 0.5*1.25;
+        auto v = compare(baseline, current, 0.1);
+        CHECK(v.size() == 1 && std::string(v[0].metric) == "ops/s");
+        CHECK(near(v[0].baseline, 8) && near(v[0].current, 6.4));
+
+        current = baseline;
+        for (auto &i: latency) {
+                i *= 2;
+        }
+        current[0].latency = summarize(latency);
+        current[0].errors = 1;
+
+        v = compare(baseline, current, 0.1);
+        CHECK(v.size() == 2);
+        CHECK(std::string(v[0].metric) == "p99,us" && std::string(v[1].metric) == "errors");
+
+        auto text = to_text(v);
+        CHECK(text.find("bulk_out, queue depth 4, size 16384: errors 0.0 -> 1.0") != text.npos);
+        CHECK(std::count(text.begin(), text.end(), '\n') == 2);
+
+        current[0].queue_depth = 1; // not in the baseline
+        CHECK(compare(baseline, current, 0.1).empty());
+
+        current = baseline;
+        current[0].seconds = 0.25; // faster is not a regression
+        CHECK(compare(baseline, current, 0).empty());
+}
+
+} // namespace
+
+TEST_MAIN
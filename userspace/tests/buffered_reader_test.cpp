@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Reader of OP_REP_DEVLIST, see userspace/libusbip/src/buffered_reader.h.
+
+#include "test.h"
+
+#include <libusbip/src/buffered_reader.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+
+using namespace usbip;
+
+struct socket_pair
+{
+        int fd[2]{ -1, -1 };
+
+        socket_pair() { socketpair(AF_UNIX, SOCK_STREAM, 0, fd); }
+        ~socket_pair() { close_writer(); close(fd[0]); }
+
+        void close_writer()
+        {
+                if (fd[1] >= 0) {
+                        close(fd[1]);
+                        fd[1] = -1;
+                }
+        }
+};
+
+auto make_reader(int fd, size_t size, int *calls = nullptr)
+{
+        return buffered_reader([fd, calls] (char *buf, size_t len) -> long long
+        {
+                if (calls) {
+                        ++*calls;
+                }
+                return recv(fd, buf, len, 0);
+        }, size);
+}
+
+auto make_stream(size_t len)
+{
+        std::vector<char> v(len);
+        std::mt19937 gen(len);
+
+        for (auto &c: v) {
+                c = static_cast<char>(gen());
+        }
+
+        return v;
+}
+
+/*
+ * Sends the stream in chunks of random sizes with pauses, so recv() returns partial records.
+ */
+void send_chunks(int fd, const std::vector<char> &v, unsigned int seed, size_t max_chunk)
+{
+        std::mt19937 gen(seed);
+
+        for (size_t off = 0; off < v.size(); ) {
+                auto len = std::min(v.size() - off, 1 + gen() % max_chunk);
+                auto ret = send(fd, v.data() + off, len, 0);
+                if (ret <= 0) {
+                        return;
+                }
+                off += ret;
+
+                if (gen() % 64 == 0) {
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+        }
+}
+
+TEST(partial_chunks)
+{
+        auto stream = make_stream(20'000);
+
+        for (size_t bufsize: {1, 7, 48, 312, 4096, 64*1024}) {
+                for (size_t max_chunk: {1, 3, 100, 5000}) {
+                        socket_pair sp;
+                        std::jthread writer([&] { send_chunks(sp.fd[1], stream, unsigned(bufsize + max_chunk), max_chunk); });
+
+                        auto rd = make_reader(sp.fd[0], bufsize);
+                        std::mt19937 gen(1);
+
+                        std::vector<char> got;
+                        got.reserve(stream.size());
+
+                        while (got.size() < stream.size()) { // records of usbip_usb_device and usbip_usb_interface sizes
+                                auto len = std::min(stream.size() - got.size(), size_t(gen() % 2 ? 312 : 4));
+                                if (gen() % 64 == 0) {
+                                        len = std::min(stream.size() - got.size(), 3*bufsize); // bypasses the buffer
+                                }
+
+                                auto off = got.size();
+                                got.resize(off + len);
+
+                                if (!rd.read(got.data() + off, len)) {
+                                        break;
+                                }
+                        }
+
+                        CHECK(got == stream);
+                }
+        }
+}
+
+TEST(syscalls)
+{
+        enum { RECORD = 312, CNT = 200 };
+        auto stream = make_stream(RECORD*CNT);
+
+        socket_pair sp;
+        CHECK(send(sp.fd[1], stream.data(), stream.size(), 0) == ssize_t(stream.size()));
+        sp.close_writer();
+
+        int calls = 0;
+        auto rd = make_reader(sp.fd[0], 64*1024, &calls);
+
+        std::vector<char> rec(RECORD);
+        for (int i = 0; i < CNT; ++i) {
+                CHECK(rd.read(rec.data(), rec.size()));
+                CHECK(std::equal(rec.begin(), rec.end(), stream.begin() + i*RECORD));
+        }
+
+        CHECK(calls < CNT/10); // not a recv() per record
+}
+
+TEST(eof)
+{
+        socket_pair sp;
+        CHECK(send(sp.fd[1], "abcdef", 6, 0) == 6);
+        sp.close_writer();
+
+        auto rd = make_reader(sp.fd[0], 4);
+
+        char buf[4];
+        CHECK(rd.read(buf, 4));
+        CHECK(!memcmp(buf, "abcd", 4));
+
+        CHECK(!rd.read(buf, 4)); // truncated record
+}
+
+TEST(error)
+{
+        int calls = 0;
+        buffered_reader rd([&calls] (char*, size_t) -> long long { ++calls; return -1; }, 16);
+
+        char c;
+        CHECK(!rd.read(c));
+        CHECK(calls == 1);
+
+        CHECK(rd.read(&c, 0)); // nothing to read
+        CHECK(calls == 1);
+}
+
+} // namespace
+
+TEST_MAIN
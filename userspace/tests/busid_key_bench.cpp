@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Sorting of busid column of wusbip: parsing both busids on every comparison versus cached keys.
+
+#include <wusbip/busid_key.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+/*
+ * As TreeListItemComparator did before sort keys were cached.
+ */
+auto parse_busid(std::wstring busid)
+{
+        std::vector<int> v;
+
+        if (auto i = busid.find(L'-'); i != busid.npos) {
+                busid[i] = L'.';
+        } else {
+                return v;
+        }
+
+        for (size_t pos = 0; pos <= busid.size(); ) {
+                auto end = std::min(busid.find(L'.', pos), busid.size());
+                v.push_back(std::stoi(busid.substr(pos, end - pos)));
+                pos = end + 1;
+        }
+
+        if (v.size() < 2) {
+                v.clear();
+        }
+
+        return v;
+}
+
+auto make_busids(size_t n)
+{
+        std::mt19937 gen(1);
+        std::vector<std::wstring> v;
+
+        while (v.size() < n) {
+                auto s = std::to_wstring(1 + gen() % 8) + L'-' + std::to_wstring(1 + gen() % 16);
+                for (auto depth = gen() % 4; depth; --depth) {
+                        s += L'.' + std::to_wstring(1 + gen() % 8);
+                }
+                v.push_back(std::move(s));
+        }
+
+        return v;
+}
+
+template<typename F>
+auto ms(F &&f)
+{
+        auto start = clock_type::now();
+        f();
+        std::chrono::duration<double, std::milli> elapsed = clock_type::now() - start;
+        return elapsed.count();
+}
+
+} // namespace
+
+int main()
+{
+        enum { ROWS = 5000 };
+        auto busids = make_busids(ROWS);
+
+        size_t comparisons = 0;
+        std::vector<size_t> parsed(ROWS);
+        std::vector<size_t> cached(ROWS);
+
+        for (size_t i = 0; i < ROWS; ++i) {
+                parsed[i] = cached[i] = i;
+        }
+
+        auto t_parsed = ms([&] {
+                std::ranges::sort(parsed, [&] (auto a, auto b) {
+                        ++comparisons;
+                        return parse_busid(busids[a]) < parse_busid(busids[b]);
+                });
+        });
+
+        std::vector<busid_key> keys;
+
+        auto t_cached = ms([&] {
+                keys.reserve(ROWS);
+                for (auto &s: busids) {
+                        keys.push_back(make_busid_key(s));
+                }
+
+                std::ranges::sort(cached, [&] (auto a, auto b) { return compare(keys[a], keys[b]) < 0; });
+        });
+
+        auto same = std::ranges::equal(parsed, cached, [&] (auto a, auto b) { return busids[a] == busids[b]; });
+
+        printf("%d busids, %zu comparisons: parsed %.2f ms, cached keys %.2f ms, same order %s\n", 
+                ROWS, comparisons, t_parsed, t_cached, same ? "yes" : "NO");
+
+        return !same;
+}
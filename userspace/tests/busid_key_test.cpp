@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Sort keys of busid column of wusbip, see wusbip/busid_key.h.
+
+#include "test.h"
+
+#include <wusbip/busid_key.h>
+
+#include <string>
+
+namespace
+{
+
+using namespace usbip;
+
+auto key(const wchar_t *busid)
+{
+        return make_busid_key(std::wstring_view(busid));
+}
+
+auto cmp(const wchar_t *a, const wchar_t *b)
+{
+        return compare(key(a), key(b));
+}
+
+TEST(parse)
+{
+        auto k = key(L"12-3.4.15");
+        CHECK(k.len == 4);
+        CHECK(k.v[0] == 12 && k.v[1] == 3 && k.v[2] == 4 && k.v[3] == 15);
+
+        CHECK(key(L"1-1").len == 2);
+        CHECK(key(L"1-1.2.3.4.5.6.7").len == 8);
+
+        for (auto s: {L"", L"1", L"1-", L"-1", L"1.1", L"1-1-1", L"1-1.", L"1--1", L"1-a", L"1 -1", L"1-1.2.3.4.5.6.7.8"}) {
+                CHECK(!key(s).len);
+        }
+}
+
+TEST(order)
+{
+        CHECK(cmp(L"1-1", L"1-1") == 0);
+        CHECK(cmp(L"1-2", L"1-10") < 0); // numeric, "1-10" < "1-2" as text
+        CHECK(cmp(L"2-1", L"10-1") < 0);
+        CHECK(cmp(L"1-1", L"1-1.1") < 0);
+        CHECK(cmp(L"1-1.9", L"1-2") < 0);
+        CHECK(cmp(L"1-3.2", L"1-3.1") > 0);
+}
+
+} // namespace
+
+TEST_MAIN
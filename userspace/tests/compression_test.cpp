@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// LZ4 block codec and compression policy of the driver, see include/usbip/lz4.h.
+
+#include "test.h"
+
+#include <usbip/lz4.h>
+#include <usbip/compression_policy.h>
+
+#include <string>
+#include <vector>
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+auto compress(const std::string &s, size_t capacity)
+{
+        std::vector<lz4::hash_entry> table(lz4::HASH_TABLE_SIZE);
+        std::string out(capacity, '\0');
+
+        out.resize(lz4::compress(s.data(), s.size(), out.data(), out.size(), table.data()));
+        return out;
+}
+
+auto compress(const std::string &s)
+{
+        return compress(s, lz4::compress_bound(s.size()));
+}
+
+bool decompress(const std::string &block, std::string &out, size_t capacity)
+{
+        out.assign(capacity, '\0');
+        size_t size{};
+
+        auto ok = lz4::decompress(block.data(), block.size(), out.data(), out.size(), size);
+        out.resize(size);
+        return ok;
+}
+
+auto random_bytes(size_t n, unsigned int seed = 1)
+{
+        std::mt19937 gen(seed);
+        std::string s(n, '\0');
+
+        for (auto &c: s) {
+                c = static_cast<char>(gen());
+        }
+
+        return s;
+}
+
+auto text(size_t n)
+{
+        std::string s;
+        for (int i = 0; s.size() < n; ++i) {
+                s += "Scanned page " + std::to_string(i % 97) + ", 600 dpi, 24-bit colour. ";
+        }
+
+        s.resize(n);
+        return s;
+}
+
+void round_trip(const std::string &s)
+{
+        auto block = compress(s);
+        CHECK(!block.empty() || s.empty());
+        CHECK(block.size() <= lz4::compress_bound(s.size()));
+
+        std::string out;
+        CHECK(decompress(block, out, s.size()));
+        CHECK(out == s);
+}
+
+TEST(round_trips)
+{
+        round_trip("");
+        round_trip("a");
+        round_trip("abcdefghijkl"); // MFLIMIT
+        round_trip(std::string(13, 'x'));
+        round_trip(std::string(64*1024, '\0'));
+        round_trip(std::string(1024*1024, 'z')); // match lengths with many extension bytes
+        round_trip(text(100'000));
+        round_trip(random_bytes(100'000));
+        round_trip(random_bytes(300) + std::string(70'000, 'q') + random_bytes(300, 2)); // offsets near MAX_DISTANCE
+
+        for (size_t n = 0; n < 64; ++n) {
+                round_trip(std::string(n, 'a') + random_bytes(n, unsigned(n)));
+        }
+}
+
+TEST(ratio)
+{
+        auto s = text(64*1024);
+        CHECK(compress(s).size() < s.size()/4);
+
+        auto r = random_bytes(64*1024);
+        CHECK(compress(r).size() > r.size());
+}
+
+TEST(capacity)
+{
+        auto r = random_bytes(4096);
+        CHECK(compress(r, r.size()).empty()); // incompressible, does not fit
+
+        auto s = text(4096);
+        auto block = compress(s);
+        CHECK(compress(s, block.size()) == block);
+        CHECK(compress(s, block.size() - 1).empty());
+}
+
+TEST(malformed)
+{
+        auto s = text(10'000);
+        auto block = compress(s);
+        std::string out;
+
+        CHECK(!decompress(block, out, s.size() - 1)); // does not fit
+        CHECK(!decompress(block.substr(0, block.size() - 1), out, s.size()) || out != s); // truncated
+
+        CHECK(!decompress(std::string("\xF0", 1), out, 100)); // no length byte
+        CHECK(!decompress(std::string("\x10", 1), out, 100)); // literal is missing
+        CHECK(!decompress(std::string("\x10" "a" "\x05", 3), out, 100)); // truncated offset
+        CHECK(!decompress(std::string("\x10" "a" "\x02\x00", 4), out, 100)); // offset is beyond the output
+        CHECK(!decompress(std::string("\x10" "a" "\x00\x00", 4), out, 100)); // zero offset
+
+        CHECK(decompress(std::string("\x14" "a" "\x01\x00", 4), out, 100)); // overlapped match
+        CHECK(out == std::string(9, 'a'));
+
+        std::mt19937 gen(3);
+        for (int i = 0; i < 10'000; ++i) { // must not crash, ASan/valgrind catch out-of-bounds access
+                auto b = block;
+                b[gen() % b.size()] = static_cast<char>(gen());
+                decompress(b, out, s.size());
+        }
+}
+
+TEST(policy)
+{
+        compression_policy p{};
+
+        CHECK(!p.next(compression_policy::MIN_LENGTH - 1));
+        CHECK(p.next(compression_policy::MIN_LENGTH));
+        CHECK(p.next(compression_policy::MAX_LENGTH));
+        CHECK(!p.next(compression_policy::MAX_LENGTH + 1));
+
+        p.compressed(64*1024, 8*1024, 100); // good ratio, fast
+        CHECK(p.worthwhile());
+        CHECK(p.next(64*1024));
+
+        compression_policy q{};
+        q.compressed(64*1024, 0, 100); // incompressible
+        CHECK(!q.worthwhile());
+        CHECK(q.skip == compression_policy::MIN_SKIP);
+
+        for (unsigned int i = 0; i < compression_policy::MIN_SKIP; ++i) {
+                CHECK(!q.next(64*1024));
+        }
+        CHECK(q.next(64*1024)); // probe
+
+        q.compressed(64*1024, 0, 100);
+        CHECK(q.skip == 2*compression_policy::MIN_SKIP); // backoff
+
+        for (int i = 0; i < 20; ++i) {
+                q.compressed(64*1024, 0, 100);
+        }
+        CHECK(q.skip == compression_policy::MAX_SKIP);
+
+        compression_policy slow{};
+        slow.completed(10'000'000, 1000); // 10 GB/s link
+        slow.compressed(64*1024, 8*1024, 1000); // 64 MB/s compressor
+        CHECK(!slow.worthwhile());
+
+        compression_policy fast{};
+        fast.completed(1'000'000, 1'000'000); // 1 MB/s link
+        fast.compressed(64*1024, 8*1024, 1000);
+        CHECK(fast.worthwhile());
+
+        compression_policy marginal{};
+        marginal.completed(100'000, 1000); // 100 MB/s link
+        marginal.compressed(400'000, 300'000, 1000); // 400 MB/s compressor saves 25%, slower than sending as is
+        CHECK(!marginal.worthwhile());
+}
+
+} // namespace
+
+TEST_MAIN
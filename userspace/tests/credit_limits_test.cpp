@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Credit limits of bulk IN flow control, see drivers/ude/credit_limits.h.
+
+#include "test.h"
+
+#include <drivers/ude/credit_limits.h>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr auto MSEC = credit_limits::MSEC;
+constexpr auto SECOND = credit_limits::SECOND;
+
+auto make()
+{
+        credit_limits c{};
+        c.init(1);
+        return c;
+}
+
+/*
+ * Completes URBs of the same size back to back over a link with the given rate and RTT.
+ * @return the time after the last completion
+ */
+auto run(credit_limits &c, long long now, long long duration,
+         unsigned long long rate, long long rtt, unsigned int urb_size)
+{
+        auto step = static_cast<long long>(urb_size*SECOND/rate);
+
+        for (auto end = now + duration; now < end; now += step) {
+                c.taken(urb_size);
+                c.delivered(rtt, urb_size, now);
+        }
+
+        return now;
+}
+
+TEST(allow)
+{
+        auto c = make();
+        CHECK(c.max_urbs == credit_limits::INITIAL_URBS);
+        CHECK(c.max_bytes == credit_limits::INITIAL_BYTES);
+
+        CHECK(c.allow(0, 0));
+        CHECK(c.allow(0, 100*c.max_bytes)); // nothing is outstanding
+        CHECK(c.allow(c.max_urbs - 1, c.max_bytes - 1));
+        CHECK(!c.allow(c.max_urbs, 0));
+        CHECK(!c.allow(1, c.max_bytes));
+}
+
+TEST(bandwidth_delay_product)
+{
+        const struct {
+                unsigned long long rate; // bytes per second
+                long long rtt;
+                unsigned int urb_size;
+                unsigned int max_bytes;
+                unsigned int max_urbs;
+        } cases[] {
+                { 100'000'000, 1*MSEC, 16*1024, 200'000, 13 }, // 2*BDP
+                { 1'000'000'000, 10*MSEC, 64*1024, credit_limits::MAX_BYTES, credit_limits::MAX_URBS },
+                { 1'000'000, 1*MSEC, 4*1024, credit_limits::MIN_BYTES, 17 },
+                { 10'000'000, 50*MSEC, 512*1024, 1'000'000, 2 }, // MIN_URBS
+        };
+
+        for (auto &t: cases) {
+                auto c = make();
+                run(c, 1, 2*SECOND, t.rate, t.rtt, t.urb_size);
+
+                CHECK(c.min_rtt == t.rtt);
+                CHECK(c.rate > t.rate*95/100 && c.rate < t.rate*105/100);
+
+                CHECK(c.max_bytes > t.max_bytes*95/100 && c.max_bytes < t.max_bytes*105/100 + 1);
+                CHECK(c.max_urbs >= t.max_urbs - 1 && c.max_urbs <= t.max_urbs + 1);
+
+                CHECK(c.max_bytes >= credit_limits::MIN_BYTES && c.max_bytes <= credit_limits::MAX_BYTES);
+                CHECK(c.max_urbs >= credit_limits::MIN_URBS && c.max_urbs <= credit_limits::MAX_URBS);
+        }
+}
+
+TEST(window)
+{
+        auto c = make();
+        c.window_start = 0;
+
+        CHECK(!c.delivered(MSEC, 1000, 1)); // min_rtt is 1 ms, the window is MIN_RATE_WINDOW
+        CHECK(!c.delivered(MSEC, 1000, credit_limits::MIN_RATE_WINDOW - 1));
+        CHECK(c.delivered(MSEC, 1000, credit_limits::MIN_RATE_WINDOW));
+
+        CHECK(!c.window_bytes);
+        CHECK(c.rate == 3000*SECOND/credit_limits::MIN_RATE_WINDOW);
+}
+
+/*
+ * The rate is the max with a decay, RTT is the min over MIN_RTT_WINDOW.
+ */
+TEST(decay)
+{
+        auto c = make();
+        auto now = run(c, 1, SECOND, 100'000'000, MSEC, 64*1024);
+        auto fast = c.rate;
+
+        now = run(c, now, 3*credit_limits::MIN_RATE_WINDOW, 10'000'000, 2*MSEC, 64*1024);
+        CHECK(c.min_rtt == MSEC);
+        CHECK(c.rate < fast);
+        CHECK(c.rate >= fast - fast/credit_limits::RATE_DECAY*3);
+
+        now = run(c, now, SECOND, 10'000'000, 2*MSEC, 64*1024);
+        CHECK(c.rate < 11'000'000); // has decayed to the current rate
+
+        run(c, now, credit_limits::MIN_RTT_WINDOW + SECOND, 10'000'000, 2*MSEC, 64*1024);
+        CHECK(c.min_rtt == 2*MSEC); // the old minimum has expired
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Per-host deadline of enum_exportable_devices_many, see userspace/libusbip/src/deadline.h.
+
+#include "test.h"
+
+#include <libusbip/src/deadline.h>
+#include <libusbip/src/buffered_reader.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace
+{
+
+using namespace usbip;
+using namespace std::chrono_literals;
+using std::chrono::steady_clock;
+
+TEST(left)
+{
+        deadline dl(50ms);
+        CHECK(!dl.expired());
+        CHECK(dl.left() > 0ms && dl.left() <= 50ms);
+
+        deadline now(0ms);
+        CHECK(now.expired());
+        CHECK(now.left() == 0ms);
+}
+
+TEST(rounded_up)
+{
+        deadline dl(2ms);
+
+        for (std::chrono::milliseconds left; !dl.expired(); ) { // zero would mean infinite socket timeout
+                if (left = dl.left(); left == 0ms) {
+                        CHECK(dl.expired());
+                        break;
+                }
+        }
+
+        CHECK(dl.left() == 0ms);
+}
+
+enum { TOTAL = 64*1024 };
+
+enum class behavior { fast, trickle, silent, stall };
+
+/*
+ * Stand-in server that sends TOTAL bytes of OP_REP_DEVLIST in its own way.
+ * It exits when the client closes the connection.
+ */
+struct server
+{
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        int port{};
+        std::jthread thread;
+
+        explicit server(behavior b)
+        {
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+                socklen_t len = sizeof(addr);
+                if (bind(listener, reinterpret_cast<sockaddr*>(&addr), len) ||
+                    listen(listener, 1) ||
+                    getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len)) {
+                        return;
+                }
+
+                port = ntohs(addr.sin_port);
+                thread = std::jthread([this, b] { run(b); });
+        }
+
+        ~server()
+        {
+                thread = {};
+                close(listener);
+        }
+
+        void run(behavior b)
+        {
+                auto s = accept(listener, nullptr, nullptr);
+                if (s < 0) {
+                        return;
+                }
+
+                std::vector<char> data(TOTAL, 'x');
+
+                switch (b) {
+                case behavior::fast:
+                        send(s, data.data(), data.size(), MSG_NOSIGNAL);
+                        break;
+                case behavior::trickle: // each chunk arrives before a receive timeout that is not a deadline
+                        for (int i = 0; i < TOTAL && send(s, data.data(), 1, MSG_NOSIGNAL) == 1; ++i) {
+                                std::this_thread::sleep_for(20ms);
+                        }
+                        break;
+                case behavior::stall:
+                        send(s, data.data(), data.size()/2, MSG_NOSIGNAL);
+                        [[fallthrough]];
+                case behavior::silent:
+                        break;
+                }
+
+                for (char c; recv(s, &c, 1, 0) > 0; ); // until the client disconnects
+                close(s);
+        }
+};
+
+struct result
+{
+        bool ok;
+        bool expired;
+        steady_clock::duration elapsed;
+};
+
+auto connect_to(int port)
+{
+        auto s = socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (connect(s, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+                close(s);
+                return -1;
+        }
+
+        return s;
+}
+
+/*
+ * The same sequence as enum_host: deadline, then the reader with recv_before.
+ */
+auto enum_host(int port, std::chrono::milliseconds timeout)
+{
+        auto start = steady_clock::now();
+        deadline dl(timeout);
+
+        auto s = connect_to(port);
+        if (s < 0) {
+                return result{};
+        }
+
+        auto set_rcvtimeo = [s] (std::chrono::milliseconds t)
+        {
+                timeval tv{ .tv_sec = t.count()/1000, .tv_usec = (t.count() % 1000)*1000 };
+                return !setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        };
+
+        buffered_reader rd(recv_before(dl, set_rcvtimeo, [s] (char *buf, size_t len) -> long long
+        {
+                return recv(s, buf, len, 0);
+        }), 1024);
+
+        bool ok = true;
+        for (int i = 0; ok && i < TOTAL/64; ++i) { // records
+                char rec[64];
+                ok = rd.read(rec);
+        }
+
+        close(s);
+        return result{ ok, dl.expired(), steady_clock::now() - start };
+}
+
+/*
+ * Servers are enumerated concurrently, each one is bounded by its own deadline.
+ */
+TEST(stand_in_servers)
+{
+        const behavior behaviors[] { behavior::fast, behavior::trickle, behavior::silent,
+                                     behavior::stall, behavior::trickle, behavior::fast };
+
+        constexpr auto timeout = 300ms;
+        constexpr auto slack = 200ms;
+
+        std::vector<std::unique_ptr<server>> servers;
+        for (auto b: behaviors) {
+                servers.push_back(std::make_unique<server>(b));
+                CHECK(servers.back()->port);
+        }
+
+        std::vector<result> results(servers.size());
+        {
+                std::vector<std::jthread> clients;
+                for (size_t i = 0; i < servers.size(); ++i) {
+                        clients.emplace_back([&, i] { results[i] = enum_host(servers[i]->port, timeout); });
+                }
+        }
+
+        for (size_t i = 0; i < servers.size(); ++i) {
+                auto &r = results[i];
+
+                if (behaviors[i] == behavior::fast) {
+                        CHECK(r.ok);
+                        CHECK(r.elapsed < timeout);
+                } else {
+                        CHECK(!r.ok);
+                        CHECK(r.expired); // reported as ERROR_TIMEOUT
+                        CHECK(r.elapsed >= timeout);
+                        CHECK(r.elapsed < timeout + slack);
+                }
+        }
+}
+
+} // namespace
+
+TEST_MAIN
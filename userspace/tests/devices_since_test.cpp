@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Delta and generation semantics of ioctl::get_imported_devices_since, see drivers/ude/devices_since.h.
+
+#include "test.h"
+
+#include <drivers/ude/devices_since.h>
+
+#include <functional>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct delta // vhci::imported_devices_delta
+{
+        unsigned long long instance;
+        long long generation;
+        bool full;
+        std::map<int, int> devices; // port -> device
+        std::vector<int> removed;
+};
+
+/*
+ * Mirrors vhci_ctx::generation, port_slot and get_imported_devices_since of the driver.
+ */
+class driver
+{
+public:
+        explicit driver(int ports, unsigned long long instance = 1) :
+                m_instance(instance), m_port_gen(ports + 1), m_device(ports + 1) {}
+
+        void plug(int port, int device)
+        {
+                m_device[port] = device;
+                m_port_gen[port] = ++m_generation;
+        }
+
+        void unplug(int port)
+        {
+                m_device[port] = 0;
+                m_port_gen[port] = ++m_generation;
+        }
+
+        auto ports() const { return static_cast<int>(m_device.size()) - 1; }
+        auto device(int port) const { return m_device[port]; }
+
+        /*
+         * @param during_scan(port) is called before a port is scanned, can change any port
+         */
+        auto get_since(unsigned long long instance, long long generation, size_t max_cnt = 1000,
+                       const std::function<void(int)> &during_scan = {})
+        {
+                delta r{};
+
+                auto gen = m_generation;
+                auto since = devices_since::since(m_instance, instance, generation);
+
+                auto port_generation = [this, &during_scan] (int port)
+                {
+                        if (during_scan) {
+                                during_scan(port);
+                        }
+                        return m_port_gen[port];
+                };
+
+                auto get_device = [this] (int port) { return m_device[port]; };
+
+                auto report = [&r, max_cnt] (int port, int dev)
+                {
+                        if (r.devices.size() + r.removed.size() == max_cnt) {
+                                return -1; // STATUS_BUFFER_TOO_SMALL
+                        }
+
+                        if (dev) {
+                                r.devices[port] = dev;
+                        } else {
+                                r.removed.push_back(port);
+                        }
+
+                        return 0;
+                };
+
+                if (devices_since::scan(ports(), since, port_generation, get_device, report)) {
+                        r.full = false;
+                        r.generation = -1;
+                        return r;
+                }
+
+                r.instance = m_instance;
+                r.generation = gen;
+                r.full = !since;
+
+                return r;
+        }
+
+private:
+        unsigned long long m_instance;
+        long long m_generation{};
+        std::vector<long long> m_port_gen; // [0] is unused
+        std::vector<int> m_device;
+};
+
+/*
+ * Keeps the list of imported devices up to date as wusbip does.
+ */
+struct client
+{
+        unsigned long long instance{};
+        long long generation{};
+        std::map<int, int> devices; // port -> device
+
+        void apply(const delta &d)
+        {
+                if (d.full) {
+                        devices.clear();
+                }
+
+                for (auto port: d.removed) {
+                        devices.erase(port);
+                }
+
+                for (auto [port, dev]: d.devices) {
+                        devices[port] = dev;
+                }
+
+                instance = d.instance;
+                generation = d.generation;
+        }
+
+        void poll(driver &drv, const std::function<void(int)> &during_scan = {})
+        {
+                apply(drv.get_since(instance, generation, 1000, during_scan));
+        }
+
+        bool in_sync(const driver &drv) const
+        {
+                std::map<int, int> m;
+                for (int port = 1; port <= drv.ports(); ++port) {
+                        if (auto dev = drv.device(port)) {
+                                m[port] = dev;
+                        }
+                }
+                return m == devices;
+        }
+};
+
+TEST(full_list)
+{
+        driver drv(8);
+        drv.plug(2, 20);
+        drv.plug(5, 50);
+        drv.plug(7, 70);
+        drv.unplug(7);
+
+        auto d = drv.get_since(0, 0);
+
+        CHECK(d.full);
+        CHECK(d.generation == 4);
+        CHECK(d.devices.size() == 2);
+        CHECK(d.devices[2] == 20 && d.devices[5] == 50);
+        CHECK(d.removed.empty()); // free ports are not reported in the full list
+}
+
+TEST(nothing_changed)
+{
+        driver drv(8);
+        drv.plug(1, 10);
+
+        client c;
+        c.poll(drv);
+
+        auto d = drv.get_since(c.instance, c.generation);
+
+        CHECK(!d.full);
+        CHECK(d.generation == c.generation);
+        CHECK(d.devices.empty());
+        CHECK(d.removed.empty());
+}
+
+TEST(only_changes)
+{
+        driver drv(8);
+        drv.plug(1, 10);
+        drv.plug(2, 20);
+        drv.plug(3, 30);
+
+        client c;
+        c.poll(drv);
+
+        drv.unplug(2);
+        drv.plug(4, 40);
+
+        auto d = drv.get_since(c.instance, c.generation);
+
+        CHECK(!d.full);
+        CHECK(d.devices.size() == 1 && d.devices[4] == 40);
+        CHECK(d.removed == std::vector<int>{2});
+
+        c.apply(d);
+        CHECK(c.in_sync(drv));
+}
+
+/*
+ * Another device on the same port between two calls is reported as a device, not as a removal.
+ */
+TEST(port_reused)
+{
+        driver drv(4);
+        drv.plug(1, 10);
+
+        client c;
+        c.poll(drv);
+
+        drv.unplug(1);
+        drv.plug(1, 11);
+
+        auto d = drv.get_since(c.instance, c.generation);
+
+        CHECK(d.removed.empty());
+        CHECK(d.devices.size() == 1 && d.devices[1] == 11);
+}
+
+/*
+ * Generations start anew after the driver is reloaded, the client's generation can be greater than the driver's.
+ */
+TEST(another_instance)
+{
+        driver old_drv(4, 1);
+        for (int i = 0; i < 10; ++i) {
+                old_drv.plug(1, 10 + i);
+        }
+
+        client c;
+        c.poll(old_drv);
+        CHECK(c.generation == 10);
+
+        driver drv(4, 2);
+        drv.plug(3, 30);
+
+        auto d = drv.get_since(c.instance, c.generation);
+
+        CHECK(d.full);
+        CHECK(d.instance == 2);
+        CHECK(d.devices.size() == 1 && d.devices[3] == 30);
+
+        c.apply(d);
+        CHECK(c.in_sync(drv));
+}
+
+TEST(buffer_too_small)
+{
+        driver drv(8);
+        for (int port = 1; port <= 8; ++port) {
+                drv.plug(port, port*10);
+        }
+
+        CHECK(drv.get_since(0, 0, 7).generation == -1);
+        CHECK(drv.get_since(0, 0, 8).devices.size() == 8);
+}
+
+/*
+ * A port that changes during the scan, before or after it is scanned, must be returned by the next call.
+ */
+TEST(changes_during_scan)
+{
+        enum { PORTS = 16 };
+
+        for (int changed = 1; changed <= PORTS; ++changed) {
+                for (int when = 1; when <= PORTS; ++when) {
+                        driver drv(PORTS);
+                        for (int port = 1; port <= PORTS; port += 2) {
+                                drv.plug(port, port);
+                        }
+
+                        client c;
+                        c.poll(drv);
+
+                        c.poll(drv, [&drv, changed, when] (int port)
+                        {
+                                if (port == when) {
+                                        drv.device(changed) ? drv.unplug(changed) : drv.plug(changed, 100 + changed);
+                                }
+                        });
+
+                        c.poll(drv);
+                        CHECK(c.in_sync(drv));
+                }
+        }
+}
+
+TEST(random)
+{
+        enum { PORTS = 30 };
+        driver drv(PORTS);
+
+        std::mt19937 gen(PORTS);
+        client c;
+        int next_device = 1;
+
+        auto change = [&drv, &gen, &next_device]
+        {
+                auto port = 1 + static_cast<int>(gen() % PORTS);
+                drv.device(port) ? drv.unplug(port) : drv.plug(port, next_device++);
+        };
+
+        for (int i = 0; i < 20'000; ++i) {
+                for (auto n = gen() % 4; n; --n) {
+                        change();
+                }
+
+                if (gen() % 4) {
+                        c.poll(drv);
+                } else {
+                        c.poll(drv, [&gen, &change] (int) { if (gen() % 8 == 0) change(); });
+                        c.poll(drv);
+                }
+
+                CHECK(c.in_sync(drv));
+        }
+}
+
+} // namespace
+
+TEST_MAIN
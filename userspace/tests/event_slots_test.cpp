@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Compacted device states of the driver, see drivers/ude/event_slots.h.
+
+#include "test.h"
+
+#include <drivers/ude/event_slots.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+enum class state { unplugged, connecting, connected, plugged, disconnected, unplugging }; // vhci::state
+
+struct slot
+{
+        unsigned long long seq;
+        int location;
+        int port;
+        state st;
+};
+
+/*
+ * Mirrors fileobject_ctx, vhci::device_state_changed and vhci::complete_read.
+ */
+class subscriber
+{
+public:
+        explicit subscriber(int ports) :
+                m_slots(2*ports),
+                m_dirty(event_slots::bitmap_words(size())),
+                m_order(size()) {}
+
+        void changed(int location, int port, state st)
+        {
+                auto [i, prev] = find_slot(location, port, st);
+
+                if (prev >= 0) {
+                        event_slots::set_dirty(m_dirty.data(), prev, false);
+                }
+
+                if (is_dirty(i) && m_slots[i].location != location && i >= ports()) {
+                        ++m_dropped;
+                }
+
+                m_slots[i] = { ++m_seq, location, port, st };
+                event_slots::set_dirty(m_dirty.data(), i, true);
+        }
+
+        auto read(size_t max_cnt)
+        {
+                auto dirty = event_slots::dirty_by_seq(m_slots.data(), m_dirty.data(), size(), m_order.data());
+                std::vector<slot> v;
+
+                for (int j = 0; v.size() < max_cnt && j < dirty; ++j) {
+                        auto i = m_order[j];
+                        v.push_back(m_slots[i]);
+                        event_slots::set_dirty(m_dirty.data(), i, false);
+                }
+
+                return v;
+        }
+
+        bool has_events() const { return event_slots::any_dirty(m_dirty.data(), size()); }
+        auto dropped() const { return m_dropped; }
+
+private:
+        std::vector<slot> m_slots;
+        std::vector<event_slots::word_t> m_dirty;
+        std::vector<int> m_order;
+        unsigned long long m_seq{};
+        int m_dropped{};
+
+        int size() const { return static_cast<int>(m_slots.size()); }
+        int ports() const { return size()/2; }
+        bool is_dirty(int i) const { return event_slots::is_dirty(m_dirty.data(), i); }
+
+        static auto owns_port(int port, state st)
+        {
+                return port && !(st == state::unplugging || st == state::unplugged);
+        }
+
+        int find_portless_slot(int location) const
+        {
+                return event_slots::find(m_slots.data(), m_dirty.data(), ports(), size(),
+                                         [location] (auto &s) { return s.location == location; });
+        }
+
+        std::pair<int, int> find_slot(int location, int port, state st) const
+        {
+                std::pair<int, int> r(-1, -1);
+                auto &[i, prev] = r;
+
+                if (owns_port(port, st)) {
+                        i = port - 1;
+                        if (auto j = find_portless_slot(location); is_dirty(j) && m_slots[j].location == location) {
+                                prev = j;
+                        }
+                } else {
+                        i = find_portless_slot(location);
+                        if (auto j = port - 1; port && is_dirty(j) && m_slots[j].location == location) {
+                                prev = j;
+                        }
+                }
+
+                return r;
+        }
+};
+
+void check_read(const std::vector<slot> &v)
+{
+        std::set<int> locations;
+
+        for (size_t i = 0; i < v.size(); ++i) {
+                CHECK(!i || v[i - 1].seq < v[i].seq); // in the order they happened
+                CHECK(locations.insert(v[i].location).second); // compacted
+        }
+}
+
+/*
+ * A device of location is attached, plugged into port and detached, as the driver posts it.
+ */
+void attach(subscriber &s, int location, int port)
+{
+        s.changed(location, 0, state::connecting);
+        s.changed(location, 0, state::connected);
+        s.changed(location, port, state::plugged);
+}
+
+void detach(subscriber &s, int location, int port)
+{
+        s.changed(location, port, state::unplugging); // the port is already reclaimed
+        s.changed(location, port, state::unplugged);
+}
+
+TEST(bitmap)
+{
+        enum { CNT = 2*254 }; // twice MAX_PORTS
+        std::vector<event_slots::word_t> dirty(event_slots::bitmap_words(CNT));
+
+        CHECK(dirty.size() == 8);
+        CHECK(!event_slots::any_dirty(dirty.data(), CNT));
+
+        for (int i: {0, 63, 64, 127, CNT - 1}) {
+                event_slots::set_dirty(dirty.data(), i, true);
+                CHECK(event_slots::is_dirty(dirty.data(), i));
+                CHECK(event_slots::any_dirty(dirty.data(), CNT));
+
+                event_slots::set_dirty(dirty.data(), i, false);
+                CHECK(!event_slots::is_dirty(dirty.data(), i));
+                CHECK(!event_slots::any_dirty(dirty.data(), CNT));
+        }
+}
+
+TEST(for_each_dirty)
+{
+        enum { CNT = 2*254 };
+        std::vector<event_slots::word_t> dirty(event_slots::bitmap_words(CNT));
+
+        std::vector<int> expected { 0, 1, 63, 64, 200, 255, 256, CNT - 1 };
+        for (auto i: expected) {
+                event_slots::set_dirty(dirty.data(), i, true);
+        }
+
+        std::vector<int> v;
+        event_slots::for_each_dirty(dirty.data(), CNT, [&v] (int i) { v.push_back(i); });
+
+        CHECK(v == expected);
+}
+
+TEST(dirty_by_seq)
+{
+        enum { CNT = 300 };
+        std::vector<slot> slots(CNT);
+        std::vector<event_slots::word_t> dirty(event_slots::bitmap_words(CNT));
+
+        std::mt19937 gen(1);
+        std::vector<int> expected;
+
+        for (int i = 0; i < CNT; ++i) {
+                slots[i].seq = gen();
+                if (gen() % 3 == 0) {
+                        event_slots::set_dirty(dirty.data(), i, true);
+                        expected.push_back(i);
+                }
+        }
+
+        std::ranges::sort(expected, {}, [&slots] (int i) { return slots[i].seq; });
+
+        std::vector<int> idx(CNT);
+        auto n = event_slots::dirty_by_seq(slots.data(), dirty.data(), CNT, idx.data());
+
+        idx.resize(n);
+        CHECK(idx == expected);
+
+        CHECK(!event_slots::dirty_by_seq(slots.data(), std::vector<event_slots::word_t>(dirty.size()).data(), CNT, idx.data()));
+}
+
+TEST(compaction)
+{
+        subscriber s(4);
+
+        attach(s, 10, 1);
+        attach(s, 20, 2);
+        s.changed(10, 1, state::disconnected); // replaces the state of the port
+
+        auto v = s.read(64);
+        check_read(v);
+
+        CHECK(v.size() == 2);
+        CHECK(v[0].location == 20 && v[0].st == state::plugged);
+        CHECK(v[1].location == 10 && v[1].st == state::disconnected);
+        CHECK(!s.has_events());
+
+        attach(s, 10, 1);
+        detach(s, 10, 1); // supersedes 'plugged' in the slot of the port
+        v = s.read(64);
+
+        CHECK(v.size() == 1);
+        CHECK(v[0].location == 10 && v[0].st == state::unplugged);
+}
+
+/*
+ * IRP_MJ_READ returns as many states as fit into its buffer, the rest are returned by the next reads.
+ */
+TEST(read_several_states)
+{
+        enum { PORTS = 8 };
+        subscriber s(PORTS);
+
+        for (int port = 1; port <= PORTS; ++port) {
+                attach(s, 100 + port, port);
+        }
+
+        auto v = s.read(3);
+        CHECK(v.size() == 3);
+
+        auto w = s.read(64);
+        CHECK(w.size() == PORTS - 3);
+
+        v.insert(v.end(), w.begin(), w.end());
+        check_read(v);
+
+        for (int i = 0; i < PORTS; ++i) {
+                CHECK(v[i].location == 101 + i);
+                CHECK(v[i].port == i + 1);
+                CHECK(v[i].st == state::plugged);
+        }
+
+        CHECK(!s.has_events());
+        CHECK(s.read(64).empty());
+}
+
+/*
+ * A port is reclaimed before unplugging, so another device can be plugged into it
+ * before the final state of the previous one was posted. Both devices must be seen.
+ */
+TEST(port_reuse)
+{
+        subscriber s(2);
+
+        attach(s, 10, 1);
+        s.changed(10, 1, state::unplugging);
+        attach(s, 20, 1);
+        s.changed(10, 1, state::unplugged);
+
+        auto v = s.read(64);
+        check_read(v);
+
+        CHECK(v.size() == 2);
+        CHECK(v[0].location == 20 && v[0].st == state::plugged && v[0].port == 1);
+        CHECK(v[1].location == 10 && v[1].st == state::unplugged);
+        CHECK(!s.dropped());
+}
+
+/*
+ * Each of 60 ports has its own device that is attached and detached over and over while the reader is slow.
+ * The reader must see the final state of every device, nothing is dropped.
+ */
+TEST(flapping_ports)
+{
+        enum { PORTS = 60 };
+        subscriber s(PORTS);
+
+        std::mt19937 gen(PORTS);
+        std::vector<bool> plugged(PORTS + 1);
+
+        std::map<int, state> final_state;
+        std::map<int, state> seen;
+
+        auto read = [&s, &seen] (size_t max_cnt)
+        {
+                auto v = s.read(max_cnt);
+                check_read(v);
+
+                for (auto &e: v) {
+                        seen[e.location] = e.st;
+                }
+        };
+
+        for (int i = 0; i < 100'000; ++i) {
+                auto port = 1 + static_cast<int>(gen() % PORTS);
+                auto location = 1000 + port;
+
+                if (plugged[port]) {
+                        detach(s, location, port);
+                        final_state[location] = state::unplugged;
+                } else if (gen() % 8) {
+                        attach(s, location, port);
+                        final_state[location] = state::plugged;
+                } else { // the server is unreachable
+                        s.changed(location, 0, state::connecting);
+                        s.changed(location, 0, state::disconnected);
+                        final_state[location] = state::disconnected;
+                        continue;
+                }
+
+                plugged[port] = !plugged[port];
+
+                if (gen() % 256 == 0) {
+                        read(1 + gen() % 64);
+                }
+        }
+
+        while (s.has_events()) {
+                read(64);
+        }
+
+        CHECK(seen == final_state);
+        CHECK(!s.dropped());
+}
+
+/*
+ * Devices are attached and detached on random free ports, so a port is used by different devices.
+ * There are no more devices than ports, the reader must see the final state of each of them.
+ */
+TEST(stress)
+{
+        for (int ports: {2, 30, 127, 254}) {
+                subscriber s(ports);
+
+                std::mt19937 gen(ports);
+                std::vector<int> port_of(ports); // location -> port, zero if not plugged
+                std::vector<int> owner(ports + 1, -1); // port -> location, [0] is unused
+
+                std::map<int, state> final_state;
+                std::map<int, state> seen;
+
+                for (int i = 0; i < 200'000; ++i) {
+                        auto loc = static_cast<int>(gen() % port_of.size());
+
+                        if (auto &port = port_of[loc]) {
+                                owner[port] = -1;
+                                detach(s, loc, port);
+                                final_state[loc] = state::unplugged;
+                                port = 0;
+                        } else if (gen() % 8) {
+                                do {
+                                        port = 1 + static_cast<int>(gen() % ports);
+                                } while (owner[port] >= 0);
+
+                                owner[port] = loc;
+                                attach(s, loc, port);
+                                final_state[loc] = state::plugged;
+                        } else { // the server is unreachable
+                                s.changed(loc, 0, state::connecting);
+                                s.changed(loc, 0, state::disconnected);
+                                final_state[loc] = state::disconnected;
+                        }
+
+                        if (gen() % 16 == 0) { // IRP_MJ_READ of a random size
+                                auto v = s.read(1 + gen() % 64);
+                                check_read(v);
+
+                                for (auto &e: v) {
+                                        seen[e.location] = e.st;
+                                }
+                        }
+                }
+
+                while (s.has_events()) {
+                        auto v = s.read(64);
+                        check_read(v);
+
+                        for (auto &e: v) {
+                                seen[e.location] = e.st;
+                        }
+                }
+
+                CHECK(seen == final_state);
+                CHECK(!s.dropped());
+        }
+}
+
+} // namespace
+
+TEST_MAIN
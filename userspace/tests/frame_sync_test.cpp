@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Virtual frame clock of the driver, see drivers/ude/frame_sync.h.
+
+#include "test.h"
+
+#include <drivers/ude/frame_sync.h>
+
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Server's frame counter that starts at an arbitrary value.
+ */
+struct server
+{
+        unsigned int start;
+        unsigned char shift;
+
+        int frame(unsigned int local) const { return int(start + (local << shift)); }
+};
+
+/*
+ * Feeds RET_SUBMIT.start_frame of transfers that are received after delay milliseconds.
+ */
+void run(frame_clock &c, const server &srv, unsigned int from, unsigned int to, unsigned int max_delay, unsigned seed)
+{
+        std::mt19937 gen(seed);
+
+        for (auto now = from; now != to; ++now) {
+                auto delay = 1 + gen() % max_delay;
+                auto start_frame = srv.frame(now - delay);
+
+                frame_sync::calibrate(c, start_frame, now);
+                if (c.calibrated) {
+                        frame_sync::synchronize(c, start_frame, now);
+                }
+        }
+}
+
+TEST(calibration)
+{
+        for (unsigned char shift: {0, 3}) {
+                frame_clock c{};
+                server srv{ 12345, shift };
+
+                run(c, srv, 1, 1000, 20, shift);
+
+                CHECK(c.calibrated);
+                CHECK(c.synchronized);
+                CHECK(c.shift == shift);
+        }
+}
+
+TEST(unit_change)
+{
+        frame_clock c{};
+        run(c, server{ 100, 0 }, 1, 500, 5, 1);
+        CHECK(c.calibrated && c.shift == 0);
+
+        server srv{ 7, 3 }; // the device was reattached to EHCI
+        run(c, srv, 500, 1500, 5, 2);
+
+        CHECK(c.calibrated && c.synchronized);
+        CHECK(c.shift == 3);
+}
+
+/*
+ * The offset converges to the smallest delay, StartFrame of a URB is translated into server's frame
+ * that is at most one delay behind.
+ */
+TEST(translation)
+{
+        for (unsigned char shift: {0, 3}) {
+                frame_clock c{};
+                server srv{ 0xFFFF'F000, shift }; // wraps around during the run
+
+                run(c, srv, 1, 10'000, 30, shift);
+                CHECK(c.synchronized && c.shift == shift);
+
+                for (unsigned int local = 9'000; local < 11'000; ++local) {
+                        auto lag = srv.frame(local) - frame_sync::to_server(c, local);
+                        CHECK(lag >= 0 && lag <= (1 << shift)); // the smallest delay is 1 ms
+
+                        auto server_frame = frame_sync::to_server(c, local);
+                        CHECK(frame_sync::to_local(c, server_frame) == local);
+                }
+        }
+}
+
+TEST(to_local_wraps_around)
+{
+        frame_clock c{};
+        c.synchronized = c.calibrated = true;
+        c.shift = 3;
+        c.offset_time = 0xFFFF'FFF0; // local frame counter is about to wrap around too
+        c.offset = int(0x7FFF'FFF0 - (c.offset_time << c.shift));
+
+        for (unsigned int d = 0; d < 64; ++d) {
+                auto local = c.offset_time + d;
+                CHECK(frame_sync::to_local(c, frame_sync::to_server(c, local)) == local);
+        }
+}
+
+TEST(offset)
+{
+        frame_clock c{};
+        c.calibrated = true;
+
+        CHECK(frame_sync::synchronize(c, 1000, 100)); // the first sample
+        CHECK(c.offset == 900);
+
+        CHECK(!frame_sync::synchronize(c, 1105, 200)); // smaller delay
+        CHECK(c.offset == 905);
+
+        CHECK(!frame_sync::synchronize(c, 1195, 300)); // larger delay is ignored
+        CHECK(c.offset == 905);
+
+        CHECK(!frame_sync::synchronize(c, 2100, 1200)); // server's clock is slower, the offset drifts
+        CHECK(c.offset == 904);
+        CHECK(c.offset_time == 1200);
+
+        CHECK(!frame_sync::synchronize(c, 2103, 1201)); // too early for the next step of the drift
+        CHECK(c.offset == 904);
+
+        CHECK(frame_sync::synchronize(c, 100, 1300)); // the counter was reset
+        CHECK(c.offset == -1200);
+}
+
+} // namespace
+
+TEST_MAIN
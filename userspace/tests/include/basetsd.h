@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Fixed-size types of basetsd.h that the portable code uses, for compilers other than MSVC.
+ */
+
+#include <cstdint>
+
+using INT8 = int8_t;
+using UINT8 = uint8_t;
+using INT16 = int16_t;
+using UINT16 = uint16_t;
+using INT32 = int32_t;
+using UINT32 = uint32_t;
+using INT64 = int64_t;
+using UINT64 = uint64_t;
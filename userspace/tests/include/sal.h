@@ -0,0 +1,14 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * SAL annotations that the portable code uses, for compilers other than MSVC.
+ */
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Inout_
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Depth adaptation of the jitter buffer, see drivers/ude/jitter_control.h.
+
+#include "test.h"
+
+#include <drivers/ude/jitter_control.h>
+
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr long long msec = 10'000; // 100ns units
+
+auto make(unsigned int depth, unsigned int underrun_rate = 10)
+{
+        jitter_control c{};
+        c.depth = depth;
+        c.min_depth = 1;
+        c.underrun_rate = underrun_rate;
+        return c;
+}
+
+/*
+ * The first sample sets the deviation to half of the interval, as RFC 6298 does for RTTVAR.
+ * It decays for a steady stream, but the depth is decreased by adapt() only.
+ */
+TEST(steady_stream)
+{
+        auto c = make(1);
+        long long now = 1;
+
+        for (int i = 0; i < 1000; ++i, now += msec) {
+                c.arrived(now);
+        }
+
+        CHECK(c.interval == msec);
+        CHECK(c.deviation < msec/100);
+        CHECK(c.min_depth == 2);
+        CHECK(c.depth == 3);
+}
+
+/*
+ * RET_SUBMIT arrive in bursts, the depth must cover the gaps between them.
+ */
+TEST(bursty_stream)
+{
+        auto c = make(1);
+        long long now = 1;
+
+        for (int i = 0; i < 1000; ++i) {
+                now += i % 4 ? msec/10 : 4*msec - 3*msec/10; // four at once every 4 ms
+                c.arrived(now);
+        }
+
+        CHECK(c.min_depth >= 4);
+        CHECK(c.depth >= c.min_depth);
+}
+
+/*
+ * Every tenth RET_SUBMIT is late, the next ones arrive at once.
+ */
+TEST(min_depth_covers_late_arrivals)
+{
+        unsigned int prev = 0;
+
+        for (long long late: {0LL, 2*msec, 5*msec, 10*msec}) {
+                auto c = make(1);
+                long long now = 1;
+
+                for (int i = 1; i <= 10'000; ++i) {
+                        auto expected = i*msec;
+                        now = i % 10 ? (expected > now ? expected : now + 1) : expected + late;
+                        c.arrived(now);
+                }
+
+                CHECK(c.min_depth > prev);
+                CHECK(c.depth >= c.min_depth);
+                prev = c.min_depth;
+        }
+}
+
+TEST(underruns_increase_depth)
+{
+        auto c = make(2, 10);
+        auto limit = c.underrun_rate*jitter_control::WINDOW/1000; // underruns per window
+
+        for (unsigned int i = 0; i < limit; ++i) {
+                CHECK(!c.adapt(true));
+        }
+
+        CHECK(c.adapt(true)); // the target rate is exceeded
+        CHECK(c.depth == 3);
+        CHECK(!c.window && !c.window_underruns);
+        CHECK(c.underruns == limit + 1);
+}
+
+TEST(quiet_window_decreases_depth)
+{
+        auto c = make(4);
+        c.min_depth = 3;
+
+        for (unsigned int i = 1; i < jitter_control::WINDOW; ++i) {
+                CHECK(!c.adapt(false));
+        }
+        CHECK(c.adapt(false));
+        CHECK(c.depth == 3);
+
+        for (unsigned int i = 0; i < 10*jitter_control::WINDOW; ++i) {
+                CHECK(!c.adapt(false)); // min_depth is reached
+        }
+        CHECK(c.depth == 3);
+}
+
+TEST(max_depth)
+{
+        auto c = make(jitter_control::MAX_DEPTH, 1);
+
+        for (int i = 0; i < 100; ++i) {
+                CHECK(!c.adapt(true));
+        }
+
+        CHECK(c.depth == jitter_control::MAX_DEPTH);
+}
+
+/*
+ * Underruns happen at random while the depth is less than the one the network needs.
+ * The depth must settle near it and not grow further.
+ */
+TEST(convergence)
+{
+        for (unsigned int need: {2, 5, 12}) {
+                auto c = make(1, 10);
+                std::mt19937 gen(need);
+                unsigned int max_depth = 0;
+
+                for (int i = 0; i < 200'000; ++i) {
+                        auto underrun = c.depth < need && gen() % 100 < 5; // 5%
+                        c.adapt(underrun);
+
+                        if (i > 100'000 && c.depth > max_depth) {
+                                max_depth = c.depth;
+                        }
+                }
+
+                CHECK(c.depth == need || c.depth + 1 == need);
+                CHECK(max_depth == need);
+        }
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Background jobs of wusbip, see libusbip/src/job_queue.h.
+
+#include "test.h"
+
+#include <libusbip/src/job_queue.h>
+
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <stdexcept>
+#include <string>
+
+namespace
+{
+
+using namespace usbip;
+using namespace std::chrono_literals;
+
+auto wait_until(auto &&pred)
+{
+        for (int i = 0; i < 2000 && !pred(); ++i) {
+                std::this_thread::sleep_for(1ms);
+        }
+
+        return pred();
+}
+
+TEST(concurrent)
+{
+        enum { N = 8 };
+
+        job_queue q;
+        std::latch all_started(N); // each job waits for the others, deadlocks if they were serialized
+        std::atomic<int> done{};
+
+        for (int i = 0; i < N; ++i) {
+                q.post([&] (auto) { all_started.arrive_and_wait(); }, 
+                       [&] (auto error) { done += !error; });
+        }
+
+        CHECK(wait_until([&] { return done == N; }));
+        CHECK(wait_until([&] { return !q.pending(); }));
+}
+
+TEST(exception_is_reported)
+{
+        job_queue q;
+        std::atomic<int> reported{};
+        std::string what;
+
+        q.post([] (auto) { throw std::runtime_error("boom"); }, 
+               [&] (auto error) 
+               {
+                        try {
+                                std::rethrow_exception(error);
+                        } catch (std::exception &e) {
+                                what = e.what();
+                        }
+                        ++reported;
+               });
+
+        q.post([] (auto) { throw 42; }, [&] (auto error) { reported += error ? 1 : 100; });
+
+        CHECK(wait_until([&] { return reported == 2; }));
+        CHECK(what == "boom");
+}
+
+TEST(cancel)
+{
+        job_queue q(1);
+
+        std::atomic<bool> running{};
+        std::atomic<bool> stopped{};
+        std::atomic<int> completed{};
+
+        q.post([&] (auto stop) 
+               {
+                        running = true;
+                        stopped = wait_until([&] { return stop.stop_requested(); });
+               },
+               [&] (auto) { ++completed; });
+
+        q.post([] (auto) {}, [&] (auto) { completed += 100; }); // waits for the only thread
+
+        CHECK(wait_until([&] { return running.load(); }));
+        CHECK(q.pending() == 2);
+
+        q.cancel(); // the second job is discarded
+        CHECK(wait_until([&] { return completed > 0; }));
+        CHECK(stopped);
+        CHECK(completed == 1);
+
+        q.post([] (auto) {}, [&] (auto) { ++completed; }); // the queue is usable after cancel
+        CHECK(wait_until([&] { return completed == 2; }));
+}
+
+TEST(stop_waits_for_jobs)
+{
+        std::atomic<bool> finished{};
+        std::atomic<bool> started{};
+
+        {
+                job_queue q;
+
+                q.post([&] (auto stop) 
+                       { 
+                                started = true;
+                                std::condition_variable_any cv;
+                                std::mutex m;
+                                std::unique_lock lck(m);
+                                cv.wait(lck, stop, [] { return false; }); // a blocking call that is cancellable
+                                finished = true;
+                       }, 
+                       nullptr);
+
+                CHECK(wait_until([&] { return started.load(); }));
+        } // ~job_queue
+
+        CHECK(finished);
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Live statistics of wusbip, see wusbip/live_stats.h.
+// sources: ../wusbip/live_stats.cpp
+
+#include "test.h"
+
+#include <wusbip/live_stats.h>
+
+#include <cmath>
+
+namespace
+{
+
+using namespace usbip;
+
+enum { BUCKETS = 24 };
+
+auto near(double a, double b)
+{
+        return std::abs(a - b) < 1e-9;
+}
+
+auto counters(std::uint64_t generation, std::uint64_t bytes_in, std::uint64_t bytes_out, std::uint64_t urbs)
+{
+        transfer_counters c {
+                .generation = generation,
+                .bytes_in = bytes_in,
+                .bytes_out = bytes_out,
+                .urbs = urbs,
+                .in_flight = 1,
+                .latency = std::vector<std::uint64_t>(BUCKETS),
+        };
+
+        c.latency[4] = urbs; // [16, 32) us
+        return c;
+}
+
+TEST(percentile)
+{
+        std::vector<std::uint64_t> h(BUCKETS);
+        CHECK(usbip::percentile(h, 0.99) < 0);
+
+        h[0] = 100; // [0, 2)
+        CHECK(near(usbip::percentile(h, 0.5), 1));
+        CHECK(near(usbip::percentile(h, 1), 2));
+
+        h[0] = 0;
+        h[10] = 100; // [1024, 2048)
+        CHECK(near(usbip::percentile(h, 0.5), 1536));
+
+        h[3] = 100; // [8, 16)
+        CHECK(near(usbip::percentile(h, 0.25), 12));
+        CHECK(near(usbip::percentile(h, 0.75), 1536));
+        CHECK(near(usbip::percentile(h, 2), 2048)); // clamped
+
+        h[BUCKETS - 1] = 1'000'000; // open-ended
+        CHECK(near(usbip::percentile(h, 0.99), double(1ULL << (BUCKETS - 1))));
+}
+
+TEST(continuation)
+{
+        RateMeter m;
+
+        CHECK(!m.add(1, counters(1, 0, 0, 0))); // the first sample
+        CHECK(m.empty());
+
+        CHECK(m.add(2, counters(1, 1000, 500, 10)));
+        auto &r = m.last();
+        CHECK(near(r.bytes_in, 1000));
+        CHECK(near(r.bytes_out, 500));
+        CHECK(near(r.urbs, 10));
+        CHECK(near(r.p99_latency, 16 + 16*0.99)); // all in [16, 32)
+        CHECK(r.in_flight == 1);
+
+        CHECK(m.add(4, counters(1, 5000, 500, 20))); // two seconds
+        CHECK(near(m.last().bytes_in, 2000));
+        CHECK(near(m.last().bytes_out, 0));
+
+        CHECK(!m.add(4, counters(1, 6000, 500, 30))); // no time has passed, the sample is ignored
+
+        auto v = m.history([] (auto &r) { return r.urbs; });
+        CHECK(v.size() == 2);
+        CHECK(near(v[0], 10) && near(v[1], 5));
+}
+
+TEST(reset)
+{
+        RateMeter m;
+
+        CHECK(!m.add(1, counters(1, 0, 0, 0)));
+        CHECK(m.add(2, counters(1, 100, 0, 1)));
+
+        CHECK(!m.add(3, counters(2, 200, 0, 2))); // another device was attached
+        CHECK(m.empty());
+        CHECK(m.add(4, counters(2, 300, 0, 3)));
+        CHECK(near(m.last().bytes_in, 100));
+
+        CHECK(!m.add(5, counters(2, 100, 0, 4))); // a counter went backwards
+        CHECK(m.empty());
+
+        auto c = counters(2, 200, 0, 5);
+        c.latency.resize(BUCKETS/2);
+        CHECK(!m.add(6, c)); // another histogram
+}
+
+TEST(history_is_bounded)
+{
+        RateMeter m(3);
+
+        for (int i = 0; i < 10; ++i) {
+                m.add(i, counters(1, 0, 0, i*i));
+        }
+
+        auto v = m.history([] (auto &r) { return r.urbs; });
+        CHECK(v.size() == 3);
+        CHECK(near(v[0], 13) && near(v[1], 15) && near(v[2], 17)); // the oldest first
+}
+
+TEST(sparkline)
+{
+        CHECK(sparkline({}).empty());
+
+        std::vector<double> v{0, 1, 2, 3, 4, 5, 6, 7};
+        auto s = sparkline(v);
+
+        CHECK(s.size() == v.size());
+        CHECK(s.front() == L'\u2581' && s.back() == L'\u2588');
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Throughput of LZ4 codec of the driver and effective throughput of a link with and without compression.
+
+#include <usbip/lz4.h>
+#include <usbip/compression_policy.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+/*
+ * @param compressible fraction of bytes that repeat earlier data, the rest is random
+ */
+auto make_data(size_t n, double compressible)
+{
+        std::mt19937 gen(1);
+        std::uniform_real_distribution<double> coin;
+        std::string s;
+
+        while (s.size() < n) {
+                auto len = 8 + gen() % 56;
+
+                if (s.size() > 64 && coin(gen) < compressible) {
+                        auto off = 1 + gen() % std::min<size_t>(s.size(), 4096);
+                        for (size_t i = 0; i < len; ++i) {
+                                s += s[s.size() - off];
+                        }
+                } else {
+                        for (size_t i = 0; i < len; ++i) {
+                                s += static_cast<char>(gen());
+                        }
+                }
+        }
+
+        s.resize(n);
+        return s;
+}
+
+template<typename F>
+auto mb_per_sec(size_t bytes, F &&f)
+{
+        size_t total = 0;
+        auto start = clock_type::now();
+        std::chrono::duration<double> elapsed{};
+
+        do {
+                f();
+                total += bytes;
+                elapsed = clock_type::now() - start;
+        } while (elapsed.count() < 0.5);
+
+        return total/elapsed.count()/1'000'000;
+}
+
+} // namespace
+
+int main()
+{
+        enum { TRANSFER_SIZE = 64*1024 };
+        const double link_mbps[] = { 10, 100, 1000 }; // Mbit/s
+
+        printf("%-14s %6s %10s %12s", "data", "ratio", "comp,MB/s", "decomp,MB/s");
+        for (auto l: link_mbps) {
+                printf(" %6.0f Mbit/s raw/lz4", l);
+        }
+        printf(", MB/s\n");
+
+        std::vector<lz4::hash_entry> table(lz4::HASH_TABLE_SIZE);
+        std::string block(lz4::compress_bound(TRANSFER_SIZE), '\0');
+        std::string out(TRANSFER_SIZE, '\0');
+
+        for (auto compressible: { 0.0, 0.25, 0.5, 0.75, 0.9, 0.99 }) {
+                auto data = make_data(TRANSFER_SIZE, compressible);
+                size_t size = 0;
+
+                auto comp = mb_per_sec(data.size(), [&] {
+                        size = lz4::compress(data.data(), data.size(), block.data(), block.size(), table.data());
+                });
+
+                size_t n{};
+                auto decomp = mb_per_sec(data.size(), [&] {
+                        lz4::decompress(block.data(), size, out.data(), out.size(), n);
+                });
+
+                if (n != data.size() || out != data) {
+                        fprintf(stderr, "round trip failed\n");
+                        return 1;
+                }
+
+                auto ratio = double(size)/data.size();
+
+                char name[32];
+                snprintf(name, sizeof(name), "%.0f%% repeats", compressible*100);
+                printf("%-14s %6.3f %10.1f %12.1f", name, ratio, comp, decomp);
+
+                for (auto l: link_mbps) {
+                        auto link = l/8; // MB/s
+                        auto raw = link;
+
+                        compression_policy p{};
+                        p.completed(static_cast<unsigned long long>(link*1000), 1000); // bytes per ms
+                        p.compressed(data.size(), size < data.size() ? size : 0,
+                                     static_cast<unsigned long long>(data.size()/comp)); // usec
+
+                        // the compressor and the link work sequentially for a transfer
+                        auto lz4 = p.worthwhile() ? 1/(1/comp + ratio/link) : raw;
+                        printf(" %10.1f/%-10.1f", raw, lz4);
+                }
+
+                printf("\n");
+        }
+}
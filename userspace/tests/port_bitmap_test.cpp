@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Claimed root hub ports of the driver, see drivers/ude/port_bitmap.h.
+
+#include "test.h"
+
+#include <drivers/ude/port_bitmap.h>
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+TEST(words)
+{
+        CHECK(port_bitmap::words(1) == 1);
+        CHECK(port_bitmap::words(32) == 1);
+        CHECK(port_bitmap::words(33) == 2);
+        CHECK(port_bitmap::words(254) == 8);
+}
+
+TEST(claim_release)
+{
+        enum { CNT = 70 };
+        std::vector<port_bitmap::word_t> bitmap(port_bitmap::words(CNT));
+
+        for (int i = 0; i < CNT; ++i) {
+                CHECK(port_bitmap::claim(bitmap.data(), 0, CNT) == i); // the lowest free one
+        }
+        CHECK(port_bitmap::claim(bitmap.data(), 0, CNT) == -1);
+
+        CHECK(port_bitmap::release(bitmap.data(), 33));
+        CHECK(!port_bitmap::release(bitmap.data(), 33));
+
+        CHECK(port_bitmap::claim(bitmap.data(), 40, CNT) == -1); // other range
+        CHECK(port_bitmap::claim(bitmap.data(), 0, CNT) == 33);
+}
+
+TEST(ranges)
+{
+        enum { USB2 = 30, USB3 = 34 };
+        std::vector<port_bitmap::word_t> bitmap(port_bitmap::words(USB2 + USB3));
+
+        for (int i = 0; i < USB3; ++i) {
+                CHECK(port_bitmap::claim(bitmap.data(), USB2, USB2 + USB3) == USB2 + i);
+        }
+
+        CHECK(port_bitmap::claim(bitmap.data(), USB2, USB2 + USB3) == -1);
+        CHECK(port_bitmap::claim(bitmap.data(), 0, USB2) == 0); // usb2 ports are still free
+}
+
+/*
+ * Threads attach and detach devices concurrently. A port must never be claimed twice,
+ * and a claim must fail only if all ports were taken at some moment.
+ */
+TEST(concurrent)
+{
+        for (int ports: {1, 30, 64, 254}) {
+                std::vector<port_bitmap::word_t> bitmap(port_bitmap::words(ports));
+                std::vector<std::atomic<int>> owner(ports); // thread + 1, zero if free
+                std::atomic<int> claimed = 0;
+                std::atomic<bool> ok = true;
+
+                auto worker = [&] (int id)
+                {
+                        std::mt19937 gen(id);
+                        std::vector<int> mine;
+
+                        for (int n = 0; n < 100'000; ++n) {
+                                if (mine.empty() || gen() % 2) {
+                                        auto i = port_bitmap::claim(bitmap.data(), 0, ports);
+                                        if (i < 0) {
+                                                continue;
+                                        }
+
+                                        ++claimed;
+                                        if (int free = 0; !owner[i].compare_exchange_strong(free, id + 1)) {
+                                                ok = false; // was claimed twice
+                                        }
+                                        mine.push_back(i);
+                                } else {
+                                        auto pos = gen() % mine.size();
+                                        auto i = mine[pos];
+                                        mine.erase(mine.begin() + pos);
+
+                                        if (int self = id + 1; !owner[i].compare_exchange_strong(self, 0)) {
+                                                ok = false;
+                                        }
+                                        if (!port_bitmap::release(bitmap.data(), i)) {
+                                                ok = false;
+                                        }
+                                }
+                        }
+
+                        for (auto i: mine) {
+                                owner[i] = 0;
+                                if (!port_bitmap::release(bitmap.data(), i)) {
+                                        ok = false;
+                                }
+                        }
+                };
+
+                std::vector<std::jthread> threads;
+                for (int id = 0; id < 8; ++id) {
+                        threads.emplace_back(worker, id);
+                }
+                threads.clear(); // join
+
+                CHECK(ok);
+                CHECK(claimed > ports);
+
+                for (auto w: bitmap) {
+                        CHECK(!w);
+                }
+        }
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Lookup of wusbip tree rows by url and busid: RowIndex versus a walk over the rows that compares their text.
+
+#include <wusbip/row_index.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+struct row
+{
+        std::wstring url;
+        std::wstring busid;
+};
+
+auto make_rows(int servers, int devices)
+{
+        std::vector<row> v;
+
+        for (int s = 0; s < servers; ++s) {
+                auto url = L"server" + std::to_wstring(s) + L".example.com:3240";
+                for (int d = 0; d < devices; ++d) {
+                        v.push_back({url, std::to_wstring(1 + d/16) + L'-' + std::to_wstring(1 + d % 16)});
+                }
+        }
+
+        return v;
+}
+
+template<typename F>
+auto ns_per_call(size_t calls, F &&f)
+{
+        auto start = clock_type::now();
+        for (size_t i = 0; i < calls; ++i) {
+                f(i);
+        }
+        std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+        return elapsed.count()/calls;
+}
+
+} // namespace
+
+int main()
+{
+        enum { SERVERS = 100, DEVICES = 100, LOOKUPS = 100'000 }; // 10k rows
+
+        auto rows = make_rows(SERVERS, DEVICES);
+
+        std::mt19937 gen(1);
+        std::vector<size_t> order(LOOKUPS);
+        for (auto &i: order) {
+                i = gen() % rows.size();
+        }
+
+        RowIndex<size_t> idx; // row number + 1
+        auto build = ns_per_call(rows.size(), [&] (auto i) { idx.device(rows[i].url, rows[i].busid) = i + 1; });
+
+        size_t found = 0;
+
+        auto walk = ns_per_call(LOOKUPS/100, [&] (auto i) { // as find_or_add_device did, slow
+                auto &r = rows[order[i]];
+                for (auto &t: rows) {
+                        if (t.url == r.url && t.busid == r.busid) {
+                                ++found;
+                                break;
+                        }
+                }
+        });
+
+        auto indexed = ns_per_call(LOOKUPS, [&] (auto i) {
+                auto &r = rows[order[i]];
+                found += idx.device(r.url, r.busid) == order[i] + 1;
+        });
+
+        printf("%zu rows: insert %.0f ns, walk %.0f ns, index %.0f ns per lookup, %zu found\n", 
+                rows.size(), build, walk, indexed, found);
+
+        return found == LOOKUPS/100 + LOOKUPS ? 0 : 1;
+}
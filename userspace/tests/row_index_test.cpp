@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Lookup of wusbip tree rows, see wusbip/row_index.h.
+
+#include "test.h"
+
+#include <wusbip/row_index.h>
+
+namespace
+{
+
+using namespace usbip;
+
+TEST(lookup)
+{
+        RowIndex<int> idx; // zero is "no row"
+
+        CHECK(!idx.server(L"srv1:3240"));
+        idx.server(L"srv1:3240") = 1;
+        idx.device(L"srv1:3240", L"1-1") = 2;
+        idx.device(L"srv1:3240", L"1-2") = 3;
+        idx.device(L"srv2:3240", L"1-1") = 4;
+
+        CHECK(idx.server(L"srv1:3240") == 1);
+        CHECK(idx.device(L"srv1:3240", L"1-2") == 3);
+        CHECK(idx.device(L"srv2:3240", L"1-1") == 4);
+        CHECK(idx.devices().size() == 3);
+
+        idx.remove_device(L"srv1:3240", L"1-2");
+        CHECK(!idx.device(L"srv1:3240", L"1-2"));
+
+        idx.remove_server(L"srv1:3240");
+        CHECK(!idx.server(L"srv1:3240"));
+
+        idx.clear();
+        CHECK(idx.devices().empty());
+}
+
+} // namespace
+
+TEST_MAIN
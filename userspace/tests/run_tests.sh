@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Builds and runs tests of the code that does not depend on Windows headers.
+# Usage: run_tests.sh [--bench]
+#
+
+set -e
+
+cd "$(dirname "$0")"
+
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:-"-std=c++20 -O2 -Wall -Wextra -Werror"}
+INCLUDES="-I../../include -I.. -I../.. -Iinclude" # include/ has sal.h for non-MSVC
+OUT=${OUT:-$(mktemp -d)}
+
+for t in *_test.cpp; do
+        exe="$OUT/${t%.cpp}"
+        $CXX $CXXFLAGS $INCLUDES -o "$exe" "$t" $(sed -n 's|^// sources: *||p' "$t" | tr -d '\r')
+        echo "== $t"
+        "$exe"
+done
+
+if [ "$1" = "--bench" ]; then
+        for b in *_bench.cpp; do
+                exe="$OUT/${b%.cpp}"
+                $CXX $CXXFLAGS $INCLUDES -o "$exe" "$b" $(sed -n 's|^// sources: *||p' "$b" | tr -d '\r')
+                echo "== $b"
+                "$exe"
+        done
+fi
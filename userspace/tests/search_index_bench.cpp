@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Search of wusbip over 10k rows, see wusbip/search_index.h. A query must take less than a millisecond.
+// sources: ../wusbip/search_index.cpp
+
+#include <wusbip/search_index.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+struct row
+{
+        std::wstring url;
+        std::wstring busid;
+        std::wstring vendor;
+        std::wstring product;
+        std::wstring notes;
+};
+
+auto widen(std::string_view s)
+{
+        return std::wstring(s.begin(), s.end());
+}
+
+/*
+ * Vendor and product names are taken from the bundled usb.ids.
+ */
+auto make_rows(size_t cnt)
+{
+        std::vector<row> v;
+        v.reserve(cnt);
+
+        std::ifstream f("../usbip/usb.ids");
+        std::string vendor;
+
+        for (std::string line; v.size() < cnt && std::getline(f, line); ) {
+                if (line.empty() || line[0] == '#') {
+                        continue;
+                } else if (line[0] != '\t') {
+                        vendor = line.size() > 6 ? line.substr(6) : "";
+                } else if (line.size() > 7 && line[1] != '\t') {
+                        auto n = v.size();
+                        v.push_back({
+                                L"server" + std::to_wstring(n/100) + L".example.com:3240",
+                                std::to_wstring(1 + n % 100/16) + L'-' + std::to_wstring(1 + n % 16),
+                                widen(vendor),
+                                widen(line.substr(7)),
+                                n % 10 ? L"" : L"shared by the lab" });
+                }
+        }
+
+        return v;
+}
+
+struct stats
+{
+        double median;
+        double max;
+        size_t found;
+};
+
+auto measure(const SearchIndex &idx, std::wstring_view query, int reps)
+{
+        std::vector<double> usec;
+        size_t found = 0;
+
+        for (int i = 0; i < reps; ++i) {
+                auto start = clock_type::now();
+                found = idx.find(query).size();
+                usec.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+        }
+
+        std::ranges::sort(usec);
+        return stats{ usec[usec.size()/2], usec.back(), found };
+}
+
+} // namespace
+
+int main()
+{
+        enum { ROWS = 10'000, REPS = 200 };
+        constexpr auto LIMIT_USEC = 1000.0;
+
+        auto rows = make_rows(ROWS);
+        if (rows.size() != ROWS) {
+                printf("%zu rows were made of usb.ids, %d expected\n", rows.size(), ROWS);
+                return 1;
+        }
+
+        SearchIndex idx;
+
+        auto start = clock_type::now();
+        for (size_t i = 0; i < rows.size(); ++i) {
+                auto &r = rows[i];
+                idx.update(i + 1, { r.url, r.busid, r.vendor, r.product, r.notes });
+        }
+        std::chrono::duration<double, std::milli> build = clock_type::now() - start;
+
+        printf("%zu rows, index built in %.1f ms\n\n", idx.size(), build.count());
+        printf("%-28s %8s %12s %10s\n", "query", "found", "median, us", "max, us");
+
+        const wchar_t *queries[] {
+                L"logitech",
+                L"receiver",
+                L"hewlett laserjet",
+                L"mass storage",
+                L"server42",
+                L"1-2",
+                L"lab",
+                L"hp", // shorter than a trigram, scans all rows
+                L"hp laserjet", // "hp" filters the rows of "laserjet"
+                L"logitek receivr", // fuzzy
+                L"hewlet packrd deskjet", // fuzzy, several words
+                L"zzqqxx", // nothing found, both passes
+        };
+
+        bool ok = true;
+
+        for (auto q: queries) {
+                auto s = measure(idx, q, REPS);
+                ok = ok && s.median < LIMIT_USEC;
+
+                printf("%-28ls %8zu %12.1f %10.1f\n", q, s.found, s.median, s.max);
+        }
+
+        printf("\nmedian of every query is %s %.0f us\n", ok ? "under" : "NOT under", LIMIT_USEC);
+        return !ok;
+}
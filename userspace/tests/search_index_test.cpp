@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Search of wusbip, see wusbip/search_index.h.
+// sources: ../wusbip/search_index.cpp
+
+#include "test.h"
+
+#include <wusbip/search_index.h>
+
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip;
+
+auto find(const SearchIndex &idx, std::wstring_view query)
+{
+        auto v = idx.find(query);
+        std::ranges::sort(v);
+        return v;
+}
+
+using ids = std::vector<SearchIndex::id_type>;
+
+auto make_index()
+{
+        SearchIndex idx;
+        idx.update(1, { L"HP LaserJet 1020", L"03f0:2b17", L"1-1" });
+        idx.update(2, { L"Logitech USB Receiver", L"046d:c52b", L"1-2" });
+        idx.update(3, { L"SanDisk Cruzer Blade", L"0781:5567", L"2-1" });
+        idx.update(4, { L"HP Deskjet 2130", L"03f0:ef11", L"2-2" });
+        return idx;
+}
+
+TEST(exact)
+{
+        auto idx = make_index();
+
+        CHECK(find(idx, L"laserjet") == ids{1});
+        CHECK(find(idx, L"LASERJET 1020") == ids{1});
+        CHECK(find(idx, L"03f0") == (ids{1, 4}));
+        CHECK(find(idx, L"hp") == (ids{1, 4})); // shorter than a trigram
+        CHECK(find(idx, L"hp deskjet") == ids{4});
+        CHECK(find(idx, L"2- hp") == ids{4}); // short words only
+        CHECK(find(idx, L"1-2") == ids{2});
+        CHECK(find(idx, L"   ").empty());
+        CHECK(find(idx, L"canon").empty());
+}
+
+TEST(fuzzy)
+{
+        auto idx = make_index();
+
+        CHECK(find(idx, L"laserjt") == ids{1});
+        CHECK(find(idx, L"hp laserjt") == ids{1}); // a short word must not discard the fuzzy result
+        CHECK(find(idx, L"hp cruzer").empty());
+        CHECK(find(idx, L"logitek receiver") == ids{2});
+        CHECK(find(idx, L"usb") == ids{2}); // a single trigram must match exactly
+}
+
+TEST(update_remove)
+{
+        auto idx = make_index();
+
+        idx.update(1, { L"Canon LiDE 300", L"04a9:1913", L"1-1" });
+        CHECK(find(idx, L"laserjet").empty());
+        CHECK(find(idx, L"lide") == ids{1});
+
+        idx.remove(2);
+        CHECK(idx.size() == 3);
+        CHECK(find(idx, L"logitech").empty());
+
+        idx.update(5, { L"Logitech Webcam C270", L"046d:0825", L"1-2" }); // reuses the slot of 2
+        CHECK(idx.size() == 4);
+        CHECK(find(idx, L"logitech") == ids{5});
+        CHECK(find(idx, L"receiver").empty());
+        CHECK(find(idx, L"1-") == (ids{1, 5}));
+
+        idx.clear();
+        CHECK(!idx.size());
+        CHECK(find(idx, L"lide").empty());
+}
+
+} // namespace
+
+TEST_MAIN
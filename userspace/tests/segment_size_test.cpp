@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Segment size of bulk OUT transfers, see drivers/ude/segment_size.h.
+
+#include "test.h"
+
+#include <drivers/ude/segment_size.h>
+
+#include <random>
+
+namespace
+{
+
+using namespace usbip;
+
+constexpr auto segments(unsigned int size, unsigned int length)
+{
+        return (length - 1)/size + 1;
+}
+
+TEST(not_split)
+{
+        CHECK(!segment_size(0, 512, 1'000'000)); // disabled
+        CHECK(!segment_size(65536, 0, 1'000'000)); // invalid wMaxPacketSize
+        CHECK(!segment_size(65536, 512, 65536));
+        CHECK(!segment_size(65536, 512, 1000));
+}
+
+TEST(rounding)
+{
+        CHECK(segment_size(65536, 512, 65537) == 65536);
+        CHECK(segment_size(100'000, 512, 1'000'000) == 99'840); // rounded down
+        CHECK(segment_size(100'000, 1024, 1'000'000) == 99'328);
+        CHECK(segment_size(65536, 3*1024, 1'000'000) == 64'512);
+}
+
+TEST(max_segments)
+{
+        auto size = segment_size(65536, 512, 64*1024*1024);
+        CHECK(size == 1024*1024);
+        CHECK(segments(size, 64*1024*1024) == MAX_SEGMENTS);
+
+        size = segment_size(65536, 512, 64*1024*1024 + 1); // rounded up
+        CHECK(size == 1024*1024 + 512);
+        CHECK(segments(size, 64*1024*1024 + 1) == MAX_SEGMENTS);
+}
+
+/*
+ * The configured size fits MAX_SEGMENTS, but the size that was rounded down to wMaxPacketSize does not.
+ */
+TEST(rounding_exceeds_max_segments)
+{
+        auto length = 64*100'000U;
+        CHECK(segments(100'000, length) == MAX_SEGMENTS);
+
+        auto size = segment_size(100'000, 512, length);
+        CHECK(size % 512 == 0);
+        CHECK(segments(size, length) <= MAX_SEGMENTS);
+}
+
+TEST(sweep)
+{
+        std::mt19937 gen(1);
+
+        for (unsigned int maxp: {8, 64, 512, 1024, 1023, 3*1024}) {
+                for (unsigned int configured: {65536U, 100'000U, 1U << 20, 1'000'003U}) {
+                        for (int i = 0; i < 20'000; ++i) {
+                                auto length = 1 + gen() % (256*1024*1024);
+                                auto size = segment_size(configured, maxp, length);
+
+                                if (length <= configured) {
+                                        CHECK(!size);
+                                        continue;
+                                }
+
+                                CHECK(size);
+                                CHECK(size % maxp == 0);
+                                CHECK(size < length);
+                                CHECK(segments(size, length) <= MAX_SEGMENTS);
+
+                                if (auto rounded = configured - configured % maxp;
+                                    segments(rounded, length) <= MAX_SEGMENTS) {
+                                        CHECK(size == rounded);
+                                } else {
+                                        CHECK(size > rounded);
+                                        CHECK(segments(size - maxp, length) > MAX_SEGMENTS); // the smallest one
+                                }
+                        }
+                }
+        }
+}
+
+} // namespace
+
+TEST_MAIN
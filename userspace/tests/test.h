@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Minimal test runner for the code that does not depend on Windows headers, see run_tests.sh.
+ */
+
+#include <cstdio>
+#include <vector>
+
+namespace usbip::test
+{
+
+struct test_case
+{
+        const char *name;
+        void (*func)();
+};
+
+inline auto& registry()
+{
+        static std::vector<test_case> v;
+        return v;
+}
+
+inline int failures;
+
+inline void check(bool ok, const char *expr, const char *file, int line)
+{
+        if (!ok) {
+                ++failures;
+                fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, expr);
+        }
+}
+
+struct registrar
+{
+        registrar(const char *name, void (*func)()) { registry().push_back({name, func}); }
+};
+
+inline int run_all()
+{
+        for (auto &t: registry()) {
+                auto before = failures;
+                t.func();
+                printf("%-40s %s\n", t.name, failures == before ? "ok" : "FAILED");
+        }
+
+        return failures ? 1 : 0;
+}
+
+} // namespace usbip::test
+
+#define CHECK(expr) usbip::test::check(static_cast<bool>(expr), #expr, __FILE__, __LINE__)
+
+#define TEST(name) \
+        void test_##name(); \
+        usbip::test::registrar registrar_##name(#name, test_##name); \
+        void test_##name()
+
+#define TEST_MAIN int main() { return usbip::test::run_all(); }
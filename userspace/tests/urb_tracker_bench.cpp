@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// The bookkeeping cost of urb_client per URB: CMD_SUBMIT, RET_SUBMIT and completion at several queue depths.
+// sources: ../libusbip/src/urb_tracker.cpp
+
+#include <libusbip/src/urb_tracker.h>
+
+#include <chrono>
+#include <deque>
+#include <cstdio>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+/*
+ * The queue of the server is FIFO, RET_SUBMIT arrives in the order of CMD_SUBMIT.
+ * @return nanoseconds per URB
+ */
+auto cycle(size_t depth, size_t urbs, UINT64 &bytes)
+{
+        urb_tracker t(0x0001'0002);
+
+        urb_request r{};
+        r.ep = 1;
+        r.dir_in = true;
+        r.in_length = 512;
+
+        std::deque<usbip_header> wire; // CMD_SUBMIT in network byte order
+        UINT64 completed = 0;
+
+        auto start = clock_type::now();
+
+        for (size_t i = 0; i < urbs; ++i) {
+                wire.push_back(to_net(t.submit(r, [&completed] (auto&) { ++completed; }, clock_type::now())));
+                if (wire.size() < depth) {
+                        continue;
+                }
+
+                auto hdr = wire.front(); // the server replies with the same seqnum
+                wire.pop_front();
+                byteswap_header(hdr);
+
+                hdr.base.command = USBIP_RET_SUBMIT;
+                hdr.u.ret_submit.actual_length = hdr.u.cmd_submit.transfer_buffer_length;
+
+                urb_tracker::pending_urb urb;
+                UINT32 payload{};
+
+                if (t.take_ret_submit(hdr, urb, payload) == urb_tracker::ret_error::none) {
+                        auto res = t.completed(hdr.base.seqnum, urb, 0, payload, nullptr, clock_type::now());
+                        urb.f(res);
+                }
+        }
+
+        std::chrono::duration<double, std::nano> elapsed = clock_type::now() - start;
+
+        bytes = t.get_stats(1, true).bytes;
+        return completed ? elapsed.count()/completed : 0;
+}
+
+} // namespace
+
+int main()
+{
+        enum { URBS = 1'000'000 };
+        bool ok = true;
+
+        for (size_t depth: {1, 32, 1000}) {
+                UINT64 bytes{};
+                auto ns = cycle(depth, URBS, bytes);
+
+                auto expected = UINT64(URBS - depth + 1)*512;
+                ok = ok && bytes == expected;
+
+                printf("%zu URBs in flight: %.1f ns per URB, %s\n", depth, ns, bytes == expected ? "ok" : "BYTES DIFFER");
+        }
+
+        return !ok;
+}
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// PDUs, seqnums and statistics of urb_client, see userspace/libusbip/src/urb_tracker.h.
+// sources: ../libusbip/src/urb_tracker.cpp
+
+#include "test.h"
+
+#include <libusbip/src/urb_tracker.h>
+
+#include <cstring>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+using namespace std::chrono_literals;
+
+constexpr UINT32 DEVID = 0x0001'0002; // busnum 1, devnum 2
+
+const urb_tracker::clock_type::time_point t0;
+
+auto bulk_in(UINT8 ep, UINT32 len)
+{
+        urb_request r{};
+
+        r.ep = ep;
+        r.dir_in = true;
+        r.in_length = len;
+
+        return r;
+}
+
+auto bulk_out(UINT8 ep, const char *data, UINT32 len)
+{
+        urb_request r{};
+
+        r.ep = ep;
+        r.out = data;
+        r.out_length = len;
+
+        return r;
+}
+
+auto ret_submit(seqnum_t seqnum, INT32 status, INT32 actual_length)
+{
+        usbip_header hdr{};
+
+        hdr.base.command = USBIP_RET_SUBMIT;
+        hdr.base.seqnum = seqnum;
+        hdr.u.ret_submit.status = status;
+        hdr.u.ret_submit.actual_length = actual_length;
+        hdr.u.ret_submit.number_of_packets = number_of_packets_non_isoch;
+
+        return hdr;
+}
+
+auto ret_unlink(seqnum_t seqnum, INT32 status)
+{
+        usbip_header hdr{};
+
+        hdr.base.command = USBIP_RET_UNLINK;
+        hdr.base.seqnum = seqnum;
+        hdr.u.ret_unlink.status = status;
+
+        return hdr;
+}
+
+TEST(cmd_submit_wire_format)
+{
+        urb_tracker t(DEVID, 0x0A0B0C0D);
+
+        auto r = bulk_in(0x1, 512);
+        r.transfer_flags = 0x200;
+        r.interval = 4;
+        r.setup = { 0x80, 6, 0, 1, 0, 0, 0x12, 0 };
+
+        auto hdr = to_net(t.submit(r, {}, t0));
+
+        const unsigned char expected[sizeof(hdr)] {
+                0, 0, 0, 1, // command
+                0x0A, 0x0B, 0x0C, 0x0D, // seqnum
+                0, 1, 0, 2, // devid
+                0, 0, 0, 1, // direction
+                0, 0, 0, 1, // ep
+                0, 0, 2, 0, // transfer_flags
+                0, 0, 2, 0, // transfer_buffer_length
+                0, 0, 0, 0, // start_frame
+                0xFF, 0xFF, 0xFF, 0xFF, // number_of_packets
+                0, 0, 0, 4, // interval
+                0x80, 6, 0, 1, 0, 0, 0x12, 0 // setup is not swapped
+        };
+
+        CHECK(!memcmp(&hdr, expected, sizeof(hdr)));
+
+        byteswap_header(hdr);
+        CHECK(hdr.base.seqnum == 0x0A0B0C0D);
+        CHECK(hdr.u.cmd_submit.setup[0] == 0x80);
+}
+
+TEST(cmd_unlink)
+{
+        urb_tracker t(DEVID);
+
+        char data[64]{};
+        auto seqnum = t.submit(bulk_out(2, data, sizeof(data)), {}, t0).base.seqnum;
+
+        usbip_header hdr;
+        CHECK(!t.unlink(seqnum + 100, hdr));
+        CHECK(t.unlink(seqnum, hdr));
+
+        CHECK(hdr.base.command == USBIP_CMD_UNLINK);
+        CHECK(hdr.base.seqnum == seqnum + 1);
+        CHECK(hdr.base.devid == DEVID);
+        CHECK(hdr.base.direction == USBIP_DIR_OUT);
+        CHECK(hdr.base.ep == 2);
+        CHECK(hdr.u.cmd_unlink.seqnum == seqnum);
+}
+
+TEST(seqnum_skips_zero)
+{
+        urb_tracker t(DEVID, 0xFFFF'FFFE);
+
+        CHECK(t.submit(bulk_in(1, 8), {}, t0).base.seqnum == 0xFFFF'FFFE);
+        CHECK(t.submit(bulk_in(1, 8), {}, t0).base.seqnum == 0xFFFF'FFFF);
+        CHECK(t.submit(bulk_in(1, 8), {}, t0).base.seqnum == 1);
+}
+
+TEST(is_valid)
+{
+        char data[8]{};
+
+        CHECK(urb_tracker::is_valid(bulk_in(0xF, 8)));
+        CHECK(urb_tracker::is_valid(bulk_out(1, data, sizeof(data))));
+
+        CHECK(!urb_tracker::is_valid(bulk_in(0x10, 8)));
+        CHECK(!urb_tracker::is_valid(bulk_out(1, nullptr, 8)));
+        CHECK(!urb_tracker::is_valid(bulk_in(1, 0x8000'0000)));
+
+        auto r = bulk_in(1, 8);
+        r.out_length = 1;
+        CHECK(!urb_tracker::is_valid(r));
+}
+
+TEST(ret_submit)
+{
+        urb_tracker t(DEVID);
+
+        char data[100]{};
+        auto in = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        auto out = t.submit(bulk_out(2, data, sizeof(data)), {}, t0).base.seqnum;
+
+        urb_tracker::pending_urb urb;
+        UINT32 payload{};
+
+        CHECK(t.take_ret_submit(ret_submit(in + 1000, 0, 0), urb, payload) == urb_tracker::ret_error::unknown_seqnum);
+
+        CHECK(t.take_ret_submit(ret_submit(in, 0, 13), urb, payload) == urb_tracker::ret_error::none);
+        CHECK(urb.dir_in && urb.ep == 1 && payload == 13);
+
+        CHECK(t.take_ret_submit(ret_submit(out, 0, 100), urb, payload) == urb_tracker::ret_error::none);
+        CHECK(!urb.dir_in && !payload); // RET_SUBMIT of OUT has no payload
+
+        CHECK(t.take_ret_submit(ret_submit(in, 0, 13), urb, payload) == urb_tracker::ret_error::unknown_seqnum);
+        CHECK(!t.pending());
+}
+
+TEST(ret_submit_bad_header)
+{
+        urb_tracker t(DEVID);
+        urb_tracker::pending_urb urb;
+        UINT32 payload{};
+
+        auto s = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        CHECK(t.take_ret_submit(ret_submit(s, 0, 513), urb, payload) == urb_tracker::ret_error::bad_header);
+
+        s = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        CHECK(t.take_ret_submit(ret_submit(s, 0, -1), urb, payload) == urb_tracker::ret_error::bad_header);
+
+        s = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        auto hdr = ret_submit(s, 0, 0);
+        hdr.u.ret_submit.number_of_packets = 3;
+        CHECK(t.take_ret_submit(hdr, urb, payload) == urb_tracker::ret_error::bad_header);
+
+        CHECK(!payload);
+        CHECK(!t.pending()); // the URB is taken anyway, the caller completes it
+}
+
+TEST(ret_unlink)
+{
+        urb_tracker t(DEVID);
+
+        auto a = t.submit(bulk_in(1, 8), {}, t0).base.seqnum;
+        auto b = t.submit(bulk_in(1, 8), {}, t0).base.seqnum;
+
+        usbip_header ua, ub;
+        CHECK(t.unlink(a, ua));
+        CHECK(t.unlink(b, ub));
+
+        seqnum_t seqnum{};
+        urb_tracker::pending_urb urb;
+
+        CHECK(!t.take_ret_unlink(ret_unlink(12345, URB_UNLINKED), seqnum, urb)); // unknown CMD_UNLINK
+
+        CHECK(t.take_ret_unlink(ret_unlink(ua.base.seqnum, URB_UNLINKED), seqnum, urb));
+        CHECK(seqnum == a);
+
+        // RET_SUBMIT was sent before CMD_UNLINK was received
+        UINT32 payload{};
+        CHECK(t.take_ret_submit(ret_submit(b, 0, 8), urb, payload) == urb_tracker::ret_error::none);
+        CHECK(!t.take_ret_unlink(ret_unlink(ub.base.seqnum, 0), seqnum, urb));
+
+        CHECK(!t.pending());
+}
+
+TEST(take_all)
+{
+        urb_tracker t(DEVID);
+
+        for (int i = 0; i < 10; ++i) {
+                t.submit(bulk_in(1, 8), {}, t0);
+        }
+
+        usbip_header hdr;
+        CHECK(t.unlink(3, hdr));
+
+        auto v = t.take_all();
+        CHECK(v.size() == 10);
+        CHECK(!t.pending());
+
+        seqnum_t seqnum{};
+        urb_tracker::pending_urb urb;
+        CHECK(!t.take_ret_unlink(ret_unlink(hdr.base.seqnum, URB_UNLINKED), seqnum, urb));
+}
+
+TEST(stats)
+{
+        urb_tracker t(DEVID);
+
+        auto complete = [&t] (seqnum_t seqnum, INT32 status, INT32 actual_length, auto latency)
+        {
+                urb_tracker::pending_urb urb;
+                UINT32 payload{};
+
+                CHECK(t.take_ret_submit(ret_submit(seqnum, status, actual_length), urb, payload) ==
+                      urb_tracker::ret_error::none);
+
+                return t.completed(seqnum, urb, status, actual_length, nullptr, t0 + latency);
+        };
+
+        auto a = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        auto b = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        auto c = t.submit(bulk_in(1, 512), {}, t0).base.seqnum;
+        t.submit(bulk_in(2, 512), {}, t0);
+
+        auto &st = t.get_stats(1, true);
+        CHECK(st.submitted == 3 && st.in_flight == 3);
+        CHECK(t.get_stats(2, true).in_flight == 1);
+        CHECK(!t.get_stats(1, false).submitted);
+
+        auto r = complete(a, 0, 100, 1500us);
+        CHECK(r.seqnum == a && r.actual_length == 100 && r.latency == 1500us);
+
+        complete(b, -32, 0, 10us); // EPIPE
+        complete(c, URB_UNLINKED, 0, 10us);
+
+        CHECK(st.completed == 3 && !st.in_flight);
+        CHECK(st.bytes == 100);
+        CHECK(st.errors == 1);
+        CHECK(st.unlinked == 1);
+        CHECK(st.latency[10] == 1); // [1024, 2048) us
+}
+
+TEST(latency_bucket)
+{
+        CHECK(urb_tracker::latency_bucket(0ns) == 0);
+        CHECK(urb_tracker::latency_bucket(999ns) == 0);
+        CHECK(urb_tracker::latency_bucket(1us) == 0);
+        CHECK(urb_tracker::latency_bucket(2us) == 1);
+        CHECK(urb_tracker::latency_bucket(3us) == 1);
+        CHECK(urb_tracker::latency_bucket(1024us) == 10);
+        CHECK(urb_tracker::latency_bucket(1h) == URB_LATENCY_BUCKETS - 1);
+}
+
+} // namespace
+
+TEST_MAIN
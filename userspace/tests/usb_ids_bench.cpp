@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Startup time and memory of eager and lazy UsbIds, see userspace/libusbip/src/usb_ids_tables.h.
+// sources: ../libusbip/src/usb_ids_tables.cpp
+
+#include <libusbip/src/usb_ids_tables.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+
+using namespace usbip;
+using clock_type = std::chrono::steady_clock;
+
+auto load_usb_ids()
+{
+        std::ifstream f("../usbip/usb.ids", std::ios::binary);
+        std::stringstream ss;
+        ss << f.rdbuf();
+        return ss.str();
+}
+
+auto heap_bytes()
+{
+        return mallinfo2().uordblks;
+}
+
+auto rss_kb()
+{
+        long pages = 0, resident = 0;
+
+        if (auto f = fopen("/proc/self/statm", "r")) {
+                if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+                        resident = 0;
+                }
+                fclose(f);
+        }
+
+        return resident*4;
+}
+
+template<typename F>
+auto median_usec(int cnt, F &&f)
+{
+        std::vector<double> v;
+
+        for (int i = 0; i < cnt; ++i) {
+                auto start = clock_type::now();
+                f();
+                v.push_back(std::chrono::duration<double, std::micro>(clock_type::now() - start).count());
+        }
+
+        std::ranges::nth_element(v, v.begin() + v.size()/2);
+        return v[v.size()/2];
+}
+
+/*
+ * A command of usbip.exe looks up a few devices.
+ */
+void lookups(usb_ids_tables &t)
+{
+        t.find_product(0x1d6b, 0x0002);
+        t.find_product(0x046d, 0xc52b);
+        t.find_product(0x0781, 0x5583);
+        t.find_class_subclass_proto(0x09, 0, 0);
+}
+
+} // namespace
+
+int main()
+{
+        auto content = load_usb_ids();
+        printf("usb.ids %zu bytes\n\n", content.size());
+
+        printf("%-6s %14s %18s %14s %12s\n", "mode", "startup, us", "startup+4 lookups", "heap, KB", "RSS, KB");
+
+        fflush(stdout);
+
+        for (bool lazy: {false, true}) {
+                if (auto pid = fork()) { // memory is measured in a fresh process
+                        waitpid(pid, nullptr, 0);
+                        continue;
+                }
+
+                auto heap = heap_bytes();
+                auto rss = rss_kb();
+
+                auto t = std::make_unique<usb_ids_tables>(content, lazy);
+                lookups(*t);
+
+                auto heap_kb = (heap_bytes() - heap)/1024;
+                auto rss_delta = rss_kb() - rss;
+
+                auto startup = median_usec(50, [&] { usb_ids_tables t(content, lazy); });
+                auto with_lookups = median_usec(50, [&] { usb_ids_tables t(content, lazy); lookups(t); });
+
+                printf("%-6s %14.0f %18.0f %14zu %12ld\n", lazy ? "lazy" : "eager", startup, with_lookups, heap_kb, rss_delta);
+                return 0;
+        }
+}
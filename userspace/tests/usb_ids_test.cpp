@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+// Eager and lazy modes of UsbIds, see userspace/libusbip/src/usb_ids_tables.h.
+// sources: ../libusbip/src/usb_ids_tables.cpp
+
+#include "test.h"
+
+#include <libusbip/src/usb_ids_tables.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using namespace usbip;
+
+struct tables : usb_ids_tables
+{
+        using usb_ids_tables::usb_ids_tables;
+        using usb_ids_tables::m_vendors;
+        using usb_ids_tables::m_products;
+        using usb_ids_tables::m_classes;
+        using usb_ids_tables::m_subclasses;
+        using usb_ids_tables::m_protocols;
+};
+
+const auto& usb_ids()
+{
+        static auto s = []
+        {
+                std::ifstream f("../usbip/usb.ids", std::ios::binary);
+                std::stringstream ss;
+                ss << f.rdbuf();
+                return ss.str();
+        }();
+
+        return s;
+}
+
+template<typename T>
+auto same(const usb_ids_table<T> &a, const usb_ids_table<T> &b)
+{
+        return std::ranges::equal(a, b, [] (auto &x, auto &y) { return x.key == y.key && x.name == y.name; });
+}
+
+TEST(loaded)
+{
+        CHECK(usb_ids().size() > 100'000);
+
+        tables eager(usb_ids(), false);
+        tables lazy(usb_ids(), true);
+
+        CHECK(eager);
+        CHECK(lazy);
+
+        CHECK(eager.m_products.size() > 10'000);
+        CHECK(lazy.m_products.empty());
+        CHECK(same(eager.m_vendors, lazy.m_vendors));
+
+        CHECK(eager.find_product(0x1d6b, 0x0002).first == "Linux Foundation");
+        CHECK(eager.find_product(0x1d6b, 0x0002).second == "2.0 root hub");
+        CHECK(std::get<0>(lazy.find_class_subclass_proto(0x09, 0, 0)) == "Hub");
+}
+
+/*
+ * Vendors are looked up in random order, so lazy mode merges their products in any order.
+ */
+TEST(equivalence)
+{
+        tables eager(usb_ids(), false);
+        tables lazy(usb_ids(), true);
+
+        std::vector<uint16_t> vids;
+        for (auto &v: eager.m_vendors) {
+                vids.push_back(v.key);
+        }
+        for (int i = 0; i < 1000; ++i) {
+                vids.push_back(static_cast<uint16_t>(i*65)); // unknown ones as well
+        }
+
+        std::mt19937 gen(1);
+        std::ranges::shuffle(vids, gen);
+
+        int mismatches = 0;
+
+        for (auto vid: vids) {
+                std::vector<uint16_t> pids { 0, 1, 0xFFFF, static_cast<uint16_t>(gen()) };
+
+                auto i = std::ranges::lower_bound(eager.m_products, uint32_t(vid) << 16, {}, &usb_ids_entry<uint32_t>::key);
+                for ( ; i != eager.m_products.end() && i->key >> 16 == vid; ++i) {
+                        pids.push_back(static_cast<uint16_t>(i->key));
+                }
+
+                for (auto pid: pids) {
+                        mismatches += eager.find_product(vid, pid) != lazy.find_product(vid, pid);
+                }
+        }
+
+        CHECK(!mismatches);
+        CHECK(same(eager.m_products, lazy.m_products)); // all vendors have been parsed
+
+        for (int cls = 0; cls < 0x100; ++cls) {
+                for (int sub = 0; sub < 0x100; sub += 3) {
+                        for (int prot: {0, 1, 2, 0x80, 0xFF}) {
+                                mismatches += eager.find_class_subclass_proto(uint8_t(cls), uint8_t(sub), uint8_t(prot)) !=
+                                               lazy.find_class_subclass_proto(uint8_t(cls), uint8_t(sub), uint8_t(prot));
+                        }
+                }
+        }
+
+        CHECK(!mismatches);
+        CHECK(same(eager.m_classes, lazy.m_classes));
+        CHECK(same(eager.m_subclasses, lazy.m_subclasses));
+        CHECK(same(eager.m_protocols, lazy.m_protocols));
+}
+
+/*
+ * usb.ids is sorted, but this is not guaranteed. The first of duplicates is kept in both modes.
+ */
+TEST(unsorted_duplicates)
+{
+        const std::string content =
+                "# comment\n"
+                "2000  Second\n"
+                "\t0002  two\n"
+                "\t0001  one\n"
+                "# comment inside the block\n"
+                "\t0001  one again\n"
+                "1000  First\n"
+                "\t0001  first one\n"
+                "1000  First again\n"
+                "\t0002  first two\n"
+                "\n"
+                "# List of known device classes, subclasses and protocols\n"
+                "C 09  Hub\n"
+                "\t01  Subclass\n"
+                "\t\t01  Single TT\n"
+                "C 03  Human Interface Device\n"
+                "C 09  Hub again\n";
+
+        using names = std::pair<std::string_view, std::string_view>;
+
+        for (bool lazy: {false, true}) {
+                tables t(content, lazy);
+
+                CHECK(t.find_product(0x2000, 0x0001) == names("Second", "one"));
+                CHECK(t.find_product(0x2000, 0x0002).second == "two");
+                CHECK(t.find_product(0x1000, 0x0001) == names("First", "first one"));
+                CHECK(t.find_product(0x1000, 0x0003).second.empty());
+                CHECK(t.find_product(0x3000, 0x0001).first.empty());
+
+                CHECK(std::get<0>(t.find_class_subclass_proto(0x09, 1, 1)) == "Hub");
+                CHECK(std::get<2>(t.find_class_subclass_proto(0x09, 1, 1)) == "Single TT");
+                CHECK(std::get<0>(t.find_class_subclass_proto(0x03, 0, 0)) == "Human Interface Device");
+
+                CHECK(std::ranges::is_sorted(t.m_products, {}, &usb_ids_entry<uint32_t>::key));
+                CHECK(std::ranges::adjacent_find(t.m_products, {}, &usb_ids_entry<uint32_t>::key) == t.m_products.end());
+        }
+
+        tables lazy(content, true);
+        lazy.find_product(0x2000, 0);
+        CHECK(lazy.m_products.size() == 2); // "one again" is dropped
+}
+
+TEST(concurrent_lazy_lookups)
+{
+        tables eager(usb_ids(), false);
+        tables lazy(usb_ids(), true);
+
+        std::vector<int> mismatches(8);
+        {
+                std::vector<std::jthread> threads;
+                for (int t = 0; t < int(mismatches.size()); ++t) {
+                        threads.emplace_back([&, t]
+                        {
+                                std::mt19937 gen(t);
+                                for (int i = 0; i < 20'000; ++i) {
+                                        auto &p = eager.m_products[gen() % eager.m_products.size()];
+                                        auto vid = static_cast<uint16_t>(p.key >> 16);
+                                        auto pid = static_cast<uint16_t>(p.key);
+                                        mismatches[t] += lazy.find_product(vid, pid) != eager.find_product(vid, pid);
+                                }
+                        });
+                }
+        }
+
+        for (auto m: mismatches) {
+                CHECK(!m);
+        }
+}
+
+} // namespace
+
+TEST_MAIN
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "usbip.h"
+#include "bench_stats.h"
+#include "bench_storage.h"
+
+#include <libusbip\vhci.h>
+#include <libusbip\urb_client.h>
+
+#include <resources\messages.h>
+#include <spdlog\spdlog.h>
+
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::bench;
+using namespace std::chrono_literals;
+
+using clock_type = std::chrono::steady_clock;
+
+enum : UINT8 { DIR_IN = 0x80 }; // bmRequestType, bEndpointAddress
+enum : UINT32 { INTERRUPT_LENGTH = 1024 }; // max wMaxPacketSize of high-speed interrupt endpoint
+
+auto usec_since(_In_ clock_type::time_point start)
+{
+        return std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+}
+
+auto seconds_since(_In_ clock_type::time_point start)
+{
+        return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+/*
+ * A server releases a device asynchronously after the connection was closed,
+ * it can be busy for a while after detach.
+ */
+template<typename F>
+auto retry_if_busy(_In_ F f)
+{
+        for (int i = 0; ; ++i) {
+                if (auto ret = f(); ret || GetLastError() != USBIP_ERROR_ST_DEV_BUSY || i == 50) {
+                        return ret;
+                }
+                std::this_thread::sleep_for(100ms);
+        }
+}
+
+/*
+ * Each cycle measures vhci::attach (connect, import, plug in) and vhci::detach.
+ */
+bool bench_attach(_In_ const bench_args &args, _Inout_ std::vector<result> &results)
+{
+        auto dev = vhci::open();
+        if (!dev) {
+                spdlog::error(GetLastErrorMsg());
+                return false;
+        }
+
+        device_location location {
+                .hostname = args.remote,
+                .service = global_args.tcp_port,
+                .busid = args.busid,
+        };
+
+        std::vector<double> attach;
+        std::vector<double> detach;
+
+        for (int i = 0; i < args.attach; ++i) {
+                clock_type::time_point t;
+
+                auto port = retry_if_busy([&] { t = clock_type::now(); return vhci::attach(dev.get(), location); });
+                if (!port) {
+                        spdlog::error("attach: {}", GetLastErrorMsg());
+                        return false;
+                }
+                attach.push_back(usec_since(t));
+
+                t = clock_type::now();
+
+                if (!vhci::detach(dev.get(), port)) {
+                        spdlog::error("detach port {}: {}", port, GetLastErrorMsg());
+                        return false;
+                }
+                detach.push_back(usec_since(t));
+        }
+
+        for (auto [test, samples]: { std::pair("attach", &attach), std::pair("detach", &detach) }) {
+                auto l = summarize(*samples);
+                auto secs = l.mean*l.count/1'000'000; // its own calls only, ops/s is the inverse of the mean
+
+                results.push_back({ .test = test, .queue_depth = 1, .seconds = secs, .latency = l });
+        }
+
+        return true;
+}
+
+/*
+ * Keeps queue_depth URBs in flight until the deadline or until count of them were submitted.
+ * The next URB is submitted by the callback of the previous one, the first error stops the run
+ * because the endpoint is likely halted.
+ *
+ * Callbacks run on the receiver thread of urb_client, the data members are read after wait_idle().
+ * An instance must outlive urb_client, the destructor of the client completes URBs in flight.
+ */
+class pipeline
+{
+public:
+        std::vector<double> latency; // microseconds, of successful URBs
+        size_t errors{};
+        INT32 first_error{};
+        std::uint64_t bytes{};
+        double seconds{};
+
+        bool run(_Inout_ urb_client &client, _In_ const urb_request &req, _In_ unsigned int queue_depth,
+                 _In_ size_t count, _In_ clock_type::duration duration);
+
+private:
+        urb_client *m_client{};
+        urb_request m_req{};
+        clock_type::time_point m_deadline;
+        std::atomic<size_t> m_remaining; // URBs to submit
+        std::atomic<bool> m_failed;
+
+        bool take();
+        bool submit();
+        void on_completion(_In_ const urb_result &r);
+};
+
+bool pipeline::take()
+{
+        auto n = m_remaining.load();
+        while (n && !m_remaining.compare_exchange_weak(n, n - 1));
+
+        return n && clock_type::now() < m_deadline;
+}
+
+bool pipeline::submit()
+{
+        if (m_client->submit(m_req, [this] (auto &r) { on_completion(r); })) {
+                return true;
+        }
+
+        spdlog::error("submit: {}", GetLastErrorMsg());
+        m_failed = true;
+        return false;
+}
+
+void pipeline::on_completion(_In_ const urb_result &r)
+{
+        if (r.status) {
+                if (!errors++) {
+                        first_error = r.status;
+                }
+                m_remaining = 0;
+                return;
+        }
+
+        latency.push_back(std::chrono::duration<double, std::micro>(r.latency).count());
+        bytes += r.actual_length;
+
+        if (take() && submit()) {
+                m_client->flush();
+        }
+}
+
+/*
+ * @param count zero means until the deadline
+ * @return false if URBs can't be submitted or were not completed in time
+ */
+bool pipeline::run(
+        _Inout_ urb_client &client, _In_ const urb_request &req, _In_ unsigned int queue_depth,
+        _In_ size_t count, _In_ clock_type::duration duration)
+{
+        latency.clear();
+        latency.reserve(count ? count : 64*1024);
+        errors = 0;
+        first_error = 0;
+        bytes = 0;
+
+        m_client = &client;
+        m_req = req;
+        m_remaining = count ? count : SIZE_MAX;
+        m_failed = false;
+
+        auto start = clock_type::now();
+        m_deadline = start + duration;
+
+        for (unsigned int i = 0; i < queue_depth && take() && submit(); ++i);
+        client.flush();
+
+        auto ok = client.wait_idle(std::chrono::duration_cast<std::chrono::milliseconds>(duration) + 10s);
+        seconds = seconds_since(start);
+
+        if (!ok) {
+                spdlog::error("URBs were not completed in time");
+        } else if (errors) {
+                spdlog::warn("endpoint {:#x}: {} URB(s) failed, the first status {}",
+                             req.ep | (req.dir_in ? DIR_IN : 0), errors, first_error);
+        }
+
+        return ok && !m_failed;
+}
+
+auto import_remote(_In_ const bench_args &args, _Out_ usb_device &dev)
+{
+        Socket s;
+
+        auto ok = retry_if_busy([&]
+        {
+                s = connect(args.remote.c_str(), global_args.tcp_port.c_str());
+                return s && import_device(s.get(), args.busid.c_str(), dev);
+        });
+
+        if (!ok) {
+                spdlog::error("import {}:{}/{}: {}", args.remote, global_args.tcp_port, args.busid, GetLastErrorMsg());
+                s.close();
+        }
+
+        return s;
+}
+
+auto make_result(_In_ const char *test, _In_ unsigned int queue_depth, _In_ size_t transfer_size,
+                 _Inout_ pipeline &p)
+{
+        return result {
+                .test = test,
+                .queue_depth = queue_depth,
+                .transfer_size = transfer_size,
+                .errors = p.errors,
+                .seconds = p.seconds,
+                .bytes = p.bytes,
+                .latency = summarize(p.latency),
+        };
+}
+
+/*
+ * Sequential and random READ(10), then WRITE(10) if enabled, for each I/O size.
+ */
+bool bench_storage(
+        _In_ const bench_args &args, _Inout_ storage &st, _Inout_ urb_client &client,
+        _Inout_ std::vector<result> &results)
+{
+        if (!st.start(client)) {
+                return false;
+        }
+
+        std::chrono::seconds duration(args.duration);
+
+        for (auto write: { false, true }) {
+                if (write && !args.storage_write) {
+                        continue;
+                }
+
+                for (auto random: { false, true }) {
+                        for (auto size: args.io_size) {
+                                auto blocks = size/st.block_size();
+
+                                if (size % st.block_size() || blocks > USHRT_MAX || blocks > st.blocks()) {
+                                        spdlog::warn("I/O size {} is skipped, block size {}, blocks {}",
+                                                     size, st.block_size(), st.blocks());
+                                        continue;
+                                }
+
+                                result r;
+                                auto ok = st.run(r, write, random, size, duration);
+
+                                results.push_back(std::move(r));
+                                if (!ok) {
+                                        return false;
+                                }
+                        }
+                }
+        }
+
+        return true;
+}
+
+/*
+ * URBs are sent to the server directly by urb_client, the driver is not involved.
+ */
+bool bench_transfers(_In_ const bench_args &args, _Inout_ std::vector<result> &results)
+{
+        usb_device udev;
+
+        auto s = import_remote(args, udev);
+        if (!s) {
+                return false;
+        }
+
+        pipeline p; // must outlive the client
+        storage st(UINT8(args.bulk_in), UINT8(args.bulk_out), UINT8(args.lun));
+
+        urb_client client(std::move(s), make_devid(udev));
+
+        auto timeout = clock_type::duration(1h); // for runs that are limited by count
+
+        urb_request ctrl {
+                .dir_in = true,
+                .setup = { DIR_IN, USB_REQUEST_GET_DESCRIPTOR, 0, USB_DEVICE_DESCRIPTOR_TYPE, 0, 0,
+                           sizeof(USB_DEVICE_DESCRIPTOR), 0 },
+                .in_length = sizeof(USB_DEVICE_DESCRIPTOR),
+        };
+
+        if (!p.run(client, ctrl, 1, args.count, timeout)) {
+                return false;
+        }
+        results.push_back(make_result("control", 1, ctrl.in_length, p));
+
+        if (args.interrupt_in) {
+                urb_request r {
+                        .ep = UINT8(args.interrupt_in),
+                        .dir_in = true,
+                        .in_length = INTERRUPT_LENGTH,
+                        .interval = args.interval,
+                };
+
+                if (!p.run(client, r, 1, args.count, timeout)) {
+                        return false;
+                }
+                results.push_back(make_result("interrupt_in", 1, r.in_length, p));
+        }
+
+        if (args.storage) {
+                return bench_storage(args, st, client, results);
+        }
+
+        std::vector<char> payload(args.bulk_out ? args.size : 0, '\xA5');
+        std::chrono::seconds duration(args.duration);
+
+        for (auto [ep, dir_in, test]: { std::tuple(args.bulk_in, true, "bulk_in"),
+                                        std::tuple(args.bulk_out, false, "bulk_out") }) {
+                if (!ep) {
+                        continue;
+                }
+
+                urb_request r {
+                        .ep = UINT8(ep),
+                        .dir_in = dir_in,
+                        .out = dir_in ? nullptr : payload.data(),
+                        .out_length = dir_in ? 0 : UINT32(payload.size()),
+                        .in_length = dir_in ? args.size : 0,
+                };
+
+                for (auto qd: args.queue_depth) {
+                        if (!p.run(client, r, qd, 0, duration)) {
+                                return false;
+                        }
+                        results.push_back(make_result(test, qd, args.size, p));
+                }
+        }
+
+        return true;
+}
+
+/*
+ * A baseline is the report of a previous run in CSV format, "usbip bench ... --format csv > baseline.csv".
+ */
+bool check_baseline(_In_ const bench_args &args, _In_ const std::vector<result> &results)
+{
+        std::ifstream f(args.baseline, std::ios::binary);
+        std::stringstream csv;
+        csv << f.rdbuf();
+
+        std::vector<result> baseline;
+
+        if (!f || !from_csv(baseline, csv.view())) {
+                spdlog::error("'{}' is not a CSV report of usbip bench", args.baseline);
+                return false;
+        }
+
+        auto v = compare(baseline, results, args.tolerance/100.0);
+        if (v.empty()) {
+                spdlog::info("no regressions against '{}'", args.baseline);
+                return true;
+        }
+
+        spdlog::error("{} regression(s) against '{}', tolerance {}%", v.size(), args.baseline, args.tolerance);
+        fputs(to_text(v).c_str(), stderr);
+
+        return false;
+}
+
+} // namespace
+
+
+bool usbip::cmd_bench(void *p)
+{
+        auto &args = *reinterpret_cast<bench_args*>(p);
+        std::vector<result> results;
+
+        auto ok = (!args.attach || bench_attach(args, results)) && bench_transfers(args, results);
+
+        if (results.empty()) {
+                return ok;
+        }
+
+        for (auto &r: results) {
+                if (!is_valid(r)) {
+                        spdlog::error("{}, queue depth {}: {} URB(s) have completed, but no bytes were transferred",
+                                      r.test, r.queue_depth, r.latency.count);
+                        ok = false;
+                }
+        }
+
+        auto report = args.format == "json" ? to_json(results) :
+                      args.format == "csv"  ? to_csv(results) :
+                                              to_text(results);
+
+        fputs(report.c_str(), stdout);
+
+        if (!args.baseline.empty() && !check_baseline(args, results)) {
+                ok = false;
+        }
+
+        return ok;
+}
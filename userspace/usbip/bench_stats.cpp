@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "bench_stats.h"
+
+#include <cmath>
+#include <cstdio>
+#include <numeric>
+#include <charconv>
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip::bench;
+
+template<typename... Args>
+void append(std::string &s, const char *fmt, Args... args)
+{
+        char buf[256];
+        auto n = snprintf(buf, sizeof(buf), fmt, args...);
+        s.append(buf, n > 0 ? std::min(size_t(n), sizeof(buf) - 1) : 0);
+}
+
+/*
+ * Test names are ASCII identifiers, but a report must be valid in any case.
+ */
+auto json_string(const std::string &s)
+{
+        std::string r("\"");
+
+        for (auto c: s) {
+                if (c == '"' || c == '\\') {
+                        r += '\\';
+                        r += c;
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                        append(r, "\\u%04x", c);
+                } else {
+                        r += c;
+                }
+        }
+
+        r += '"';
+        return r;
+}
+
+const char csv_header[] = "test,queue_depth,transfer_size,count,errors,seconds,bytes,mb_per_sec,ops_per_sec,"
+                          "min_us,mean_us,stddev_us,p50_us,p90_us,p99_us,p999_us,max_us";
+
+/*
+ * Removes the field from the beginning of the line.
+ */
+auto next_field(std::string_view &line)
+{
+        auto pos = line.find(',');
+        auto field = line.substr(0, pos);
+
+        line.remove_prefix(pos == line.npos ? line.size() : pos + 1);
+        return field;
+}
+
+template<typename T>
+auto parse_field(std::string_view &line, T &val)
+{
+        auto field = next_field(line);
+        auto end = field.data() + field.size();
+
+        auto [ptr, ec] = std::from_chars(field.data(), end, val);
+        return ec == std::errc() && ptr == end;
+}
+
+auto parse_row(result &r, std::string_view line)
+{
+        r = {};
+        r.test = next_field(line);
+
+        auto &l = r.latency;
+        double mb_per_sec, ops_per_sec;
+
+        return  !r.test.empty() &&
+                parse_field(line, r.queue_depth) &&
+                parse_field(line, r.transfer_size) &&
+                parse_field(line, l.count) &&
+                parse_field(line, r.errors) &&
+                parse_field(line, r.seconds) &&
+                parse_field(line, r.bytes) &&
+                parse_field(line, mb_per_sec) &&
+                parse_field(line, ops_per_sec) &&
+                parse_field(line, l.min) &&
+                parse_field(line, l.mean) &&
+                parse_field(line, l.stddev) &&
+                parse_field(line, l.p50) &&
+                parse_field(line, l.p90) &&
+                parse_field(line, l.p99) &&
+                parse_field(line, l.p999) &&
+                parse_field(line, l.max) &&
+                line.empty();
+}
+
+auto same_run(const result &a, const result &b)
+{
+        return a.test == b.test && a.queue_depth == b.queue_depth && a.transfer_size == b.transfer_size;
+}
+
+} // namespace
+
+
+double usbip::bench::percentile(std::span<const double> sorted, double p)
+{
+        if (sorted.empty()) {
+                return 0;
+        }
+
+        auto pos = std::clamp(p, 0.0, 1.0)*(sorted.size() - 1);
+        auto i = static_cast<size_t>(pos);
+
+        if (i + 1 >= sorted.size()) {
+                return sorted.back();
+        }
+
+        return sorted[i] + (pos - i)*(sorted[i + 1] - sorted[i]);
+}
+
+auto usbip::bench::summarize(std::vector<double> &samples) -> summary
+{
+        summary r{};
+
+        r.count = samples.size();
+        if (samples.empty()) {
+                return r;
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        r.min = samples.front();
+        r.max = samples.back();
+        r.mean = std::accumulate(samples.begin(), samples.end(), 0.0)/samples.size();
+
+        auto var = std::accumulate(samples.begin(), samples.end(), 0.0,
+                                   [mean = r.mean] (auto acc, auto v) { return acc + (v - mean)*(v - mean); });
+
+        r.stddev = std::sqrt(var/samples.size());
+
+        r.p50 = percentile(samples, 0.5);
+        r.p90 = percentile(samples, 0.9);
+        r.p99 = percentile(samples, 0.99);
+        r.p999 = percentile(samples, 0.999);
+
+        return r;
+}
+
+bool usbip::bench::is_valid(const result &r)
+{
+        return !(r.transfer_size && r.latency.count && !r.bytes);
+}
+
+std::string usbip::bench::to_text(std::span<const result> results)
+{
+        std::string s;
+        append(s, "%-14s %5s %8s %8s %6s %10s %10s %10s %10s %10s %10s %10s\n",
+                  "test", "qd", "size", "count", "errors", "MB/s", "ops/s", "min,us", "p50,us", "p99,us", "p99.9,us", "max,us");
+
+        for (auto &r: results) {
+                auto &l = r.latency;
+                append(s, "%-14s %5u %8zu %8zu %6zu %10.2f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                          r.test.c_str(), r.queue_depth, r.transfer_size, l.count, r.errors,
+                          r.mb_per_sec(), r.ops_per_sec(), l.min, l.p50, l.p99, l.p999, l.max);
+        }
+
+        return s;
+}
+
+std::string usbip::bench::to_json(std::span<const result> results)
+{
+        std::string s("{\n  \"results\": [");
+
+        for (size_t i = 0; i < results.size(); ++i) {
+                auto &r = results[i];
+                auto &l = r.latency;
+
+                s += i ? ",\n    {" : "\n    {";
+                s += "\"test\": " + json_string(r.test);
+
+                append(s, ", \"queue_depth\": %u, \"transfer_size\": %zu, \"count\": %zu, \"errors\": %zu",
+                          r.queue_depth, r.transfer_size, l.count, r.errors);
+
+                append(s, ", \"seconds\": %.6f, \"bytes\": %llu, \"mb_per_sec\": %.3f, \"ops_per_sec\": %.3f",
+                          r.seconds, static_cast<unsigned long long>(r.bytes), r.mb_per_sec(), r.ops_per_sec());
+
+                append(s, ", \"latency_us\": {\"min\": %.3f, \"mean\": %.3f, \"stddev\": %.3f, "
+                          "\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p99.9\": %.3f, \"max\": %.3f}}",
+                          l.min, l.mean, l.stddev, l.p50, l.p90, l.p99, l.p999, l.max);
+        }
+
+        s += results.empty() ? "]\n}\n" : "\n  ]\n}\n";
+        return s;
+}
+
+std::string usbip::bench::to_csv(std::span<const result> results)
+{
+        std::string s(csv_header);
+        s += '\n';
+
+        for (auto &r: results) {
+                auto &l = r.latency;
+
+                append(s, "%s,%u,%zu,%zu,%zu,%.6f,%llu,%.3f,%.3f,",
+                          r.test.c_str(), r.queue_depth, r.transfer_size, l.count, r.errors,
+                          r.seconds, static_cast<unsigned long long>(r.bytes), r.mb_per_sec(), r.ops_per_sec());
+
+                append(s, "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                          l.min, l.mean, l.stddev, l.p50, l.p90, l.p99, l.p999, l.max);
+        }
+
+        return s;
+}
+
+bool usbip::bench::from_csv(std::vector<result> &results, std::string_view csv)
+{
+        results.clear();
+        bool header = true;
+
+        while (!csv.empty()) {
+                auto pos = csv.find('\n');
+                auto line = csv.substr(0, pos);
+                csv.remove_prefix(pos == csv.npos ? csv.size() : pos + 1);
+
+                if (line.ends_with('\r')) {
+                        line.remove_suffix(1);
+                }
+
+                if (header) {
+                        if (line != csv_header) {
+                                return false;
+                        }
+                        header = false;
+                } else if (!line.empty() && !parse_row(results.emplace_back(), line)) {
+                        return false;
+                }
+        }
+
+        return !header;
+}
+
+auto usbip::bench::compare(std::span<const result> baseline, std::span<const result> results, double tolerance)
+        -> std::vector<regression>
+{
+        std::vector<regression> v;
+
+        for (auto &r: results) {
+                auto b = std::find_if(baseline.begin(), baseline.end(), [&r] (auto &b) { return same_run(b, r); });
+                if (b == baseline.end()) {
+                        continue;
+                }
+
+                auto add = [&v, &r] (auto metric, double baseline, double current)
+                {
+                        v.push_back({ r.test, r.queue_depth, r.transfer_size, metric, baseline, current });
+                };
+
+                if (r.ops_per_sec() < b->ops_per_sec()*(1 - tolerance)) {
+                        add("ops/s", b->ops_per_sec(), r.ops_per_sec());
+                }
+
+                if (r.latency.count && b->latency.count && r.latency.p99 > b->latency.p99*(1 + tolerance)) {
+                        add("p99,us", b->latency.p99, r.latency.p99);
+                }
+
+                if (r.errors > b->errors) {
+                        add("errors", double(b->errors), double(r.errors));
+                }
+        }
+
+        return v;
+}
+
+std::string usbip::bench::to_text(std::span<const regression> regressions)
+{
+        std::string s;
+
+        for (auto &r: regressions) {
+                auto change = r.baseline ? 100*(r.current - r.baseline)/r.baseline : 0;
+
+                append(s, "%s, queue depth %u, size %zu: %s %.1f -> %.1f (%+.1f%%)\n",
+                          r.test.c_str(), r.queue_depth, r.transfer_size, r.metric, r.baseline, r.current, change);
+        }
+
+        return s;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+/*
+ * Statistics and reports of "usbip bench".
+ * Does not depend on Windows headers, it can be built and checked on any platform.
+ */
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+namespace usbip::bench
+{
+
+/*
+ * Of latency samples, microseconds.
+ */
+struct summary
+{
+        size_t count;
+        double min;
+        double mean;
+        double stddev;
+        double p50;
+        double p90;
+        double p99;
+        double p999;
+        double max;
+};
+
+/*
+ * Linear interpolation between the closest ranks.
+ * @param sorted in ascending order
+ * @param p in [0, 1]
+ * @return zero if there are no samples
+ */
+double percentile(std::span<const double> sorted, double p);
+
+/*
+ * @param samples are sorted in place
+ */
+summary summarize(std::vector<double> &samples);
+
+struct result
+{
+        std::string test; // attach, control, bulk_in, bot_seq_read, etc.
+        unsigned int queue_depth; // URBs in flight
+        size_t transfer_size; // bytes, of each URB
+        size_t errors;
+        double seconds; // duration of the run
+        std::uint64_t bytes; // transferred by successful URBs
+        summary latency;
+
+        double ops_per_sec() const { return seconds > 0 ? latency.count/seconds : 0; }
+        double mb_per_sec() const { return seconds > 0 ? bytes/seconds/1'000'000 : 0; }
+};
+
+/*
+ * A transfer test that has completed URBs without moving a byte has measured nothing,
+ * e.g. if actual_length of OUT transfers is not reported. Such result must fail the run.
+ */
+bool is_valid(const result &r);
+
+std::string to_text(std::span<const result> results);
+std::string to_json(std::span<const result> results);
+std::string to_csv(std::span<const result> results);
+
+/*
+ * Parses the report of to_csv, e.g. a baseline saved by a previous run.
+ * Derived columns (MB/s, ops/s) are recalculated from the others.
+ * @return false if the header or a row is malformed
+ */
+bool from_csv(std::vector<result> &results, std::string_view csv);
+
+struct regression
+{
+        std::string test;
+        unsigned int queue_depth;
+        size_t transfer_size;
+        const char *metric; // "ops/s", "p99,us" or "errors"
+        double baseline;
+        double current;
+};
+
+/*
+ * Compares each result with the baseline of the same test, queue depth and transfer size.
+ * Lower ops/s (thus MB/s) or higher p99 latency by more than tolerance is a regression, as well as more errors.
+ * Results that are not in the baseline are not compared.
+ * @param tolerance fraction, e.g. 0.1 is 10%
+ */
+std::vector<regression> compare(std::span<const result> baseline, std::span<const result> results, double tolerance);
+
+std::string to_text(std::span<const regression> regressions);
+
+} // namespace usbip::bench
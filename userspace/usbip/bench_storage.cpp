@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "bench_storage.h"
+#include "usbip.h"
+
+#include <spdlog\spdlog.h>
+
+#include <cstring>
+
+namespace
+{
+
+using namespace usbip;
+using namespace usbip::bench;
+using namespace std::chrono_literals;
+
+enum : UINT32 {
+        CBW_SIGNATURE = 0x43425355, // "USBC"
+        CSW_SIGNATURE = 0x53425355, // "USBS"
+};
+
+enum : UINT8 { CBW_FLAGS_DATA_IN = 0x80 };
+enum : UINT8 { CSW_PASSED, CSW_FAILED, CSW_PHASE_ERROR };
+
+enum : UINT8 { // SCSI operation codes
+        OP_TEST_UNIT_READY = 0x00,
+        OP_REQUEST_SENSE = 0x03,
+        OP_READ_CAPACITY_10 = 0x25,
+        OP_READ_10 = 0x28,
+        OP_WRITE_10 = 0x2A,
+};
+
+enum : UINT8 { SENSE_LENGTH = 18 }; // fixed format sense data
+enum : UINT32 { READ_CAPACITY_10_LENGTH = 8 };
+
+inline auto get_be32(_In_ const char *p) noexcept
+{
+        auto b = reinterpret_cast<const UINT8*>(p);
+        return UINT32(b[0]) << 24 | UINT32(b[1]) << 16 | UINT32(b[2]) << 8 | b[3];
+}
+
+auto make_rw10(_In_ UINT8 op, _In_ UINT32 lba, _In_ UINT16 blocks) noexcept
+{
+        return std::array<UINT8, 10> {
+                op, 0,
+                UINT8(lba >> 24), UINT8(lba >> 16), UINT8(lba >> 8), UINT8(lba),
+                0, // group number
+                UINT8(blocks >> 8), UINT8(blocks),
+                0 // control
+        };
+}
+
+auto usec_since(_In_ std::chrono::steady_clock::time_point start)
+{
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+
+bool usbip::bench::storage::issue(
+        _In_ std::span<const UINT8> cdb, _In_ UINT32 length, _In_ bool dir_in, _In_ std::span<const char> out)
+{
+        m_cbw = {
+                .signature = CBW_SIGNATURE,
+                .tag = m_cbw.tag + 1,
+                .data_transfer_length = length,
+                .flags = UINT8(dir_in ? CBW_FLAGS_DATA_IN : 0),
+                .lun = m_lun,
+                .cb_length = UINT8(cdb.size()),
+        };
+
+        std::copy(cdb.begin(), cdb.end(), m_cbw.cb);
+
+        for (auto &i: m_seqnum) {
+                i = 0;
+        }
+
+        m_urb_error = 0;
+        m_csw = {};
+        m_csw_received = false;
+        m_issued = clock_type::now();
+
+        urb_request stages[STAGE_CNT] {
+                { .ep = m_bulk_out, .out = reinterpret_cast<const char*>(&m_cbw), .out_length = sizeof(m_cbw) },
+                dir_in ? urb_request{ .ep = m_bulk_in, .dir_in = true, .in_length = length } :
+                         urb_request{ .ep = m_bulk_out, .out = out.data(), .out_length = UINT32(out.size()) },
+                { .ep = m_bulk_in, .dir_in = true, .in_length = sizeof(m_csw) },
+        };
+
+        for (int i = 0; i < STAGE_CNT; ++i) {
+                if (i == STAGE_DATA && !length) {
+                        continue;
+                }
+
+                auto seqnum = m_client->submit(stages[i], [this, i] (auto &r) { on_urb(i, r); });
+                if (!seqnum) {
+                        spdlog::error("submit: {}", GetLastErrorMsg());
+                        return false; // the connection is closed, queued URBs will get URB_SHUTDOWN
+                }
+
+                m_seqnum[i] = seqnum;
+        }
+
+        return m_client->flush();
+}
+
+/*
+ * If a stage fails, the next ones are unlinked because the device will not complete them.
+ */
+void usbip::bench::storage::on_urb(_In_ int stage, _In_ const urb_result &r)
+{
+        if (r.status) {
+                if (!m_urb_error) {
+                        m_urb_error = r.status;
+
+                        for (auto &i: m_seqnum) {
+                                if (auto seqnum = i.load(); seqnum && seqnum != r.seqnum) {
+                                        m_client->unlink(seqnum); // fails if URB was completed
+                                }
+                        }
+                }
+        } else if (stage == STAGE_DATA && !m_running) {
+                m_data.assign(r.data, r.data + r.actual_length);
+        } else if (stage == STAGE_CSW && r.actual_length == sizeof(m_csw)) {
+                memcpy(&m_csw, r.data, sizeof(m_csw));
+                m_csw_received = true;
+        }
+
+        if (stage == STAGE_CSW && m_running) {
+                on_command_done();
+        }
+}
+
+bool usbip::bench::storage::passed() const noexcept
+{
+        return !m_urb_error && m_csw_received &&
+                m_csw.signature == CSW_SIGNATURE &&
+                m_csw.tag == m_cbw.tag &&
+                m_csw.status == CSW_PASSED &&
+                !m_csw.data_residue;
+}
+
+/*
+ * Runs on the receiver thread of urb_client.
+ */
+void usbip::bench::storage::on_command_done()
+{
+        if (!passed()) {
+                ++m_errors;
+                m_running = false;
+                return;
+        }
+
+        m_latency.push_back(usec_since(m_issued));
+        m_bytes += m_cbw.data_transfer_length;
+
+        if (clock_type::now() >= m_deadline || !issue_next()) {
+                m_running = false;
+        }
+}
+
+bool usbip::bench::storage::issue_next()
+{
+        if (!m_io_blocks || m_io_blocks > m_blocks) { // a command must fit the device
+                spdlog::error("I/O of {} blocks, the device has {}", m_io_blocks, m_blocks);
+                return false;
+        }
+
+        UINT64 lba{};
+
+        if (m_random) {
+                std::uniform_int_distribution<UINT64> d(0, m_blocks/m_io_blocks - 1);
+                lba = d(m_rand)*m_io_blocks;
+        } else {
+                if (m_next_lba + m_io_blocks > m_blocks) {
+                        m_next_lba = 0;
+                }
+                lba = m_next_lba;
+                m_next_lba += m_io_blocks;
+        }
+
+        auto cdb = make_rw10(m_write ? OP_WRITE_10 : OP_READ_10, UINT32(lba), UINT16(m_io_blocks));
+        auto length = m_io_blocks*m_block_size;
+
+        return m_write ? issue(cdb, length, false, m_payload) : issue(cdb, length, true);
+}
+
+/*
+ * Synchronous command with optional data-in stage, it is saved to m_data.
+ */
+bool usbip::bench::storage::execute(_In_ std::span<const UINT8> cdb, _In_ UINT32 length)
+{
+        m_data.clear();
+
+        if (!issue(cdb, length, true)) {
+                m_client->wait_idle(10s);
+                return false;
+        }
+
+        if (!m_client->wait_idle(10s)) {
+                spdlog::error("SCSI command {:#04x} was not completed in time", cdb[0]);
+                return false;
+        }
+
+        return passed();
+}
+
+void usbip::bench::storage::log_sense()
+{
+        std::array<UINT8, 6> cdb{ OP_REQUEST_SENSE, 0, 0, 0, SENSE_LENGTH, 0 };
+
+        if (execute(cdb, SENSE_LENGTH) && m_data.size() >= 14) {
+                spdlog::warn("LUN {}: sense key {:#x}, ASC {:#04x}, ASCQ {:#04x}",
+                             m_lun, m_data[2] & 0xF, UINT8(m_data[12]), UINT8(m_data[13]));
+        }
+}
+
+/*
+ * A device reports UNIT ATTENTION after reset or media change, REQUEST SENSE clears it.
+ */
+bool usbip::bench::storage::start(_Inout_ urb_client &client)
+{
+        m_client = &client;
+        m_running = false;
+
+        std::array<UINT8, 6> test_unit_ready{ OP_TEST_UNIT_READY };
+
+        for (int i = 0; !execute(test_unit_ready, 0); ++i) {
+                if (m_urb_error || !m_csw_received || i == 5) {
+                        spdlog::error("LUN {} is not ready, URB status {}", m_lun, m_urb_error);
+                        return false;
+                }
+                log_sense();
+        }
+
+        std::array<UINT8, 10> read_capacity{ OP_READ_CAPACITY_10 };
+
+        if (!execute(read_capacity, READ_CAPACITY_10_LENGTH) || m_data.size() < READ_CAPACITY_10_LENGTH) {
+                spdlog::error("LUN {}: READ CAPACITY(10) failed", m_lun);
+                return false;
+        }
+
+        m_blocks = UINT64(get_be32(m_data.data())) + 1; // 0xFFFFFFFF if there are more, (10) can't address them
+        m_block_size = get_be32(m_data.data() + 4);
+
+        if (!m_block_size) {
+                spdlog::error("LUN {}: block size is zero", m_lun);
+                return false;
+        }
+
+        spdlog::debug("LUN {}: {} blocks of {} bytes", m_lun, m_blocks, m_block_size);
+        return true;
+}
+
+bool usbip::bench::storage::run(
+        _Out_ result &r, _In_ bool write, _In_ bool random, _In_ UINT32 io_size,
+        _In_ std::chrono::steady_clock::duration duration)
+{
+        assert(io_size && !(io_size % m_block_size));
+
+        m_write = write;
+        m_random = random;
+        m_io_blocks = io_size/m_block_size;
+        m_next_lba = 0;
+
+        if (write) {
+                m_payload.assign(io_size, '\xA5');
+        }
+
+        m_latency.clear();
+        m_errors = 0;
+        m_bytes = 0;
+
+        auto start = clock_type::now();
+        m_deadline = start + duration;
+
+        m_running = true;
+        auto ok = issue_next();
+
+        if (!m_client->wait_idle(std::chrono::duration_cast<std::chrono::milliseconds>(duration) + 10s)) {
+                spdlog::error("storage: URBs were not completed in time");
+                ok = false;
+        }
+
+        m_running = false;
+
+        r = result {
+                .test = std::string("bot_") + (random ? "rand_" : "seq_") + (write ? "write" : "read"),
+                .queue_depth = 1, // BOT can't have more, see storage
+                .transfer_size = io_size,
+                .errors = m_errors,
+                .seconds = std::chrono::duration<double>(clock_type::now() - start).count(),
+                .bytes = m_bytes,
+                .latency = summarize(m_latency),
+        };
+
+        if (m_errors) {
+                spdlog::error("{}: URB status {}, CSW status {}, residue {}",
+                              r.test, m_urb_error, m_csw.status, m_csw.data_residue);
+
+                if (!m_urb_error && m_csw_received && m_csw.status == CSW_FAILED) {
+                        log_sense();
+                }
+        }
+
+        return ok && !m_errors;
+}
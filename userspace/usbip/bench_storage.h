@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include "bench_stats.h"
+#include <libusbip\urb_client.h>
+
+#include <atomic>
+#include <random>
+#include <span>
+
+namespace usbip::bench
+{
+
+#pragma pack(push, 1)
+
+/*
+ * Little-endian, see "Universal Serial Bus Mass Storage Class Bulk-Only Transport", Revision 1.0.
+ */
+struct command_block_wrapper
+{
+        UINT32 signature;
+        UINT32 tag;
+        UINT32 data_transfer_length;
+        UINT8 flags; // bit 7 is direction IN
+        UINT8 lun;
+        UINT8 cb_length;
+        UINT8 cb[16];
+};
+static_assert(sizeof(command_block_wrapper) == 31);
+
+struct command_status_wrapper
+{
+        UINT32 signature;
+        UINT32 tag;
+        UINT32 data_residue;
+        UINT8 status;
+};
+static_assert(sizeof(command_status_wrapper) == 13);
+
+#pragma pack(pop)
+
+/*
+ * Issues SCSI READ(10)/WRITE(10) to a mass storage device with Bulk-Only Transport.
+ *
+ * BOT has one command in flight, thus the queue depth is always 1. The device executes CBW, data and CSW
+ * stages strictly in sequence over the same pair of bulk pipes: the next CBW is accepted only after CSW
+ * is sent, and the data stage has no tag that would tell which command it belongs to.
+ * Queueing requires USB Attached SCSI (UAS) with bulk streams, which is not implemented.
+ *
+ * CBW, data and CSW URBs of a command are submitted together, thus there are no round-trips
+ * between the stages. The next command is issued by the callback of CSW.
+ * Reset Recovery is not implemented, the first error stops the run.
+ *
+ * An instance must outlive urb_client, see pipeline.
+ */
+class storage
+{
+public:
+        storage(_In_ UINT8 bulk_in, _In_ UINT8 bulk_out, _In_ UINT8 lun) :
+                m_bulk_in(bulk_in), m_bulk_out(bulk_out), m_lun(lun) {}
+
+        /*
+         * Wait until the unit is ready, read its capacity.
+         */
+        bool start(_Inout_ urb_client &client);
+
+        auto block_size() const noexcept { return m_block_size; }
+        auto blocks() const noexcept { return m_blocks; }
+
+        /*
+         * Sequential or random commands of io_size bytes until the deadline.
+         * @param io_size must be a multiple of block_size
+         */
+        bool run(_Out_ result &r, _In_ bool write, _In_ bool random, _In_ UINT32 io_size,
+                 _In_ std::chrono::steady_clock::duration duration);
+
+private:
+        using clock_type = std::chrono::steady_clock;
+        enum { STAGE_CBW, STAGE_DATA, STAGE_CSW, STAGE_CNT };
+
+        urb_client *m_client{};
+        const UINT8 m_bulk_in;
+        const UINT8 m_bulk_out;
+        const UINT8 m_lun;
+
+        UINT32 m_block_size{};
+        UINT64 m_blocks{}; // that READ(10) and WRITE(10) can address
+
+        // the command in flight
+        command_block_wrapper m_cbw{}; // must be valid until it is sent
+        std::array<std::atomic<seqnum_t>, STAGE_CNT> m_seqnum{};
+        clock_type::time_point m_issued;
+        INT32 m_urb_error{}; // of the first failed URB
+        command_status_wrapper m_csw{};
+        bool m_csw_received{};
+        std::vector<char> m_data; // data-in of a synchronous command
+
+        // state of run(), is updated by the callbacks
+        bool m_running{};
+        bool m_write{};
+        bool m_random{};
+        UINT32 m_io_blocks{};
+        UINT64 m_next_lba{};
+        std::vector<char> m_payload; // of WRITE(10)
+        std::minstd_rand m_rand;
+        clock_type::time_point m_deadline;
+        std::vector<double> m_latency; // microseconds
+        size_t m_errors{};
+        std::uint64_t m_bytes{};
+
+        bool issue(_In_ std::span<const UINT8> cdb, _In_ UINT32 length, _In_ bool dir_in,
+                   _In_ std::span<const char> out = {});
+
+        bool execute(_In_ std::span<const UINT8> cdb, _In_ UINT32 length);
+        bool issue_next();
+        bool passed() const noexcept;
+        void log_sense();
+
+        void on_urb(_In_ int stage, _In_ const urb_result &r);
+        void on_command_done();
+};
+
+} // namespace usbip::bench
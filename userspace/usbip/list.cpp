@@ -15,15 +15,13 @@ namespace
 
 using namespace usbip;
 
-void on_device_count(int count)
+auto format_device_count(int count)
 {
-	if (count) {
-		printf("Exportable USB devices\n"
-			"======================\n");
-	}
+	return count ? "Exportable USB devices\n"
+		       "======================\n" : "";
 }
 
-void on_device(int, const usb_device &d)
+auto format_device(const usb_device &d)
 {
 	auto &ids = get_ids();
 	auto prod = get_product(ids, d.idVendor, d.idProduct);
@@ -41,10 +39,10 @@ void on_device(int, const usb_device &d)
 		lines += '\n';
 	}
 
-	printf(lines.c_str());
+	return lines;
 }
 
-void on_interface(int, const usb_device &d, int idx, const usb_interface &r)
+auto format_interface(const usb_device &d, int idx, const usb_interface &r)
 {
 	auto &ids = get_ids();
 	auto csp = get_class(ids, r.bInterfaceClass, r.bInterfaceSubClass, r.bInterfaceProtocol);
@@ -54,7 +52,51 @@ void on_interface(int, const usb_device &d, int idx, const usb_interface &r)
 		s += '\n';
 	}
 
-	printf(s.c_str());
+	return s;
+}
+
+/*
+ * Output of a host is printed when it is done, thus output of different hosts does not interleave.
+ */
+auto list_exportable_devices(const list_args &args)
+{
+	std::vector<remote_host> hosts;
+	for (auto &r: args.remote) {
+		hosts.emplace_back(r, global_args.tcp_port);
+	}
+
+	std::vector<std::string> out(hosts.size());
+	bool success = true;
+
+	enum_devices_callbacks cb {
+		.on_dev = [&out] (auto host, auto, auto &dev) { out[host] += format_device(dev); },
+		.on_intf = [&out] (auto host, auto, auto &dev, auto idx, auto &intf) { out[host] += format_interface(dev, idx, intf); },
+		.on_dev_cnt = [&out] (auto host, auto count) { out[host] += format_device_count(count); },
+
+		.on_done = [&hosts, &out, &success] (auto host, auto err)
+		{
+			auto &h = hosts[host];
+
+			if (err) {
+				spdlog::error("{}:{}: {}", h.hostname, h.service, GetLastErrorMsg(err));
+				success = false;
+			} else {
+				if (hosts.size() > 1) {
+					printf("%s:%s\n", h.hostname.c_str(), h.service.c_str());
+				}
+				fputs(out[host].c_str(), stdout);
+			}
+
+			out[host].clear();
+		}
+	};
+
+	if (!enum_exportable_devices_many(hosts, std::chrono::seconds(args.timeout), cb)) {
+		spdlog::error(GetLastErrorMsg());
+		return false;
+	}
+
+	return success;
 }
 
 auto list_stashed_devices()
@@ -78,22 +120,5 @@ auto list_stashed_devices()
 bool usbip::cmd_list(void *p)
 {
 	auto &args = *reinterpret_cast<list_args*>(p);
-	if (args.stashed) {
-		return list_stashed_devices();
-	}
-
-	auto sock = connect(args.remote.c_str(), global_args.tcp_port.c_str());
-	if (!sock) {
-		spdlog::error(GetLastErrorMsg());
-		return false;
-	}
-
-	spdlog::debug("connected to {}:{}", args.remote, global_args.tcp_port);
-
-	if (!enum_exportable_devices(sock.get(), on_device, on_interface, on_device_count)) {
-		spdlog::error(GetLastErrorMsg());
-		return false;
-	}
-
-	return true;
+	return args.stashed ? list_stashed_devices() : list_exportable_devices(args);
 }
@@ -15,6 +15,8 @@
 #include <libusbip\src\strconv.h>
 #include <libusbip\src\file_ver.h>
 
+#include <usbip\consts.h>
+
 #include <resources\messages.h>
 
 #include <spdlog\spdlog.h>
@@ -27,8 +29,6 @@ namespace
 
 using namespace usbip;
 
-const auto MAX_HUB_PORTS = 127;
-
 auto get_ids_data()
 {
 	win::Resource r(GetModuleHandle(nullptr), MAKEINTRESOURCE(IDR_USB_IDS), RT_RCDATA);
@@ -83,7 +83,7 @@ void add_cmd_detach(CLI::App &app)
 		->require_option(1);
 
 	cmd->add_option("-p,--port", r.port, "Hub port number the device is plugged in")
-		->check(CLI::Range(1, MAX_HUB_PORTS));
+		->check(CLI::Range(1, int(MAX_PORTS)));
 
 	cmd->add_flag("-a,--all", [&port = r.port] (auto) { port = -1; }, "Detach all devices");
 }
@@ -96,10 +96,14 @@ void add_cmd_list(CLI::App &app)
 		->callback(pack(cmd_list, &r))
 		->require_option(1);
 
-	cmd->add_option_group("remote", "List exportable USB devices")
-		->add_option("-r,--remote", r.remote, "List exportable devices on a remote")
+	auto rem = cmd->add_option_group("remote", "List exportable USB devices");
+
+	rem->add_option("-r,--remote", r.remote, "List exportable devices on a remote, can be repeated")
 		->required();
 
+	rem->add_option("--timeout", r.timeout, "Timeout in seconds for each remote, default 30")
+		->check(CLI::Range(1, 3600));
+
 	cmd->add_option_group("stashed", "List stashed USB devices")
 		->add_flag("-s,--stashed", r.stashed, "List devices stashed by 'port --stash'");
 }
@@ -115,8 +119,77 @@ void add_cmd_port(CLI::App &app)
 		      "Devices listed by the command will be attached each time the driver is loaded");
 	
 	cmd->add_option("number", r.ports, "Hub port number")
-		->check(CLI::Range(1, MAX_HUB_PORTS))
-		->expected(1, MAX_HUB_PORTS);
+		->check(CLI::Range(1, int(MAX_PORTS)))
+		->expected(1, MAX_PORTS);
+}
+
+void add_cmd_bench(CLI::App &app)
+{
+	static bench_args r;
+
+	auto cmd = app.add_subcommand("bench", "Measure latency and throughput of a remote USB device")
+		->callback(pack(cmd_bench, &r));
+
+	cmd->add_option("-r,--remote", r.remote, "Hostname/IP of a USB/IP server with exported USB devices")
+		->required();
+
+	cmd->add_option("-b,--bus-id", r.busid, "Bus Id of the USB device on a server")
+		->required();
+
+	cmd->add_option("--attach", r.attach, "Attach/detach cycles through the driver, zero to skip")
+		->check(CLI::Range(0, 1000));
+
+	cmd->add_option("-n,--count", r.count, "URBs of control and interrupt latency tests")
+		->check(CLI::Range(1, 1'000'000));
+
+	cmd->add_option("--interrupt-in", r.interrupt_in, "Interrupt IN endpoint number for latency test")
+		->check(CLI::Range(1, 15));
+
+	cmd->add_option("--interval", r.interval, "Interval of interrupt URBs, (micro)frames")
+		->check(CLI::Range(1, 1024));
+
+	auto bulk_in = cmd->add_option("--bulk-in", r.bulk_in, "Bulk IN endpoint number for throughput test")
+		->check(CLI::Range(1, 15));
+
+	auto bulk_out = cmd->add_option("--bulk-out", r.bulk_out, "Bulk OUT endpoint number for throughput test, "
+					"the device must accept arbitrary data")
+		->check(CLI::Range(1, 15));
+
+	cmd->add_option("--size", r.size, "Bytes of each bulk URB")
+		->check(CLI::Range(1U, 16U*1024*1024));
+
+	cmd->add_option("--queue-depth", r.queue_depth, "Bulk URBs in flight, comma separated list")
+		->check(CLI::Range(1U, 1024U))
+		->delimiter(',');
+
+	cmd->add_option("--duration", r.duration, "Seconds of each bulk test")
+		->check(CLI::Range(1, 3600));
+
+	auto storage = cmd->add_flag("--storage", r.storage,
+				     "Bulk endpoints are of mass storage device, run SCSI READ(10) tests instead")
+		->needs(bulk_in)
+		->needs(bulk_out);
+
+	cmd->add_flag("--storage-write", r.storage_write, "Also run WRITE(10) tests, DESTROYS data on the device")
+		->needs(storage);
+
+	cmd->add_option("--lun", r.lun, "Logical unit number of mass storage device")
+		->check(CLI::Range(0, 15));
+
+	cmd->add_option("--io-size", r.io_size, "Bytes of each SCSI command, comma separated list")
+		->check(CLI::Range(512U, 16U*1024*1024))
+		->delimiter(',');
+
+	cmd->add_option("-f,--format", r.format, "Report format")
+		->check(CLI::IsMember({"text", "json", "csv"}));
+
+	auto baseline = cmd->add_option("--baseline", r.baseline, "CSV report of a previous run, "
+					 "the exit code is non-zero if a result has regressed")
+		->check(CLI::ExistingFile);
+
+	cmd->add_option("--tolerance", r.tolerance, "Percent of slowdown that is not a regression")
+		->check(CLI::Range(0, 100))
+		->needs(baseline);
 }
 
 auto &msgtable_dll = L"resources"; // resource-only DLL that contains RT_MESSAGETABLE
@@ -152,6 +225,7 @@ void init(CLI::App &app)
 	add_cmd_detach(app);
 	add_cmd_list(app);
 	add_cmd_port(app);
+	add_cmd_bench(app);
 
 	app.require_subcommand(1);
 }
@@ -202,7 +276,7 @@ std::string usbip::GetLastErrorMsg(unsigned long msg_id)
 
 const UsbIds& usbip::get_ids()
 {
-	static UsbIds ids(get_ids_data());
+	static UsbIds ids(get_ids_data(), true); // a command looks up a few devices only
 	assert(ids);
 	return ids;
 }
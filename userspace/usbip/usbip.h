@@ -6,6 +6,7 @@
 
 #include <string>
 #include <set>
+#include <vector>
 
 #include <libusbip\remote.h>
 
@@ -46,7 +47,8 @@ command_t cmd_detach;
 struct list_args
 {
         // --remote
-        std::string remote;
+        std::vector<std::string> remote;
+        int timeout = 30; // seconds, for each remote
 
         // --stashed
         bool stashed;
@@ -60,4 +62,35 @@ struct port_args
 };
 command_t cmd_port;
 
+struct bench_args
+{
+        std::string remote;
+        std::string busid;
+
+        int attach = 5; // attach/detach cycles through the driver
+        int count = 1000; // URBs of each latency test
+
+        int interrupt_in{}; // endpoint numbers, zero means skip the test
+        int bulk_in{};
+        int bulk_out{};
+
+        int interval = 1; // of interrupt URB, see usb_submit_urb
+
+        unsigned int size = 64*1024; // bytes, of each bulk URB
+        std::vector<unsigned int> queue_depth{ 1, 4, 16, 32 };
+        int duration = 5; // seconds, for each queue depth
+
+        // bulk endpoints of a mass storage device with Bulk-Only Transport
+        bool storage{};
+        bool storage_write{}; // destroys data on the device
+        int lun{};
+        std::vector<unsigned int> io_size{ 4*1024, 64*1024, 1024*1024 };
+
+        std::string format = "text";
+
+        std::string baseline; // CSV report of a previous run
+        int tolerance = 10; // percent, of regressions against the baseline
+};
+command_t cmd_bench;
+
 } // namespace usbip
@@ -0,0 +1,67 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <array>
+#include <algorithm>
+
+namespace usbip
+{
+
+/*
+ * Numeric sort key of busid, it does not depend on wxWidgets.
+ */
+struct busid_key
+{
+        std::array<int, 8> v; // hub, port[, port]...
+        int len; // the number of parsed values, zero if busid has another format
+};
+
+/*
+ * @param busid hub-port[.port]..., a range of characters that are convertible to wchar_t
+ */
+template<typename String>
+auto make_busid_key(_In_ const String &busid)
+{
+        busid_key key{};
+
+        int cnt = 0;
+        int val = 0;
+        bool digits = false;
+
+        for (auto ch: busid) {
+                if (auto c = static_cast<wchar_t>(ch); c >= L'0' && c <= L'9') {
+                        val = 10*val + (c - L'0');
+                        digits = true;
+                } else if (digits && cnt < int(key.v.size()) && c == (cnt ? L'.' : L'-')) {
+                        key.v[cnt++] = val;
+                        val = 0;
+                        digits = false;
+                } else {
+                        return key;
+                }
+        }
+
+        if (digits && cnt && cnt < int(key.v.size())) { // hub-port at least
+                key.v[cnt++] = val;
+                key.len = cnt;
+        }
+
+        return key;
+}
+
+/*
+ * @return negative, zero or positive like strcmp, both keys must be parsed
+ */
+inline int compare(_In_ const busid_key &a, _In_ const busid_key &b)
+{
+        auto ret = std::lexicographical_compare_three_way(a.v.begin(), a.v.begin() + a.len, 
+                                                          b.v.begin(), b.v.begin() + b.len);
+        return (ret > 0) - (ret < 0);
+}
+
+} // namespace usbip
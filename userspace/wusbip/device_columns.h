@@ -25,6 +25,13 @@ enum column_pos_t { // columns order in the tree
 	COL_NOTES,
 	COL_LAST_VISIBLE = COL_NOTES,
 	COL_SAVED_STATE, // hidden
+	COL_IN_RATE, // live statistics, are appended by MainFrame::init_statistics
+	COL_OUT_RATE,
+	COL_URB_RATE,
+	COL_LATENCY,
+	COL_IN_FLIGHT,
+	COL_FIRST_LIVE = COL_IN_RATE,
+	COL_LAST_LIVE = COL_IN_FLIGHT,
 };
 
 enum { // for device_columns only
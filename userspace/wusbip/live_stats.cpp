@@ -0,0 +1,138 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "live_stats.h"
+
+#include <algorithm>
+
+namespace
+{
+
+using namespace usbip;
+
+/*
+ * Counters of the driver never decrease while a device is attached.
+ */
+auto is_continuation(_In_ const transfer_counters &prev, _In_ const transfer_counters &c) noexcept
+{
+        if (c.generation != prev.generation || c.latency.size() != prev.latency.size() ||
+            c.bytes_in < prev.bytes_in || c.bytes_out < prev.bytes_out || c.urbs < prev.urbs) {
+                return false;
+        }
+
+        for (std::size_t i = 0; i < c.latency.size(); ++i) {
+                if (c.latency[i] < prev.latency[i]) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+} // namespace
+
+
+bool usbip::RateMeter::add(_In_ double time, _In_ const transfer_counters &c)
+{
+        if (!(m_has_prev && is_continuation(m_prev, c))) {
+                clear();
+        } else if (auto dt = time - m_prev_time; dt <= 0) {
+                return false; // keep the previous sample
+        } else {
+                m_latency.resize(c.latency.size());
+                for (std::size_t i = 0; i < c.latency.size(); ++i) {
+                        m_latency[i] = c.latency[i] - m_prev.latency[i];
+                }
+
+                transfer_rates r {
+                        .bytes_in = (c.bytes_in - m_prev.bytes_in)/dt,
+                        .bytes_out = (c.bytes_out - m_prev.bytes_out)/dt,
+                        .urbs = (c.urbs - m_prev.urbs)/dt,
+                        .p99_latency = percentile(m_latency, 0.99),
+                        .in_flight = c.in_flight,
+                };
+
+                if (m_history.size() < m_capacity) {
+                        m_history.push_back(r);
+                } else {
+                        m_history[m_head] = r;
+                        m_head = (m_head + 1) % m_capacity;
+                }
+        }
+
+        m_has_prev = true;
+        m_prev_time = time;
+        m_prev = c;
+
+        return !m_history.empty();
+}
+
+void usbip::RateMeter::clear() noexcept
+{
+        m_has_prev = false;
+        m_history.clear();
+        m_head = 0;
+}
+
+auto usbip::RateMeter::last() const noexcept -> const transfer_rates&
+{
+        auto n = m_history.size();
+        return m_history[(m_head + n - 1) % n];
+}
+
+double usbip::percentile(_In_ std::span<const std::uint64_t> histogram, _In_ double p)
+{
+        std::uint64_t total{};
+        for (auto n: histogram) {
+                total += n;
+        }
+
+        if (!total) {
+                return -1;
+        }
+
+        auto rank = std::clamp(p, 0.0, 1.0)*total;
+        std::uint64_t cum{};
+
+        for (std::size_t i = 0; i < histogram.size(); ++i) {
+                auto n = histogram[i];
+                if (!n || cum + n < rank) {
+                        cum += n;
+                        continue;
+                }
+
+                auto lo = i ? double(1ULL << i) : 0.0;
+                if (i + 1 == histogram.size()) {
+                        return lo;
+                }
+
+                auto hi = double(2ULL << i);
+                auto fraction = (rank - cum)/n;
+
+                return lo + (hi - lo)*fraction;
+        }
+
+        return -1; // unreachable
+}
+
+std::wstring usbip::sparkline(_In_ std::span<const double> values)
+{
+        static constexpr wchar_t bars[] = L"\u2581\u2582\u2583\u2584\u2585\u2586\u2587\u2588"; // LOWER ONE EIGHTH BLOCK .. FULL BLOCK
+        constexpr auto cnt = std::size(bars) - 1;
+
+        double max{};
+        for (auto v: values) {
+                max = std::max(max, v);
+        }
+
+        std::wstring s;
+        s.reserve(values.size());
+
+        for (auto v: values) {
+                auto i = max > 0 ? std::size_t(std::max(v, 0.0)/max*(cnt - 1) + 0.5) : 0;
+                s += bars[std::min(i, cnt - 1)];
+        }
+
+        return s;
+}
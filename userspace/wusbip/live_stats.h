@@ -0,0 +1,100 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace usbip
+{
+
+/*
+ * Cumulative counters of a device, a copy of vhci::device_statistics.
+ */
+struct transfer_counters
+{
+        std::uint64_t generation; // counters start anew if it changes
+        std::uint64_t bytes_in;
+        std::uint64_t bytes_out;
+        std::uint64_t urbs;
+        std::uint32_t in_flight;
+        std::vector<std::uint64_t> latency; // [i] counts [2^i, 2^(i+1)) microseconds, see device_statistics
+};
+
+struct transfer_rates
+{
+        double bytes_in; // per second
+        double bytes_out;
+        double urbs;
+        double p99_latency; // microseconds, negative if no URB was completed during the interval
+        std::uint32_t in_flight;
+};
+
+/*
+ * Calculates rates from the differences of two consecutive samples, it does not depend on wxWidgets.
+ * Keeps the last rates for sparklines.
+ */
+class RateMeter
+{
+public:
+        explicit RateMeter(_In_ std::size_t history = 60) : m_capacity(history ? history : 1) {}
+
+        /*
+         * @param time of the sample, seconds from any monotonic clock
+         * @return false if rates are not available yet, the first sample or another device was attached
+         */
+        bool add(_In_ double time, _In_ const transfer_counters &c);
+
+        void clear() noexcept;
+
+        auto empty() const noexcept { return m_history.empty(); }
+        const transfer_rates& last() const noexcept; // must not be empty()
+
+        /*
+         * @return the oldest first
+         */
+        template<typename F>
+        auto history(_In_ F &&get) const
+        {
+                std::vector<double> v;
+                v.reserve(m_history.size());
+
+                for (std::size_t i = 0; i < m_history.size(); ++i) {
+                        v.push_back(get(m_history[(m_head + i) % m_history.size()]));
+                }
+
+                return v;
+        }
+
+private:
+        std::size_t m_capacity;
+
+        bool m_has_prev{};
+        double m_prev_time{};
+        transfer_counters m_prev{};
+        std::vector<std::uint64_t> m_latency; // the difference of histograms, to avoid allocations
+
+        std::vector<transfer_rates> m_history; // ring buffer
+        std::size_t m_head{}; // the oldest if the buffer is full
+};
+
+/*
+ * Linear interpolation inside of a bucket, the last bucket is open-ended and its lower bound is returned.
+ * @param p in the range [0, 1]
+ * @return microseconds, negative if histogram is empty
+ */
+double percentile(_In_ std::span<const std::uint64_t> histogram, _In_ double p);
+
+/*
+ * @return a bar of eighth blocks per value, scaled to the max
+ */
+std::wstring sparkline(_In_ std::span<const double> values);
+
+} // namespace usbip
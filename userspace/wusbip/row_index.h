@@ -0,0 +1,68 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace usbip
+{
+
+/*
+ * Rows of servers and their devices in a tree control, looked up by url and by url/busid.
+ * It does not depend on wxWidgets, Item is a handle of a row. Default-constructed Item means "no row".
+ */
+template<typename Item>
+class RowIndex
+{
+public:
+        using map_type = std::unordered_map<std::wstring, Item>;
+
+        /*
+         * @return the row of the server, default-constructed if it was not added yet
+         */
+        auto& server(_In_ std::wstring_view url) { return m_servers[std::wstring(url)]; }
+
+        /*
+         * @return the row of the device, default-constructed if it was not added yet
+         */
+        auto& device(_In_ std::wstring_view url, _In_ std::wstring_view busid)
+        {
+                return m_devices[make_device_key(url, busid)];
+        }
+
+        void remove_server(_In_ std::wstring_view url) { m_servers.erase(std::wstring(url)); }
+
+        void remove_device(_In_ std::wstring_view url, _In_ std::wstring_view busid)
+        {
+                m_devices.erase(make_device_key(url, busid));
+        }
+
+        const auto& devices() const noexcept { return m_devices; } // url/busid
+
+        void clear() noexcept
+        {
+                m_servers.clear();
+                m_devices.clear();
+        }
+
+private:
+        map_type m_servers; // url
+        map_type m_devices; // url/busid
+
+        static auto make_device_key(_In_ std::wstring_view url, _In_ std::wstring_view busid)
+        {
+                std::wstring key;
+                key.reserve(url.size() + 1 + busid.size());
+
+                key.append(url).append(1, L'/').append(busid);
+                return key;
+        }
+};
+
+} // namespace usbip
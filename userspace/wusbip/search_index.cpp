@@ -0,0 +1,277 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#include "search_index.h"
+
+#include <algorithm>
+#include <iterator>
+#include <cwctype>
+
+namespace
+{
+
+auto to_lower(_In_ std::wstring_view s)
+{
+        std::wstring r(s);
+        for (auto &c: r) {
+                c = static_cast<wchar_t>(std::towlower(c));
+        }
+        return r;
+}
+
+/*
+ * wchar_t is 16 bit on Windows, 32 bit on Linux; Unicode code point fits 21 bit.
+ */
+constexpr auto make_trigram(_In_ const wchar_t *s) noexcept
+{
+        constexpr std::uint64_t mask = 0x1F'FFFF;
+        return (s[0] & mask) << 42 | (s[1] & mask) << 21 | (s[2] & mask);
+}
+
+/*
+ * @return sorted and unique
+ */
+auto get_trigrams(_In_ std::wstring_view s)
+{
+        std::vector<std::uint64_t> v;
+
+        if (s.size() >= 3) {
+                v.reserve(s.size() - 2);
+                for (size_t i = 0; i + 3 <= s.size(); ++i) {
+                        v.push_back(make_trigram(s.data() + i));
+                }
+        }
+
+        std::ranges::sort(v);
+        auto dups = std::ranges::unique(v);
+        v.erase(dups.begin(), dups.end());
+
+        return v;
+}
+
+auto split_words(_In_ std::wstring_view query)
+{
+        std::vector<std::wstring> v;
+
+        auto is_space = [] (auto c) { return std::iswspace(c); };
+
+        for (auto i = query.begin(); i != query.end(); ) {
+                auto first = std::find_if_not(i, query.end(), is_space);
+                auto last = std::find_if(first, query.end(), is_space);
+
+                if (first != last) {
+                        v.push_back(to_lower(std::wstring_view(first, last)));
+                }
+
+                i = last;
+        }
+
+        return v;
+}
+
+} // namespace
+
+
+void usbip::SearchIndex::update(_In_ id_type id, _In_ std::initializer_list<std::wstring_view> fields)
+{
+        std::wstring text;
+        for (auto &f: fields) {
+                if (!text.empty()) {
+                        text += L'\n'; // a word can't match across fields
+                }
+                text += to_lower(f);
+        }
+
+        auto [it, inserted] = m_rows.try_emplace(id);
+        auto &slot = it->second;
+
+        if (!inserted) {
+                if (auto &cur = m_slots[slot].text; cur == text) {
+                        return;
+                } else {
+                        remove_postings(slot, cur);
+                }
+        } else if (m_free.empty()) {
+                slot = static_cast<slot_t>(m_slots.size());
+                m_slots.emplace_back(id);
+        } else {
+                slot = m_free.back();
+                m_free.pop_back();
+                m_slots[slot].id = id;
+        }
+
+        auto &cur = m_slots[slot].text;
+        cur = std::move(text);
+        add_postings(slot, cur);
+}
+
+void usbip::SearchIndex::remove(_In_ id_type id)
+{
+        if (auto it = m_rows.find(id); it != m_rows.end()) {
+                auto slot = it->second;
+                auto &r = m_slots[slot];
+
+                remove_postings(slot, r.text);
+                r = row{};
+
+                m_free.push_back(slot);
+                m_rows.erase(it);
+        }
+}
+
+void usbip::SearchIndex::clear() noexcept
+{
+        m_slots.clear();
+        m_free.clear();
+        m_rows.clear();
+        m_postings.clear();
+}
+
+void usbip::SearchIndex::add_postings(_In_ slot_t slot, _In_ std::wstring_view text)
+{
+        for (auto t: get_trigrams(text)) {
+                m_postings[t].push_back(slot);
+        }
+}
+
+void usbip::SearchIndex::remove_postings(_In_ slot_t slot, _In_ std::wstring_view text)
+{
+        for (auto t: get_trigrams(text)) {
+
+                auto it = m_postings.find(t);
+                if (it == m_postings.end()) {
+                        continue;
+                }
+
+                auto &v = it->second;
+
+                if (auto i = std::ranges::find(v, slot); i != v.end()) {
+                        *i = v.back(); // order does not matter
+                        v.pop_back();
+                }
+
+                if (v.empty()) {
+                        m_postings.erase(it);
+                }
+        }
+}
+
+auto usbip::SearchIndex::find(_In_ std::wstring_view query) const -> std::vector<id_type>
+{
+        auto words = split_words(query);
+        std::vector<slot_t> slots;
+
+        for (auto fuzzy: {false, true}) {
+                if (words.empty() || !(slots = find_words(words, fuzzy)).empty()) {
+                        break;
+                }
+        }
+
+        std::vector<id_type> res;
+        res.reserve(slots.size());
+
+        for (auto slot: slots) {
+                res.push_back(m_slots[slot].id);
+        }
+
+        return res;
+}
+
+/*
+ * Words that are shorter than a trigram go last, they filter the rows that were found by the others.
+ */
+auto usbip::SearchIndex::find_words(_In_ const std::vector<std::wstring> &words, _In_ bool fuzzy) const -> std::vector<slot_t>
+{
+        std::vector<const std::wstring*> order;
+        for (auto &w: words) {
+                order.push_back(&w);
+        }
+        std::ranges::stable_partition(order, [] (auto w) { return w->size() >= 3; });
+
+        std::vector<slot_t> res;
+
+        for (bool first = true; auto w: order) {
+
+                if (first) {
+                        first = false;
+                        res = find_word(*w, fuzzy);
+                        std::ranges::sort(res);
+                } else if (w->size() < 3) {
+                        std::erase_if(res, [this, w] (auto slot) { return m_slots[slot].text.find(*w) == std::wstring::npos; });
+                } else {
+                        auto v = find_word(*w, fuzzy);
+                        std::ranges::sort(v);
+
+                        std::vector<slot_t> both;
+                        std::ranges::set_intersection(res, v, std::back_inserter(both));
+                        res = std::move(both);
+                }
+
+                if (res.empty()) {
+                        break;
+                }
+        }
+
+        return res;
+}
+
+auto usbip::SearchIndex::find_word(_In_ std::wstring_view word, _In_ bool fuzzy) const -> std::vector<slot_t>
+{
+        std::vector<slot_t> res;
+
+        auto trigrams = get_trigrams(word);
+        if (trigrams.empty()) {
+                return scan(word); // too short for typo tolerance, must match in both passes
+        }
+
+        if (!fuzzy || trigrams.size() < 2) { // a single trigram can't be matched partially
+                const std::vector<slot_t> *shortest{};
+
+                for (auto t: trigrams) {
+                        auto it = m_postings.find(t);
+                        if (it == m_postings.end()) {
+                                return res;
+                        }
+                        if (auto &v = it->second; !shortest || v.size() < shortest->size()) {
+                                shortest = &v;
+                        }
+                }
+
+                for (auto slot: *shortest) {
+                        if (m_slots[slot].text.find(word) != std::wstring::npos) {
+                                res.push_back(slot);
+                        }
+                }
+
+                return res;
+        }
+
+        auto threshold = (2*trigrams.size() + 2)/3;
+        std::vector<unsigned int> hits(m_slots.size());
+
+        for (auto t: trigrams) {
+                if (auto it = m_postings.find(t); it != m_postings.end()) {
+                        for (auto slot: it->second) {
+                                if (++hits[slot] == threshold) {
+                                        res.push_back(slot);
+                                }
+                        }
+                }
+        }
+
+        return res;
+}
+
+auto usbip::SearchIndex::scan(_In_ std::wstring_view word) const -> std::vector<slot_t>
+{
+        std::vector<slot_t> res;
+
+        for (slot_t slot = 0; slot < m_slots.size(); ++slot) {
+                if (m_slots[slot].text.find(word) != std::wstring::npos) { // free slot has empty text
+                        res.push_back(slot);
+                }
+        }
+
+        return res;
+}
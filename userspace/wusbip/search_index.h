@@ -0,0 +1,71 @@
+﻿/*
+ * Copyright (C) 2024 Vadym Hrynchyshyn <vadimgrn@gmail.com>
+ */
+
+#pragma once
+
+#include <sal.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <initializer_list>
+
+namespace usbip
+{
+
+/*
+ * Case-insensitive search over text fields of rows, it does not depend on wxWidgets.
+ *
+ * Text of a row is indexed by trigrams. A query word is looked up in the shortest posting list 
+ * of its trigrams, candidates are verified by substring search. Every word of a query must match.
+ * If nothing is found, a word matches a row that has two thirds of its trigrams (typo tolerance).
+ * Words shorter than a trigram must match exactly in both passes, as well as words of three characters.
+ * They filter the rows that the other words have found, a query of short words only scans all rows.
+ */
+class SearchIndex
+{
+public:
+        using id_type = std::uintptr_t;
+
+        /*
+         * Add a row or replace its text.
+         */
+        void update(_In_ id_type id, _In_ std::initializer_list<std::wstring_view> fields);
+
+        void remove(_In_ id_type id);
+        void clear() noexcept;
+
+        auto size() const noexcept { return m_rows.size(); }
+
+        /*
+         * @return rows in no particular order, empty if the query has no words
+         */
+        std::vector<id_type> find(_In_ std::wstring_view query) const;
+
+private:
+        using trigram_t = std::uint64_t;
+        using slot_t = std::uint32_t; // index of m_slots
+
+        struct row
+        {
+                id_type id;
+                std::wstring text; // lowercase, fields are separated by '\n', empty if the slot is free
+        };
+
+        std::vector<row> m_slots; // postings refer to rows by slot, thus counters of fuzzy search are a flat array
+        std::vector<slot_t> m_free; // slots of removed rows
+        std::unordered_map<id_type, slot_t> m_rows;
+        std::unordered_map<trigram_t, std::vector<slot_t>> m_postings; // unique slots
+
+        void add_postings(_In_ slot_t slot, _In_ std::wstring_view text);
+        void remove_postings(_In_ slot_t slot, _In_ std::wstring_view text);
+
+        std::vector<slot_t> find_words(_In_ const std::vector<std::wstring> &words, _In_ bool fuzzy) const;
+        std::vector<slot_t> find_word(_In_ std::wstring_view word, _In_ bool fuzzy) const;
+        std::vector<slot_t> scan(_In_ std::wstring_view word) const;
+};
+
+} // namespace usbip
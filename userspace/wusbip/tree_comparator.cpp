@@ -7,56 +7,48 @@
 #include "wxutils.h"
 #include "utils.h"
 
-namespace
-{
-
 using namespace usbip;
 
-/*
- * @param busid hub-port[.port]... 
- */
-auto parse_busid(_In_ wxString busid)
+auto TreeListItemComparator::get_key(_In_ wxTreeListCtrl &tree, _In_ wxTreeListItem item) -> const sort_key&
 {
-        std::vector<int> v;
+        auto [i, inserted] = m_keys.try_emplace(item.GetID());
+        auto &key = i->second;
 
-        if (auto i = busid.Find(L'-'); i != wxNOT_FOUND) {
-                busid[i] = L'.';
-        } else {
-                return v;
-        }
-
-        int val;
-        for (wxString rest; busid.BeforeFirst(L'.', &rest).ToInt(&val); busid = std::move(rest)) {
-                v.push_back(val);
-        }
+        if (inserted) {
+                if (tree.GetItemParent(item) != tree.GetRootItem()) { // server has no busid
+                        key.busid = make_busid_key(tree.GetItemText(item, COL_BUSID));
+                }
 
-        if (v.size() < 2) { // hub-port at least
-                v.clear();
+                USB_DEVICE_SPEED speed;
+                key.speed = get_speed_val(speed, tree.GetItemText(item, COL_SPEED)) ? speed : -1;
         }
 
-        return v;
+        return key;
 }
 
-} // namespace
-
-
 int TreeListItemComparator::Compare(
         wxTreeListCtrl *tree, unsigned int column, wxTreeListItem first, wxTreeListItem second)
 {
-        auto left = tree->GetItemText(first, column);
-        auto right = tree->GetItemText(second, column);
-
-        if (column == COL_BUSID && tree->GetItemParent(first) != tree->GetRootItem()) {
-                if (auto a = parse_busid(left), b = parse_busid(right); !(a.empty() || b.empty())) {
-                        auto ret = a <=> b;
-                        return ret._Value;
-                }
-        } else if (column == COL_SPEED) {
-                if (USB_DEVICE_SPEED a, b; get_speed_val(a, left) && get_speed_val(b, right)) {
-                        auto ret = a <=> b;
-                        return ret._Value;
+        if (column == COL_BUSID || column == COL_SPEED) {
+                auto &a = get_key(*tree, first);
+                auto &b = get_key(*tree, second);
+
+                if (column == COL_SPEED) {
+                        if (a.speed >= 0 && b.speed >= 0) {
+                                auto ret = a.speed <=> b.speed;
+                                return ret._Value;
+                        }
+                } else if (a.busid.len && b.busid.len) {
+                        return compare(a.busid, b.busid);
                 }
         }
 
+        auto &left = tree->GetItemText(first, column);
+        auto &right = tree->GetItemText(second, column);
+
+        if (double a, b; column >= COL_FIRST_LIVE && left.ToDouble(&a) && right.ToDouble(&b)) {
+                return (a > b) - (a < b);
+        }
+
         return left.Cmp(right);
 }
@@ -4,10 +4,32 @@
 
 #pragma once
 
+#include "busid_key.h"
+
 #include <wx/treelist.h>
 
+#include <unordered_map>
+
+/*
+ * Numeric sort keys of busid and speed columns are parsed once per row and cached.
+ * A row must be invalidated if its text was changed and before it is deleted.
+ */
 class TreeListItemComparator : public wxTreeListItemComparator
 {
 public:
         int Compare(wxTreeListCtrl *tree, unsigned int column, wxTreeListItem first, wxTreeListItem second) override;
+
+        void invalidate(_In_ wxTreeListItem item) { m_keys.erase(item.GetID()); }
+        void clear() noexcept { m_keys.clear(); }
+
+private:
+        struct sort_key
+        {
+                usbip::busid_key busid; // busid.len is zero if busid column must be compared as text
+                int speed; // USB_DEVICE_SPEED, negative if unknown
+        };
+
+        std::unordered_map<const void*, sort_key> m_keys; // wxTreeListItem::GetID
+
+        const sort_key& get_key(_In_ wxTreeListCtrl &tree, _In_ wxTreeListItem item);
 };
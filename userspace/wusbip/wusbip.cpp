@@ -25,9 +25,14 @@
 #include <wx/headerctrl.h>
 #include <wx/clipbrd.h>
 #include <wx/persist/dataview.h>
+#include <wx/srchctrl.h>
+#include <wx/wupdlock.h>
 
 #include <format>
 #include <set>
+#include <algorithm>
+#include <chrono>
+#include <span>
 
 namespace
 {
@@ -38,6 +43,9 @@ const auto g_persistent_mark = L'\u2713'; // CHECK MARK, 2714 HEAVY CHECK MARK
 auto &g_key_devices = L"/devices";
 auto &g_key_url = L"url";
 
+auto &g_key_statistics = L"/statistics/enabled";
+auto &g_key_statistics_interval = L"/statistics/interval"; // milliseconds
+
 consteval auto get_saved_keys()
 {
         using key_val = std::pair<const wchar_t* const, column_pos_t>;
@@ -201,6 +209,12 @@ auto get_devices(_In_ const wxTreeListCtrl &tree)
         return v;
 }
 
+auto has_devices(_In_ const wxTreeListCtrl &tree, _In_ const usbip::RowIndex<wxTreeListItem>::map_type &devices)
+{
+        auto pred = [&tree] (auto &item) { return !is_empty(tree, item.second); };
+        return std::ranges::any_of(devices, pred);
+}
+
 auto get_selected_devices(_In_ const wxTreeListCtrl &tree)
 {
         wxTreeListItems v;
@@ -220,6 +234,19 @@ auto make_device_location(_In_ const wxTreeListCtrl &tree, _In_ wxTreeListItem s
         return usbip::make_device_location(url, busid);
 }
 
+/*
+ * For std::stop_callback of a job, see CancelSynchronousIo and cancel_connect.
+ */
+auto open_current_thread()
+{
+        return Handle(OpenThread(THREAD_TERMINATE | THREAD_SET_CONTEXT, false, GetCurrentThreadId()));
+}
+
+auto is_cancelled(_In_ DWORD err)
+{
+        return err == ERROR_OPERATION_ABORTED || err == ERROR_CANCELLED || err == WSA_E_CANCELLED;
+}
+
 auto get_persistent(_In_ const Handle &vhci = get_vhci())
 {
         std::set<device_location> result;
@@ -296,6 +323,83 @@ auto to_string(_In_ _In_ const wxTreeListCtrl &tree, _In_ wxTreeListItem dev)
         return s;
 }
 
+inline auto get_id(_In_ wxTreeListItem item) noexcept
+{
+        return reinterpret_cast<SearchIndex::id_type>(item.GetID());
+}
+
+inline auto get_item(_In_ SearchIndex::id_type id) noexcept
+{
+        return wxTreeListItem(reinterpret_cast<wxTreeListModelNode*>(id));
+}
+
+inline auto as_view(_In_ const wxString &s)
+{
+        return std::wstring_view(s.wc_str(), s.length());
+}
+
+auto to_counters(_In_ const device_statistics &s)
+{
+        transfer_counters c {
+                .generation = s.generation,
+                .bytes_in = s.bytes_in,
+                .bytes_out = s.bytes_out,
+                .urbs = s.urbs,
+                .in_flight = s.in_flight,
+                .latency = std::vector<std::uint64_t>(s.latency.begin(), s.latency.end()),
+        };
+
+        return c;
+}
+
+/*
+ * @return negative if not available
+ */
+double get_live_value(_In_ unsigned int col, _In_ const transfer_rates &r)
+{
+        switch (col) {
+        case COL_IN_RATE:
+                return r.bytes_in/1E6; // MB/s
+        case COL_OUT_RATE:
+                return r.bytes_out/1E6;
+        case COL_URB_RATE:
+                return r.urbs;
+        case COL_LATENCY:
+                return r.p99_latency < 0 ? r.p99_latency : r.p99_latency/1000; // ms
+        case COL_IN_FLIGHT:
+                return r.in_flight;
+        }
+
+        wxFAIL_MSG("unexpected column");
+        return -1;
+}
+
+auto format_live_value(_In_ unsigned int col, _In_ double value)
+{
+        if (value < 0) {
+                return wxString();
+        }
+
+        auto integer = col == COL_URB_RATE || col == COL_IN_FLIGHT;
+        return wxString::Format(integer ? L"%.0f" : L"%.2f", value);
+}
+
+/*
+ * SetItemText repaints the row even if the text is the same.
+ */
+void set_item_text(_In_ wxTreeListCtrl &tree, _In_ wxTreeListItem item, _In_ unsigned int col, _In_ const wxString &text)
+{
+        if (tree.GetItemText(item, col) != text) {
+                tree.SetItemText(item, col, text);
+        }
+}
+
+auto get_time()
+{
+        using namespace std::chrono;
+        return duration<double>(steady_clock::now().time_since_epoch()).count(); // seconds
+}
+
 auto get_servers(_In_ const std::vector<device_columns> &devices)
 {
         std::set<wxString> servers;
@@ -371,8 +475,11 @@ void MainFrame::init()
         m_spinCtrlPort->SetValue(wxString::FromAscii(port)); // NI_MAXSERV
 
         init_tree_list();
+        init_search();
+        init_statistics();
 
         Bind(EVT_DEVICE_STATE, &MainFrame::on_device_state, this);
+        Bind(wxEVT_CHAR_HOOK, &MainFrame::on_char_hook, this);
 }
 
 /*
@@ -401,6 +508,29 @@ void MainFrame::init_tree_list()
         }
 }
 
+/*
+ * wxTreeListCtrl can't hide rows, matching devices are selected.
+ */
+void MainFrame::init_search()
+{
+        auto &tb = *m_auiToolBarAdd;
+
+        m_search = new wxSearchCtrl(&tb, wxID_ANY, wxEmptyString, wxDefaultPosition, FromDIP(wxSize(200, -1)));
+        m_search->SetDescriptiveText(_("Search devices"));
+        m_search->ShowCancelButton(true);
+
+        tb.AddSeparator();
+        tb.AddControl(m_search);
+        tb.Realize();
+
+        m_mgr.GetPane(&tb).BestSize(tb.GetBestSize());
+        m_mgr.Update();
+
+        m_search->Bind(wxEVT_TEXT, &MainFrame::on_search, this);
+        m_search->Bind(wxEVT_SEARCH, &MainFrame::on_search, this);
+        m_search->Bind(wxEVT_SEARCH_CANCEL, &MainFrame::on_search, this);
+}
+
 wxWithImages::Images MainFrame::get_tree_images()
 {
         static_assert(IMG_SERVER == 0);
@@ -419,6 +549,9 @@ void MainFrame::restore_state()
 {
         wxPersistentRegisterAndRestore(this, L"MainFrame"); // @see persist.h
         wxPersistentRegisterAndRestore(m_treeListCtrl->GetDataView(), m_treeListCtrl->GetName());
+
+        auto enabled = wxConfig::Get()->ReadBool(g_key_statistics, false);
+        show_statistics(enabled); // overrides restored visibility of live columns
 }
 
 void MainFrame::post_refresh()
@@ -445,6 +578,9 @@ void MainFrame::on_close(wxCloseEvent &event)
                 return;
         }
 
+        m_jobs.stop(); // cancel attach and detach that are in progress
+        m_stats_timer.Stop();
+
         break_read_loop();
         m_read_thread.join();
 
@@ -486,13 +622,17 @@ void MainFrame::read_loop()
 
         std::unique_ptr<MainFrame, decltype(on_exit)> ptr(this, on_exit);
 
-        for (device_state st; vhci::read_device_state(m_read.get(), st); ) {
-                auto evt = new DeviceStateEvent(std::move(st));
-                QueueEvent(evt); // see on_device_state()
+        std::vector<device_state> v(64); // detach all, etc. produce a burst of states
+
+        for (size_t cnt; (cnt = vhci::read_device_states(m_read.get(), v.data(), v.size())); ) {
+                for (auto &st: std::span(v.data(), cnt)) {
+                        auto evt = new DeviceStateEvent(std::move(st));
+                        QueueEvent(evt); // see on_device_state()
+                }
         }
 
         if (auto err = GetLastError(); err != ERROR_OPERATION_ABORTED) { // see CancelSynchronousIo
-                wxLogError(_("vhci::read_device_state error %lu\n%s"), err, GetLastErrorMsg(err));
+                wxLogError(_("vhci::read_device_states error %lu\n%s"), err, GetLastErrorMsg(err));
         }
 }
 
@@ -584,8 +724,8 @@ void MainFrame::on_device_state(_In_ DeviceStateEvent &event)
 
 void MainFrame::on_has_devices_update_ui(wxUpdateUIEvent &event)
 {
-        auto v = get_devices(*m_treeListCtrl);
-        event.Enable(!v.empty());
+        auto ok = has_devices(*m_treeListCtrl, m_rows.devices());
+        event.Enable(ok);
 }
 
 void MainFrame::on_has_selected_devices_update_ui(wxUpdateUIEvent &event)
@@ -661,6 +801,7 @@ void MainFrame::on_edit_notes(wxCommandEvent&)
         if (dlg.ShowModal() == wxID_OK) {
                 notes = dlg.GetValue();
                 tree.SetItemText(dev, COL_NOTES, notes);
+                index_device(dev);
         }
 }
 
@@ -768,13 +909,89 @@ void MainFrame::on_close_to_tray(wxCommandEvent &event)
         m_close_to_tray = checked;
 }
 
-DWORD MainFrame::attach(_In_ const wxString &url, _In_ const wxString &busid)
+/*
+ * Jobs run concurrently, each of them opens its own handle of the driver
+ * because I/O on a handle that was opened for synchronous I/O is serialized.
+ */
+void MainFrame::post_job(_In_ wxString error_msg, _In_ std::function<DWORD(std::stop_token)> f)
+{
+        ++m_jobs_cnt;
+        show_jobs();
+
+        auto job = [this, gen = m_jobs_gen, error_msg, f = std::move(f)] (auto stop)
+        {
+                auto err = f(stop);
+                CallAfter([this, gen, error_msg, err] { job_done(gen, error_msg, err); }); // QueueEvent to GUI thread
+        };
+
+        auto done = [this, gen = m_jobs_gen, error_msg = std::move(error_msg)] (auto error)
+        {
+                if (!error) {
+                        return; // reported by the job
+                }
+
+                try {
+                        std::rethrow_exception(error);
+                } catch (std::exception &e) {
+                        wxLogVerbose(_("exception: %s"), what(e));
+                } catch (...) {
+                        wxLogVerbose(_("unknown exception"));
+                }
+
+                CallAfter([this, gen, error_msg] { job_done(gen, error_msg, ERROR_INTERNAL_ERROR); });
+        };
+
+        m_jobs.post(std::move(job), std::move(done));
+}
+
+void MainFrame::job_done(_In_ unsigned int gen, _In_ const wxString &error_msg, _In_ DWORD err)
 {
+        if (gen != m_jobs_gen) { // was cancelled, see on_char_hook
+                return;
+        }
+
+        wxASSERT(m_jobs_cnt > 0);
+        --m_jobs_cnt;
+
+        if (err && !is_cancelled(err)) {
+                wxLogError(L"%s\n%s %lu\n%s", error_msg, _("Error"), err, GetLastErrorMsg(err));
+        }
+
+        show_jobs();
+}
+
+void MainFrame::show_jobs()
+{
+        if (m_jobs_cnt) {
+                wxLogStatus(_("%d operation(s) in progress, press Esc to cancel"), m_jobs_cnt);
+        } else {
+                wxLogStatus(wxEmptyString);
+        }
+}
+
+void MainFrame::on_char_hook(_In_ wxKeyEvent &event)
+{
+        if (event.GetKeyCode() == WXK_ESCAPE && m_jobs_cnt) {
+                wxLogVerbose(_("Cancel %d operation(s)"), m_jobs_cnt);
+                m_jobs.cancel(); // discarded jobs are not reported
+                ++m_jobs_gen; // running jobs are not reported too
+                m_jobs_cnt = 0;
+                show_jobs();
+        } else {
+                event.Skip();
+        }
+}
+
+void MainFrame::attach(_In_ const wxString &url, _In_ const wxString &busid)
+{
+        auto error_msg = wxString::Format(_("Could not attach %s/%s"), url, busid);
+
         wxString hostname;
         wxString service;
 
         if (!split_server_url(url, hostname, service)) {
-                return ERROR_INVALID_PARAMETER;
+                wxLogError(L"%s\n%s", error_msg, GetLastErrorMsg(ERROR_INVALID_PARAMETER));
+                return;
         }
 
         device_location loc {
@@ -783,17 +1000,42 @@ DWORD MainFrame::attach(_In_ const wxString &url, _In_ const wxString &busid)
                 .busid = busid.ToStdString(wxConvUTF8),
         };
 
-        DWORD err{};
-        auto f = [&err, loc = std::move(loc), vhci = get_vhci().get()]
+        auto f = [loc = std::move(loc)] (auto stop) -> DWORD
         { 
-                auto port = vhci::attach(vhci, loc); 
-                err = port > 0 ? ERROR_SUCCESS : GetLastError();
+                auto vhci = vhci::open(); // see comments for on_device_state()
+                if (!vhci) {
+                        return GetLastError();
+                }
+
+                auto thread = open_current_thread();
+                std::stop_callback cancel(stop, [h = thread.get()] { CancelSynchronousIo(h); });
+
+                auto port = vhci::attach(vhci.get(), loc); 
+                return port > 0 ? ERROR_SUCCESS : GetLastError();
         };
 
-        auto msg = wxString::Format(L"%s/%s", url, busid);
-        run_cancellable(this, msg, _("Attaching"), std::move(f));
+        post_job(std::move(error_msg), std::move(f));
+}
+
+void MainFrame::detach(_In_ const wxString &url, _In_ const wxString &busid, _In_ int port)
+{
+        auto error_msg = port > 0 ? wxString::Format(_("Could not detach %s/%s"), url, busid) : 
+                                    _("Could detach all devices");
+
+        auto f = [port] (auto stop) -> DWORD
+        { 
+                auto vhci = vhci::open();
+                if (!vhci) {
+                        return GetLastError();
+                }
+
+                auto thread = open_current_thread();
+                std::stop_callback cancel(stop, [h = thread.get()] { CancelSynchronousIo(h); });
+
+                return vhci::detach(vhci.get(), port) ? ERROR_SUCCESS : GetLastError();
+        };
 
-        return err;
+        post_job(std::move(error_msg), std::move(f));
 }
 
 void MainFrame::on_attach(wxCommandEvent&)
@@ -806,13 +1048,7 @@ void MainFrame::on_attach(wxCommandEvent&)
                 auto url = tree.GetItemText(server);
                 auto busid = tree.GetItemText(dev);
 
-                if (auto err = attach(url,  busid)) {
-                        if (err != ERROR_OPERATION_ABORTED) {
-                                wxLogError(_("Could not attach %s/%s\nError %lu\n%s"), 
-                                              url, busid, err, GetLastErrorMsg(err));
-                        }
-                        break;
-                }
+                attach(url, busid);
         }
 }
 
@@ -822,17 +1058,12 @@ void MainFrame::on_detach(wxCommandEvent&)
 
         for (auto &tree = *m_treeListCtrl; auto &dev: get_selected_devices(tree)) {
 
-                if (auto port = get_port(dev); !port) {
-                        // 
-                } else if (auto &vhci = get_vhci(); !vhci::detach(vhci.get(), port)) {
-                        auto err = GetLastError();
-
+                if (auto port = get_port(dev)) {
                         auto server = tree.GetItemParent(dev);
                         auto url = tree.GetItemText(server);
                         auto busid = tree.GetItemText(dev);
 
-                        wxLogError(_("Could not detach %s/%s\nError %lu\n%s"), url, busid, err, GetLastErrorMsg(err));
-                        break;
+                        detach(url, busid, port);
                 }
         }
 }
@@ -840,41 +1071,34 @@ void MainFrame::on_detach(wxCommandEvent&)
 void MainFrame::on_detach_all(wxCommandEvent&) 
 {
         wxLogVerbose(wxString::FromAscii(__func__));
-
-        if (auto &vhci = get_vhci(); !vhci::detach(vhci.get(), -1)) {
-                auto err = GetLastError();
-                wxLogError(_("Could detach all devices\nError %lu\n%s"), err, GetLastErrorMsg(err));
-        }
+        detach(wxEmptyString, wxEmptyString, -1);
 }
 
 wxTreeListItem MainFrame::find_or_add_server(_In_ const wxString &url)
 {
-        auto &tree = *m_treeListCtrl;
-        wxTreeListItem server;
+        auto &server = m_rows.server(url.ToStdWstring());
 
-        for (auto item = tree.GetFirstItem(); item.IsOk(); item = tree.GetNextSibling(item)) {
-                if (tree.GetItemText(item) == url) {
-                        return server = item;
-                }
+        if (!server.IsOk()) {
+                auto &tree = *m_treeListCtrl;
+                server = tree.AppendItem(tree.GetRootItem(), url, IMG_SERVER, IMG_SERVER);
         }
 
-        return server = tree.AppendItem(tree.GetRootItem(), url, IMG_SERVER, IMG_SERVER);
+        return server;
 }
 
 std::pair<wxTreeListItem, bool> MainFrame::find_or_add_device(_In_ const wxString &url, _In_ const wxString &busid)
 {
         std::pair<wxTreeListItem, bool> res;
 
+        auto &device = m_rows.device(url.ToStdWstring(), busid.ToStdWstring());
+        if (device.IsOk()) {
+                return res = std::make_pair(device, false);
+        }
+
         auto &tree = *m_treeListCtrl;
         auto server = find_or_add_server(url);
 
-        for (auto item = tree.GetFirstChild(server); item.IsOk(); item = tree.GetNextSibling(item)) {
-                if (tree.GetItemText(item) == busid) {
-                        return res = std::make_pair(item, false);
-                }
-        }
-
-        auto device = tree.AppendItem(server, busid, IMG_DEVICE, IMG_DEVICE);
+        device = tree.AppendItem(server, busid, IMG_DEVICE, IMG_DEVICE);
 
         if (!tree.IsExpanded(server)) {
                 tree.Expand(server);
@@ -903,9 +1127,16 @@ void MainFrame::remove_device(_In_ wxTreeListItem device)
         auto &tree = *m_treeListCtrl;
 
         auto server = tree.GetItemParent(device);
+        auto &url = tree.GetItemText(server);
+
+        m_rows.remove_device(url.ToStdWstring(), tree.GetItemText(device).ToStdWstring());
+        m_search_index.remove(get_id(device));
+        m_tree_cmp.invalidate(device);
         tree.DeleteItem(device);
 
         if (auto child = tree.GetFirstChild(server); !child.IsOk()) { // has no children
+                m_rows.remove_server(url.ToStdWstring());
+                m_tree_cmp.invalidate(server);
                 tree.DeleteItem(server);
         }
 }
@@ -926,8 +1157,206 @@ void MainFrame::update_device(_In_ wxTreeListItem device, _In_ const device_colu
                 if (auto &new_val = dc[col]; 
                     (flags & mkflag(col)) && new_val != tree.GetItemText(device, col)) {
                         tree.SetItemText(device, col, new_val);
+                        if (col == COL_SPEED) {
+                                m_tree_cmp.invalidate(device); // sort key
+                        }
                 }
         }
+
+        index_device(device);
+}
+
+void MainFrame::index_device(_In_ wxTreeListItem device)
+{
+        auto &tree = *m_treeListCtrl;
+        auto server = tree.GetItemParent(device);
+
+        m_search_index.update(get_id(device), {
+                as_view(tree.GetItemText(server)), // url
+                as_view(tree.GetItemText(device, COL_BUSID)),
+                as_view(tree.GetItemText(device, COL_VENDOR)),
+                as_view(tree.GetItemText(device, COL_PRODUCT)),
+                as_view(tree.GetItemText(device, COL_NOTES)) });
+}
+
+void MainFrame::on_search(_In_ wxCommandEvent&)
+{
+        auto &tree = *m_treeListCtrl;
+        tree.UnselectAll();
+
+        auto query = m_search->GetValue();
+        auto found = m_search_index.find(as_view(query));
+
+        wxTreeListItem first;
+
+        for (auto id: found) {
+                auto dev = get_item(id);
+                tree.Select(dev);
+
+                if (!first.IsOk()) {
+                        first = dev;
+                }
+        }
+
+        if (first.IsOk()) {
+                tree.EnsureVisible(first);
+        }
+
+        auto msg = query.empty() ? wxString() : wxString::Format(_("%zu device(s) found"), found.size());
+        m_statusBar->SetStatusText(msg);
+}
+
+/*
+ * Live columns are not in the Columns menu, they are shown or hidden together.
+ */
+void MainFrame::init_statistics()
+{
+        auto &tree = *m_treeListCtrl;
+        wxASSERT(tree.GetColumnCount() == COL_FIRST_LIVE);
+
+        const wxString titles[] { _("IN, MB/s"), _("OUT, MB/s"), _("URB/s"), _("p99, ms"), _("In flight") };
+        static_assert(sizeof(titles)/sizeof(*titles) == COL_LAST_LIVE - COL_FIRST_LIVE + 1);
+
+        for (auto &title: titles) {
+                tree.AppendColumn(title, wxCOL_WIDTH_AUTOSIZE, wxALIGN_RIGHT, 
+                                  wxCOL_REORDERABLE | wxCOL_RESIZABLE | wxCOL_SORTABLE | wxCOL_HIDDEN);
+        }
+
+        auto &menu = *m_menu_view;
+
+        size_t pos{};
+        [[maybe_unused]] auto found = menu.FindChildItem(m_view_labels->GetId(), &pos);
+        wxASSERT(found);
+
+        m_view_statistics = menu.InsertCheckItem(pos + 1, wxID_ANY, _("Live statistics"), 
+                                                 _("Show transfer rates and latency of attached devices"));
+
+        menu.Bind(wxEVT_COMMAND_MENU_SELECTED, &MainFrame::on_view_statistics, this, m_view_statistics->GetId());
+
+        m_stats_timer.SetOwner(this);
+        Bind(wxEVT_TIMER, &MainFrame::on_stats_timer, this, m_stats_timer.GetId());
+
+        tree.GetView()->Bind(wxEVT_MOTION, &MainFrame::on_tree_motion, this);
+}
+
+void MainFrame::on_view_statistics(_In_ wxCommandEvent &event)
+{
+        auto show = event.IsChecked();
+
+        wxConfig::Get()->Write(g_key_statistics, show);
+        show_statistics(show);
+}
+
+/*
+ * The refresh interval can be changed in the config, see g_key_statistics_interval.
+ */
+void MainFrame::show_statistics(_In_ bool show)
+{
+        m_view_statistics->Check(show);
+
+        auto &view = *m_treeListCtrl->GetDataView();
+
+        for (auto n = view.GetColumnCount(), pos = 0U; pos < n; ++pos) { // columns can be reordered
+                if (auto col = view.GetColumn(pos); col->GetModelColumn() >= COL_FIRST_LIVE) {
+                        col->SetHidden(!show);
+                }
+        }
+
+        if (show) {
+                auto ms = wxConfig::Get()->ReadLong(g_key_statistics_interval, 1000);
+                m_stats_timer.Start(std::clamp(ms, 100L, 60'000L));
+        } else {
+                m_stats_timer.Stop();
+                m_meters.clear();
+        }
+
+        update_statistics();
+}
+
+void MainFrame::on_stats_timer(_In_ wxTimerEvent&)
+{
+        update_statistics();
+}
+
+/*
+ * Cells are cleared if the timer is stopped.
+ */
+void MainFrame::update_statistics()
+{
+        std::vector<device_statistics> stats;
+
+        if (m_stats_timer.IsRunning()) {
+                bool ok{};
+                stats = vhci::get_device_statistics(get_vhci().get(), ok);
+
+                if (!ok) {
+                        auto err = GetLastError();
+                        wxLogError(_("Could not get device statistics\nError %lu\n%s"), err, GetLastErrorMsg(err));
+                        show_statistics(false); // do not repeat the error
+                        return;
+                }
+        }
+
+        std::erase_if(m_meters, [&stats] (auto &m) 
+        { 
+                return std::ranges::find(stats, m.first, &device_statistics::port) == stats.end(); // detached
+        });
+
+        std::unordered_map<int, const transfer_rates*> rates; // hub port
+
+        for (auto time = get_time(); auto &s: stats) {
+                if (auto &m = m_meters[s.port]; m.add(time, to_counters(s))) {
+                        rates.emplace(s.port, &m.last());
+                }
+        }
+
+        auto &tree = *m_treeListCtrl;
+
+        for (auto &[key, dev]: m_rows.devices()) {
+                auto port = get_port(dev);
+                auto r = port ? rates.find(port) : rates.end();
+
+                for (unsigned int col = COL_FIRST_LIVE; col <= COL_LAST_LIVE; ++col) {
+                        auto text = r == rates.end() ? wxString() : format_live_value(col, get_live_value(col, *r->second));
+                        set_item_text(tree, dev, col, text);
+                }
+        }
+}
+
+/*
+ * Tooltip of a live cell is the sparkline of its recent values.
+ */
+void MainFrame::on_tree_motion(_In_ wxMouseEvent &event)
+{
+        event.Skip();
+
+        auto &tree = *m_treeListCtrl;
+        auto &dv = *tree.GetDataView();
+        auto &view = *tree.GetView();
+
+        wxDataViewItem item;
+        wxDataViewColumn *col{};
+        dv.HitTest(dv.ScreenToClient(view.ClientToScreen(event.GetPosition())), item, col);
+
+        wxString tip;
+
+        if (!(item.IsOk() && col && col->GetModelColumn() >= COL_FIRST_LIVE)) {
+                // not a live cell
+        } else if (wxTreeListItem dev(static_cast<wxTreeListModelNode*>(item.GetID())); 
+                   tree.GetItemParent(dev) == tree.GetRootItem()) {
+                // server
+        } else if (auto m = m_meters.find(get_port(dev)); m != m_meters.end() && !m->second.empty()) {
+                auto n = col->GetModelColumn();
+                auto values = m->second.history([n] (auto &r) { return get_live_value(n, r); });
+                auto max = *std::ranges::max_element(values);
+
+                tip = wxString::Format(_("%s, max %s\n%s"), col->GetTitle(), format_live_value(n, max), 
+                                       wxString(sparkline(values)));
+        }
+
+        if (view.GetToolTipText() != tip) {
+                view.SetToolTip(tip); // removes the tooltip if empty
+        }
 }
 
 void MainFrame::on_help_about(wxCommandEvent&)
@@ -949,34 +1378,6 @@ void MainFrame::on_help_about(wxCommandEvent&)
         wxAboutBox(d, this);
 }
 
-auto MainFrame::connect(
-        _In_ const wxString &hostname, _In_ const wxString &service, 
-        _In_ const std::string &hostname_u8, _In_ const std::string &service_u8)
-{
-        Socket sock;
-        DWORD err{};
-
-        auto f = [&sock, &err, host = hostname_u8.c_str(), svc = service_u8.c_str()]
-        {
-                sock = usbip::connect(host, svc, CANCEL_BY_APC);
-                err = sock ? ERROR_SUCCESS : GetLastError();
-        };
-
-        auto msg = wxString::Format(L"%s:%s", hostname, service);
-        run_cancellable(this, msg, _("Connecting"), std::move(f), cancel_connect);
-
-        switch (err) {
-        case ERROR_SUCCESS:
-        case WSA_E_CANCELLED:
-        case ERROR_CANCELLED:
-                break;
-        default:
-                wxLogError(_("Could not connect to %s:%s\nError %lu\n%s"), hostname, service, err, GetLastErrorMsg(err));
-        }
-
-        return sock;
-}
-
 void MainFrame::add_exported_devices(wxCommandEvent&)
 {
         auto &cb = *m_comboBoxServer;
@@ -990,21 +1391,54 @@ void MainFrame::add_exported_devices(wxCommandEvent&)
         auto port = wxString::Format(L"%d", m_spinCtrlPort->GetValue());
         wxLogVerbose(L"%s, host='%s', port='%s'", wxString::FromAscii(__func__), host, port);
 
-        auto u8_host = host.ToStdString(wxConvUTF8);
-        auto u8_port = port.ToStdString(wxConvUTF8);
+        auto f = [this, gen = m_jobs_gen, host, u8_host = host.ToStdString(wxConvUTF8), u8_port = port.ToStdString(wxConvUTF8)] 
+                 (auto stop) -> DWORD
+        {
+                auto thread = open_current_thread();
+                std::stop_callback cancel(stop, [h = thread.get()] { cancel_connect(h); });
 
-        auto sock = connect(host, port, u8_host, u8_port);
-        if (!sock) {
-                return;
-        }
+                auto sock = usbip::connect(u8_host.c_str(), u8_port.c_str(), CANCEL_BY_APC);
+                if (!sock) {
+                        return GetLastError();
+                }
+
+                std::stop_callback cancel_recv(stop, [s = sock.get()] { shutdown(s, SD_BOTH); }); // recv fails
+
+                std::vector<imported_device> devices;
+
+                auto dev = [&devices, &u8_host, &u8_port] (auto, auto &device)
+                {
+                        devices.push_back(make_imported_device(u8_host, u8_port, device));
+                };
+
+                auto intf = [] (auto /*dev_idx*/, auto& /*dev*/, auto /*idx*/, auto& /*intf*/) {};
+
+                if (!enum_exportable_devices(sock.get(), dev, intf)) {
+                        return GetLastError();
+                }
+
+                CallAfter([this, gen, host, devices = std::move(devices)] 
+                {
+                        if (gen == m_jobs_gen) { // was not cancelled, see job_done
+                                on_exported_devices(host, devices);
+                        }
+                });
+                return ERROR_SUCCESS;
+        };
 
+        post_job(wxString::Format(_("Could not get exported devices of %s:%s"), host, port), std::move(f));
+}
+
+void MainFrame::on_exported_devices(_In_ const wxString &host, _In_ const std::vector<imported_device> &devices)
+{
         auto persistent = get_persistent();
         auto saved = as_set(get_saved());
 
-        auto dev = [this, host = std::move(u8_host), port = std::move(u8_port), &persistent, &saved] (auto, auto &device)
-        {
+        wxWindowUpdateLocker lock(m_treeListCtrl); // one repaint for all rows
+
+        for (auto &dev: devices) {
                 device_state st {
-                        .device = make_imported_device(std::move(host), std::move(port), device),
+                        .device = dev,
                         .state = state::unplugged
                 };
 
@@ -1017,14 +1451,9 @@ void MainFrame::add_exported_devices(wxCommandEvent&)
                 }
 
                 update_device(item, dc, flags);
-        };
-
-        auto intf = [this] (auto /*dev_idx*/, auto& /*dev*/, auto /*idx*/, auto& /*intf*/) {};
+        }
 
-        if (!enum_exportable_devices(sock.get(), dev, intf)) {
-                auto err = GetLastError();
-                wxLogError(_("enum_exportable_devices error %lu\n%s"), err, GetLastErrorMsg(err));
-        } else if (cb.FindString(host) != wxNOT_FOUND) {
+        if (auto &cb = *m_comboBoxServer; cb.FindString(host) != wxNOT_FOUND) {
                 // already exists
         } else if (auto pos = cb.Append(host); cb.GetCount() > 32) {
                 cb.Delete(pos > 0 ? --pos : ++pos);
@@ -1206,6 +1635,8 @@ void MainFrame::on_load(wxCommandEvent&)
                 }
         }
 
+        wxWindowUpdateLocker lock(m_treeListCtrl); // one repaint for all rows
+
         for (auto persistent = get_persistent(); auto &dc: saved) {
 
                 auto flags = get_saved_flags();
@@ -1234,7 +1665,12 @@ void MainFrame::on_reload(wxCommandEvent &event)
         wxLogVerbose(wxString::FromAscii(__func__));
 
         auto &tree = *m_treeListCtrl;
+        wxWindowUpdateLocker lock(&tree); // one repaint for all rows
+
         tree.DeleteAllItems();
+        m_rows.clear();
+        m_search_index.clear();
+        m_tree_cmp.clear();
 
         auto &vhci = get_vhci();
 
@@ -7,8 +7,14 @@
 #include "frame.h"
 #include "device_columns.h"
 #include "tree_comparator.h"
+#include "search_index.h"
+#include "row_index.h"
+#include "live_stats.h"
 
 #include <libusbip/win_handle.h>
+#include <libusbip/src/job_queue.h>
+
+#include <wx/timer.h>
 
 #include <thread>
 #include <mutex>
@@ -16,6 +22,7 @@
 class wxLogWindow;
 class TaskBarIcon;
 class wxDataViewColumn;
+class wxSearchCtrl;
 
 class DeviceStateEvent;
 wxDECLARE_EVENT(EVT_DEVICE_STATE, DeviceStateEvent);
@@ -45,6 +52,11 @@ private:
 
 	wxLogWindow *m_log{};
 	TreeListItemComparator m_tree_cmp;
+
+	usbip::SearchIndex m_search_index; // devices of m_treeListCtrl
+
+	usbip::RowIndex<wxTreeListItem> m_rows; // items of m_treeListCtrl, see find_or_add_server, find_or_add_device
+	wxSearchCtrl *m_search{};
 	std::unique_ptr<TaskBarIcon> m_taskbar_icon;
 	std::unique_ptr<wxMenu> m_tree_popup_menu;
 
@@ -53,6 +65,14 @@ private:
 
 	std::thread m_read_thread{ &MainFrame::read_loop, this };
 
+	usbip::job_queue m_jobs; // attach, detach and network requests
+	int m_jobs_cnt{}; // posted and not completed, GUI thread only
+	unsigned int m_jobs_gen{}; // is incremented when jobs are cancelled, GUI thread only
+
+	wxMenuItem *m_view_statistics{};
+	wxTimer m_stats_timer; // polls the driver if live statistics are shown
+	std::unordered_map<int, usbip::RateMeter> m_meters; // hub port
+
 	static wxWithImages::Images get_tree_images();
 
 	void on_close(wxCloseEvent &event) override; 
@@ -112,6 +132,8 @@ private:
 
 	void init();
 	void init_tree_list();
+	void init_search();
+	void init_statistics();
 	void restore_state();
 
 	void read_loop();
@@ -124,7 +146,13 @@ private:
 	std::pair<wxTreeListItem, bool> find_or_add_device(_In_ const usbip::device_columns &dc);
 
 	void remove_device(_In_ wxTreeListItem dev);
-	DWORD attach(_In_ const wxString &url, _In_ const wxString &busid);
+	void attach(_In_ const wxString &url, _In_ const wxString &busid);
+	void detach(_In_ const wxString &url, _In_ const wxString &busid, _In_ int port);
+
+	void post_job(_In_ wxString error_msg, _In_ std::function<DWORD(std::stop_token)> f);
+	void job_done(_In_ unsigned int gen, _In_ const wxString &error_msg, _In_ DWORD err);
+	void show_jobs();
+	void on_char_hook(_In_ wxKeyEvent &event);
 	
 	void post_refresh();
 	void post_exit();
@@ -133,9 +161,16 @@ private:
 	void set_persistent(_In_ wxTreeListItem device, _In_ bool persistent);
 
 	void update_device(_In_ wxTreeListItem device, _In_ const usbip::device_columns &dc, _In_ unsigned int flags);
+	void index_device(_In_ wxTreeListItem device);
+	void on_search(_In_ wxCommandEvent &event);
 	
-	auto connect(_In_ const wxString &hostname, _In_ const wxString &service, 
-		              _In_ const std::string &hostname_u8, _In_ const std::string &service_u8);
+	void on_exported_devices(_In_ const wxString &host, _In_ const std::vector<usbip::imported_device> &devices);
+
+	void on_view_statistics(_In_ wxCommandEvent &event);
+	void show_statistics(_In_ bool show);
+	void on_stats_timer(_In_ wxTimerEvent &event);
+	void update_statistics();
+	void on_tree_motion(_In_ wxMouseEvent &event);
 
 	wxDataViewColumn* find_column(_In_ const wxString &title) const noexcept;
 	wxDataViewColumn* find_column(_In_ int item_id) const noexcept;